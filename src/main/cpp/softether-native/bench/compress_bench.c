@@ -0,0 +1,212 @@
+/**
+ * SoftEther VPN Compression Benchmark
+ *
+ * Streams synthetic TUN packets through each compressor and its
+ * decompressor, checks every packet round-trips, and reports the ratio and
+ * throughput. Build with -DSOFTETHER_BUILD_BENCHMARKS=ON, push to a device
+ * and run:
+ *
+ *   softether-compress-bench [milliseconds per case]
+ */
+
+#include "softether_compress.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#define BENCH_DEFAULT_MS    500
+#define BENCH_PACKET_SIZE   1400
+#define BENCH_IP_HEADER     20
+#define BENCH_TCP_HEADER    20
+#define BENCH_PACKETS       256     // Distinct packets cycled through
+
+typedef enum {
+    PAYLOAD_TEXT,       // HTTP headers and JSON, varying per packet
+    PAYLOAD_RANDOM,     // Already compressed or encrypted, plain port
+    PAYLOAD_TLS,        // Random payload on port 443
+} payload_kind_t;
+
+typedef struct {
+    const char* name;
+    payload_kind_t kind;
+} bench_payload_t;
+
+static const bench_payload_t g_payloads[] = {
+    { "text",   PAYLOAD_TEXT },
+    { "random", PAYLOAD_RANDOM },
+    { "tls",    PAYLOAD_TLS },
+};
+
+static const struct {
+    const char* name;
+    int algorithm;
+} g_algorithms[] = {
+    { "zlib", SE_COMPRESS_ZLIB },
+    { "lz",   SE_COMPRESS_LZ },
+};
+
+#define PAYLOAD_COUNT   (sizeof(g_payloads) / sizeof(g_payloads[0]))
+#define ALGORITHM_COUNT (sizeof(g_algorithms) / sizeof(g_algorithms[0]))
+
+static uint8_t g_packets[BENCH_PACKETS][BENCH_PACKET_SIZE];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t xorshift(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// IPv4/TCP packets of one flow with the chosen payload
+static void build_packets(payload_kind_t kind) {
+    static const char* lines[] = {
+        "GET /api/v1/items?page=%u HTTP/1.1\r\nHost: example.com\r\n",
+        "Accept: application/json\r\nAccept-Encoding: identity\r\n",
+        "{\"id\":%u,\"name\":\"item-%u\",\"tags\":[\"alpha\",\"beta\"],\"price\":%u.99},",
+        "User-Agent: SoftEtherBench/1.0 (Linux; Android)\r\nConnection: keep-alive\r\n",
+    };
+    uint32_t seed = 0x12345678;
+    uint16_t port = kind == PAYLOAD_TLS ? 443 : 8080;
+
+    for (int p = 0; p < BENCH_PACKETS; p++) {
+        uint8_t* pkt = g_packets[p];
+        memset(pkt, 0, BENCH_IP_HEADER + BENCH_TCP_HEADER);
+        pkt[0] = 0x45;
+        pkt[2] = BENCH_PACKET_SIZE >> 8;
+        pkt[3] = BENCH_PACKET_SIZE & 0xFF;
+        pkt[8] = 64;
+        pkt[9] = 6;
+        pkt[12] = 10; pkt[15] = 2;
+        pkt[16] = 10; pkt[19] = 1;
+
+        uint8_t* tcp = pkt + BENCH_IP_HEADER;
+        tcp[0] = 0xC3; tcp[1] = 0x50;
+        tcp[2] = port >> 8; tcp[3] = port & 0xFF;
+        tcp[4] = (uint8_t)(p >> 8); tcp[5] = (uint8_t)p;
+        tcp[12] = 5 << 4;
+        tcp[13] = 0x18;
+
+        uint8_t* payload = tcp + BENCH_TCP_HEADER;
+        size_t payload_len = BENCH_PACKET_SIZE - BENCH_IP_HEADER - BENCH_TCP_HEADER;
+        if (kind == PAYLOAD_TEXT) {
+            size_t used = 0;
+            while (used < payload_len) {
+                char line[160];
+                uint32_t r = xorshift(&seed);
+                int n = snprintf(line, sizeof(line), lines[r % 4], r % 1000, (r >> 10) % 1000, (r >> 20) % 100);
+                size_t take = (size_t)n < payload_len - used ? (size_t)n : payload_len - used;
+                memcpy(payload + used, line, take);
+                used += take;
+            }
+        } else {
+            for (size_t i = 0; i < payload_len; i++) {
+                payload[i] = (uint8_t)xorshift(&seed);
+            }
+        }
+    }
+}
+
+// Compress and decompress packets for duration_ms. Returns 0 and fills
+// the ratio (sent / original) and MB/s of both directions, -1 on a
+// mismatch.
+static int bench_case(int algorithm, int duration_ms, double* ratio, double* compress_rate,
+                      double* decompress_rate, double* skipped) {
+    se_compressor_t* c = se_compressor_new(algorithm, false);
+    se_compressor_t* d = se_compressor_new(algorithm, true);
+    if (!c || !d) {
+        se_compressor_free(c);
+        se_compressor_free(d);
+        return -1;
+    }
+
+    int result = -1;
+    uint64_t packets = 0;
+    uint64_t decompressed = 0;
+    uint64_t compress_ns = 0;
+    uint64_t decompress_ns = 0;
+    uint64_t deadline = now_ns() + (uint64_t)duration_ms * 1000000ull;
+
+    while (now_ns() < deadline) {
+        for (int p = 0; p < BENCH_PACKETS; p++) {
+            const uint8_t* compressed = NULL;
+            uint64_t t0 = now_ns();
+            int len = se_compress(c, g_packets[p], BENCH_PACKET_SIZE, &compressed);
+            uint64_t t1 = now_ns();
+            compress_ns += t1 - t0;
+            if (len < 0) goto done;
+            if (len == 0) {
+                packets++;
+                continue;   // Sent as it is
+            }
+
+            // Every other payload split the way a ring buffer wrap would
+            size_t first = p % 2 ? (size_t)len / 2 : (size_t)len;
+            struct iovec iov[2] = {
+                { (void*)compressed, first },
+                { (void*)(compressed + first), (size_t)len - first },
+            };
+            const uint8_t* out = NULL;
+            t0 = now_ns();
+            int out_len = se_decompress(d, iov, p % 2 ? 2 : 1, &out);
+            decompress_ns += now_ns() - t0;
+            if (out_len != BENCH_PACKET_SIZE || memcmp(out, g_packets[p], BENCH_PACKET_SIZE) != 0) {
+                fprintf(stderr, "round trip mismatch at packet %d\n", p);
+                goto done;
+            }
+            decompressed += (uint64_t)out_len;
+            packets++;
+        }
+    }
+
+    se_compress_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    se_compressor_add_stats(c, &stats);
+
+    // Compression counts every packet offered, decompression only what it produced
+    double mb = (double)packets * BENCH_PACKET_SIZE / 1e6;
+    *ratio = (double)stats.bytes_out / (double)stats.bytes_in;
+    *compress_rate = compress_ns ? mb / ((double)compress_ns / 1e9) : 0;
+    *decompress_rate = decompress_ns ? (double)decompressed / 1e6 / ((double)decompress_ns / 1e9) : 0;
+    *skipped = 100.0 * (double)stats.packets_skipped / (double)stats.packets_in;
+    result = 0;
+
+done:
+    se_compressor_free(c);
+    se_compressor_free(d);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    int duration_ms = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_MS;
+    if (duration_ms <= 0) duration_ms = BENCH_DEFAULT_MS;
+
+    printf("%-6s %-8s %8s %10s %14s %16s\n",
+           "algo", "payload", "ratio", "skipped%", "compress MB/s", "decompress MB/s");
+
+    for (size_t p = 0; p < PAYLOAD_COUNT; p++) {
+        build_packets(g_payloads[p].kind);
+
+        for (size_t a = 0; a < ALGORITHM_COUNT; a++) {
+            double ratio, compress_rate, decompress_rate, skipped;
+            if (bench_case(g_algorithms[a].algorithm, duration_ms, &ratio, &compress_rate,
+                           &decompress_rate, &skipped) < 0) {
+                fprintf(stderr, "%s failed on %s packets\n", g_algorithms[a].name, g_payloads[p].name);
+                return 1;
+            }
+            printf("%-6s %-8s %8.3f %10.1f %14.1f %16.1f\n", g_algorithms[a].name, g_payloads[p].name,
+                   ratio, skipped, compress_rate, decompress_rate);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+/**
+ * SoftEther VPN Crypto Benchmark
+ *
+ * Measures AEAD seal/open throughput of the TLS record ciphers on the
+ * current machine and checks it against the order softether_cipher.c
+ * offers. Build with -DSOFTETHER_BUILD_BENCHMARKS=ON, push to a device
+ * and run:
+ *
+ *   softether-crypto-bench [milliseconds per case]
+ */
+
+#include "softether_cipher.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <openssl/evp.h>
+
+#define BENCH_DEFAULT_MS    500
+#define BENCH_AAD_LEN       13      // TLS 1.2 record AAD; TLS 1.3 uses 5
+#define BENCH_TAG_LEN       16
+#define BENCH_MAX_SIZE      16384
+
+typedef struct {
+    const char* name;
+    const char* tls13_suite;
+    const EVP_CIPHER* (*cipher)(void);
+} bench_suite_t;
+
+static const bench_suite_t g_suites[] = {
+    { "AES-128-GCM",       "TLS_AES_128_GCM_SHA256",       EVP_aes_128_gcm },
+    { "AES-256-GCM",       "TLS_AES_256_GCM_SHA384",       EVP_aes_256_gcm },
+    { "ChaCha20-Poly1305", "TLS_CHACHA20_POLY1305_SHA256", EVP_chacha20_poly1305 },
+};
+
+// Keepalive frame, one TUN packet, one full TLS record
+static const size_t g_sizes[] = { 64, 1400, BENCH_MAX_SIZE };
+
+#define SUITE_COUNT (sizeof(g_suites) / sizeof(g_suites[0]))
+#define SIZE_COUNT  (sizeof(g_sizes) / sizeof(g_sizes[0]))
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int seal(EVP_CIPHER_CTX* ctx, const uint8_t* nonce, const uint8_t* aad,
+                const uint8_t* in, size_t len, uint8_t* out, uint8_t* tag) {
+    int n;
+    return EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce) == 1 &&
+           EVP_EncryptUpdate(ctx, NULL, &n, aad, BENCH_AAD_LEN) == 1 &&
+           EVP_EncryptUpdate(ctx, out, &n, in, (int)len) == 1 &&
+           EVP_EncryptFinal_ex(ctx, out + n, &n) == 1 &&
+           EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, BENCH_TAG_LEN, tag) == 1 ? 0 : -1;
+}
+
+static int open_record(EVP_CIPHER_CTX* ctx, const uint8_t* nonce, const uint8_t* aad,
+                       const uint8_t* in, size_t len, uint8_t* out, const uint8_t* tag) {
+    int n;
+    return EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce) == 1 &&
+           EVP_DecryptUpdate(ctx, NULL, &n, aad, BENCH_AAD_LEN) == 1 &&
+           EVP_DecryptUpdate(ctx, out, &n, in, (int)len) == 1 &&
+           EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, BENCH_TAG_LEN, (void*)tag) == 1 &&
+           EVP_DecryptFinal_ex(ctx, out + n, &n) == 1 ? 0 : -1;
+}
+
+// Run seal or open for duration_ms and return MB/s, or -1 on failure
+static double bench_case(const bench_suite_t* suite, size_t size, bool encrypt, int duration_ms) {
+    static uint8_t plain[BENCH_MAX_SIZE];
+    static uint8_t sealed[BENCH_MAX_SIZE];
+    static uint8_t scratch[BENCH_MAX_SIZE];
+    uint8_t key[32], nonce[12], aad[BENCH_AAD_LEN], tag[BENCH_TAG_LEN];
+
+    memset(key, 0x42, sizeof(key));
+    memset(nonce, 0x24, sizeof(nonce));
+    memset(aad, 0x17, sizeof(aad));
+    for (size_t i = 0; i < size; i++) plain[i] = (uint8_t)(i * 31);
+
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) return -1;
+
+    double result = -1;
+    int init = encrypt ? EVP_EncryptInit_ex(ctx, suite->cipher(), NULL, key, NULL)
+                       : EVP_DecryptInit_ex(ctx, suite->cipher(), NULL, key, NULL);
+    if (init != 1) goto done;
+
+    // Open always checks the same valid record
+    if (!encrypt) {
+        EVP_CIPHER_CTX* sealer = EVP_CIPHER_CTX_new();
+        int ok = sealer && EVP_EncryptInit_ex(sealer, suite->cipher(), NULL, key, NULL) == 1 &&
+                 seal(sealer, nonce, aad, plain, size, sealed, tag) == 0;
+        EVP_CIPHER_CTX_free(sealer);
+        if (!ok) goto done;
+    }
+
+    uint64_t iterations = 0;
+    uint64_t start = now_ns();
+    uint64_t deadline = start + (uint64_t)duration_ms * 1000000ull;
+    uint64_t end;
+
+    do {
+        for (int i = 0; i < 64; i++) {
+            int rc;
+            if (encrypt) {
+                // Per-record nonce, as the record layer does
+                nonce[11] = (uint8_t)iterations;
+                rc = seal(ctx, nonce, aad, plain, size, scratch, tag);
+            } else {
+                rc = open_record(ctx, nonce, aad, sealed, size, scratch, tag);
+            }
+            if (rc < 0) goto done;
+            iterations++;
+        }
+        end = now_ns();
+    } while (end < deadline);
+
+    result = (double)iterations * (double)size / ((double)(end - start) / 1e9) / 1e6;
+
+done:
+    EVP_CIPHER_CTX_free(ctx);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    int duration_ms = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_MS;
+    if (duration_ms <= 0) duration_ms = BENCH_DEFAULT_MS;
+
+    unsigned int features = se_cipher_cpu_features();
+    printf("CPU features: aes=%d pmull=%d\n",
+           (features & SE_CPU_AES) != 0, (features & SE_CPU_PMULL) != 0);
+    printf("Offered TLS 1.3 order: %s\n\n", se_cipher_tls13_suites());
+
+    printf("%-18s %6s %12s %12s\n", "suite", "bytes", "seal MB/s", "open MB/s");
+
+    double packet_rate[SUITE_COUNT] = { 0 };
+
+    for (size_t s = 0; s < SUITE_COUNT; s++) {
+        for (size_t z = 0; z < SIZE_COUNT; z++) {
+            double seal_rate = bench_case(&g_suites[s], g_sizes[z], true, duration_ms);
+            double open_rate = bench_case(&g_suites[s], g_sizes[z], false, duration_ms);
+            if (seal_rate < 0 || open_rate < 0) {
+                fprintf(stderr, "%s failed at %zu bytes\n", g_suites[s].name, g_sizes[z]);
+                return 1;
+            }
+
+            printf("%-18s %6zu %12.1f %12.1f\n", g_suites[s].name, g_sizes[z], seal_rate, open_rate);
+
+            if (g_sizes[z] == 1400) {
+                packet_rate[s] = (seal_rate + open_rate) / 2;
+            }
+        }
+    }
+
+    // Judge the offered order by the first suite against the measured best
+    size_t fastest = 0;
+    for (size_t s = 1; s < SUITE_COUNT; s++) {
+        if (packet_rate[s] > packet_rate[fastest]) fastest = s;
+    }
+
+    const char* offered = se_cipher_tls13_suites();
+    bool agrees = strncmp(offered, g_suites[fastest].tls13_suite, strlen(g_suites[fastest].tls13_suite)) == 0;
+
+    printf("\nFastest at 1400 bytes: %s (%s the offered order)\n",
+           g_suites[fastest].name, agrees ? "matches" : "DOES NOT match");
+
+    return 0;
+}
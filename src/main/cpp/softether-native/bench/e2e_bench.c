@@ -0,0 +1,447 @@
+/**
+ * SoftEther VPN End-to-End Benchmark
+ *
+ * Drives synthetic traffic through the whole client data path: a
+ * socketpair stands in for the TUN device, se_connection_connect and its
+ * worker threads carry the packets over loopback TLS, and the in-process
+ * mock server (mock_server.h) is the far end. Upstream cases write to the
+ * TUN and the server's sink takes the packets; downstream cases have the
+ * server's source send and read them from the TUN.
+ *
+ * Each case runs two phases. The saturated phase offers packets as fast as
+ * they are taken and reports Gbit/s, packets/s, loss and CPU per byte;
+ * its latency percentiles include the queueing a full pipe causes. The
+ * paced phase then offers BENCH_PACED_PPS packets/s for latency with the
+ * queues near empty. Every packet carries its send time after its IPv4
+ * and UDP headers, so latency is one-way within the process.
+ *
+ * CPU per byte is given for the client alone (process CPU less the mock
+ * server's session thread and the traffic thread) and for the process.
+ * Traffic is either bulk (MTU-sized packets) or simple IMIX (7:4:1 of 40,
+ * 576 and 1500 bytes). Build with -DSOFTETHER_BUILD_BENCHMARKS=ON and run:
+ *
+ *   softether-e2e-bench [seconds per case]
+ */
+
+#include "softether_protocol.h"
+#include "mock_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <openssl/ssl.h>
+
+#define BENCH_DEFAULT_SECONDS   3
+#define BENCH_MTU               1500
+#define BENCH_STAMP_OFFSET      28      // After the IPv4 and UDP headers
+#define BENCH_MIN_PACKET        (BENCH_STAMP_OFFSET + 8)
+#define BENCH_FLOWS             64
+#define BENCH_PACED_PPS         10000
+#define BENCH_PACED_MS          1000
+#define BENCH_DRAIN_MS          200     // Quiet time that ends a phase
+#define BENCH_MAX_SAMPLES       (1 << 21)
+#define BENCH_SOCKET_BUFFER     (4 * 1024 * 1024)
+
+// Simple IMIX, in the order the packets go out
+static const uint16_t g_imix[] = { 40, 576, 40, 40, 576, 40, 1500, 40, 576, 40, 40, 576 };
+
+#define IMIX_COUNT (sizeof(g_imix) / sizeof(g_imix[0]))
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t cpu_ns(clockid_t clock) {
+    struct timespec ts;
+    if (clock_gettime(clock, &ts) < 0) return 0;
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t thread_cpu_ns(pthread_t thread) {
+    clockid_t clock;
+    return pthread_getcpuclockid(thread, &clock) == 0 ? cpu_ns(clock) : 0;
+}
+
+// ============================================================================
+// Traffic
+// ============================================================================
+
+typedef struct {
+    bool imix;
+    uint64_t interval_ns;               // Pacing, 0 to saturate
+    uint64_t next_ns;
+    uint64_t seq;
+
+    volatile bool running;              // Offer packets while set
+    volatile bool finished;             // No more phases
+
+    uint64_t packets;                   // Offered in the current phase
+    uint64_t bytes;
+} traffic_t;
+
+typedef struct {
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t last_ns;                   // When the last packet arrived
+    uint32_t* samples;                  // One-way latency, ns
+    size_t sample_count;
+} receiver_t;
+
+static size_t traffic_size(const traffic_t* traffic) {
+    return traffic->imix ? g_imix[traffic->seq % IMIX_COUNT] : BENCH_MTU;
+}
+
+// Build the next packet as an IPv4/UDP datagram of one of BENCH_FLOWS
+// flows, stamped as late as possible. Waits for its slot when paced.
+static size_t traffic_next(traffic_t* traffic, uint8_t* packet) {
+    size_t len = traffic_size(traffic);
+    unsigned int flow = (unsigned int)(traffic->seq % BENCH_FLOWS);
+
+    memset(packet, 0, BENCH_STAMP_OFFSET);
+    packet[0] = 0x45;
+    packet[2] = (uint8_t)(len >> 8);
+    packet[3] = (uint8_t)len;
+    packet[8] = 64;
+    packet[9] = IPPROTO_UDP;
+    packet[12] = 10; packet[15] = 2;
+    packet[16] = 10; packet[19] = 1;
+    packet[20] = (uint8_t)((10000 + flow) >> 8);
+    packet[21] = (uint8_t)(10000 + flow);
+    packet[22] = 0x13;
+    packet[23] = 0x88;
+    packet[24] = (uint8_t)((len - 20) >> 8);
+    packet[25] = (uint8_t)(len - 20);
+
+    if (traffic->interval_ns > 0) {
+        traffic->next_ns += traffic->interval_ns;
+        uint64_t now = now_ns();
+        if (traffic->next_ns > now) {
+            struct timespec ts = {
+                (time_t)(traffic->next_ns / 1000000000ull), (long)(traffic->next_ns % 1000000000ull)
+            };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+    }
+
+    uint64_t stamp = now_ns();
+    memcpy(packet + BENCH_STAMP_OFFSET, &stamp, sizeof(stamp));
+
+    traffic->seq++;
+    traffic->packets++;
+    traffic->bytes += len;
+    return len;
+}
+
+static void receiver_take(receiver_t* receiver, const uint8_t* packet, size_t len) {
+    uint64_t now = now_ns();
+    __atomic_store_n(&receiver->packets, receiver->packets + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&receiver->bytes, receiver->bytes + len, __ATOMIC_RELAXED);
+    __atomic_store_n(&receiver->last_ns, now, __ATOMIC_RELAXED);
+
+    if (len < BENCH_MIN_PACKET || receiver->sample_count == BENCH_MAX_SAMPLES) return;
+
+    uint64_t stamp;
+    memcpy(&stamp, packet + BENCH_STAMP_OFFSET, sizeof(stamp));
+    uint64_t latency = now > stamp ? now - stamp : 0;
+    receiver->samples[receiver->sample_count++] = latency > UINT32_MAX ? UINT32_MAX : (uint32_t)latency;
+}
+
+// The mock server's sink and source
+
+static void server_sink(void* arg, const uint8_t* packet, size_t len) {
+    receiver_take((receiver_t*)arg, packet, len);
+}
+
+// Nothing between phases (before the first the client has no TUN yet),
+// nor before a paced packet is due, so the server flushes what it has
+static size_t server_source(void* arg, uint8_t* packet, size_t max) {
+    traffic_t* traffic = (traffic_t*)arg;
+    if (!traffic->running) return 0;
+    if (traffic->interval_ns > 0 && now_ns() < traffic->next_ns + traffic->interval_ns) return 0;
+    return traffic_next(traffic, packet);
+}
+
+// ============================================================================
+// TUN side
+// ============================================================================
+
+typedef struct {
+    int fd;
+    traffic_t* traffic;
+    receiver_t* receiver;
+} tun_side_t;
+
+// Upstream: offer packets to the TUN for one phase; blocks when it is full
+static void* tun_writer(void* arg) {
+    tun_side_t* side = (tun_side_t*)arg;
+    uint8_t packet[BENCH_MTU];
+
+    while (side->traffic->running) {
+        size_t len = traffic_next(side->traffic, packet);
+        if (send(side->fd, packet, len, 0) < 0) break;
+    }
+    return NULL;
+}
+
+// Downstream: take what the client writes to the TUN until the last phase
+static void* tun_reader(void* arg) {
+    tun_side_t* side = (tun_side_t*)arg;
+    uint8_t packet[SE_MAX_PACKET_SIZE];
+
+    while (!side->traffic->finished) {
+        struct pollfd pfd = { side->fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 50) <= 0) continue;
+
+        ssize_t len;
+        while ((len = recv(side->fd, packet, sizeof(packet), MSG_DONTWAIT)) > 0) {
+            receiver_take(side->receiver, packet, (size_t)len);
+        }
+    }
+    return NULL;
+}
+
+// ============================================================================
+// Cases
+// ============================================================================
+
+typedef struct {
+    const char* name;
+    bool imix;
+    bool upstream;
+} bench_case_t;
+
+typedef struct {
+    double gbit_per_sec;
+    double packets_per_sec;
+    double loss;                        // Fraction of offered packets not received
+    double client_cpu_ns_per_byte;
+    double total_cpu_ns_per_byte;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+} phase_result_t;
+
+static int compare_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const uint32_t* sorted, size_t count, double p) {
+    if (count == 0) return 0;
+    return sorted[(size_t)(p * (double)(count - 1) + 0.5)];
+}
+
+typedef struct {
+    const bench_case_t* bench;
+    int tun;                            // Bench end of the TUN socketpair
+    pthread_t server_session;
+    pthread_t reader;                   // Downstream only
+    traffic_t* traffic;
+    receiver_t* receiver;
+} case_context_t;
+
+// Run one phase of duration_ms and fill result
+static void run_phase(case_context_t* ctx, uint64_t interval_ns, int duration_ms, phase_result_t* result) {
+    traffic_t* traffic = ctx->traffic;
+    receiver_t* receiver = ctx->receiver;
+    bool upstream = ctx->bench->upstream;
+
+    traffic->interval_ns = interval_ns;
+    traffic->next_ns = now_ns();
+    traffic->packets = 0;
+    traffic->bytes = 0;
+    __atomic_store_n(&receiver->packets, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&receiver->bytes, 0, __ATOMIC_RELAXED);
+    receiver->sample_count = 0;
+
+    pthread_t writer;
+    tun_side_t side = { ctx->tun, traffic, receiver };
+    pthread_t traffic_thread = upstream ? 0 : ctx->reader;
+
+    uint64_t cpu_start = cpu_ns(CLOCK_PROCESS_CPUTIME_ID);
+    uint64_t server_start = thread_cpu_ns(ctx->server_session);
+    uint64_t traffic_start = upstream ? 0 : thread_cpu_ns(traffic_thread);
+    uint64_t start = now_ns();
+
+    traffic->running = true;
+    if (upstream) {
+        pthread_create(&writer, NULL, tun_writer, &side);
+        traffic_thread = writer;
+    }
+    usleep((useconds_t)duration_ms * 1000);
+
+    // Account the writer's CPU before it exits, then stop offering
+    uint64_t traffic_cpu = thread_cpu_ns(traffic_thread) - traffic_start;
+    traffic->running = false;
+    uint64_t elapsed = now_ns() - start;
+    uint64_t bytes = __atomic_load_n(&receiver->bytes, __ATOMIC_RELAXED);
+    uint64_t packets = __atomic_load_n(&receiver->packets, __ATOMIC_RELAXED);
+
+    if (upstream) pthread_join(writer, NULL);
+
+    // Let what is in flight arrive so loss only counts what went missing
+    while (now_ns() - __atomic_load_n(&receiver->last_ns, __ATOMIC_RELAXED) < BENCH_DRAIN_MS * 1000000ull) {
+        usleep(10000);
+    }
+
+    uint64_t cpu = cpu_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+    uint64_t server_cpu = thread_cpu_ns(ctx->server_session) - server_start;
+    if (!upstream) traffic_cpu = thread_cpu_ns(traffic_thread) - traffic_start;
+    uint64_t received = __atomic_load_n(&receiver->packets, __ATOMIC_RELAXED);
+    uint64_t received_bytes = __atomic_load_n(&receiver->bytes, __ATOMIC_RELAXED);
+    uint64_t client_cpu = cpu > server_cpu + traffic_cpu ? cpu - server_cpu - traffic_cpu : 0;
+
+    result->gbit_per_sec = (double)bytes * 8 / (double)elapsed;
+    result->packets_per_sec = (double)packets / ((double)elapsed / 1e9);
+    result->loss = traffic->packets > received
+        ? (double)(traffic->packets - received) / (double)traffic->packets : 0.0;
+    result->client_cpu_ns_per_byte = received_bytes ? (double)client_cpu / (double)received_bytes : 0.0;
+    result->total_cpu_ns_per_byte = received_bytes ? (double)cpu / (double)received_bytes : 0.0;
+
+    qsort(receiver->samples, receiver->sample_count, sizeof(receiver->samples[0]), compare_u32);
+    result->p50_ns = percentile(receiver->samples, receiver->sample_count, 0.50);
+    result->p99_ns = percentile(receiver->samples, receiver->sample_count, 0.99);
+    result->p999_ns = percentile(receiver->samples, receiver->sample_count, 0.999);
+}
+
+static int run_case(SSL_CTX* ssl_ctx, const bench_case_t* bench, int seconds,
+                    phase_result_t* saturated, phase_result_t* paced) {
+    static uint32_t samples[BENCH_MAX_SAMPLES];
+    traffic_t traffic;
+    receiver_t receiver;
+    memset(&traffic, 0, sizeof(traffic));
+    memset(&receiver, 0, sizeof(receiver));
+    traffic.imix = bench->imix;
+    receiver.samples = samples;
+
+    mock_server_t server;
+    memset(&server, 0, sizeof(server));
+    server.ssl_ctx = ssl_ctx;
+    server.connections = 1;
+    server.callback_arg = bench->upstream ? (void*)&receiver : (void*)&traffic;
+    if (bench->upstream) {
+        server.sink = server_sink;
+    } else {
+        server.source = server_source;
+    }
+    if (mock_server_listen(&server, false) < 0) return -1;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, mock_server_thread, &server);
+
+    se_connection_params_t params;
+    memset(&params, 0, sizeof(params));
+    snprintf(params.server_host, sizeof(params.server_host), "127.0.0.1");
+    params.server_port = server.port;
+    snprintf(params.hub_name, sizeof(params.hub_name), "VPN");
+    snprintf(params.username, sizeof(params.username), "bench");
+    params.use_ktls = true;
+    params.max_connections = 1;
+    params.mtu = BENCH_MTU;
+
+    int tun[2];
+    socketpair(AF_UNIX, SOCK_DGRAM, 0, tun);
+    int buffer = BENCH_SOCKET_BUFFER;
+    for (int i = 0; i < 2; i++) {
+        setsockopt(tun[i], SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+        setsockopt(tun[i], SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    }
+
+    se_connection_t* conn = se_connection_new();
+    int rc = conn ? se_connection_connect(conn, &params) : SE_ERR_OUT_OF_MEMORY;
+    if (rc != SE_ERR_SUCCESS) {
+        fprintf(stderr, "Connect failed: %s\n", se_error_string(rc));
+        traffic.finished = true;
+        se_connection_free(conn);
+        shutdown(server.listen_fd, SHUT_RDWR);
+        pthread_join(thread, NULL);
+        close(server.listen_fd);
+        close(tun[0]);
+        close(tun[1]);
+        return -1;
+    }
+    se_connection_set_tun_fd(conn, tun[0]);
+
+    case_context_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.bench = bench;
+    ctx.tun = tun[1];
+    ctx.server_session = server.sessions[0];
+    ctx.traffic = &traffic;
+    ctx.receiver = &receiver;
+
+    tun_side_t side = { tun[1], &traffic, &receiver };
+    if (!bench->upstream) pthread_create(&ctx.reader, NULL, tun_reader, &side);
+
+    run_phase(&ctx, 0, seconds * 1000, saturated);
+    run_phase(&ctx, 1000000000ull / BENCH_PACED_PPS, BENCH_PACED_MS, paced);
+
+    se_connection_free(conn);
+    traffic.finished = true;
+    if (!bench->upstream) pthread_join(ctx.reader, NULL);
+
+    server.stopping = true;
+    shutdown(server.listen_fd, SHUT_RDWR);
+    pthread_join(thread, NULL);
+    close(server.listen_fd);
+    close(tun[0]);
+    close(tun[1]);
+    return saturated->packets_per_sec > 0 && paced->packets_per_sec > 0 ? 0 : -1;
+}
+
+int main(int argc, char** argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_SECONDS;
+    if (seconds <= 0) seconds = BENCH_DEFAULT_SECONDS;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    SSL_CTX* ssl_ctx = mock_server_ssl_ctx_new();
+    if (!ssl_ctx) {
+        fprintf(stderr, "Failed to create server certificate\n");
+        return 1;
+    }
+
+    printf("Loopback TLS to the mock server, %d s saturated then %d ms at %d pkt/s per case\n\n",
+           seconds, BENCH_PACED_MS, BENCH_PACED_PPS);
+    printf("%-15s %8s %10s %7s %12s %11s %10s %10s %10s %10s %10s\n", "case", "Gbit/s", "pkt/s", "loss",
+           "client ns/B", "total ns/B", "load p50", "load p99", "p50", "p99", "p99.9");
+
+    static const bench_case_t cases[] = {
+        { "bulk upstream", false, true },
+        { "bulk downstream", false, false },
+        { "imix upstream", true, true },
+        { "imix downstream", true, false },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        phase_result_t saturated, paced;
+        memset(&saturated, 0, sizeof(saturated));
+        memset(&paced, 0, sizeof(paced));
+        if (run_case(ssl_ctx, &cases[i], seconds, &saturated, &paced) < 0) {
+            fprintf(stderr, "%s failed\n", cases[i].name);
+            SSL_CTX_free(ssl_ctx);
+            return 1;
+        }
+
+        printf("%-15s %8.3f %10.0f %6.2f%% %12.2f %11.2f %8.1fus %8.1fus %8.1fus %8.1fus %8.1fus\n",
+               cases[i].name, saturated.gbit_per_sec, saturated.packets_per_sec, saturated.loss * 100,
+               saturated.client_cpu_ns_per_byte, saturated.total_cpu_ns_per_byte,
+               saturated.p50_ns / 1e3, saturated.p99_ns / 1e3,
+               paced.p50_ns / 1e3, paced.p99_ns / 1e3, paced.p999_ns / 1e3);
+    }
+
+    SSL_CTX_free(ssl_ctx);
+    return 0;
+}
@@ -0,0 +1,366 @@
+/**
+ * SoftEther VPN I/O Model Benchmark
+ *
+ * Compares the three-thread connection model (receive, send, keepalive)
+ * with the single-thread event loop, with traffic striped over several
+ * parallel connections, and with data carried by UDP acceleration. A
+ * client connection talks TLS (and UDP) over loopback to an in-process
+ * echo server; a socketpair stands in for the TUN device. For each model
+ * it reports echo throughput with a window of packets in flight, CPU time
+ * and context switches per packet, and the round-trip latency of single
+ * packets. The UDP model then blocks the server's UDP path to check that
+ * traffic falls back to TLS and returns to UDP. Build with
+ * -DSOFTETHER_BUILD_BENCHMARKS=ON, push to a device and run:
+ *
+ *   softether-io-bench [seconds per case] [packet bytes]
+ */
+
+#include "softether_protocol.h"
+#include "softether_udp.h"
+#include "mock_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <openssl/ssl.h>
+
+#define BENCH_DEFAULT_SECONDS   3
+#define BENCH_DEFAULT_SIZE      1400
+#define BENCH_WINDOW            128     // Packets in flight for the throughput case
+#define BENCH_LATENCY_SIZE      64
+#define BENCH_LATENCY_SAMPLES   2000
+#define BENCH_STALL_MS          200     // Treat the window as lost after this long
+#define BENCH_FLOWS             64      // UDP flows the pumped packets are spread over
+#define BENCH_STRIPES           4       // Connections for the striped model
+
+typedef struct {
+    const char* name;
+    bool event_loop;
+    int connections;
+    bool udp;
+    int compress;                       // SE_COMPRESS_*
+} bench_model_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// ============================================================================
+// Cases
+// ============================================================================
+
+typedef struct {
+    double packets_per_sec;
+    double mbytes_per_sec;
+    double lost;
+    double cpu_us_per_packet;
+    double switches_per_packet;
+    double rtt_avg_us;
+    double rtt_p50_us;
+    double rtt_p99_us;
+} bench_result_t;
+
+static uint64_t cpu_us(const struct rusage* usage) {
+    return (uint64_t)(usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000ull +
+           (uint64_t)(usage->ru_utime.tv_usec + usage->ru_stime.tv_usec);
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Make the packet an IPv4/UDP datagram of the given flow so striping
+// spreads the flows over the connections
+static void set_flow(uint8_t* packet, size_t size, unsigned int flow) {
+    if (size < 28) return;
+    packet[0] = 0x45;
+    packet[6] = 0;
+    packet[7] = 0;
+    packet[9] = IPPROTO_UDP;
+    packet[20] = (uint8_t)((10000 + flow) >> 8);
+    packet[21] = (uint8_t)(10000 + flow);
+}
+
+// Keep window packets in flight through the tunnel for seconds and count
+// the echoes. Returns packets echoed; *lost counts packets given up on.
+static uint64_t pump(int tun, size_t size, int window, int seconds, uint64_t* lost) {
+    uint8_t packet[SE_MAX_PACKET_SIZE];
+    memset(packet, 0x5A, size);
+    unsigned int flow = 0;
+
+    uint64_t echoed = 0;
+    int in_flight = 0;
+    uint64_t deadline = now_ns() + (uint64_t)seconds * 1000000000ull;
+    uint64_t last_progress = now_ns();
+    *lost = 0;
+
+    while (now_ns() < deadline) {
+        set_flow(packet, size, flow++ % BENCH_FLOWS);
+        while (in_flight < window && send(tun, packet, size, MSG_DONTWAIT) == (ssize_t)size) {
+            in_flight++;
+            set_flow(packet, size, flow++ % BENCH_FLOWS);
+        }
+
+        struct pollfd pfd = { tun, POLLIN, 0 };
+        if (poll(&pfd, 1, 10) > 0) {
+            while (recv(tun, packet, sizeof(packet), MSG_DONTWAIT) > 0) {
+                echoed++;
+                if (in_flight > 0) in_flight--;
+                last_progress = now_ns();
+            }
+        } else if (now_ns() - last_progress > BENCH_STALL_MS * 1000000ull) {
+            *lost += in_flight;
+            in_flight = 0;
+            last_progress = now_ns();
+        }
+    }
+
+    // Let the tail drain so the next case starts empty
+    struct pollfd pfd = { tun, POLLIN, 0 };
+    while (poll(&pfd, 1, BENCH_STALL_MS) > 0 && recv(tun, packet, sizeof(packet), 0) > 0) {}
+
+    return echoed;
+}
+
+static int measure_latency(int tun, bench_result_t* result) {
+    static uint64_t samples[BENCH_LATENCY_SAMPLES];
+    uint8_t packet[BENCH_LATENCY_SIZE];
+    memset(packet, 0xA5, sizeof(packet));
+
+    int count = 0;
+    uint64_t total = 0;
+    for (int i = 0; i < BENCH_LATENCY_SAMPLES; i++) {
+        uint64_t start = now_ns();
+        if (send(tun, packet, sizeof(packet), 0) < 0) return -1;
+
+        struct pollfd pfd = { tun, POLLIN, 0 };
+        if (poll(&pfd, 1, BENCH_STALL_MS) <= 0) continue;
+        if (recv(tun, packet, sizeof(packet), 0) <= 0) return -1;
+
+        samples[count] = (now_ns() - start) / 1000;
+        total += samples[count++];
+    }
+    if (count == 0) return -1;
+
+    qsort(samples, count, sizeof(samples[0]), compare_u64);
+    result->rtt_avg_us = (double)total / count;
+    result->rtt_p50_us = (double)samples[count / 2];
+    result->rtt_p99_us = (double)samples[count * 99 / 100];
+    return 0;
+}
+
+// Wait up to timeout_ms for the UDP state to become state. Returns the
+// time it took in ms, -1 on timeout.
+// Where the pumped packets waited, from the client's own histograms
+static void print_path_latency(se_connection_t* conn) {
+    static const char* names[SE_LATENCY_PATH_COUNT] = { "tun->wire", "wire->tun" };
+    static se_latency_snapshot_t snapshot;
+
+    for (int path = 0; path < SE_LATENCY_PATH_COUNT; path++) {
+        if (se_connection_get_latency(conn, path, &snapshot, true) < 0 || snapshot.count == 0) continue;
+        printf("  %s: %llu packets, p50 %.1fus, p99 %.1fus, p99.9 %.1fus, max %.1fus\n", names[path],
+               (unsigned long long)snapshot.count, se_latency_percentile(&snapshot, 50.0) / 1e3,
+               se_latency_percentile(&snapshot, 99.0) / 1e3, se_latency_percentile(&snapshot, 99.9) / 1e3,
+               snapshot.max_ns / 1e3);
+    }
+}
+
+static int wait_udp_state(se_connection_t* conn, int state, int timeout_ms) {
+    uint64_t start = now_ns();
+    se_udp_stats_t stats;
+
+    while ((now_ns() - start) / 1000000 < (uint64_t)timeout_ms) {
+        se_connection_get_udp_stats(conn, &stats);
+        if (stats.state == state) return (int)((now_ns() - start) / 1000000);
+        usleep(10000);
+    }
+    return -1;
+}
+
+// Block the UDP path until the client falls back, check that echoes still
+// come back over TLS, then unblock it and wait for the return to UDP
+static int check_udp_fallback(mock_server_t* server, se_connection_t* conn, int tun, size_t size) {
+    server->udp_blocked = true;
+    int fallback_ms = wait_udp_state(conn, SE_UDP_STATE_PROBING, SE_UDP_DEAD_MS * 2);
+
+    uint64_t lost;
+    uint64_t echoed = fallback_ms >= 0 ? pump(tun, size, 1, 1, &lost) : 0;
+
+    server->udp_blocked = false;
+    int recover_ms = wait_udp_state(conn, SE_UDP_STATE_ACTIVE, SE_UDP_PROBE_INTERVAL_MS * 3);
+
+    se_udp_stats_t stats;
+    se_connection_get_udp_stats(conn, &stats);
+    printf("  udp: %llu datagrams sent, %llu received, %llu rejected; fell back to TLS after %d ms "
+           "(%llu echoes over TLS), back on UDP after %d ms\n",
+           (unsigned long long)stats.datagrams_sent, (unsigned long long)stats.datagrams_received,
+           (unsigned long long)stats.rejected, fallback_ms, (unsigned long long)echoed, recover_ms);
+
+    return (fallback_ms >= 0 && echoed > 0 && recover_ms >= 0 && stats.fallbacks == 1) ? 0 : -1;
+}
+
+static int run_model(SSL_CTX* ssl_ctx, const bench_model_t* model, int seconds, size_t size,
+                     bench_result_t* result) {
+    mock_server_t server;
+    memset(&server, 0, sizeof(server));
+    server.ssl_ctx = ssl_ctx;
+    server.connections = model->connections;
+    if (mock_server_listen(&server, model->udp) < 0) return -1;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, mock_server_thread, &server);
+
+    se_connection_params_t params;
+    memset(&params, 0, sizeof(params));
+    snprintf(params.server_host, sizeof(params.server_host), "127.0.0.1");
+    params.server_port = server.port;
+    snprintf(params.hub_name, sizeof(params.hub_name), "VPN");
+    snprintf(params.username, sizeof(params.username), "bench");
+    params.use_ktls = true;
+    params.use_event_loop = model->event_loop;
+    params.max_connections = model->connections;
+    params.use_udp_acceleration = model->udp;
+    params.use_compress = model->compress != SE_COMPRESS_NONE;
+    params.compress_algorithm = model->compress;
+    params.mtu = (int)size;
+
+    int tun[2];
+    socketpair(AF_UNIX, SOCK_DGRAM, 0, tun);
+    int buffer = 4 * 1024 * 1024;
+    for (int i = 0; i < 2; i++) {
+        setsockopt(tun[i], SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+        setsockopt(tun[i], SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    }
+
+    se_connection_t* conn = se_connection_new();
+    int rc = conn ? se_connection_connect(conn, &params) : SE_ERR_OUT_OF_MEMORY;
+    if (rc != SE_ERR_SUCCESS) {
+        fprintf(stderr, "Connect failed: %s\n", se_error_string(rc));
+        se_connection_free(conn);
+        shutdown(server.listen_fd, SHUT_RDWR);
+        pthread_join(thread, NULL);
+        close(server.listen_fd);
+        return -1;
+    }
+    se_connection_set_tun_fd(conn, tun[0]);
+
+    if (model->udp && wait_udp_state(conn, SE_UDP_STATE_ACTIVE, SE_UDP_PROBE_INTERVAL_MS * 3) < 0) {
+        fprintf(stderr, "UDP path never became active\n");
+    }
+
+    // Time only the pumped packets
+    se_connection_reset_statistics(conn);
+
+    struct rusage before, after;
+    uint64_t lost;
+    getrusage(RUSAGE_SELF, &before);
+    uint64_t start = now_ns();
+    uint64_t echoed = pump(tun[1], size, BENCH_WINDOW, seconds, &lost);
+    double elapsed = (double)(now_ns() - start) / 1e9;
+    getrusage(RUSAGE_SELF, &after);
+
+    long switches = (after.ru_nvcsw - before.ru_nvcsw) + (after.ru_nivcsw - before.ru_nivcsw);
+    result->packets_per_sec = echoed / elapsed;
+    result->mbytes_per_sec = echoed * size / elapsed / 1e6;
+    result->lost = (double)lost;
+    result->cpu_us_per_packet = echoed ? (double)(cpu_us(&after) - cpu_us(&before)) / echoed : 0;
+    result->switches_per_packet = echoed ? (double)switches / echoed : 0;
+
+    se_transport_stats_t stats[SE_MAX_CONNECTIONS];
+    int count = se_connection_get_transport_stats(conn, stats, SE_MAX_CONNECTIONS);
+    for (int i = 0; count > 1 && i < count; i++) {
+        printf("  connection %d: %llu packets sent, %llu received, %llu dropped\n", i,
+               (unsigned long long)stats[i].packets_sent, (unsigned long long)stats[i].packets_received,
+               (unsigned long long)stats[i].drops);
+    }
+
+    se_compress_stats_t compress;
+    if (model->compress != SE_COMPRESS_NONE && se_connection_get_compress_stats(conn, &compress) == 0) {
+        printf("  compression: ratio %.3f, %llu of %llu packets skipped, %.2f us/pkt compress, "
+               "%.2f us/pkt decompress\n",
+               compress.bytes_in ? (double)compress.bytes_out / compress.bytes_in : 1.0,
+               (unsigned long long)compress.packets_skipped, (unsigned long long)compress.packets_in,
+               compress.packets_in ? compress.compress_ns / 1e3 / compress.packets_in : 0.0,
+               compress.packets_compressed ? compress.decompress_ns / 1e3 / compress.packets_compressed : 0.0);
+    }
+
+    print_path_latency(conn);
+
+    rc = measure_latency(tun[1], result);
+    if (rc == 0 && model->udp) {
+        rc = check_udp_fallback(&server, conn, tun[1], size);
+    }
+
+    se_connection_free(conn);
+    shutdown(server.listen_fd, SHUT_RDWR);
+    pthread_join(thread, NULL);
+    close(server.listen_fd);
+    if (server.udp_fd >= 0) close(server.udp_fd);
+    close(tun[0]);
+    close(tun[1]);
+    return rc;
+}
+
+int main(int argc, char** argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_SECONDS;
+    size_t size = argc > 2 ? (size_t)atoi(argv[2]) : BENCH_DEFAULT_SIZE;
+    if (seconds <= 0) seconds = BENCH_DEFAULT_SECONDS;
+    if (size == 0 || size > SE_MAX_FRAME_PAYLOAD) size = BENCH_DEFAULT_SIZE;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    SSL_CTX* ssl_ctx = mock_server_ssl_ctx_new();
+    if (!ssl_ctx) {
+        fprintf(stderr, "Failed to create server certificate\n");
+        return 1;
+    }
+
+    printf("Echo over loopback TLS: %zu-byte packets, window %d, %d s per model\n\n",
+           size, BENCH_WINDOW, seconds);
+    printf("%-12s %10s %9s %6s %11s %10s %9s %9s %9s\n", "model", "pkt/s", "MB/s", "lost",
+           "cpu us/pkt", "csw/pkt", "rtt avg", "rtt p50", "rtt p99");
+
+    static const bench_model_t models[] = {
+        { "threads", false, 1, false, SE_COMPRESS_NONE },
+        { "event-loop", true, 1, false, SE_COMPRESS_NONE },
+        { "striped", false, BENCH_STRIPES, false, SE_COMPRESS_NONE },
+        { "udp", false, 1, true, SE_COMPRESS_NONE },
+        { "zlib", false, 1, false, SE_COMPRESS_ZLIB },
+        { "lz", false, 1, false, SE_COMPRESS_LZ },
+        { "lz-loop", true, 1, false, SE_COMPRESS_LZ },
+        { "lz-striped", false, BENCH_STRIPES, false, SE_COMPRESS_LZ },
+    };
+    for (size_t i = 0; i < sizeof(models) / sizeof(models[0]); i++) {
+        const bench_model_t* model = &models[i];
+        bench_result_t result;
+        memset(&result, 0, sizeof(result));
+        if (run_model(ssl_ctx, model, seconds, size, &result) < 0) {
+            fprintf(stderr, "%s model failed\n", model->name);
+            SSL_CTX_free(ssl_ctx);
+            return 1;
+        }
+
+        printf("%-12s %10.0f %9.1f %6.0f %11.2f %10.3f %8.1fus %8.1fus %8.1fus\n", model->name,
+               result.packets_per_sec, result.mbytes_per_sec, result.lost, result.cpu_us_per_packet,
+               result.switches_per_packet, result.rtt_avg_us, result.rtt_p50_us, result.rtt_p99_us);
+    }
+
+    SSL_CTX_free(ssl_ctx);
+    return 0;
+}
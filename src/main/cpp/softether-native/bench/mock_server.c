@@ -0,0 +1,354 @@
+/**
+ * SoftEther VPN Mock Server
+ *
+ * See mock_server.h. Shared by the benchmarks that need a server and by
+ * the standalone softether-mock-server.
+ */
+
+#include "mock_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <openssl/rand.h>
+
+typedef struct {
+    mock_server_t* server;
+    int fd;
+} mock_session_t;
+
+SSL_CTX* mock_server_ssl_ctx_new(void) {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    EVP_PKEY* key = EVP_EC_gen("P-256");
+    X509* cert = X509_new();
+    if (!ctx || !key || !cert) goto fail;
+
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 86400);
+    X509_set_pubkey(cert, key);
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+
+    if (!X509_sign(cert, key, EVP_sha256()) ||
+        SSL_CTX_use_certificate(ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey(ctx, key) != 1) {
+        goto fail;
+    }
+
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return ctx;
+
+fail:
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    SSL_CTX_free(ctx);
+    return NULL;
+}
+
+static int ssl_read_full(SSL* ssl, uint8_t* buffer, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+        size_t n;
+        if (!SSL_read_ex(ssl, buffer + total, len - total, &n)) return -1;
+        total += n;
+    }
+    return 0;
+}
+
+static int ssl_write_frame(SSL* ssl, uint32_t type, const uint8_t* payload, uint32_t len) {
+    uint8_t frame[SE_FRAME_HEADER_SIZE + 64];
+    memset(frame, 0, SE_FRAME_HEADER_SIZE);
+    frame[3] = (uint8_t)type;
+    frame[8] = (uint8_t)(len >> 24);
+    frame[9] = (uint8_t)(len >> 16);
+    frame[10] = (uint8_t)(len >> 8);
+    frame[11] = (uint8_t)len;
+    memcpy(frame + SE_FRAME_HEADER_SIZE, payload, len);
+
+    size_t n;
+    return SSL_write_ex(ssl, frame, SE_FRAME_HEADER_SIZE + len, &n) ? 0 : -1;
+}
+
+typedef struct {
+    mock_server_t* server;
+    se_udp_channel_t* channel;
+    struct iovec echo[SE_UDP_BATCH];
+    int echo_count;
+} mock_udp_t;
+
+// Collect data for one echo batch; answer probes straight away
+static void server_udp_deliver(void* arg, uint8_t type, const uint8_t* payload, size_t len) {
+    mock_udp_t* udp = (mock_udp_t*)arg;
+    if (udp->server->udp_blocked) return;
+
+    if (type == SE_UDP_MSG_PROBE) {
+        struct iovec probe = { NULL, 0 };
+        se_udp_channel_send(udp->channel, SE_UDP_MSG_PROBE, &probe, 1);
+    } else if (type == SE_UDP_MSG_DATA) {
+        udp->echo[udp->echo_count].iov_base = (void*)payload;
+        udp->echo[udp->echo_count].iov_len = len;
+        udp->echo_count++;
+    }
+}
+
+// Connect to the client's address on its first datagram, then echo data
+// and answer probes on the channel
+static void* server_udp_thread(void* arg) {
+    mock_server_t* server = (mock_server_t*)arg;
+    mock_udp_t udp = { server, NULL, {{ 0 }}, 0 };
+
+    while (!server->stopping) {
+        struct pollfd pfd = { server->udp_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) <= 0) continue;
+
+        if (!udp.channel) {
+            struct sockaddr_storage peer;
+            socklen_t len = sizeof(peer);
+            uint8_t byte;
+            if (recvfrom(server->udp_fd, &byte, 1, MSG_PEEK, (struct sockaddr*)&peer, &len) < 0 ||
+                connect(server->udp_fd, (struct sockaddr*)&peer, len) < 0) {
+                continue;
+            }
+
+            se_udp_keys_t keys;
+            se_udp_derive_keys(server->client_random, server->server_random, false, &keys);
+            udp.channel = se_udp_channel_new(dup(server->udp_fd), server->udp_aead, &keys);
+            if (!udp.channel) break;
+        }
+
+        udp.echo_count = 0;
+        if (se_udp_channel_recv(udp.channel, server_udp_deliver, &udp) > 0 && udp.echo_count > 0) {
+            se_udp_channel_send(udp.channel, SE_UDP_MSG_DATA, udp.echo, udp.echo_count);
+        }
+    }
+
+    se_udp_channel_free(udp.channel);
+    return NULL;
+}
+
+// Read one frame from the client and drop it. Returns its type, -1 when
+// the connection failed.
+static int ssl_read_discard(SSL* ssl) {
+    uint8_t buffer[SE_FRAME_HEADER_SIZE + 256];
+    if (ssl_read_full(ssl, buffer, SE_FRAME_HEADER_SIZE) < 0) return -1;
+
+    int type = (int)(((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) |
+                     ((uint32_t)buffer[2] << 8) | buffer[3]);
+    size_t len = ((size_t)buffer[8] << 24) | ((size_t)buffer[9] << 16) |
+                 ((size_t)buffer[10] << 8) | buffer[11];
+    while (len > 0) {
+        size_t chunk = len < sizeof(buffer) ? len : sizeof(buffer);
+        if (ssl_read_full(ssl, buffer, chunk) < 0) return -1;
+        len -= chunk;
+    }
+    return type;
+}
+
+// Send what the source produces, as DATA frames coalesced into records of
+// up to SE_MAX_PACKET_SIZE, until the client disconnects or the server
+// stops. Whenever the source has nothing, flush and read what the client
+// sent meanwhile, waiting a millisecond for it.
+static void server_source(mock_server_t* server, SSL* ssl, uint8_t* batch) {
+    size_t used = 0;
+    size_t n;
+
+    while (!server->stopping) {
+        uint8_t* header = batch + used;
+        bool room = SE_MAX_PACKET_SIZE - used >= SE_FRAME_HEADER_SIZE + MOCK_SOURCE_MAX_PACKET;
+        size_t len = room ? server->source(server->callback_arg, header + SE_FRAME_HEADER_SIZE,
+                                           MOCK_SOURCE_MAX_PACKET) : 0;
+
+        if (len > 0) {
+            memset(header, 0, SE_FRAME_HEADER_SIZE);
+            header[3] = (uint8_t)SE_PACKET_TYPE_DATA;
+            header[10] = (uint8_t)(len >> 8);
+            header[11] = (uint8_t)len;
+            used += SE_FRAME_HEADER_SIZE + len;
+            continue;
+        }
+
+        if (used > 0) {
+            if (!SSL_write_ex(ssl, batch, used, &n)) return;
+            used = 0;
+            if (!room) continue;    // Record full; the source may have more
+        }
+
+        struct pollfd pfd = { SSL_get_fd(ssl), POLLIN, 0 };
+        if (SSL_pending(ssl) > 0 || poll(&pfd, 1, 1) > 0) {
+            int type = ssl_read_discard(ssl);
+            if (type < 0 || type == SE_PACKET_TYPE_DISCONNECT) return;
+        }
+    }
+}
+
+// Stall a session that got to the phase being held until the server stops
+static bool server_hold(mock_server_t* server, int phase) {
+    if (server->hold_phase != phase) return false;
+    __atomic_fetch_add(&server->held, 1, __ATOMIC_RELAXED);
+    while (!server->stopping) usleep(10000);
+    return true;
+}
+
+// Answer hello, auth (or joining an additional connection) and DHCP, then
+// echo every data frame on the connection it came in on until disconnect,
+// or hand it to the sink, or switch to sending the source's packets.
+// Compression is granted as asked: echoing compressed frames unchanged
+// replays the client's own stream to its decompressor.
+static void server_session(mock_server_t* server, SSL* ssl, uint8_t* frame) {
+    uint8_t* header = frame;
+    uint8_t* payload = frame + SE_FRAME_HEADER_SIZE;
+    uint8_t hello[64];
+
+    if (server_hold(server, SE_CONNECT_PHASE_HELLO)) return;
+    if (ssl_read_full(ssl, hello, sizeof(hello)) < 0) return;
+    hello[4] = SE_VERSION_MAJOR;
+    hello[5] = SE_VERSION_MINOR;
+    hello[10] = (uint8_t)server->connections;
+
+    // Offer UDP on the first connection that asks for it
+    uint8_t aead = hello[12];
+    hello[12] = SE_UDP_AEAD_NONE;
+    if (aead != SE_UDP_AEAD_NONE && server->udp_fd >= 0 && !server->udp_started) {
+        server->udp_aead = aead;
+        memcpy(server->client_random, hello + 32, SE_UDP_RANDOM_SIZE);
+        RAND_bytes(server->server_random, SE_UDP_RANDOM_SIZE);
+        hello[12] = aead;
+        hello[14] = (uint8_t)(server->udp_port >> 8);
+        hello[15] = (uint8_t)server->udp_port;
+        memcpy(hello + 32, server->server_random, SE_UDP_RANDOM_SIZE);
+        server->udp_started = true;
+        pthread_create(&server->udp_thread, NULL, server_udp_thread, server);
+    }
+
+    size_t n;
+    if (!SSL_write_ex(ssl, hello, sizeof(hello), &n)) return;
+
+    while (ssl_read_full(ssl, header, SE_FRAME_HEADER_SIZE) == 0) {
+        uint32_t type = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+                        ((uint32_t)header[2] << 8) | header[3];
+        uint32_t len = ((uint32_t)header[8] << 24) | ((uint32_t)header[9] << 16) |
+                       ((uint32_t)header[10] << 8) | header[11];
+        if (len > SE_MAX_FRAME_PAYLOAD || ssl_read_full(ssl, payload, len) < 0) return;
+
+        if (type == SE_PACKET_TYPE_AUTH_REQUEST || type == SE_PACKET_TYPE_ADD_CONNECTION) {
+            static const uint8_t ok[4] = { 0, 0, 0, 0 };
+            int phase = type == SE_PACKET_TYPE_AUTH_REQUEST ? SE_CONNECT_PHASE_AUTH : SE_CONNECT_PHASE_SESSION;
+            if (server_hold(server, phase)) return;
+            if (ssl_write_frame(ssl, SE_PACKET_TYPE_AUTH_RESPONSE, ok, sizeof(ok)) < 0) return;
+        } else if (type == SE_PACKET_TYPE_DHCP_REQUEST) {
+            if (server_hold(server, SE_CONNECT_PHASE_DHCP)) return;
+            static const uint8_t lease[24] = { 10, 0, 0, 2, 255, 255, 255, 0, 10, 0, 0, 1, 10, 0, 0, 1 };
+            if (ssl_write_frame(ssl, SE_PACKET_TYPE_DHCP_RESPONSE, lease, sizeof(lease)) < 0) return;
+            if (server->source) {
+                server_source(server, ssl, frame);
+                return;
+            }
+        } else if (type == SE_PACKET_TYPE_DATA) {
+            if (server->sink) {
+                server->sink(server->callback_arg, payload, len);
+            } else if (!SSL_write_ex(ssl, frame, SE_FRAME_HEADER_SIZE + len, &n)) {
+                return;
+            }
+        } else if (type == SE_PACKET_TYPE_DISCONNECT) {
+            return;
+        }
+    }
+}
+
+static void* session_thread(void* arg) {
+    mock_session_t* session = (mock_session_t*)arg;
+    uint8_t* frame = malloc(SE_MAX_PACKET_SIZE);
+
+    int nodelay = 1;
+    setsockopt(session->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    SSL* ssl = SSL_new(session->server->ssl_ctx);
+    SSL_set_fd(ssl, session->fd);
+    if (frame && !server_hold(session->server, SE_CONNECT_PHASE_TLS) && SSL_accept(ssl) == 1) {
+        server_session(session->server, ssl, frame);
+    }
+
+    SSL_free(ssl);
+    close(session->fd);
+    free(frame);
+    free(session);
+    return NULL;
+}
+
+void* mock_server_thread(void* arg) {
+    mock_server_t* server = (mock_server_t*)arg;
+
+    while (server->session_count < SE_MAX_CONNECTIONS) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) break;
+
+        mock_session_t* session = malloc(sizeof(mock_session_t));
+        if (!session) {
+            close(fd);
+            break;
+        }
+        session->server = server;
+        session->fd = fd;
+        pthread_create(&server->sessions[server->session_count++], NULL, session_thread, session);
+    }
+
+    for (int i = 0; i < server->session_count; i++) {
+        pthread_join(server->sessions[i], NULL);
+    }
+
+    server->stopping = true;
+    if (server->udp_started) {
+        pthread_join(server->udp_thread, NULL);
+    }
+    return NULL;
+}
+
+int mock_server_listen(mock_server_t* server, bool udp) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)server->port);
+
+    socklen_t len = sizeof(addr);
+    int reuse = 1;
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listen_fd < 0 ||
+        setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+        bind(server->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(server->listen_fd, SE_MAX_CONNECTIONS) < 0 ||
+        getsockname(server->listen_fd, (struct sockaddr*)&addr, &len) < 0) {
+        return -1;
+    }
+    server->port = ntohs(addr.sin_port);
+
+    server->udp_fd = -1;
+    if (!udp) return 0;
+
+    addr.sin_port = 0;
+    len = sizeof(addr);
+    server->udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int buffer = 4 * 1024 * 1024;
+    setsockopt(server->udp_fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    setsockopt(server->udp_fd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+    if (server->udp_fd < 0 ||
+        bind(server->udp_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        getsockname(server->udp_fd, (struct sockaddr*)&addr, &len) < 0) {
+        return -1;
+    }
+    server->udp_port = ntohs(addr.sin_port);
+    return 0;
+}
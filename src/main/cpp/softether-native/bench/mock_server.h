@@ -0,0 +1,86 @@
+/**
+ * SoftEther VPN Mock Server - Benchmark Header
+ *
+ * An in-process stand-in for a SoftEther server that speaks the framing
+ * of softether_protocol.c over loopback TLS: it answers hello, auth (and
+ * additional connections) and DHCP, then handles DATA frames until the
+ * client sends DISCONNECT or closes. Keepalives are read and ignored.
+ *
+ * What happens to data depends on the callbacks. With neither set, every
+ * DATA frame is echoed on the connection it came in on. With sink set,
+ * frames are handed to it and not echoed. With source set, the server
+ * sends the packets it produces to the client as fast as TLS takes them
+ * and drops what the client sends, short of a DISCONNECT. UDP
+ * acceleration is offered once if the server listens with udp set, and
+ * then echoes too. With hold_phase set, sessions stop answering once
+ * the client's connect is in that phase and wait for the server to stop,
+ * so a test can catch a connect there.
+ */
+
+#ifndef SOFTETHER_MOCK_SERVER_H
+#define SOFTETHER_MOCK_SERVER_H
+
+#include "softether_protocol.h"
+#include "softether_udp.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <openssl/ssl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Called with each DATA payload received, from the session's thread
+typedef void (*mock_server_sink_t)(void* arg, const uint8_t* packet, size_t len);
+
+#define MOCK_SOURCE_MAX_PACKET  2048    // max passed to a source
+
+// Fill packet (up to max bytes) with the next packet to send. Returns its
+// length, or 0 when there is nothing to send right now; the server then
+// checks for frames from the client and asks again.
+typedef size_t (*mock_server_source_t)(void* arg, uint8_t* packet, size_t max);
+
+typedef struct {
+    SSL_CTX* ssl_ctx;
+    int listen_fd;
+    int port;                           // Set before listening to pick one, 0 for any
+    int connections;                    // Granted in the hello response
+    pthread_t sessions[SE_MAX_CONNECTIONS];
+    int session_count;
+
+    mock_server_sink_t sink;
+    mock_server_source_t source;
+    void* callback_arg;
+
+    // UDP acceleration stand-in
+    int udp_fd;                         // -1 when not offered
+    int udp_port;
+    int udp_aead;
+    uint8_t client_random[SE_UDP_RANDOM_SIZE];
+    uint8_t server_random[SE_UDP_RANDOM_SIZE];
+    pthread_t udp_thread;
+    volatile bool udp_started;
+    volatile bool udp_blocked;          // Drop every datagram, as a hostile network would
+    int hold_phase;                     // SE_CONNECT_PHASE_* (TLS to SESSION) to stall in, 0 for none
+    volatile int held;                  // Sessions stalled so far
+    volatile bool stopping;
+} mock_server_t;
+
+// Self-signed P-256 certificate for localhost
+SSL_CTX* mock_server_ssl_ctx_new(void);
+
+// Listen on loopback, and on UDP too if udp is set. Returns -1 on failure.
+int mock_server_listen(mock_server_t* server, bool udp);
+
+// Accept until the listening socket is shut down, one thread per
+// connection, then join the sessions. Run it with pthread_create.
+void* mock_server_thread(void* arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOFTETHER_MOCK_SERVER_H
@@ -0,0 +1,92 @@
+/**
+ * SoftEther VPN Mock Server - Standalone
+ *
+ * Runs mock_server.h on loopback for clients in other processes, such as
+ * the app on an emulator through adb reverse or a host build under perf.
+ * In echo mode every data packet comes back; in sink mode packets are
+ * counted and a rate is printed each second. Serves until killed:
+ *
+ *   softether-mock-server [port] [echo|sink]
+ */
+
+#include "mock_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+typedef struct {
+    uint64_t packets;
+    uint64_t bytes;
+} sink_counters_t;
+
+static void count_sink(void* arg, const uint8_t* packet, size_t len) {
+    sink_counters_t* counters = (sink_counters_t*)arg;
+    __atomic_fetch_add(&counters->packets, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counters->bytes, len, __ATOMIC_RELAXED);
+}
+
+static void* report_thread(void* arg) {
+    sink_counters_t* counters = (sink_counters_t*)arg;
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+
+    for (;;) {
+        sleep(1);
+        uint64_t p = __atomic_load_n(&counters->packets, __ATOMIC_RELAXED);
+        uint64_t b = __atomic_load_n(&counters->bytes, __ATOMIC_RELAXED);
+        if (p != packets) {
+            printf("%llu pkt/s, %.3f Gbit/s\n", (unsigned long long)(p - packets), (double)(b - bytes) * 8 / 1e9);
+            fflush(stdout);
+        }
+        packets = p;
+        bytes = b;
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    int port = argc > 1 ? atoi(argv[1]) : 0;
+    bool sink = argc > 2 && strcmp(argv[2], "sink") == 0;
+    static sink_counters_t counters;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    SSL_CTX* ssl_ctx = mock_server_ssl_ctx_new();
+    if (!ssl_ctx) {
+        fprintf(stderr, "Failed to create server certificate\n");
+        return 1;
+    }
+
+    mock_server_t server;
+    memset(&server, 0, sizeof(server));
+    server.ssl_ctx = ssl_ctx;
+    server.port = port;
+    server.connections = SE_MAX_CONNECTIONS;
+    if (sink) {
+        server.sink = count_sink;
+        server.callback_arg = &counters;
+
+        pthread_t reporter;
+        pthread_create(&reporter, NULL, report_thread, &counters);
+        pthread_detach(reporter);
+    }
+    if (mock_server_listen(&server, false) < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    printf("Mock server (%s) on 127.0.0.1:%d\n", sink ? "sink" : "echo", server.port);
+    fflush(stdout);
+
+    // mock_server_thread returns once SE_MAX_CONNECTIONS sessions ended
+    for (;;) {
+        server.session_count = 0;
+        mock_server_thread(&server);
+    }
+}
@@ -0,0 +1,523 @@
+/**
+ * SoftEther VPN Packet Microbenchmark
+ *
+ * Times the packet primitives on the data path: se_packet_new/free (and
+ * the pooled variant for comparison), se_packet_serialize/deserialize and
+ * the SPSC se_packet_queue, at an MTU-sized and a 64 KB payload.
+ *
+ * Single-thread cases run their operation in batches of BENCH_BATCH and
+ * take the batch average as one latency sample. Cross-thread cases stamp
+ * each packet as it is pushed and sample the time until the consumer has
+ * it, so their percentiles are loaded latency. queue_ping_pong bounces one
+ * packet between two threads for unloaded one-way latency. The queue only
+ * allows one producer and one consumer, so the contended cases are a
+ * two-slot queue that parks on every push and pop, and several
+ * producer/consumer pairs running at once.
+ *
+ * Results go to stdout as JSON, one case per line, so runs diff cleanly.
+ * A readable table goes to stderr, against a stored baseline if given:
+ *
+ *   softether-packet-bench [-m milliseconds per case] [-c baseline.json] > run.json
+ */
+
+#include "softether_protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define BENCH_DEFAULT_MS    300
+#define BENCH_BATCH         64              // Operations per single-thread sample
+#define BENCH_MAX_SAMPLES   (1 << 20)
+#define BENCH_QUEUE_SIZE    256             // SE_SEND_QUEUE_SIZE order of magnitude
+#define BENCH_PARKING_SIZE  2               // Full or empty on nearly every call
+#define BENCH_MAX_PAIRS     4
+#define BENCH_MAX_CASES     64
+#define BENCH_NAME_MAX      48
+
+// One TUN packet and the largest frame payload
+static const size_t g_sizes[] = { 1400, SE_MAX_PACKET_SIZE };
+
+#define SIZE_COUNT (sizeof(g_sizes) / sizeof(g_sizes[0]))
+
+typedef struct {
+    char name[BENCH_NAME_MAX];
+    int threads;
+    size_t payload;
+    uint64_t ops;
+    uint64_t ns;                // Wall time of the measured loop
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+} bench_result_t;
+
+static bench_result_t g_results[BENCH_MAX_CASES];
+static int g_result_count = 0;
+static int g_duration_ms = BENCH_DEFAULT_MS;
+
+static uint8_t g_payload[SE_MAX_PACKET_SIZE];
+static uint8_t g_frame[SE_FRAME_HEADER_SIZE + SE_MAX_PACKET_SIZE];
+static uint32_t g_samples[BENCH_MAX_SAMPLES];
+static volatile uint8_t g_sink;         // Keeps payload reads alive
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const uint32_t* sorted, size_t count, double p) {
+    if (count == 0) return 0;
+    size_t index = (size_t)(p * (double)(count - 1) + 0.5);
+    return sorted[index];
+}
+
+static bench_result_t* add_result(const char* name, int threads, size_t payload, uint64_t ops,
+                                  uint64_t ns, uint32_t* samples, size_t sample_count) {
+    if (g_result_count == BENCH_MAX_CASES) return NULL;
+
+    bench_result_t* r = &g_results[g_result_count++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->threads = threads;
+    r->payload = payload;
+    r->ops = ops;
+    r->ns = ns;
+
+    qsort(samples, sample_count, sizeof(samples[0]), compare_u32);
+    r->p50_ns = percentile(samples, sample_count, 0.50);
+    r->p99_ns = percentile(samples, sample_count, 0.99);
+    r->p999_ns = percentile(samples, sample_count, 0.999);
+    return r;
+}
+
+static uint32_t clamp_sample(uint64_t ns) {
+    return ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+}
+
+// ============================================================================
+// Single-thread cases
+// ============================================================================
+
+typedef struct {
+    size_t size;
+    se_packet_pool_t* pool;
+    se_packet_t* packet;        // Serialize source
+    se_packet_queue_t* queue;
+    int frame_len;              // Deserialize source length
+} op_context_t;
+
+typedef int (*bench_op_t)(op_context_t* ctx);
+
+static int op_new_free(op_context_t* ctx) {
+    se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_DATA, 0, g_payload, ctx->size);
+    if (!packet) return -1;
+    se_packet_free(packet);
+    return 0;
+}
+
+static int op_pooled_new_free(op_context_t* ctx) {
+    se_packet_t* packet = se_packet_new_pooled(ctx->pool, SE_PACKET_TYPE_DATA, 0, g_payload, ctx->size);
+    if (!packet) return -1;
+    se_packet_free(packet);
+    return 0;
+}
+
+static int op_serialize(op_context_t* ctx) {
+    return se_packet_serialize(ctx->packet, g_frame, sizeof(g_frame)) < 0 ? -1 : 0;
+}
+
+static int op_deserialize(op_context_t* ctx) {
+    se_packet_t* packet = se_packet_deserialize(g_frame, (size_t)ctx->frame_len);
+    if (!packet) return -1;
+    se_packet_free(packet);
+    return 0;
+}
+
+static int op_push_pop(op_context_t* ctx) {
+    if (se_packet_queue_push(ctx->queue, ctx->packet, false) < 0) return -1;
+    return se_packet_queue_pop(ctx->queue, false) == ctx->packet ? 0 : -1;
+}
+
+static int run_single(const char* name, size_t size, bench_op_t op, op_context_t* ctx) {
+    size_t sample_count = 0;
+    uint64_t ops = 0;
+    uint64_t start = now_ns();
+    uint64_t deadline = start + (uint64_t)g_duration_ms * 1000000ull;
+    uint64_t end = start;
+
+    do {
+        uint64_t batch_start = end;
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            if (op(ctx) < 0) {
+                fprintf(stderr, "%s failed at %zu bytes\n", name, size);
+                return -1;
+            }
+        }
+        end = now_ns();
+        ops += BENCH_BATCH;
+        if (sample_count < BENCH_MAX_SAMPLES) {
+            g_samples[sample_count++] = clamp_sample((end - batch_start) / BENCH_BATCH);
+        }
+    } while (end < deadline);
+
+    add_result(name, 1, size, ops, end - start, g_samples, sample_count);
+    return 0;
+}
+
+static int bench_single_thread(size_t size) {
+    char name[BENCH_NAME_MAX];
+    op_context_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.size = size;
+    ctx.pool = se_packet_pool_new();
+    ctx.packet = se_packet_new(SE_PACKET_TYPE_DATA, 0, g_payload, size);
+    ctx.queue = se_packet_queue_new(BENCH_QUEUE_SIZE);
+    int rc = -1;
+    if (!ctx.pool || !ctx.packet || !ctx.queue) goto done;
+
+    ctx.frame_len = se_packet_serialize(ctx.packet, g_frame, sizeof(g_frame));
+    if (ctx.frame_len < 0) goto done;
+
+    snprintf(name, sizeof(name), "packet_new_free/%zu", size);
+    if (run_single(name, size, op_new_free, &ctx) < 0) goto done;
+    snprintf(name, sizeof(name), "packet_pooled_new_free/%zu", size);
+    if (run_single(name, size, op_pooled_new_free, &ctx) < 0) goto done;
+    snprintf(name, sizeof(name), "packet_serialize/%zu", size);
+    if (run_single(name, size, op_serialize, &ctx) < 0) goto done;
+    snprintf(name, sizeof(name), "packet_deserialize/%zu", size);
+    if (run_single(name, size, op_deserialize, &ctx) < 0) goto done;
+    // Only pointers move through the queue, so once is enough
+    if (size == g_sizes[0] && run_single("queue_push_pop", 0, op_push_pop, &ctx) < 0) goto done;
+    rc = 0;
+
+done:
+    se_packet_queue_free(ctx.queue);
+    se_packet_free(ctx.packet);
+    se_packet_pool_free(ctx.pool);
+    return rc;
+}
+
+// ============================================================================
+// Cross-thread cases
+// ============================================================================
+
+#define BENCH_STOP_FLAG 1u      // Set on the packet that ends a run
+
+typedef struct {
+    se_packet_queue_t* queue;
+    size_t size;
+    uint64_t deadline;
+    pthread_t thread;
+
+    // Consumer results
+    uint64_t ops;
+    uint64_t ns;
+    uint32_t* samples;
+    size_t max_samples;
+    size_t sample_count;
+    int failed;
+} stream_t;
+
+// Allocate, fill and stamp packets as the TUN reader does, until the deadline
+static void* stream_producer(void* arg) {
+    stream_t* s = arg;
+    for (;;) {
+        uint64_t now = now_ns();
+        bool stop = now >= s->deadline;
+        se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_DATA, stop ? BENCH_STOP_FLAG : 0,
+                                            g_payload, s->size);
+        if (!packet) {
+            s->failed = 1;
+            packet = se_packet_new(SE_PACKET_TYPE_DATA, BENCH_STOP_FLAG, NULL, 0);
+            stop = true;
+        }
+        packet->read_ns = now_ns();
+        if (se_packet_queue_push(s->queue, packet, true) < 0) {
+            se_packet_free(packet);
+            s->failed = 1;
+            return NULL;
+        }
+        if (stop) return NULL;
+    }
+}
+
+// Pop, read and free packets as the send thread does, until the stop packet
+static void* stream_consumer(void* arg) {
+    stream_t* s = arg;
+    uint64_t start = now_ns();
+    for (;;) {
+        se_packet_t* packet = se_packet_queue_pop(s->queue, true);
+        if (!packet) {
+            s->failed = 1;
+            break;
+        }
+        uint64_t now = now_ns();
+        if (packet->flags & BENCH_STOP_FLAG) {
+            se_packet_free(packet);
+            break;
+        }
+        if (s->sample_count < s->max_samples) {
+            s->samples[s->sample_count++] = clamp_sample(now - packet->read_ns);
+        }
+        g_sink ^= packet->payload[0] ^ packet->payload[packet->payload_len - 1];
+        se_packet_free(packet);
+        s->ops++;
+    }
+    s->ns = now_ns() - start;
+    return NULL;
+}
+
+// pairs producer/consumer pairs, one queue of queue_size each
+static int run_streams(const char* name, size_t size, size_t queue_size, int pairs) {
+    stream_t streams[BENCH_MAX_PAIRS];
+    pthread_t producers[BENCH_MAX_PAIRS];
+    uint64_t deadline = now_ns() + (uint64_t)g_duration_ms * 1000000ull;
+    int rc = 0;
+
+    memset(streams, 0, sizeof(streams));
+    for (int i = 0; i < pairs; i++) {
+        stream_t* s = &streams[i];
+        s->queue = se_packet_queue_new(queue_size);
+        if (!s->queue) return -1;
+        s->size = size;
+        s->deadline = deadline;
+        s->max_samples = BENCH_MAX_SAMPLES / (size_t)pairs;
+        s->samples = g_samples + (size_t)i * s->max_samples;
+    }
+
+    for (int i = 0; i < pairs; i++) {
+        pthread_create(&streams[i].thread, NULL, stream_consumer, &streams[i]);
+        pthread_create(&producers[i], NULL, stream_producer, &streams[i]);
+    }
+
+    uint64_t ops = 0;
+    uint64_t ns = 0;
+    size_t sample_count = 0;
+    for (int i = 0; i < pairs; i++) {
+        stream_t* s = &streams[i];
+        pthread_join(producers[i], NULL);
+        pthread_join(s->thread, NULL);
+        se_packet_queue_free(s->queue);
+        if (s->failed) rc = -1;
+
+        ops += s->ops;
+        if (s->ns > ns) ns = s->ns;
+        // Compact the per-pair slices for the percentiles
+        memmove(g_samples + sample_count, s->samples, s->sample_count * sizeof(g_samples[0]));
+        sample_count += s->sample_count;
+    }
+
+    if (rc < 0) {
+        fprintf(stderr, "%s failed at %zu bytes\n", name, size);
+        return -1;
+    }
+    add_result(name, pairs * 2, size, ops, ns, g_samples, sample_count);
+    return 0;
+}
+
+typedef struct {
+    se_packet_queue_t* to_echo;
+    se_packet_queue_t* from_echo;
+} ping_pong_t;
+
+static void* echo_thread(void* arg) {
+    ping_pong_t* pp = arg;
+    for (;;) {
+        se_packet_t* packet = se_packet_queue_pop(pp->to_echo, true);
+        if (!packet) return NULL;
+        bool stop = (packet->flags & BENCH_STOP_FLAG) != 0;
+        g_sink ^= packet->payload[0] ^ packet->payload[packet->payload_len - 1];
+        se_packet_queue_push(pp->from_echo, packet, true);
+        if (stop) return NULL;
+    }
+}
+
+// One packet in flight; half the round trip is the one-way handoff
+static int run_ping_pong(const char* name, size_t size) {
+    ping_pong_t pp;
+    pp.to_echo = se_packet_queue_new(BENCH_QUEUE_SIZE);
+    pp.from_echo = se_packet_queue_new(BENCH_QUEUE_SIZE);
+    se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_DATA, 0, g_payload, size);
+    int rc = -1;
+    if (!pp.to_echo || !pp.from_echo || !packet) goto done;
+
+    pthread_t echo;
+    pthread_create(&echo, NULL, echo_thread, &pp);
+
+    size_t sample_count = 0;
+    uint64_t ops = 0;
+    uint64_t start = now_ns();
+    uint64_t deadline = start + (uint64_t)g_duration_ms * 1000000ull;
+    uint64_t end = start;
+    bool ok = true;
+
+    while (ok) {
+        bool stop = end >= deadline;
+        if (stop) packet->flags = BENCH_STOP_FLAG;
+
+        uint64_t sent = end;
+        ok = se_packet_queue_push(pp.to_echo, packet, true) == 0 &&
+             se_packet_queue_pop(pp.from_echo, true) == packet;
+        end = now_ns();
+        if (stop) break;
+
+        ops++;
+        if (sample_count < BENCH_MAX_SAMPLES) {
+            g_samples[sample_count++] = clamp_sample((end - sent) / 2);
+        }
+    }
+    pthread_join(echo, NULL);
+
+    if (!ok) {
+        fprintf(stderr, "%s failed at %zu bytes\n", name, size);
+        goto done;
+    }
+    add_result(name, 2, size, ops, end - start, g_samples, sample_count);
+    rc = 0;
+
+done:
+    se_packet_free(packet);
+    se_packet_queue_free(pp.to_echo);
+    se_packet_queue_free(pp.from_echo);
+    return rc;
+}
+
+static int bench_cross_thread(size_t size) {
+    char name[BENCH_NAME_MAX];
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int pairs = cpus >= 2 * BENCH_MAX_PAIRS ? BENCH_MAX_PAIRS : (int)(cpus / 2);
+    if (pairs < 2) pairs = 2;
+
+    snprintf(name, sizeof(name), "queue_stream/%zu", size);
+    if (run_streams(name, size, BENCH_QUEUE_SIZE, 1) < 0) return -1;
+    snprintf(name, sizeof(name), "queue_ping_pong/%zu", size);
+    if (run_ping_pong(name, size) < 0) return -1;
+    snprintf(name, sizeof(name), "queue_parking/%zu", size);
+    if (run_streams(name, size, BENCH_PARKING_SIZE, 1) < 0) return -1;
+    snprintf(name, sizeof(name), "queue_pairs/%zu", size);
+    if (run_streams(name, size, BENCH_QUEUE_SIZE, pairs) < 0) return -1;
+    return 0;
+}
+
+// ============================================================================
+// Output
+// ============================================================================
+
+static double ns_per_op(const bench_result_t* r) {
+    return r->ops > 0 ? (double)r->ns / (double)r->ops : 0.0;
+}
+
+static double mb_per_s(const bench_result_t* r) {
+    return r->ns > 0 ? (double)r->ops * (double)r->payload / ((double)r->ns / 1e9) / 1e6 : 0.0;
+}
+
+static void print_json(void) {
+    printf("{\n");
+    printf("  \"benchmark\": \"softether-packet-bench\",\n");
+    printf("  \"version\": 1,\n");
+    printf("  \"duration_ms\": %d,\n", g_duration_ms);
+    printf("  \"results\": [\n");
+    for (int i = 0; i < g_result_count; i++) {
+        const bench_result_t* r = &g_results[i];
+        printf("    {\"name\": \"%s\", \"threads\": %d, \"payload\": %zu, \"ops\": %llu, "
+               "\"ns_per_op\": %.2f, \"mops_per_s\": %.3f, \"mb_per_s\": %.1f, "
+               "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu}%s\n",
+               r->name, r->threads, r->payload, (unsigned long long)r->ops,
+               ns_per_op(r), r->ns > 0 ? (double)r->ops / ((double)r->ns / 1e3) : 0.0, mb_per_s(r),
+               (unsigned long long)r->p50_ns, (unsigned long long)r->p99_ns,
+               (unsigned long long)r->p999_ns, i + 1 < g_result_count ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+}
+
+// ns_per_op of name in a file print_json wrote, or -1
+static double baseline_ns_per_op(FILE* baseline, const char* name) {
+    char line[512];
+    char key[BENCH_NAME_MAX + 16];
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+
+    rewind(baseline);
+    while (fgets(line, sizeof(line), baseline)) {
+        if (!strstr(line, key)) continue;
+        const char* field = strstr(line, "\"ns_per_op\": ");
+        return field ? atof(field + strlen("\"ns_per_op\": ")) : -1;
+    }
+    return -1;
+}
+
+static void print_table(FILE* baseline) {
+    fprintf(stderr, "%-30s %7s %10s %10s %9s %9s %9s", "case", "threads", "ns/op", "MB/s",
+            "p50 ns", "p99 ns", "p99.9 ns");
+    fprintf(stderr, baseline ? " %10s %8s\n" : "\n", "base ns/op", "change");
+
+    for (int i = 0; i < g_result_count; i++) {
+        const bench_result_t* r = &g_results[i];
+        fprintf(stderr, "%-30s %7d %10.1f %10.1f %9llu %9llu %9llu", r->name, r->threads,
+                ns_per_op(r), mb_per_s(r), (unsigned long long)r->p50_ns,
+                (unsigned long long)r->p99_ns, (unsigned long long)r->p999_ns);
+        if (!baseline) {
+            fprintf(stderr, "\n");
+            continue;
+        }
+        double base = baseline_ns_per_op(baseline, r->name);
+        if (base > 0) {
+            fprintf(stderr, " %10.1f %+7.1f%%\n", base, (ns_per_op(r) - base) / base * 100.0);
+        } else {
+            fprintf(stderr, " %10s %8s\n", "-", "new");
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* baseline_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:c:")) != -1) {
+        switch (opt) {
+            case 'm':
+                g_duration_ms = atoi(optarg);
+                if (g_duration_ms <= 0) g_duration_ms = BENCH_DEFAULT_MS;
+                break;
+            case 'c':
+                baseline_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-m milliseconds per case] [-c baseline.json]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    FILE* baseline = NULL;
+    if (baseline_path && !(baseline = fopen(baseline_path, "r"))) {
+        perror(baseline_path);
+        return 2;
+    }
+
+    for (size_t i = 0; i < sizeof(g_payload); i++) g_payload[i] = (uint8_t)(i * 31);
+
+    for (size_t z = 0; z < SIZE_COUNT; z++) {
+        if (bench_single_thread(g_sizes[z]) < 0) return 1;
+    }
+    for (size_t z = 0; z < SIZE_COUNT; z++) {
+        if (bench_cross_thread(g_sizes[z]) < 0) return 1;
+    }
+
+    print_json();
+    print_table(baseline);
+
+    if (baseline) fclose(baseline);
+    return 0;
+}
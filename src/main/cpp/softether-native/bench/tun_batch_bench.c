@@ -0,0 +1,196 @@
+/**
+ * SoftEther VPN TUN Batch I/O Benchmark
+ *
+ * Compares the per-packet JNI TUN calls (one crossing per packet, each
+ * taking the client lock, toggling O_NONBLOCK around the read and copying
+ * through a byte[]) with the batched direct-buffer calls built on
+ * softether_tun_batch.h. A SOCK_SEQPACKET socketpair stands in for the TUN
+ * since it keeps packet boundaries the same way. Reports JNI crossings per
+ * MB and the native time each approach spends per MB; the fixed cost of a
+ * crossing itself comes on top and scales with the crossing count. Build
+ * with -DSOFTETHER_BUILD_BENCHMARKS=ON and run:
+ *
+ *   softether-tun-batch-bench [MB per case]
+ */
+
+#include "softether_tun_batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#define BENCH_DEFAULT_MB    64
+#define BENCH_BURST         32          // Packets queued between reads
+#define BENCH_BATCH_BUFFER  65536       // Direct buffer of the batched calls
+#define BENCH_MAX_PACKET    8192        // SE_MAX_PACKET_SIZE of the JNI layer
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t g_java_array[BENCH_MAX_PACKET];     // Stands in for the byte[]
+static uint8_t g_batch[BENCH_BATCH_BUFFER];
+
+typedef struct {
+    uint64_t calls;         // JNI crossings
+    uint64_t bytes;         // Packet bytes moved
+    uint64_t ns;            // Time inside the calls
+} bench_result_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// What one nativeReadPacket call did before the batched variant
+static int per_packet_read(int fd) {
+    pthread_mutex_lock(&g_lock);
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    ssize_t len = read(fd, g_java_array, sizeof(g_java_array));
+    fcntl(fd, F_SETFL, flags);
+    pthread_mutex_unlock(&g_lock);
+    return len > 0 ? (int)len : 0;
+}
+
+// What one nativeWritePacket call does
+static int per_packet_write(int fd, const uint8_t* packet, size_t len) {
+    uint8_t copy[BENCH_MAX_PACKET];
+    memcpy(copy, packet, len);      // GetByteArrayElements copy
+    pthread_mutex_lock(&g_lock);
+    ssize_t written = write(fd, copy, len);
+    pthread_mutex_unlock(&g_lock);
+    return written == (ssize_t)len ? (int)len : 0;
+}
+
+// Queue up to count packets on fd; returns how many fit
+static int feed(int fd, const uint8_t* packet, size_t len, int count) {
+    int fed = 0;
+    while (fed < count && write(fd, packet, len) == (ssize_t)len) fed++;
+    return fed;
+}
+
+static void drain(int fd) {
+    while (read(fd, g_java_array, sizeof(g_java_array)) > 0) {}
+}
+
+// TUN to Java: packets arrive in bursts, the reader empties the TUN
+static void bench_read(int tun, int peer, size_t packet_len, uint64_t total, bool batched,
+                       bench_result_t* result) {
+    uint8_t packet[BENCH_MAX_PACKET];
+    memset(packet, 0x45, packet_len);
+    memset(result, 0, sizeof(*result));
+
+    while (result->bytes < total) {
+        if (feed(peer, packet, packet_len, BENCH_BURST) == 0) break;
+
+        uint64_t t0 = now_ns();
+        for (;;) {
+            result->calls++;
+            int packets = 0;
+            int n = batched
+                ? se_tun_read_batch(tun, g_batch, sizeof(g_batch), BENCH_MAX_PACKET, &packets)
+                : per_packet_read(tun);
+            if (n <= 0) break;
+            result->bytes += batched ? (uint64_t)(n - packets * SE_TUN_BATCH_PREFIX) : (uint64_t)n;
+        }
+        result->ns += now_ns() - t0;
+    }
+}
+
+// Java to TUN: the writer hands over a burst, the peer side drains it
+static void bench_write(int tun, int peer, size_t packet_len, uint64_t total, bool batched,
+                        bench_result_t* result) {
+    uint8_t packet[BENCH_MAX_PACKET];
+    memset(packet, 0x45, packet_len);
+    memset(result, 0, sizeof(*result));
+
+    // Length-prefixed burst for the batched call
+    size_t batch_len = 0;
+    for (int i = 0; i < BENCH_BURST; i++) {
+        g_batch[batch_len] = (uint8_t)(packet_len >> 8);
+        g_batch[batch_len + 1] = (uint8_t)packet_len;
+        memcpy(g_batch + batch_len + SE_TUN_BATCH_PREFIX, packet, packet_len);
+        batch_len += SE_TUN_BATCH_PREFIX + packet_len;
+    }
+
+    while (result->bytes < total) {
+        uint64_t t0 = now_ns();
+        if (batched) {
+            size_t offset = 0;
+            while (offset < batch_len) {
+                result->calls++;
+                int packets = 0;
+                int n = se_tun_write_batch(tun, g_batch + offset, batch_len - offset, &packets);
+                if (n <= 0) break;
+                offset += (size_t)n;
+                result->bytes += (uint64_t)(n - packets * SE_TUN_BATCH_PREFIX);
+            }
+        } else {
+            for (int i = 0; i < BENCH_BURST; i++) {
+                result->calls++;
+                int n = per_packet_write(tun, packet, packet_len);
+                if (n <= 0) break;
+                result->bytes += (uint64_t)n;
+            }
+        }
+        result->ns += now_ns() - t0;
+
+        drain(peer);
+    }
+}
+
+static void print_result(const char* direction, size_t packet_len, const char* mode,
+                         const bench_result_t* r) {
+    double mb = (double)r->bytes / (1024.0 * 1024.0);
+    printf("%-10s %6zu %-10s %12.1f %12.1f %10.1f\n", direction, packet_len, mode,
+           mb > 0 ? (double)r->calls / mb : 0.0,
+           mb > 0 ? (double)r->ns / 1000.0 / mb : 0.0,
+           r->ns > 0 ? mb / ((double)r->ns / 1e9) : 0.0);
+}
+
+int main(int argc, char** argv) {
+    int total_mb = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_MB;
+    if (total_mb <= 0) total_mb = BENCH_DEFAULT_MB;
+    uint64_t total = (uint64_t)total_mb * 1024 * 1024;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0) {
+        perror("socketpair");
+        return 1;
+    }
+    int buffer_size = 1 << 20;
+    for (int i = 0; i < 2; i++) {
+        setsockopt(fds[i], SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+        setsockopt(fds[i], SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL, 0) | O_NONBLOCK);
+    }
+    int tun = fds[0];
+    int peer = fds[1];
+
+    static const size_t sizes[] = { 1400, 100 };
+
+    printf("%-10s %6s %-10s %12s %12s %10s\n", "direction", "bytes", "mode", "calls/MB", "us/MB", "MB/s");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        bench_result_t result;
+
+        bench_read(tun, peer, sizes[s], total, false, &result);
+        print_result("tun->java", sizes[s], "per-packet", &result);
+        bench_read(tun, peer, sizes[s], total, true, &result);
+        print_result("tun->java", sizes[s], "batched", &result);
+
+        bench_write(tun, peer, sizes[s], total, false, &result);
+        print_result("java->tun", sizes[s], "per-packet", &result);
+        bench_write(tun, peer, sizes[s], total, true, &result);
+        print_result("java->tun", sizes[s], "batched", &result);
+    }
+
+    close(tun);
+    close(peer);
+    return 0;
+}
@@ -0,0 +1,161 @@
+/**
+ * SoftEther VPN Cipher Suite Selection
+ *
+ * AES-GCM is only fast with AES and carry-less multiply instructions;
+ * without them (older arm64 cores, some emulators) ChaCha20-Poly1305 is
+ * several times faster. The instructions only help if the linked OpenSSL
+ * has its assembly paths (build-openssl.sh builds some ABIs with no-asm),
+ * so on capable CPUs a short probe times both AEADs before AES-GCM is
+ * offered first. bench/crypto_bench.c measures both in depth.
+ */
+
+#include "softether_cipher.h"
+#include "softether_log.h"
+
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <openssl/evp.h>
+
+#if defined(__aarch64__) || defined(__arm__)
+#include <sys/auxv.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#define LOG_TAG "SoftEtherCipher"
+#define LOGD(...) se_log_print(SE_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) se_log_print(SE_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+// Linux hwcap bits, spelled out so older headers are not a problem
+#define SE_ARM64_HWCAP_AES      (1ul << 3)
+#define SE_ARM64_HWCAP_PMULL    (1ul << 4)
+#define SE_ARM_HWCAP2_AES       (1ul << 0)
+#define SE_ARM_HWCAP2_PMULL     (1ul << 1)
+
+// Only AEAD suites the kernel can also offload are listed explicitly;
+// the TLS 1.2 tail keeps older servers reachable.
+#define SE_TLS13_AES_FIRST \
+    "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256"
+#define SE_TLS13_CHACHA_FIRST \
+    "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384"
+
+#define SE_TLS12_AES_GCM \
+    "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:" \
+    "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384"
+#define SE_TLS12_CHACHA \
+    "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305"
+#define SE_TLS12_TAIL \
+    "HIGH:!aNULL:!eNULL:!MD5:!RC4:!3DES"
+
+#define SE_TLS12_AES_FIRST      SE_TLS12_AES_GCM ":" SE_TLS12_CHACHA ":" SE_TLS12_TAIL
+#define SE_TLS12_CHACHA_FIRST   SE_TLS12_CHACHA ":" SE_TLS12_AES_GCM ":" SE_TLS12_TAIL
+
+#define SE_PROBE_BUFFER_SIZE    4096
+#define SE_PROBE_ROUNDS         4
+
+static unsigned int g_cpu_features = 0;
+static pthread_once_t g_cpu_once = PTHREAD_ONCE_INIT;
+static bool g_prefer_aes_gcm = false;
+static pthread_once_t g_prefer_once = PTHREAD_ONCE_INIT;
+
+static void cpu_detect(void) {
+    unsigned int features = 0;
+
+#if defined(__aarch64__)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    if (hwcap & SE_ARM64_HWCAP_AES) features |= SE_CPU_AES;
+    if (hwcap & SE_ARM64_HWCAP_PMULL) features |= SE_CPU_PMULL;
+#elif defined(__arm__)
+    unsigned long hwcap2 = getauxval(AT_HWCAP2);
+    if (hwcap2 & SE_ARM_HWCAP2_AES) features |= SE_CPU_AES;
+    if (hwcap2 & SE_ARM_HWCAP2_PMULL) features |= SE_CPU_PMULL;
+#elif defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        if (ecx & bit_AES) features |= SE_CPU_AES;
+        if (ecx & bit_PCLMUL) features |= SE_CPU_PMULL;
+    }
+#endif
+
+    g_cpu_features = features;
+
+    LOGD("CPU crypto features: aes=%d pmull=%d",
+         (features & SE_CPU_AES) != 0, (features & SE_CPU_PMULL) != 0);
+}
+
+unsigned int se_cipher_cpu_features(void) {
+    pthread_once(&g_cpu_once, cpu_detect);
+    return g_cpu_features;
+}
+
+static uint64_t probe_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Best time to seal one buffer with cipher, or UINT64_MAX if it failed
+static uint64_t probe_seal_ns(const EVP_CIPHER* cipher) {
+    static const uint8_t key[32];
+    static const uint8_t iv[12];
+    static uint8_t in[SE_PROBE_BUFFER_SIZE];
+    static uint8_t out[SE_PROBE_BUFFER_SIZE];
+    uint64_t best = UINT64_MAX;
+
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) return best;
+
+    for (int round = 0; round < SE_PROBE_ROUNDS; round++) {
+        int len = 0;
+        uint64_t start = probe_time_ns();
+        if (EVP_EncryptInit_ex(ctx, cipher, NULL, key, iv) != 1 ||
+            EVP_EncryptUpdate(ctx, out, &len, in, sizeof(in)) != 1 ||
+            EVP_EncryptFinal_ex(ctx, out + len, &len) != 1) break;
+        uint64_t elapsed = probe_time_ns() - start;
+        if (elapsed < best) best = elapsed;
+    }
+
+    EVP_CIPHER_CTX_free(ctx);
+    return best;
+}
+
+static void prefer_detect(void) {
+    unsigned int required = SE_CPU_AES | SE_CPU_PMULL;
+    if ((se_cipher_cpu_features() & required) != required) return;
+
+    // The CPU can do it; check this OpenSSL actually does
+    uint64_t aes_ns = probe_seal_ns(EVP_aes_128_gcm());
+    uint64_t chacha_ns = probe_seal_ns(EVP_chacha20_poly1305());
+    g_prefer_aes_gcm = aes_ns <= chacha_ns;
+
+    LOGD("Cipher probe: AES-GCM %llu ns, ChaCha20-Poly1305 %llu ns per %d bytes",
+         (unsigned long long)aes_ns, (unsigned long long)chacha_ns, SE_PROBE_BUFFER_SIZE);
+}
+
+bool se_cipher_prefer_aes_gcm(void) {
+    pthread_once(&g_prefer_once, prefer_detect);
+    return g_prefer_aes_gcm;
+}
+
+const char* se_cipher_tls13_suites(void) {
+    return se_cipher_prefer_aes_gcm() ? SE_TLS13_AES_FIRST : SE_TLS13_CHACHA_FIRST;
+}
+
+const char* se_cipher_tls12_list(void) {
+    return se_cipher_prefer_aes_gcm() ? SE_TLS12_AES_FIRST : SE_TLS12_CHACHA_FIRST;
+}
+
+int se_cipher_setup_ctx(SSL_CTX* ssl_ctx) {
+    LOGD("Offering %s first", se_cipher_prefer_aes_gcm() ? "AES-GCM" : "ChaCha20-Poly1305");
+
+    int ok13 = SSL_CTX_set_ciphersuites(ssl_ctx, se_cipher_tls13_suites());
+    int ok12 = SSL_CTX_set_cipher_list(ssl_ctx, se_cipher_tls12_list());
+
+    if (!ok13 || !ok12) {
+        LOGE("Cipher preference rejected (tls1.3=%d, tls1.2=%d), keeping OpenSSL defaults", ok13, ok12);
+    }
+
+    return (ok13 || ok12) ? 0 : -1;
+}
@@ -0,0 +1,51 @@
+/**
+ * SoftEther VPN Cipher Suite Selection - Internal Header
+ *
+ * Orders the offered TLS cipher suites by what the current CPU runs
+ * fastest. Used by ssl_context_new() and by the crypto benchmark.
+ */
+
+#ifndef SOFTETHER_CIPHER_H
+#define SOFTETHER_CIPHER_H
+
+#include <stdbool.h>
+#include <openssl/ssl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// CPU features that matter for AES-GCM
+#define SE_CPU_AES      (1u << 0)   // AES instructions (ARMv8 CE, AES-NI)
+#define SE_CPU_PMULL    (1u << 1)   // Carry-less multiply for GHASH (PMULL, PCLMULQDQ)
+
+/**
+ * Detect crypto-relevant CPU features once per process.
+ * Returns a mask of SE_CPU_* flags.
+ */
+unsigned int se_cipher_cpu_features(void);
+
+/**
+ * True when AES-GCM should be offered ahead of ChaCha20-Poly1305: the CPU
+ * has AES and carry-less multiply, and a one-time probe shows the linked
+ * OpenSSL seals faster with AES-GCM (it does not without its asm paths).
+ */
+bool se_cipher_prefer_aes_gcm(void);
+
+/**
+ * TLS 1.3 cipher suites and TLS 1.2 cipher list in preference order.
+ */
+const char* se_cipher_tls13_suites(void);
+const char* se_cipher_tls12_list(void);
+
+/**
+ * Apply the preference order to an SSL_CTX.
+ * Returns 0 on success, -1 if OpenSSL rejected both lists.
+ */
+int se_cipher_setup_ctx(SSL_CTX* ssl_ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOFTETHER_CIPHER_H
@@ -0,0 +1,526 @@
+/**
+ * SoftEther VPN Data Compression
+ *
+ * zlib and LZ4-style streaming compressors for DATA payloads, plus the
+ * cheap test that keeps already-compressed traffic (TLS, QUIC, SSH, media)
+ * away from them.
+ */
+
+#include "softether_compress.h"
+#include "softether_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <zlib.h>
+
+#define LOG_TAG "SoftEtherCompress"
+#define LOGD(...) se_log_print(SE_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) se_log_print(SE_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+// LZ window: 64 KB of history plus room for the packet being coded. Both
+// sides slide it at the same point, after a packet has been committed.
+#define LZ_HISTORY_SIZE     65536
+#define LZ_WINDOW_SIZE      (2 * LZ_HISTORY_SIZE)
+#define LZ_MAX_OFFSET       65535
+#define LZ_MIN_MATCH        4
+#define LZ_HASH_BITS        12
+#define LZ_HASH_SIZE        (1 << LZ_HASH_BITS)
+#define LZ_NO_POSITION      UINT32_MAX
+#define LZ_HEADER_SIZE      2       // Uncompressed length, big endian
+
+// Compressed payload buffer, with room for the zlib flush marker
+#define OUT_BUFFER_SIZE     (SE_COMPRESS_MAX_INPUT + SE_COMPRESS_MAX_EXPANSION + 64)
+
+// Entropy test: a sample with more distinct byte values than this share
+// of its length looks random (128 random bytes have about 79% distinct)
+#define SAMPLE_SIZE             128
+#define SAMPLE_MIN              32
+#define SAMPLE_DISTINCT_PERCENT 70
+
+struct se_compressor {
+    int algorithm;
+    bool decompress;
+
+    // SE_COMPRESS_ZLIB
+    z_stream zs;
+    bool zs_ready;
+
+    // SE_COMPRESS_LZ
+    uint8_t* window;
+    uint32_t window_end;
+    uint32_t* hash;                 // Compressor only
+
+    uint8_t* out;                   // Compressed payload, or zlib output
+    uint8_t* scratch;               // Joined input of a split LZ payload
+
+    // Counters, updated with relaxed atomics
+    uint64_t packets_in;
+    uint64_t packets_compressed;
+    uint64_t packets_skipped;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t elapsed_ns;
+};
+
+static uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void counter_add(uint64_t* counter, uint64_t value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static uint64_t counter_get(const uint64_t* counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// ============================================================================
+// Incompressible Traffic
+// ============================================================================
+
+static bool encrypted_port(uint16_t port) {
+    switch (port) {
+        case 22:    // SSH
+        case 443:   // HTTPS, QUIC
+        case 465:   // SMTPS
+        case 853:   // DNS over TLS/QUIC
+        case 993:   // IMAPS
+        case 995:   // POP3S
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool se_compress_worthwhile(const uint8_t* packet, size_t len) {
+    if (len < SE_COMPRESS_MIN_INPUT || len > SE_COMPRESS_MAX_INPUT) return false;
+
+    size_t l4 = 0;
+    uint8_t protocol = 0;
+    switch (packet[0] >> 4) {
+        case 4:
+            l4 = (size_t)(packet[0] & 0x0F) * 4;
+            protocol = packet[9];
+            break;
+        case 6:
+            l4 = 40;
+            protocol = packet[6];
+            break;
+        default:
+            return true;
+    }
+
+    size_t payload = l4;
+    if (protocol == 6 && l4 + 20 <= len) {              // TCP
+        payload = l4 + (size_t)(packet[l4 + 12] >> 4) * 4;
+    } else if (protocol == 17 && l4 + 8 <= len) {       // UDP
+        payload = l4 + 8;
+    }
+    if (payload != l4) {
+        uint16_t src = (uint16_t)((packet[l4] << 8) | packet[l4 + 1]);
+        uint16_t dst = (uint16_t)((packet[l4 + 2] << 8) | packet[l4 + 3]);
+        if (encrypted_port(src) || encrypted_port(dst)) return false;
+    }
+    if (payload >= len || len - payload < SAMPLE_MIN) return true;
+
+    size_t sample = len - payload < SAMPLE_SIZE ? len - payload : SAMPLE_SIZE;
+    uint64_t seen[4] = {0, 0, 0, 0};
+    size_t distinct = 0;
+    for (size_t i = 0; i < sample; i++) {
+        uint8_t b = packet[payload + i];
+        uint64_t bit = 1ULL << (b & 63);
+        if (!(seen[b >> 6] & bit)) {
+            seen[b >> 6] |= bit;
+            distinct++;
+        }
+    }
+    return distinct * 100 <= sample * SAMPLE_DISTINCT_PERCENT;
+}
+
+// ============================================================================
+// zlib
+// ============================================================================
+
+static const uint8_t zlib_flush_marker[4] = {0x00, 0x00, 0xFF, 0xFF};
+
+static int zlib_compress(se_compressor_t* c, const uint8_t* packet, size_t len) {
+    c->zs.next_in = (Bytef*)packet;
+    c->zs.avail_in = (uInt)len;
+    c->zs.next_out = c->out;
+    c->zs.avail_out = OUT_BUFFER_SIZE;
+
+    if (deflate(&c->zs, Z_SYNC_FLUSH) != Z_OK || c->zs.avail_in != 0 || c->zs.avail_out == 0) {
+        LOGE("deflate failed: %s", c->zs.msg ? c->zs.msg : "output full");
+        return -1;
+    }
+
+    size_t out_len = OUT_BUFFER_SIZE - c->zs.avail_out;
+    if (out_len < sizeof(zlib_flush_marker) ||
+        memcmp(c->out + out_len - sizeof(zlib_flush_marker), zlib_flush_marker, sizeof(zlib_flush_marker)) != 0) {
+        return -1;
+    }
+
+    // The packet is in the deflate history now, so it has to be sent
+    // compressed even in the rare case that this came out larger
+    out_len -= sizeof(zlib_flush_marker);
+    if (out_len > len + SE_COMPRESS_MAX_EXPANSION) return -1;
+    return (int)out_len;
+}
+
+static int zlib_inflate_piece(se_compressor_t* d, const uint8_t* in, size_t len) {
+    d->zs.next_in = (Bytef*)in;
+    d->zs.avail_in = (uInt)len;
+
+    while (d->zs.avail_in > 0) {
+        int ret = inflate(&d->zs, Z_SYNC_FLUSH);
+        if (ret != Z_OK || d->zs.avail_out == 0) return -1;
+    }
+    return 0;
+}
+
+static int zlib_decompress(se_compressor_t* d, const struct iovec* in, int iovcnt) {
+    // One byte spare: a packet that fills the buffer is over the limit
+    d->zs.next_out = d->out;
+    d->zs.avail_out = SE_COMPRESS_MAX_INPUT + 1;
+
+    for (int i = 0; i < iovcnt; i++) {
+        if (zlib_inflate_piece(d, in[i].iov_base, in[i].iov_len) < 0) return -1;
+    }
+    if (zlib_inflate_piece(d, zlib_flush_marker, sizeof(zlib_flush_marker)) < 0) return -1;
+    return (int)(SE_COMPRESS_MAX_INPUT + 1 - d->zs.avail_out);
+}
+
+// ============================================================================
+// LZ
+// ============================================================================
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t lz_hash(uint32_t value) {
+    return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// Drop all but the last LZ_HISTORY_SIZE bytes once the next packet might
+// not fit. Called on both sides after every committed packet.
+static void lz_slide(se_compressor_t* c) {
+    if (c->window_end + SE_COMPRESS_MAX_INPUT <= LZ_WINDOW_SIZE) return;
+
+    uint32_t shift = c->window_end - LZ_HISTORY_SIZE;
+    memmove(c->window, c->window + shift, LZ_HISTORY_SIZE);
+    c->window_end = LZ_HISTORY_SIZE;
+
+    if (c->hash) {
+        for (int i = 0; i < LZ_HASH_SIZE; i++) {
+            uint32_t pos = c->hash[i];
+            c->hash[i] = (pos == LZ_NO_POSITION || pos < shift) ? LZ_NO_POSITION : pos - shift;
+        }
+    }
+}
+
+static uint8_t* lz_put_length(uint8_t* op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+// Emit one sequence; match_len 0 marks the final literals-only sequence.
+// Returns NULL if it would not fit before limit.
+static uint8_t* lz_put_sequence(uint8_t* op, const uint8_t* limit, const uint8_t* literals,
+                                size_t literal_len, uint32_t offset, size_t match_len) {
+    size_t need = 1 + literal_len + literal_len / 255 + 1 + (match_len ? 2 + match_len / 255 + 1 : 0);
+    if (op + need > limit) return NULL;
+
+    uint8_t* token = op++;
+    *token = (uint8_t)((literal_len >= 15 ? 15 : literal_len) << 4);
+    if (literal_len >= 15) op = lz_put_length(op, literal_len - 15);
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+
+    if (match_len) {
+        size_t code = match_len - LZ_MIN_MATCH;
+        *token |= (uint8_t)(code >= 15 ? 15 : code);
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        if (code >= 15) op = lz_put_length(op, code - 15);
+    }
+    return op;
+}
+
+static int lz_compress(se_compressor_t* c, const uint8_t* packet, size_t len) {
+    uint8_t* window = c->window;
+    uint32_t start = c->window_end;
+    uint32_t end = start + (uint32_t)len;
+    memcpy(window + start, packet, len);
+
+    // Output must come out smaller than the packet to be worth sending
+    uint8_t* op = c->out;
+    const uint8_t* limit = c->out + len - 1;
+    *op++ = (uint8_t)(len >> 8);
+    *op++ = (uint8_t)len;
+
+    uint32_t anchor = start;
+    uint32_t pos = start;
+    uint32_t misses = 0;
+    while (pos + LZ_MIN_MATCH <= end) {
+        uint32_t h = lz_hash(read32(window + pos));
+        uint32_t ref = c->hash[h];
+        c->hash[h] = pos;
+
+        // Positions at or past pos were left by a packet that was rolled
+        // back; anything older is committed history or this packet
+        if (ref == LZ_NO_POSITION || ref >= pos || pos - ref > LZ_MAX_OFFSET ||
+            read32(window + ref) != read32(window + pos)) {
+            // Step faster through data that keeps missing
+            pos += 1 + (misses++ >> 5);
+            continue;
+        }
+
+        uint32_t match = LZ_MIN_MATCH;
+        while (pos + match < end && window[ref + match] == window[pos + match]) {
+            match++;
+        }
+
+        op = lz_put_sequence(op, limit, window + anchor, pos - anchor, pos - ref, match);
+        if (!op) return 0;
+        pos += match;
+        anchor = pos;
+        misses = 0;
+    }
+
+    op = lz_put_sequence(op, limit, window + anchor, end - anchor, 0, 0);
+    if (!op) return 0;
+
+    c->window_end = end;
+    lz_slide(c);
+    return (int)(op - c->out);
+}
+
+static int lz_get_length(const uint8_t** ip, const uint8_t* end, size_t* length) {
+    uint8_t b;
+    do {
+        if (*ip >= end) return -1;
+        b = *(*ip)++;
+        *length += b;
+    } while (b == 255);
+    return 0;
+}
+
+static int lz_decompress(se_compressor_t* d, const struct iovec* in, int iovcnt, const uint8_t** out) {
+    const uint8_t* ip;
+    size_t in_len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        in_len += in[i].iov_len;
+    }
+    if (in_len < LZ_HEADER_SIZE + 1 || in_len > SE_COMPRESS_MAX_INPUT) return -1;
+    if (iovcnt == 1) {
+        ip = in[0].iov_base;
+    } else {
+        size_t off = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            memcpy(d->scratch + off, in[i].iov_base, in[i].iov_len);
+            off += in[i].iov_len;
+        }
+        ip = d->scratch;
+    }
+    const uint8_t* ip_end = ip + in_len;
+
+    size_t len = ((size_t)ip[0] << 8) | ip[1];
+    ip += LZ_HEADER_SIZE;
+    if (len == 0 || len > SE_COMPRESS_MAX_INPUT) return -1;
+
+    uint8_t* window = d->window;
+    uint8_t* op = window + d->window_end;
+    uint8_t* op_end = op + len;
+
+    for (;;) {
+        uint8_t token = *ip++;
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && lz_get_length(&ip, ip_end, &literal_len) < 0) return -1;
+        if (literal_len > (size_t)(ip_end - ip) || literal_len > (size_t)(op_end - op)) return -1;
+        memcpy(op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+
+        if (ip == ip_end) break;
+
+        if (ip_end - ip < 2) return -1;
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t match_len = (token & 0x0F);
+        if (match_len == 15 && lz_get_length(&ip, ip_end, &match_len) < 0) return -1;
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - window) || match_len > (size_t)(op_end - op)) return -1;
+
+        // Byte by byte when the match overlaps what it is copying
+        const uint8_t* ref = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, ref, match_len);
+        } else {
+            for (size_t i = 0; i < match_len; i++) {
+                op[i] = ref[i];
+            }
+        }
+        op += match_len;
+
+        if (ip == ip_end) return -1;
+    }
+
+    if (op != op_end) return -1;
+
+    d->window_end += (uint32_t)len;
+    lz_slide(d);
+    *out = window + d->window_end - len;
+    return (int)len;
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+se_compressor_t* se_compressor_new(int algorithm, bool decompress) {
+    if (algorithm != SE_COMPRESS_ZLIB && algorithm != SE_COMPRESS_LZ) return NULL;
+
+    se_compressor_t* c = calloc(1, sizeof(se_compressor_t));
+    if (!c) return NULL;
+    c->algorithm = algorithm;
+    c->decompress = decompress;
+
+    if (algorithm == SE_COMPRESS_ZLIB) {
+        c->out = malloc(OUT_BUFFER_SIZE);
+        if (!c->out) goto fail;
+        // Raw deflate; the 32 KB window is what carries across packets
+        int ret = decompress ? inflateInit2(&c->zs, -MAX_WBITS)
+                             : deflateInit2(&c->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                                            Z_DEFAULT_STRATEGY);
+        if (ret != Z_OK) {
+            LOGE("zlib init failed: %d", ret);
+            goto fail;
+        }
+        c->zs_ready = true;
+    } else {
+        c->window = malloc(LZ_WINDOW_SIZE);
+        if (!c->window) goto fail;
+        if (decompress) {
+            c->scratch = malloc(OUT_BUFFER_SIZE);
+            if (!c->scratch) goto fail;
+        } else {
+            c->out = malloc(OUT_BUFFER_SIZE);
+            c->hash = malloc(LZ_HASH_SIZE * sizeof(uint32_t));
+            if (!c->out || !c->hash) goto fail;
+            for (int i = 0; i < LZ_HASH_SIZE; i++) {
+                c->hash[i] = LZ_NO_POSITION;
+            }
+        }
+    }
+
+    LOGD("%s created: %s", decompress ? "Decompressor" : "Compressor",
+         algorithm == SE_COMPRESS_ZLIB ? "zlib" : "lz");
+    return c;
+
+fail:
+    se_compressor_free(c);
+    return NULL;
+}
+
+void se_compressor_free(se_compressor_t* c) {
+    if (!c) return;
+    if (c->zs_ready) {
+        if (c->decompress) {
+            inflateEnd(&c->zs);
+        } else {
+            deflateEnd(&c->zs);
+        }
+    }
+    free(c->window);
+    free(c->hash);
+    free(c->out);
+    free(c->scratch);
+    free(c);
+}
+
+int se_compress(se_compressor_t* c, const uint8_t* packet, size_t len, const uint8_t** out) {
+    uint64_t started = get_time_ns();
+    int result = 0;
+
+    if (se_compress_worthwhile(packet, len)) {
+        result = c->algorithm == SE_COMPRESS_ZLIB ? zlib_compress(c, packet, len)
+                                                  : lz_compress(c, packet, len);
+    } else {
+        counter_add(&c->packets_skipped, 1);
+    }
+
+    counter_add(&c->packets_in, 1);
+    counter_add(&c->bytes_in, len);
+    if (result > 0) {
+        counter_add(&c->packets_compressed, 1);
+        counter_add(&c->bytes_out, (uint64_t)result);
+        *out = c->out;
+    } else {
+        counter_add(&c->bytes_out, len);
+    }
+    counter_add(&c->elapsed_ns, get_time_ns() - started);
+    return result;
+}
+
+int se_decompress(se_compressor_t* d, const struct iovec* in, int iovcnt, const uint8_t** out) {
+    uint64_t started = get_time_ns();
+    int result;
+
+    if (d->algorithm == SE_COMPRESS_ZLIB) {
+        result = zlib_decompress(d, in, iovcnt);
+        *out = d->out;
+    } else {
+        result = lz_decompress(d, in, iovcnt, out);
+    }
+
+    if (result < 0) {
+        LOGE("Corrupt compressed payload");
+        return -1;
+    }
+
+    for (int i = 0; i < iovcnt; i++) {
+        counter_add(&d->bytes_in, in[i].iov_len);
+    }
+    counter_add(&d->packets_in, 1);
+    counter_add(&d->bytes_out, (uint64_t)result);
+    counter_add(&d->elapsed_ns, get_time_ns() - started);
+    return result;
+}
+
+void se_compressor_add_stats(se_compressor_t* c, se_compress_stats_t* stats) {
+    if (!c) return;
+    if (c->decompress) {
+        stats->recv_bytes_in += counter_get(&c->bytes_in);
+        stats->recv_bytes_out += counter_get(&c->bytes_out);
+        stats->decompress_ns += counter_get(&c->elapsed_ns);
+    } else {
+        stats->packets_in += counter_get(&c->packets_in);
+        stats->packets_compressed += counter_get(&c->packets_compressed);
+        stats->packets_skipped += counter_get(&c->packets_skipped);
+        stats->bytes_in += counter_get(&c->bytes_in);
+        stats->bytes_out += counter_get(&c->bytes_out);
+        stats->compress_ns += counter_get(&c->elapsed_ns);
+    }
+}
+
+void se_compressor_reset_counters(se_compressor_t* c) {
+    if (!c) return;
+    __atomic_store_n(&c->packets_in, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->packets_compressed, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->packets_skipped, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->bytes_in, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->bytes_out, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->elapsed_ns, 0, __ATOMIC_RELAXED);
+}
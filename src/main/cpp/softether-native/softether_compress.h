@@ -0,0 +1,87 @@
+/**
+ * SoftEther VPN Data Compression - Internal Header
+ *
+ * Streaming compression of DATA frame payloads, one compressor per
+ * direction of each TLS connection. Both modes carry state from packet to
+ * packet, so frames must be decompressed in the order they were
+ * compressed; the UDP channel, which may lose or reorder datagrams, is
+ * never compressed.
+ *
+ * SE_COMPRESS_ZLIB: a deflate stream flushed with Z_SYNC_FLUSH after every
+ * packet, with the 00 00 ff ff flush marker stripped (as in RFC 7692).
+ *
+ * SE_COMPRESS_LZ: LZ4-style sequences (token, literals, 16-bit offset)
+ * that may reference the previous 64 KB of compressed packets. The payload
+ * starts with the uncompressed length (2 bytes, big endian).
+ */
+
+#ifndef SOFTETHER_COMPRESS_H
+#define SOFTETHER_COMPRESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "softether_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SE_COMPRESS_MIN_INPUT   128     // Smaller packets are not worth the effort
+#define SE_COMPRESS_MAX_INPUT   16384   // Larger packets are sent as they are
+#define SE_COMPRESS_MAX_EXPANSION 64     // Output never exceeds the input by more than this
+
+/**
+ * One direction of a compressed stream (opaque)
+ */
+typedef struct se_compressor se_compressor_t;
+
+/**
+ * Create a compressor, or a decompressor when decompress is set.
+ * Returns NULL for SE_COMPRESS_NONE, unknown algorithms or no memory.
+ */
+se_compressor_t* se_compressor_new(int algorithm, bool decompress);
+
+void se_compressor_free(se_compressor_t* compressor);
+
+/**
+ * Guess from the IP header and a sample of the payload whether a packet
+ * can shrink: skips small packets, well-known encrypted ports (TLS, QUIC,
+ * SSH) and payloads whose sample has nearly as many distinct bytes as a
+ * random one.
+ */
+bool se_compress_worthwhile(const uint8_t* packet, size_t len);
+
+/**
+ * Compress one packet. On success *out points at the compressed payload
+ * inside the compressor, valid until the next call. LZ output is always
+ * smaller than the packet; zlib output may exceed it by up to
+ * SE_COMPRESS_MAX_EXPANSION bytes.
+ * Returns its length, 0 to send the packet uncompressed, -1 on error.
+ */
+int se_compress(se_compressor_t* compressor, const uint8_t* packet, size_t len, const uint8_t** out);
+
+/**
+ * Decompress one payload, given as up to two pieces (a ring buffer may
+ * split it). On success *out points at the packet inside the
+ * decompressor, valid until the next call.
+ * Returns the packet length, -1 if the payload is corrupt; the stream
+ * cannot continue after an error.
+ */
+int se_decompress(se_compressor_t* decompressor, const struct iovec* in, int iovcnt, const uint8_t** out);
+
+/**
+ * Add the compressor's counters to stats: the send side for a
+ * compressor, the receive side for a decompressor
+ */
+void se_compressor_add_stats(se_compressor_t* compressor, se_compress_stats_t* stats);
+
+void se_compressor_reset_counters(se_compressor_t* compressor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOFTETHER_COMPRESS_H
@@ -0,0 +1,837 @@
+/**
+ * SoftEther VPN DNS Resolver
+ *
+ * Process-wide resolver for server hostnames. Lookups run on a worker
+ * thread, answers are cached for their DNS TTL (NXDOMAIN is cached, and
+ * failures are held briefly and reported as errors), and entries that were
+ * used recently are refreshed shortly before they expire so reconnects
+ * find a fresh answer. Queries carry random IDs and a response only counts
+ * if it echoes the question that was asked.
+ *
+ * A and AAAA queries are sent in parallel to the configured servers (see
+ * se_dns_set_servers), otherwise through Android's android_res_nquery,
+ * otherwise to the servers in /etc/resolv.conf. getaddrinfo is the last
+ * resort and carries no TTL.
+ */
+
+#include "softether_protocol.h"
+#include "softether_dns.h"
+#include "softether_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <dlfcn.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include <openssl/rand.h>
+
+#define LOG_TAG "SoftEtherDns"
+#define LOGD(...) se_log_print(SE_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) se_log_print(SE_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define LOGI(...) se_log_print(SE_LOG_INFO, LOG_TAG, __VA_ARGS__)
+
+// ============================================================================
+// Internal Structures
+// ============================================================================
+
+#define SE_DNS_CACHE_SIZE           16
+#define SE_DNS_MAX_ADDRS            SE_MAX_CONNECT_ATTEMPTS
+#define SE_DNS_MAX_SERVERS          3
+#define SE_DNS_QUERY_TIMEOUT_MS     2000    // Per server
+#define SE_DNS_MIN_TTL_MS           5000
+#define SE_DNS_MAX_TTL_MS           3600000 // Notice a moved server within the hour
+#define SE_DNS_DEFAULT_TTL_MS       60000   // getaddrinfo answers carry no TTL
+#define SE_DNS_NEGATIVE_TTL_MS      30000   // NXDOMAIN/NODATA without an SOA
+#define SE_DNS_MAX_NEGATIVE_TTL_MS  300000  // Cap on the SOA's negative TTL
+#define SE_DNS_FAILURE_TTL_MS       5000    // Timeouts and server failures
+#define SE_DNS_HOT_MS               600000  // Used this recently: refresh before expiry
+#define SE_DNS_MAX_MESSAGE          1232
+
+#define SE_DNS_TYPE_A               1
+#define SE_DNS_TYPE_AAAA            28
+#define SE_DNS_TYPE_SOA             6
+#define SE_DNS_CLASS_IN             1
+#define SE_DNS_RCODE_NXDOMAIN       3
+
+// Lookup outcome
+#define SE_DNS_OK                   0
+#define SE_DNS_NEGATIVE             1   // Name or addresses do not exist
+#define SE_DNS_FAILED               2   // No usable answer (timeout, SERVFAIL)
+
+typedef struct {
+    int status;
+    struct sockaddr_storage addrs[SE_DNS_MAX_ADDRS];
+    int count;
+    uint64_t ttl_ms;
+} se_dns_result_t;
+
+typedef struct {
+    char host[SE_MAX_HOSTNAME_LEN];
+    se_dns_result_t result;
+    bool valid;                  // result holds an answer
+    bool requested;              // A caller is waiting for a lookup
+    bool in_flight;              // The worker is resolving this entry
+    uint64_t expires_ms;
+    uint64_t refresh_ms;         // When a hot entry is refreshed
+    uint64_t last_used_ms;
+} se_dns_entry_t;
+
+// android_res_nquery()/android_res_nresult(), API 29+, looked up at runtime
+typedef int (*se_res_nquery_fn)(uint64_t network, const char* dname, int ns_class, int ns_type, uint32_t flags);
+typedef int (*se_res_nresult_fn)(int fd, int* rcode, uint8_t* answer, size_t anslen);
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;         // Signals the worker
+    pthread_cond_t done;         // Signals waiting callers
+    se_dns_entry_t entries[SE_DNS_CACHE_SIZE];
+    struct sockaddr_storage servers[SE_DNS_MAX_SERVERS];
+    int server_count;
+    se_dns_stats_t stats;
+    se_res_nquery_fn res_nquery;
+    se_res_nresult_fn res_nresult;
+    int notify_fd;               // eventfd written when a lookup finishes
+} g_dns = { .lock = PTHREAD_MUTEX_INITIALIZER, .notify_fd = -1 };
+
+static pthread_once_t g_dns_once = PTHREAD_ONCE_INIT;
+static bool g_dns_started = false;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static uint64_t dns_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void dns_deadline(struct timespec* ts, uint64_t delay_ms) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += delay_ms / 1000;
+    ts->tv_nsec += (delay_ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static uint64_t clamp_ttl(uint64_t ttl_ms, uint64_t max_ms) {
+    if (ttl_ms < SE_DNS_MIN_TTL_MS) return SE_DNS_MIN_TTL_MS;
+    if (ttl_ms > max_ms) return max_ms;
+    return ttl_ms;
+}
+
+// Parse "ip[:port]" or "[ipv6]:port"
+static int parse_server(const char* spec, struct sockaddr_storage* out) {
+    char host[64];
+    int port = 53;
+
+    memset(out, 0, sizeof(*out));
+
+    if (spec[0] == '[') {
+        const char* end = strchr(spec, ']');
+        if (!end || (size_t)(end - spec - 1) >= sizeof(host)) return -1;
+        memcpy(host, spec + 1, end - spec - 1);
+        host[end - spec - 1] = '\0';
+        if (end[1] == ':') port = atoi(end + 2);
+    } else {
+        snprintf(host, sizeof(host), "%s", spec);
+        char* colon = strchr(host, ':');
+        if (colon && !strchr(colon + 1, ':')) {  // One colon: IPv4 with port
+            *colon = '\0';
+            port = atoi(colon + 1);
+        }
+    }
+
+    if (port <= 0 || port > 65535) return -1;
+
+    struct sockaddr_in* v4 = (struct sockaddr_in*)out;
+    struct sockaddr_in6* v6 = (struct sockaddr_in6*)out;
+    if (inet_pton(AF_INET, host, &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        v4->sin_port = htons(port);
+        return 0;
+    }
+    if (inet_pton(AF_INET6, host, &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        v6->sin6_port = htons(port);
+        return 0;
+    }
+    return -1;
+}
+
+static int load_resolv_conf(struct sockaddr_storage* servers, int max_servers) {
+    FILE* file = fopen("/etc/resolv.conf", "r");
+    if (!file) return 0;
+
+    int count = 0;
+    char line[256];
+    while (count < max_servers && fgets(line, sizeof(line), file)) {
+        char address[64];
+        if (sscanf(line, " nameserver %63s", address) == 1 && parse_server(address, &servers[count]) == 0) {
+            count++;
+        }
+    }
+
+    fclose(file);
+    return count;
+}
+
+static void add_address(se_dns_result_t* result, int family, const uint8_t* data) {
+    if (result->count >= SE_DNS_MAX_ADDRS) return;
+
+    struct sockaddr_storage* addr = &result->addrs[result->count++];
+    memset(addr, 0, sizeof(*addr));
+    if (family == AF_INET) {
+        struct sockaddr_in* v4 = (struct sockaddr_in*)addr;
+        v4->sin_family = AF_INET;
+        memcpy(&v4->sin_addr, data, 4);
+    } else {
+        struct sockaddr_in6* v6 = (struct sockaddr_in6*)addr;
+        v6->sin6_family = AF_INET6;
+        memcpy(&v6->sin6_addr, data, 16);
+    }
+}
+
+// ============================================================================
+// DNS Messages
+// ============================================================================
+
+static int build_query(uint8_t* buffer, size_t buffer_size, uint16_t id, const char* host, int qtype) {
+    size_t host_len = strlen(host);
+    if (host_len == 0 || host_len > 253 || 12 + host_len + 2 + 4 > buffer_size) return -1;
+
+    memset(buffer, 0, 12);
+    buffer[0] = id >> 8;
+    buffer[1] = id & 0xFF;
+    buffer[2] = 0x01;            // RD
+    buffer[5] = 1;               // QDCOUNT
+
+    size_t off = 12;
+    const char* label = host;
+    while (*label) {
+        const char* dot = strchr(label, '.');
+        size_t len = dot ? (size_t)(dot - label) : strlen(label);
+        if (len == 0 || len > 63) {
+            if (!dot || dot[1] != '\0') return -1;  // Only a trailing dot is allowed
+            break;
+        }
+        buffer[off++] = (uint8_t)len;
+        memcpy(buffer + off, label, len);
+        off += len;
+        if (!dot) break;
+        label = dot + 1;
+    }
+    buffer[off++] = 0;
+
+    buffer[off++] = 0;
+    buffer[off++] = (uint8_t)qtype;
+    buffer[off++] = 0;
+    buffer[off++] = SE_DNS_CLASS_IN;
+    return (int)off;
+}
+
+static long skip_name(const uint8_t* msg, size_t len, size_t off) {
+    while (off < len) {
+        uint8_t label = msg[off];
+        if (label == 0) return (long)off + 1;
+        if ((label & 0xC0) == 0xC0) return off + 2 <= len ? (long)off + 2 : -1;
+        if (label & 0xC0) return -1;
+        off += 1 + label;
+    }
+    return -1;
+}
+
+static uint32_t read_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Check that a response echoes the question asked: exactly one, for host
+// (ignoring case and a trailing dot), qtype and class IN. Returns the
+// offset just past it, or -1 when it is some other question.
+static long match_question(const uint8_t* msg, size_t len, const char* host, int qtype) {
+    if (len < 12 || ((msg[4] << 8) | msg[5]) != 1) return -1;
+
+    size_t off = 12;
+    const char* name = host;
+    while (true) {
+        if (off >= len) return -1;
+        uint8_t label = msg[off++];
+        if (label == 0) break;
+        if (label & 0xC0 || off + label > len) return -1;  // Nothing precedes it to point at
+
+        for (uint8_t i = 0; i < label; i++) {
+            if (!name[i] || tolower((unsigned char)name[i]) != tolower(msg[off + i])) return -1;
+        }
+        if (name[label] != '.' && name[label] != '\0') return -1;
+        name += label;
+        if (*name == '.') name++;
+        off += label;
+    }
+    if (*name != '\0' || off + 4 > len) return -1;
+
+    int type = (msg[off] << 8) | msg[off + 1];
+    int qclass = (msg[off + 2] << 8) | msg[off + 3];
+    if (type != qtype || qclass != SE_DNS_CLASS_IN) return -1;
+    return (long)off + 4;
+}
+
+// Parse the answer to one query into result. Returns SE_DNS_OK when
+// addresses were found, SE_DNS_NEGATIVE for NXDOMAIN/NODATA (with the
+// negative TTL from the SOA in *negative_ttl_ms) or SE_DNS_FAILED.
+static int parse_response(const uint8_t* msg, size_t len, const char* host, int qtype,
+                          se_dns_result_t* result, uint64_t* negative_ttl_ms) {
+    if (len < 12 || !(msg[2] & 0x80)) return SE_DNS_FAILED;
+
+    int rcode = msg[3] & 0x0F;
+    int ancount = (msg[6] << 8) | msg[7];
+    int nscount = (msg[8] << 8) | msg[9];
+
+    if (rcode != 0 && rcode != SE_DNS_RCODE_NXDOMAIN) return SE_DNS_FAILED;
+
+    long off = match_question(msg, len, host, qtype);
+    if (off < 0) return SE_DNS_FAILED;
+
+    int found = 0;
+    int family = qtype == SE_DNS_TYPE_A ? AF_INET : AF_INET6;
+    size_t addr_len = qtype == SE_DNS_TYPE_A ? 4 : 16;
+
+    for (int i = 0; i < ancount + nscount; i++) {
+        off = skip_name(msg, len, off);
+        if (off < 0 || (size_t)off + 10 > len) return found ? SE_DNS_OK : SE_DNS_FAILED;
+
+        int type = (msg[off] << 8) | msg[off + 1];
+        int rclass = (msg[off + 2] << 8) | msg[off + 3];
+        uint64_t ttl_ms = (uint64_t)read_be32(msg + off + 4) * 1000;
+        size_t rdlen = ((size_t)msg[off + 8] << 8) | msg[off + 9];
+        off += 10;
+        if ((size_t)off + rdlen > len) return found ? SE_DNS_OK : SE_DNS_FAILED;
+
+        if (i < ancount && type == qtype && rclass == SE_DNS_CLASS_IN && rdlen == addr_len) {
+            add_address(result, family, msg + off);
+            if (ttl_ms < result->ttl_ms) result->ttl_ms = ttl_ms;
+            found++;
+        } else if (i >= ancount && type == SE_DNS_TYPE_SOA && rdlen >= 20) {
+            // RFC 2308: negative TTL is min(SOA TTL, SOA MINIMUM)
+            uint64_t minimum_ms = (uint64_t)read_be32(msg + off + rdlen - 4) * 1000;
+            *negative_ttl_ms = ttl_ms < minimum_ms ? ttl_ms : minimum_ms;
+        }
+        off += rdlen;
+    }
+
+    if (found) return SE_DNS_OK;
+    return SE_DNS_NEGATIVE;  // NXDOMAIN, or the name has no records of this type
+}
+
+// Combine the A and AAAA outcomes into the final result status
+static void finish_result(se_dns_result_t* result, const int status[2], uint64_t negative_ttl_ms) {
+    if (result->count > 0) {
+        result->status = SE_DNS_OK;
+        result->ttl_ms = clamp_ttl(result->ttl_ms, SE_DNS_MAX_TTL_MS);
+    } else if (status[0] == SE_DNS_NEGATIVE && status[1] == SE_DNS_NEGATIVE) {
+        result->status = SE_DNS_NEGATIVE;
+        result->ttl_ms = negative_ttl_ms ? clamp_ttl(negative_ttl_ms, SE_DNS_MAX_NEGATIVE_TTL_MS)
+                                         : SE_DNS_NEGATIVE_TTL_MS;
+    } else {
+        result->status = SE_DNS_FAILED;
+        result->ttl_ms = SE_DNS_FAILURE_TTL_MS;
+    }
+}
+
+// ============================================================================
+// Lookup Backends
+// ============================================================================
+
+// Send A and AAAA queries to one server and wait for both answers
+static bool query_server(const struct sockaddr_storage* server, const char* host, se_dns_result_t* result,
+                         int status[2], uint64_t* negative_ttl_ms) {
+    static const int qtypes[2] = { SE_DNS_TYPE_A, SE_DNS_TYPE_AAAA };
+
+    int fd = socket(server->ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+
+    socklen_t server_len = server->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    if (connect(fd, (const struct sockaddr*)server, server_len) < 0) {
+        close(fd);
+        return false;
+    }
+
+    // Unpredictable IDs, so an off-path spoofer has to guess them
+    uint16_t ids[2];
+    uint8_t buffer[SE_DNS_MAX_MESSAGE];
+    bool answered[2] = { false, false };
+
+    if (RAND_bytes((uint8_t*)ids, sizeof(ids)) != 1) {
+        close(fd);
+        return false;
+    }
+    if (ids[1] == ids[0]) ids[1] ^= 1;
+
+    for (int i = 0; i < 2; i++) {
+        int len = build_query(buffer, sizeof(buffer), ids[i], host, qtypes[i]);
+        if (len < 0 || send(fd, buffer, len, 0) < 0) {
+            close(fd);
+            return false;
+        }
+    }
+
+    uint64_t deadline = dns_time_ms() + SE_DNS_QUERY_TIMEOUT_MS;
+    while (!answered[0] || !answered[1]) {
+        uint64_t now = dns_time_ms();
+        if (now >= deadline) break;
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, (int)(deadline - now)) <= 0) continue;
+
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 12) continue;
+
+        // Anything for another question is not our answer; keep waiting
+        uint16_t id = (uint16_t)((buffer[0] << 8) | buffer[1]);
+        for (int i = 0; i < 2; i++) {
+            if (id == ids[i] && !answered[i] && match_question(buffer, (size_t)n, host, qtypes[i]) >= 0) {
+                status[i] = parse_response(buffer, (size_t)n, host, qtypes[i], result, negative_ttl_ms);
+                answered[i] = true;
+            }
+        }
+    }
+
+    close(fd);
+
+    // One family answering is enough to connect; a silent server is not
+    return answered[0] || answered[1];
+}
+
+static bool lookup_servers(const struct sockaddr_storage* servers, int server_count, const char* host,
+                           se_dns_result_t* result, int status[2], uint64_t* negative_ttl_ms) {
+    for (int i = 0; i < server_count; i++) {
+        status[0] = status[1] = SE_DNS_FAILED;
+        if (query_server(&servers[i], host, result, status, negative_ttl_ms) &&
+            (status[0] != SE_DNS_FAILED || status[1] != SE_DNS_FAILED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Android's per-network resolver (API 29+), which also returns TTLs
+static bool lookup_android(const char* host, se_dns_result_t* result, int status[2], uint64_t* negative_ttl_ms) {
+    static const int qtypes[2] = { SE_DNS_TYPE_A, SE_DNS_TYPE_AAAA };
+    struct pollfd pfds[2];
+
+    for (int i = 0; i < 2; i++) {
+        pfds[i].fd = g_dns.res_nquery(0, host, SE_DNS_CLASS_IN, qtypes[i], 0);  // NETWORK_UNSPECIFIED
+        pfds[i].events = POLLIN;
+        pfds[i].revents = 0;
+        status[i] = SE_DNS_FAILED;
+    }
+
+    uint64_t deadline = dns_time_ms() + SE_DNS_QUERY_TIMEOUT_MS * SE_DNS_MAX_SERVERS;
+    int pending = (pfds[0].fd >= 0) + (pfds[1].fd >= 0);
+
+    while (pending > 0) {
+        uint64_t now = dns_time_ms();
+        if (now >= deadline) break;
+        if (poll(pfds, 2, (int)(deadline - now)) <= 0) continue;
+
+        for (int i = 0; i < 2; i++) {
+            if (pfds[i].fd < 0 || !pfds[i].revents) continue;
+
+            uint8_t buffer[SE_DNS_MAX_MESSAGE];
+            int rcode = 0;
+            int n = g_dns.res_nresult(pfds[i].fd, &rcode, buffer, sizeof(buffer));  // Closes the fd
+            if (n > 0) {
+                status[i] = parse_response(buffer, (size_t)n, host, qtypes[i], result, negative_ttl_ms);
+            }
+            pfds[i].fd = -1;
+            pending--;
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (pfds[i].fd >= 0) close(pfds[i].fd);
+    }
+
+    return status[0] != SE_DNS_FAILED || status[1] != SE_DNS_FAILED;
+}
+
+static void lookup_getaddrinfo(const char* host, se_dns_result_t* result, int status[2]) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* list = NULL;
+    int rc = getaddrinfo(host, NULL, &hints, &list);
+
+    for (struct addrinfo* ai = list; ai; ai = ai->ai_next) {
+        if (ai->ai_family == AF_INET) {
+            add_address(result, AF_INET, (const uint8_t*)&((struct sockaddr_in*)ai->ai_addr)->sin_addr);
+        } else if (ai->ai_family == AF_INET6) {
+            add_address(result, AF_INET6, (const uint8_t*)&((struct sockaddr_in6*)ai->ai_addr)->sin6_addr);
+        }
+    }
+    if (list) freeaddrinfo(list);
+
+    result->ttl_ms = SE_DNS_DEFAULT_TTL_MS;
+    bool negative = rc == EAI_NONAME
+#ifdef EAI_NODATA
+                    || rc == EAI_NODATA
+#endif
+                    ;
+    status[0] = status[1] = result->count > 0 ? SE_DNS_OK : negative ? SE_DNS_NEGATIVE : SE_DNS_FAILED;
+}
+
+// Resolve host with the first backend available. Runs on the worker
+// thread; servers is a snapshot of the configured list.
+static void dns_lookup(const char* host, const struct sockaddr_storage* servers, int server_count,
+                       se_dns_result_t* result) {
+    int status[2] = { SE_DNS_FAILED, SE_DNS_FAILED };
+    uint64_t negative_ttl_ms = 0;
+
+    memset(result, 0, sizeof(*result));
+    result->ttl_ms = UINT64_MAX;
+
+    bool done = false;
+    if (server_count > 0) {
+        done = lookup_servers(servers, server_count, host, result, status, &negative_ttl_ms);
+    } else if (g_dns.res_nquery && g_dns.res_nresult) {
+        done = lookup_android(host, result, status, &negative_ttl_ms);
+    } else {
+        struct sockaddr_storage system_servers[SE_DNS_MAX_SERVERS];
+        int count = load_resolv_conf(system_servers, SE_DNS_MAX_SERVERS);
+        done = count > 0 && lookup_servers(system_servers, count, host, result, status, &negative_ttl_ms);
+    }
+
+    if (!done && server_count == 0) {
+        memset(result, 0, sizeof(*result));
+        lookup_getaddrinfo(host, result, status);
+    }
+
+    finish_result(result, status, negative_ttl_ms);
+}
+
+// ============================================================================
+// Cache and Worker
+// ============================================================================
+
+// Called with g_dns.lock held
+static se_dns_entry_t* find_entry(const char* host) {
+    for (int i = 0; i < SE_DNS_CACHE_SIZE; i++) {
+        se_dns_entry_t* entry = &g_dns.entries[i];
+        if (entry->host[0] && strcasecmp(entry->host, host) == 0) return entry;
+    }
+    return NULL;
+}
+
+// Find or create the entry for host, evicting the least recently used
+// idle entry. Called with g_dns.lock held; NULL if every entry is busy.
+static se_dns_entry_t* get_entry(const char* host) {
+    se_dns_entry_t* entry = find_entry(host);
+    if (entry) return entry;
+
+    for (int i = 0; i < SE_DNS_CACHE_SIZE; i++) {
+        se_dns_entry_t* candidate = &g_dns.entries[i];
+        if (candidate->requested || candidate->in_flight) continue;
+        if (!entry || !candidate->host[0] || candidate->last_used_ms < entry->last_used_ms) {
+            entry = candidate;
+            if (!candidate->host[0]) break;
+        }
+    }
+    if (!entry) return NULL;
+
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->host, sizeof(entry->host), "%s", host);
+    return entry;
+}
+
+// What se_dns_resolve reports for a finished entry. Called with g_dns.lock held.
+static int entry_answer(const se_dns_entry_t* entry, struct sockaddr_storage* addrs, int max_addrs) {
+    if (entry->result.status == SE_DNS_NEGATIVE) return 0;
+    if (entry->result.status != SE_DNS_OK) return SE_DNS_RESOLVE_FAILED;
+
+    int count = entry->result.count < max_addrs ? entry->result.count : max_addrs;
+    memcpy(addrs, entry->result.addrs, sizeof(struct sockaddr_storage) * count);
+    return count;
+}
+
+static bool entry_needs_refresh(const se_dns_entry_t* entry, uint64_t now) {
+    return entry->valid && !entry->in_flight && entry->result.status == SE_DNS_OK &&
+           now - entry->last_used_ms < SE_DNS_HOT_MS && now >= entry->refresh_ms;
+}
+
+static void* dns_worker(void* arg) {
+    pthread_mutex_lock(&g_dns.lock);
+
+    while (true) {
+        uint64_t now = dns_time_ms();
+        se_dns_entry_t* work = NULL;
+        uint64_t next_wake = UINT64_MAX;
+
+        for (int i = 0; i < SE_DNS_CACHE_SIZE; i++) {
+            se_dns_entry_t* entry = &g_dns.entries[i];
+            if (!entry->host[0] || entry->in_flight) continue;
+
+            if (entry->requested || entry_needs_refresh(entry, now)) {
+                if (!work || entry->requested) work = entry;
+                if (entry->requested) break;
+            } else if (entry->valid && entry->result.status == SE_DNS_OK &&
+                       now - entry->last_used_ms < SE_DNS_HOT_MS && entry->refresh_ms < next_wake) {
+                next_wake = entry->refresh_ms;
+            }
+        }
+
+        if (!work) {
+            if (next_wake == UINT64_MAX) {
+                pthread_cond_wait(&g_dns.work, &g_dns.lock);
+            } else {
+                struct timespec ts;
+                dns_deadline(&ts, next_wake - now);
+                pthread_cond_timedwait(&g_dns.work, &g_dns.lock, &ts);
+            }
+            continue;
+        }
+
+        bool refresh = !work->requested;
+        char host[SE_MAX_HOSTNAME_LEN];
+        struct sockaddr_storage servers[SE_DNS_MAX_SERVERS];
+        int server_count = g_dns.server_count;
+
+        work->in_flight = true;
+        memcpy(host, work->host, sizeof(host));
+        memcpy(servers, g_dns.servers, sizeof(servers));
+        g_dns.stats.queries++;
+        if (refresh) g_dns.stats.refreshes++;
+
+        pthread_mutex_unlock(&g_dns.lock);
+
+        se_dns_result_t result;
+        uint64_t start = dns_time_ms();
+        dns_lookup(host, servers, server_count, &result);
+        uint64_t finished = dns_time_ms();
+
+        LOGD("%s %s: %d addresses, ttl %llu ms, status %d (%llu ms)", refresh ? "Refreshed" : "Resolved",
+             host, result.count, (unsigned long long)result.ttl_ms, result.status,
+             (unsigned long long)(finished - start));
+
+        pthread_mutex_lock(&g_dns.lock);
+
+        se_dns_entry_t* entry = find_entry(host);
+        if (entry) {
+            // A failed refresh keeps serving the previous answer until it expires
+            if (!(refresh && result.status == SE_DNS_FAILED)) {
+                entry->result = result;
+                entry->valid = true;
+                entry->expires_ms = finished + result.ttl_ms;
+                // Refresh in the last fifth of the TTL
+                entry->refresh_ms = finished + result.ttl_ms - result.ttl_ms / 5;
+            } else {
+                entry->refresh_ms = finished + SE_DNS_FAILURE_TTL_MS;
+            }
+            if (result.status == SE_DNS_FAILED && !refresh) g_dns.stats.failures++;
+            entry->in_flight = false;
+            entry->requested = false;
+        }
+
+        pthread_cond_broadcast(&g_dns.done);
+
+        if (g_dns.notify_fd >= 0) {
+            uint64_t one = 1;
+            ssize_t n = write(g_dns.notify_fd, &one, sizeof(one));
+            (void)n;  // EAGAIN means a notification is already pending
+        }
+    }
+
+    return NULL;
+}
+
+static void dns_init(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_dns.work, &attr);
+    pthread_cond_init(&g_dns.done, &attr);
+    pthread_condattr_destroy(&attr);
+
+    g_dns.res_nquery = (se_res_nquery_fn)dlsym(RTLD_DEFAULT, "android_res_nquery");
+    g_dns.res_nresult = (se_res_nresult_fn)dlsym(RTLD_DEFAULT, "android_res_nresult");
+
+    pthread_t thread;
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+    g_dns_started = pthread_create(&thread, &thread_attr, dns_worker, NULL) == 0;
+    pthread_attr_destroy(&thread_attr);
+
+    if (!g_dns_started) {
+        LOGE("Failed to start DNS worker thread");
+    }
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+int se_dns_set_servers(const char* servers) {
+    struct sockaddr_storage parsed[SE_DNS_MAX_SERVERS];
+    int count = 0;
+
+    if (servers && servers[0]) {
+        char list[256];
+        snprintf(list, sizeof(list), "%s", servers);
+
+        char* save = NULL;
+        for (char* token = strtok_r(list, ", ", &save); token; token = strtok_r(NULL, ", ", &save)) {
+            if (count >= SE_DNS_MAX_SERVERS) break;
+            if (parse_server(token, &parsed[count]) < 0) {
+                LOGE("Invalid DNS server: %s", token);
+                return -1;
+            }
+            count++;
+        }
+    }
+
+    pthread_mutex_lock(&g_dns.lock);
+    memcpy(g_dns.servers, parsed, sizeof(struct sockaddr_storage) * count);
+    g_dns.server_count = count;
+    pthread_mutex_unlock(&g_dns.lock);
+
+    // Answers from the old servers no longer apply
+    se_dns_flush();
+    return count;
+}
+
+int se_dns_resolve(const char* hostname, struct sockaddr_storage* addrs, int max_addrs, int timeout_ms) {
+    if (!hostname || !hostname[0] || !addrs || max_addrs <= 0) return -1;
+
+    // Literals never touch the cache
+    memset(&addrs[0], 0, sizeof(addrs[0]));
+    struct sockaddr_in* v4 = (struct sockaddr_in*)&addrs[0];
+    struct sockaddr_in6* v6 = (struct sockaddr_in6*)&addrs[0];
+    if (inet_pton(AF_INET, hostname, &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        return 1;
+    }
+    if (inet_pton(AF_INET6, hostname, &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        return 1;
+    }
+
+    pthread_once(&g_dns_once, dns_init);
+    if (!g_dns_started) return SE_DNS_RESOLVE_FAILED;
+
+    uint64_t deadline = dns_time_ms() + (uint64_t)(timeout_ms > 0 ? timeout_ms : 0);
+    int count = SE_DNS_RESOLVE_TIMEOUT;
+
+    pthread_mutex_lock(&g_dns.lock);
+
+    g_dns.stats.lookups++;
+
+    while (true) {
+        uint64_t now = dns_time_ms();
+        se_dns_entry_t* entry = get_entry(hostname);
+        if (!entry) break;
+
+        entry->last_used_ms = now;
+
+        if (entry->valid && now < entry->expires_ms) {
+            count = entry_answer(entry, addrs, max_addrs);
+            if (!entry->requested) {
+                if (count > 0) {
+                    g_dns.stats.cache_hits++;
+                } else {
+                    g_dns.stats.negative_hits++;
+                }
+            }
+            break;
+        }
+
+        // Missing or expired: have the worker resolve it and wait
+        if (!entry->requested && !entry->in_flight) {
+            entry->requested = true;
+            pthread_cond_signal(&g_dns.work);
+        } else if (entry->in_flight && !entry->requested) {
+            entry->requested = true;  // A refresh is running; its answer will do
+        }
+
+        if (now >= deadline) break;
+
+        struct timespec ts;
+        dns_deadline(&ts, deadline - now);
+        pthread_cond_timedwait(&g_dns.done, &g_dns.lock, &ts);
+
+        // The answer arrived (or the wait timed out): take it even if the TTL is tiny
+        entry = find_entry(hostname);
+        if (entry && entry->valid && !entry->requested) {
+            count = entry_answer(entry, addrs, max_addrs);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&g_dns.lock);
+    return count;
+}
+
+void se_dns_prefetch(const char* hostname) {
+    if (!hostname || !hostname[0]) return;
+
+    struct in6_addr literal;
+    if (inet_pton(AF_INET, hostname, &literal) == 1 || inet_pton(AF_INET6, hostname, &literal) == 1) return;
+
+    pthread_once(&g_dns_once, dns_init);
+    if (!g_dns_started) return;
+
+    pthread_mutex_lock(&g_dns.lock);
+
+    se_dns_entry_t* entry = get_entry(hostname);
+    if (entry) {
+        entry->last_used_ms = dns_time_ms();
+        if ((!entry->valid || entry->last_used_ms >= entry->expires_ms) && !entry->in_flight) {
+            entry->requested = true;
+            pthread_cond_signal(&g_dns.work);
+        }
+    }
+
+    pthread_mutex_unlock(&g_dns.lock);
+}
+
+void se_dns_set_notify_fd(int fd) {
+    pthread_mutex_lock(&g_dns.lock);
+    g_dns.notify_fd = fd;
+    pthread_mutex_unlock(&g_dns.lock);
+}
+
+void se_dns_flush(void) {
+    pthread_mutex_lock(&g_dns.lock);
+
+    for (int i = 0; i < SE_DNS_CACHE_SIZE; i++) {
+        se_dns_entry_t* entry = &g_dns.entries[i];
+        // Entries being resolved stay so their waiters find them
+        if (!entry->requested && !entry->in_flight) {
+            memset(entry, 0, sizeof(*entry));
+        } else {
+            entry->valid = false;
+        }
+    }
+
+    pthread_mutex_unlock(&g_dns.lock);
+}
+
+void se_dns_get_stats(se_dns_stats_t* stats) {
+    if (!stats) return;
+
+    pthread_mutex_lock(&g_dns.lock);
+    memcpy(stats, &g_dns.stats, sizeof(se_dns_stats_t));
+    pthread_mutex_unlock(&g_dns.lock);
+}
@@ -0,0 +1,28 @@
+/**
+ * SoftEther VPN DNS Resolver - Internal Header
+ *
+ * Hooks used by the connect loop in softether_protocol.c. The public API
+ * (resolve/prefetch/stats) is declared in softether_protocol.h.
+ */
+
+#ifndef SOFTETHER_DNS_H
+#define SOFTETHER_DNS_H
+
+#include "softether_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Have the worker write to eventfd fd after every lookup it finishes, so
+ * an event loop can poll se_dns_resolve with a zero timeout instead of
+ * blocking in it. -1 turns the notification off.
+ */
+void se_dns_set_notify_fd(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOFTETHER_DNS_H
@@ -7,14 +7,19 @@
 
 #include <jni.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
-#include <android/log.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "softether_protocol.h"
+#include "softether_log.h"
 
 #define LOG_TAG "SoftEtherJNIBridge"
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGD(...) se_log_print(SE_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) se_log_print(SE_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define LOGI(...) se_log_print(SE_LOG_INFO, LOG_TAG, __VA_ARGS__)
 
 // Global JVM reference
 static JavaVM* g_jvm = NULL;
@@ -25,8 +30,9 @@ typedef struct {
     jmethodID on_connected;
     jmethodID on_disconnected;
     jmethodID on_error;
+    jmethodID on_state_changed;
     jmethodID on_bytes_transferred;
-    jmethodID on_packet_received;
+    jmethodID on_packets_tapped;
 } jni_callback_data_t;
 
 // Native connection handle wrapper
@@ -34,6 +40,11 @@ typedef struct {
     se_connection_t* conn;
     jni_callback_data_t callbacks;
     int tun_fd;
+    int refs;                    // Java's, plus one per queued event
+    bool closed;                 // nativeCleanup ran; queued events are dropped
+    uint64_t bytes_sent;         // Latest totals for the coalesced bytes event
+    uint64_t bytes_received;
+    bool bytes_queued;           // A bytes event is waiting in the queue
 } native_handle_t;
 
 // Map error codes between native and Java
@@ -68,56 +79,270 @@ JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
     return JNI_VERSION_1_6;
 }
 
-// Helper to get JNIEnv
-static JNIEnv* get_jni_env(void) {
-    JNIEnv* env = NULL;
-    if (g_jvm) {
-        jint ret = (*g_jvm)->GetEnv(g_jvm, (void**)&env, JNI_VERSION_1_6);
-        if (ret == JNI_EDETACHED) {
-            if ((*g_jvm)->AttachCurrentThread(g_jvm, &env, NULL) != 0) {
-                return NULL;
+// ============================================================================
+// Callback Dispatcher
+// ============================================================================
+
+// Protocol threads never call into the JVM. Their callbacks queue an event
+// here and one dispatcher thread, attached to the JVM once, makes every
+// upcall, so a slow listener delays other listeners but never the data
+// path. A full queue drops events rather than blocking the producer.
+
+#define SE_EVENT_QUEUE_SIZE     1024    // Power of two
+#define SE_EVENT_MESSAGE_LEN    128
+
+enum {
+    SE_EVENT_CONNECTED,
+    SE_EVENT_STATE,
+    SE_EVENT_ERROR,
+    SE_EVENT_BYTES,
+    SE_EVENT_PACKETS_TAPPED
+};
+
+typedef struct {
+    int type;                    // SE_EVENT_*
+    native_handle_t* handle;
+    int code;                    // State or error code
+    uint32_t values[3];          // Client IP, mask and DNS, or tap tail and head
+    char message[SE_EVENT_MESSAGE_LEN];
+} callback_event_t;
+
+// Bounded multi-producer queue: a cell is free for the producer at ticket
+// pos while sequence == pos, and ready for the consumer once it is pos + 1
+typedef struct {
+    uint32_t sequence;
+    callback_event_t event;
+} event_cell_t;
+
+static struct {
+    event_cell_t cells[SE_EVENT_QUEUE_SIZE];
+    uint32_t enqueue_pos __attribute__((aligned(SE_CACHE_LINE_SIZE)));
+    uint32_t dequeue_pos __attribute__((aligned(SE_CACHE_LINE_SIZE)));
+    uint32_t waiting;            // The dispatcher is parked on wake_seq
+    uint32_t wake_seq;           // Futex word, bumped to wake the dispatcher
+    uint64_t dropped;
+    pthread_t thread;
+    bool running;
+    native_handle_t* current;    // Handle whose event is being delivered
+} g_events;
+
+static pthread_once_t g_events_once = PTHREAD_ONCE_INIT;
+
+static void handle_release(JNIEnv* env, native_handle_t* handle) {
+    if (__atomic_sub_fetch(&handle->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+    if (handle->callbacks.java_client) {
+        (*env)->DeleteGlobalRef(env, handle->callbacks.java_client);
+    }
+    free(handle);
+}
+
+// Queue an event, holding a reference to its handle until delivered.
+// Returns false when the queue is full.
+static bool event_push(const callback_event_t* event) {
+    if (!__atomic_load_n(&g_events.running, __ATOMIC_ACQUIRE)) return false;
+
+    __atomic_fetch_add(&event->handle->refs, 1, __ATOMIC_RELAXED);
+
+    uint32_t pos = __atomic_load_n(&g_events.enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        event_cell_t* cell = &g_events.cells[pos & (SE_EVENT_QUEUE_SIZE - 1)];
+        int32_t diff = (int32_t)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&g_events.enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->event = *event;
+                __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+                break;
             }
+        } else if (diff < 0) {
+            // Still a reference from Java, so this is never the last one
+            __atomic_fetch_sub(&event->handle->refs, 1, __ATOMIC_RELAXED);
+            if (__atomic_fetch_add(&g_events.dropped, 1, __ATOMIC_RELAXED) == 0) {
+                LOGE("Callback queue full, dropping events");
+            }
+            return false;
+        } else {
+            pos = __atomic_load_n(&g_events.enqueue_pos, __ATOMIC_RELAXED);
         }
     }
-    return env;
+
+    // Pairs with the fence in event_wait: either it sees the event or we see it waiting
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&g_events.waiting, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&g_events.wake_seq, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &g_events.wake_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+    return true;
 }
 
-// Native callback: on_connected
-static void native_on_connected(se_connection_t* conn, const se_network_config_t* config) {
-    native_handle_t* handle = (native_handle_t*)conn->user_data;
-    if (!handle) return;
+static bool event_ready(void) {
+    uint32_t pos = g_events.dequeue_pos;
+    event_cell_t* cell = &g_events.cells[pos & (SE_EVENT_QUEUE_SIZE - 1)];
+    return __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) == pos + 1;
+}
 
-    JNIEnv* env = get_jni_env();
-    if (!env) return;
+// Dispatcher only
+static bool event_pop(callback_event_t* event) {
+    if (!event_ready()) return false;
 
-    // Convert IP addresses to strings
-    char client_ip[16], subnet_mask[16], dns1[16];
-    se_ip_int_to_string(config->client_ip, client_ip, sizeof(client_ip));
-    se_ip_int_to_string(config->subnet_mask, subnet_mask, sizeof(subnet_mask));
-    se_ip_int_to_string(config->dns1, dns1, sizeof(dns1));
+    uint32_t pos = g_events.dequeue_pos;
+    event_cell_t* cell = &g_events.cells[pos & (SE_EVENT_QUEUE_SIZE - 1)];
+    *event = cell->event;
+    __atomic_store_n(&cell->sequence, pos + SE_EVENT_QUEUE_SIZE, __ATOMIC_RELEASE);
+    g_events.dequeue_pos = pos + 1;
+    return true;
+}
 
-    jstring jClientIp = (*env)->NewStringUTF(env, client_ip);
-    jstring jSubnetMask = (*env)->NewStringUTF(env, subnet_mask);
-    jstring jDns = (*env)->NewStringUTF(env, dns1);
+// Dispatcher only: park until an event is queued
+static void event_wait(void) {
+    uint32_t seq = __atomic_load_n(&g_events.wake_seq, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&g_events.waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-    (*env)->CallVoidMethod(env, handle->callbacks.java_client,
-                          handle->callbacks.on_connected,
-                          jClientIp, jSubnetMask, jDns);
+    if (!event_ready()) {
+        syscall(SYS_futex, &g_events.wake_seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+    }
+    __atomic_store_n(&g_events.waiting, 0, __ATOMIC_RELAXED);
+}
 
-    (*env)->DeleteLocalRef(env, jClientIp);
-    (*env)->DeleteLocalRef(env, jSubnetMask);
-    (*env)->DeleteLocalRef(env, jDns);
+// A listener that throws must not leave the exception pending for the next upcall
+static void clear_exception(JNIEnv* env) {
+    if ((*env)->ExceptionCheck(env)) {
+        (*env)->ExceptionDescribe(env);
+        (*env)->ExceptionClear(env);
+    }
 }
 
-// Native callback: on_disconnected
-static void native_on_disconnected(se_connection_t* conn, int reason) {
+static void dispatch_event(JNIEnv* env, const callback_event_t* event) {
+    native_handle_t* handle = event->handle;
+    jni_callback_data_t* cb = &handle->callbacks;
+
+    switch (event->type) {
+        case SE_EVENT_CONNECTED: {
+            if (!cb->on_connected) break;
+
+            // Convert IP addresses to strings
+            char client_ip[16], subnet_mask[16], dns1[16];
+            se_ip_int_to_string(event->values[0], client_ip, sizeof(client_ip));
+            se_ip_int_to_string(event->values[1], subnet_mask, sizeof(subnet_mask));
+            se_ip_int_to_string(event->values[2], dns1, sizeof(dns1));
+
+            jstring jClientIp = (*env)->NewStringUTF(env, client_ip);
+            jstring jSubnetMask = (*env)->NewStringUTF(env, subnet_mask);
+            jstring jDns = (*env)->NewStringUTF(env, dns1);
+
+            (*env)->CallVoidMethod(env, cb->java_client, cb->on_connected,
+                                   jClientIp, jSubnetMask, jDns);
+
+            (*env)->DeleteLocalRef(env, jClientIp);
+            (*env)->DeleteLocalRef(env, jSubnetMask);
+            (*env)->DeleteLocalRef(env, jDns);
+            break;
+        }
+
+        case SE_EVENT_STATE:
+            if (cb->on_state_changed) {
+                (*env)->CallVoidMethod(env, cb->java_client, cb->on_state_changed, map_state(event->code));
+            }
+            break;
+
+        case SE_EVENT_ERROR: {
+            if (!cb->on_error) break;
+
+            jstring jMessage = (*env)->NewStringUTF(env, event->message);
+            (*env)->CallVoidMethod(env, cb->java_client, cb->on_error,
+                                   map_error_code(event->code), jMessage);
+            (*env)->DeleteLocalRef(env, jMessage);
+            break;
+        }
+
+        case SE_EVENT_BYTES: {
+            // Totals stored after this point queue a new event
+            __atomic_store_n(&handle->bytes_queued, false, __ATOMIC_SEQ_CST);
+            jlong sent = (jlong)__atomic_load_n(&handle->bytes_sent, __ATOMIC_RELAXED);
+            jlong received = (jlong)__atomic_load_n(&handle->bytes_received, __ATOMIC_RELAXED);
+            if (cb->on_bytes_transferred) {
+                (*env)->CallVoidMethod(env, cb->java_client, cb->on_bytes_transferred, sent, received);
+            }
+            break;
+        }
+
+        case SE_EVENT_PACKETS_TAPPED:
+            if (cb->on_packets_tapped) {
+                (*env)->CallVoidMethod(env, cb->java_client, cb->on_packets_tapped,
+                                       (jint)event->values[0], (jint)event->values[1]);
+                clear_exception(env);
+            }
+            // The listener may have cleaned up, freeing the connection
+            if (!__atomic_load_n(&handle->closed, __ATOMIC_SEQ_CST)) {
+                se_connection_release_packet_tap(handle->conn, event->values[1]);
+            }
+            break;
+    }
+
+    clear_exception(env);
+}
+
+static void* dispatcher_thread(void* arg) {
+    JNIEnv* env = NULL;
+    JavaVMAttachArgs args = { JNI_VERSION_1_6, "SoftEtherCallbacks", NULL };
+
+    // Attached for the life of the process; a daemon, so it never holds up VM exit
+    if ((*g_jvm)->AttachCurrentThreadAsDaemon(g_jvm, &env, &args) != JNI_OK) {
+        LOGE("Callback dispatcher failed to attach to the JVM");
+        __atomic_store_n(&g_events.running, false, __ATOMIC_RELEASE);
+        return NULL;
+    }
+
+    for (;;) {
+        callback_event_t event;
+        if (!event_pop(&event)) {
+            event_wait();
+            continue;
+        }
+
+        // nativeCleanup waits for a delivery to its handle to finish
+        native_handle_t* handle = event.handle;
+        __atomic_store_n(&g_events.current, handle, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&handle->closed, __ATOMIC_SEQ_CST)) {
+            dispatch_event(env, &event);
+        }
+        __atomic_store_n(&g_events.current, NULL, __ATOMIC_SEQ_CST);
+
+        handle_release(env, handle);
+    }
+
+    return NULL;
+}
+
+static void dispatcher_start(void) {
+    for (uint32_t i = 0; i < SE_EVENT_QUEUE_SIZE; i++) {
+        g_events.cells[i].sequence = i;
+    }
+
+    g_events.running = g_jvm && pthread_create(&g_events.thread, NULL, dispatcher_thread, NULL) == 0;
+    if (!g_events.running) {
+        LOGE("Failed to start the callback dispatcher");
+    } else {
+        pthread_detach(g_events.thread);
+    }
+}
+
+// Native callback: on_connected
+static void native_on_connected(se_connection_t* conn, const se_network_config_t* config) {
     native_handle_t* handle = (native_handle_t*)conn->user_data;
     if (!handle) return;
 
-    JNIEnv* env = get_jni_env();
-    if (!env) return;
+    callback_event_t event = { .type = SE_EVENT_CONNECTED, .handle = handle };
+    event.values[0] = config->client_ip;
+    event.values[1] = config->subnet_mask;
+    event.values[2] = config->dns1;
+    event_push(&event);
+}
 
-    // Notify Java layer
+// Native callback: on_disconnected, reported to Java as a state change
+static void native_on_disconnected(se_connection_t* conn, int reason) {
     LOGD("Native on_disconnected: reason=%d", reason);
 }
 
@@ -126,17 +351,48 @@ static void native_on_error(se_connection_t* conn, int error_code, const char* m
     native_handle_t* handle = (native_handle_t*)conn->user_data;
     if (!handle) return;
 
-    JNIEnv* env = get_jni_env();
-    if (!env) return;
+    callback_event_t event = { .type = SE_EVENT_ERROR, .handle = handle, .code = error_code };
+    snprintf(event.message, sizeof(event.message), "%s", message ? message : "Unknown error");
+    event_push(&event);
+}
 
-    jint jErrorCode = map_error_code(error_code);
-    jstring jMessage = (*env)->NewStringUTF(env, message ? message : "Unknown error");
+// Native callback: on_state_changed
+static void native_on_state_changed(se_connection_t* conn, int state) {
+    native_handle_t* handle = (native_handle_t*)conn->user_data;
+    if (!handle) return;
 
-    (*env)->CallVoidMethod(env, handle->callbacks.java_client,
-                          handle->callbacks.on_error,
-                          jErrorCode, jMessage);
+    callback_event_t event = { .type = SE_EVENT_STATE, .handle = handle, .code = state };
+    event_push(&event);
+}
 
-    (*env)->DeleteLocalRef(env, jMessage);
+// Native callback: on_bytes_transferred, coalesced to one queued event
+// that delivers the latest totals
+static void native_on_bytes_transferred(se_connection_t* conn, uint64_t sent, uint64_t received) {
+    native_handle_t* handle = (native_handle_t*)conn->user_data;
+    if (!handle) return;
+
+    __atomic_store_n(&handle->bytes_sent, sent, __ATOMIC_RELAXED);
+    __atomic_store_n(&handle->bytes_received, received, __ATOMIC_RELAXED);
+    if (__atomic_exchange_n(&handle->bytes_queued, true, __ATOMIC_ACQ_REL)) return;
+
+    callback_event_t event = { .type = SE_EVENT_BYTES, .handle = handle };
+    if (!event_push(&event)) {
+        __atomic_store_n(&handle->bytes_queued, false, __ATOMIC_RELEASE);
+    }
+}
+
+// Native callback: on_packets_tapped, one upcall for every record in
+// [tail, head); the dispatcher releases the ring after it
+static void native_on_packets_tapped(se_connection_t* conn, const se_packet_tap_t* tap,
+                                     uint32_t tail, uint32_t head) {
+    native_handle_t* handle = (native_handle_t*)conn->user_data;
+
+    callback_event_t event = { .type = SE_EVENT_PACKETS_TAPPED, .handle = handle };
+    event.values[0] = tail;
+    event.values[1] = head;
+    if (!handle || !event_push(&event)) {
+        se_connection_release_packet_tap(conn, head);
+    }
 }
 
 // ============================================================================
@@ -160,11 +416,17 @@ Java_vn_unlimit_softetherclient_SoftEtherNative_nativeInit(JNIEnv* env, jobject
         return 0;
     }
 
+    pthread_once(&g_events_once, dispatcher_start);
+
     handle->tun_fd = -1;
+    handle->refs = 1;
     handle->conn->user_data = handle;
     handle->conn->on_connected = native_on_connected;
     handle->conn->on_disconnected = native_on_disconnected;
     handle->conn->on_error = native_on_error;
+    handle->conn->on_state_changed = native_on_state_changed;
+    handle->conn->on_bytes_transferred = native_on_bytes_transferred;
+    handle->conn->on_packets_tapped = native_on_packets_tapped;
 
     // Cache Java callbacks
     handle->callbacks.java_client = (*env)->NewGlobalRef(env, thiz);
@@ -173,10 +435,12 @@ Java_vn_unlimit_softetherclient_SoftEtherNative_nativeInit(JNIEnv* env, jobject
                                                           "(Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;)V");
     handle->callbacks.on_error = (*env)->GetMethodID(env, cls, "onError",
                                                      "(ILjava/lang/String;)V");
+    handle->callbacks.on_state_changed = (*env)->GetMethodID(env, cls, "onNativeStateChanged",
+                                                              "(I)V");
     handle->callbacks.on_bytes_transferred = (*env)->GetMethodID(env, cls, "onBytesTransferred",
                                                                   "(JJ)V");
-    handle->callbacks.on_packet_received = (*env)->GetMethodID(env, cls, "onPacketReceived",
-                                                                "([B)V");
+    handle->callbacks.on_packets_tapped = (*env)->GetMethodID(env, cls, "onPacketsTapped",
+                                                               "(II)V");
 
     LOGD("nativeInit completed, handle=%p", (void*)handle);
     return (jlong)handle;
@@ -189,15 +453,21 @@ Java_vn_unlimit_softetherclient_SoftEtherNative_nativeCleanup(JNIEnv* env, jobje
     native_handle_t* h = (native_handle_t*)handle;
     if (!h) return;
 
-    if (h->conn) {
-        se_connection_free(h->conn);
+    // Drop queued events and wait out a delivery in progress, unless this
+    // call comes from inside it
+    __atomic_store_n(&h->closed, true, __ATOMIC_SEQ_CST);
+    if (!pthread_equal(pthread_self(), g_events.thread)) {
+        while (__atomic_load_n(&g_events.current, __ATOMIC_SEQ_CST) == h) {
+            usleep(1000);
+        }
     }
 
-    if (h->callbacks.java_client) {
-        (*env)->DeleteGlobalRef(env, h->callbacks.java_client);
+    if (h->conn) {
+        se_connection_free(h->conn);
     }
 
-    free(h);
+    // Freed here or by the dispatcher, whichever lets go last
+    handle_release(env, h);
     LOGD("nativeCleanup completed");
 }
 
@@ -211,8 +481,13 @@ Java_vn_unlimit_softetherclient_SoftEtherNative_nativeConnect(JNIEnv* env, jobje
                                                                jstring password,
                                                                jboolean useEncrypt,
                                                                jboolean useCompress,
+                                                               jint compressAlgorithm,
                                                                jboolean checkServerCert,
-                                                               jint tunFd) {
+                                                               jint maxConnections,
+                                                               jboolean halfDuplex,
+                                                               jboolean useUdpAcceleration,
+                                                               jint tunFd,
+                                                               jboolean async) {
     LOGD("nativeConnect called, handle=%p", (void*)handle);
 
     native_handle_t* h = (native_handle_t*)handle;
@@ -238,8 +513,13 @@ Java_vn_unlimit_softetherclient_SoftEtherNative_nativeConnect(JNIEnv* env, jobje
     strncpy(params.password, c_password, SE_MAX_PASSWORD_LEN - 1);
     params.use_encrypt = useEncrypt;
     params.use_compress = useCompress;
+    params.compress_algorithm = compressAlgorithm;
     params.verify_server_cert = checkServerCert;
+    params.use_ktls = true;  // Falls back to user-space TLS when unavailable
     params.mtu = 1400;
+    params.max_connections = maxConnections;
+    params.half_duplex = halfDuplex;
+    params.use_udp_acceleration = useUdpAcceleration;
 
     // Release strings
     (*env)->ReleaseStringUTFChars(env, serverHost, c_serverHost);
@@ -251,8 +531,9 @@ Java_vn_unlimit_softetherclient_SoftEtherNative_nativeConnect(JNIEnv* env, jobje
     h->tun_fd = tunFd;
     se_connection_set_tun_fd(h->conn, tunFd);
 
-    // Connect
-    int result = se_connection_connect(h->conn, &params);
+    // Connect; an asynchronous connect reports through the callbacks
+    int result = async ? se_connection_connect_async(h->conn, &params)
+                       : se_connection_connect(h->conn, &params);
 
     LOGD("nativeConnect result: %d", result);
     return (result == SE_ERR_SUCCESS) ? JNI_TRUE : JNI_FALSE;
@@ -266,6 +547,7 @@ Java_vn_unlimit_softetherclient_SoftEtherNative_nativeDisconnect(JNIEnv* env, jo
     if (!h || !h->conn) return;
 
     se_connection_disconnect(h->conn);
+    se_session_cache_flush();
     LOGD("nativeDisconnect completed");
 }
 
@@ -298,6 +580,196 @@ Java_vn_unlimit_softetherclient_SoftEtherNative_nativeGetStatistics(JNIEnv* env,
     return result;
 }
 
+// The statistics page, wrapped once; it stays valid until nativeCleanup
+JNIEXPORT jobject JNICALL
+Java_vn_unlimit_softetherclient_SoftEtherNative_nativeGetStatsPage(JNIEnv* env, jobject thiz, jlong handle) {
+    native_handle_t* h = (native_handle_t*)handle;
+    if (!h || !h->conn) return NULL;
+
+    const se_stats_page_t* page = se_connection_get_stats_page(h->conn);
+    if (!page) return NULL;
+
+    return (*env)->NewDirectByteBuffer(env, (void*)page, (jlong)sizeof(se_stats_page_t));
+}
+
+// The packet tap ring, wrapped whole; it stays valid until nativeCleanup
+JNIEXPORT jobject JNICALL
+Java_vn_unlimit_softetherclient_SoftEtherNative_nativeEnablePacketTap(JNIEnv* env, jobject thiz, jlong handle,
+                                                                       jint capacity, jint snapLength,
+                                                                       jint notifyPackets, jint notifyMicros) {
+    native_handle_t* h = (native_handle_t*)handle;
+    if (!h || !h->conn || capacity < 0 || snapLength < 0 || notifyPackets < 0 || notifyMicros < 0) {
+        return NULL;
+    }
+
+    if (se_connection_enable_packet_tap(h->conn, (uint32_t)capacity, (uint32_t)snapLength,
+                                        (uint32_t)notifyPackets, (uint32_t)notifyMicros) < 0) {
+        return NULL;
+    }
+
+    const se_packet_tap_t* tap = se_connection_get_packet_tap(h->conn);
+    return (*env)->NewDirectByteBuffer(env, (void*)tap, (jlong)SE_TAP_HEADER_SIZE + tap->capacity);
+}
+
+JNIEXPORT void JNICALL
+Java_vn_unlimit_softetherclient_SoftEtherNative_nativeDisablePacketTap(JNIEnv* env, jobject thiz, jlong handle) {
+    native_handle_t* h = (native_handle_t*)handle;
+    if (!h || !h->conn) return;
+
+    se_connection_disable_packet_tap(h->conn);
+}
+
+// Flattened per-connection stats, SE_TRANSPORT_STAT_FIELDS longs each
+#define SE_TRANSPORT_STAT_FIELDS 8
+
+JNIEXPORT jlongArray JNICALL
+Java_vn_unlimit_softetherclient_SoftEtherNative_nativeGetTransportStats(JNIEnv* env, jobject thiz, jlong handle) {
+    native_handle_t* h = (native_handle_t*)handle;
+
+    se_transport_stats_t native_stats[SE_MAX_CONNECTIONS];
+    int count = 0;
+    if (h && h->conn) {
+        count = se_connection_get_transport_stats(h->conn, native_stats, SE_MAX_CONNECTIONS);
+        if (count < 0) count = 0;
+    }
+
+    jlongArray result = (*env)->NewLongArray(env, count * SE_TRANSPORT_STAT_FIELDS);
+    if (!result) return NULL;
+
+    jlong stats[SE_MAX_CONNECTIONS * SE_TRANSPORT_STAT_FIELDS];
+    for (int i = 0; i < count; i++) {
+        jlong* out = &stats[i * SE_TRANSPORT_STAT_FIELDS];
+        out[0] = (jlong)native_stats[i].role;
+        out[1] = (jlong)native_stats[i].bytes_sent;
+        out[2] = (jlong)native_stats[i].bytes_received;
+        out[3] = (jlong)native_stats[i].packets_sent;
+        out[4] = (jlong)native_stats[i].packets_received;
+        out[5] = (jlong)native_stats[i].send_rate;
+        out[6] = (jlong)native_stats[i].recv_rate;
+        out[7] = (jlong)native_stats[i].drops;
+    }
+
+    (*env)->SetLongArrayRegion(env, result, 0, count * SE_TRANSPORT_STAT_FIELDS, stats);
+    return result;
+}
+
+// Latency summary of one path: count, min, p50, p90, p99, p99.9, max, mean (ns)
+#define SE_LATENCY_STAT_FIELDS 8
+
+JNIEXPORT jlongArray JNICALL
+Java_vn_unlimit_softetherclient_SoftEtherNative_nativeGetLatencyStats(JNIEnv* env, jobject thiz, jlong handle,
+                                                                      jint path, jboolean reset) {
+    native_handle_t* h = (native_handle_t*)handle;
+
+    jlongArray result = (*env)->NewLongArray(env, SE_LATENCY_STAT_FIELDS);
+    if (!result) return NULL;
+
+    jlong stats[SE_LATENCY_STAT_FIELDS] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+    // Too big for the stack of every caller
+    se_latency_snapshot_t* snapshot = (se_latency_snapshot_t*)malloc(sizeof(se_latency_snapshot_t));
+    if (snapshot && h && h->conn && se_connection_get_latency(h->conn, path, snapshot, reset) == 0 &&
+        snapshot->count > 0) {
+        stats[0] = (jlong)snapshot->count;
+        stats[1] = (jlong)snapshot->min_ns;
+        stats[2] = (jlong)se_latency_percentile(snapshot, 50.0);
+        stats[3] = (jlong)se_latency_percentile(snapshot, 90.0);
+        stats[4] = (jlong)se_latency_percentile(snapshot, 99.0);
+        stats[5] = (jlong)se_latency_percentile(snapshot, 99.9);
+        stats[6] = (jlong)snapshot->max_ns;
+        stats[7] = (jlong)(snapshot->sum_ns / snapshot->count);
+    }
+    free(snapshot);
+
+    (*env)->SetLongArrayRegion(env, result, 0, SE_LATENCY_STAT_FIELDS, stats);
+    return result;
+}
+
+// Flattened connect history, newest first, SE_CONNECT_TIMING_FIELDS longs
+// each: result, last phase, async, total ms, then ms in each phase from
+// SE_CONNECT_PHASE_RESOLVE on
+#define SE_CONNECT_TIMING_FIELDS (4 + SE_CONNECT_PHASE_COUNT - 1)
+
+JNIEXPORT jlongArray JNICALL
+Java_vn_unlimit_softetherclient_SoftEtherNative_nativeGetConnectHistory(JNIEnv* env, jobject thiz, jlong handle) {
+    native_handle_t* h = (native_handle_t*)handle;
+
+    se_connect_timing_t timings[SE_CONNECT_HISTORY_SIZE];
+    int count = 0;
+    if (h && h->conn) {
+        count = se_connection_get_connect_history(h->conn, timings, SE_CONNECT_HISTORY_SIZE);
+    }
+
+    jlongArray result = (*env)->NewLongArray(env, count * SE_CONNECT_TIMING_FIELDS);
+    if (!result) return NULL;
+
+    jlong history[SE_CONNECT_HISTORY_SIZE * SE_CONNECT_TIMING_FIELDS];
+    for (int i = 0; i < count; i++) {
+        jlong* out = &history[i * SE_CONNECT_TIMING_FIELDS];
+        out[0] = timings[i].result == SE_CONNECT_CANCELLED ? -1 : map_error_code(timings[i].result);
+        out[1] = (jlong)timings[i].last_phase;
+        out[2] = timings[i].async ? 1 : 0;
+        out[3] = (jlong)timings[i].total_ms;
+        for (int phase = SE_CONNECT_PHASE_RESOLVE; phase < SE_CONNECT_PHASE_COUNT; phase++) {
+            out[3 + phase] = (jlong)timings[i].phase_ms[phase];
+        }
+    }
+
+    (*env)->SetLongArrayRegion(env, result, 0, count * SE_CONNECT_TIMING_FIELDS, history);
+    return result;
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_vn_unlimit_softetherclient_SoftEtherNative_nativeGetUdpStats(JNIEnv* env, jobject thiz, jlong handle) {
+    native_handle_t* h = (native_handle_t*)handle;
+
+    jlongArray result = (*env)->NewLongArray(env, 7);
+    if (!result) return NULL;
+
+    jlong stats[7] = {0, 0, 0, 0, 0, 0, 0};
+
+    se_udp_stats_t native_stats;
+    if (h && h->conn && se_connection_get_udp_stats(h->conn, &native_stats) == 0) {
+        stats[0] = (jlong)native_stats.state;
+        stats[1] = (jlong)native_stats.datagrams_sent;
+        stats[2] = (jlong)native_stats.datagrams_received;
+        stats[3] = (jlong)native_stats.bytes_sent;
+        stats[4] = (jlong)native_stats.bytes_received;
+        stats[5] = (jlong)native_stats.rejected;
+        stats[6] = (jlong)native_stats.fallbacks;
+    }
+
+    (*env)->SetLongArrayRegion(env, result, 0, 7, stats);
+    return result;
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_vn_unlimit_softetherclient_SoftEtherNative_nativeGetCompressionStats(JNIEnv* env, jobject thiz, jlong handle) {
+    native_handle_t* h = (native_handle_t*)handle;
+
+    jlongArray result = (*env)->NewLongArray(env, 10);
+    if (!result) return NULL;
+
+    jlong stats[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+    se_compress_stats_t native_stats;
+    if (h && h->conn && se_connection_get_compress_stats(h->conn, &native_stats) == 0) {
+        stats[0] = (jlong)native_stats.algorithm;
+        stats[1] = (jlong)native_stats.packets_in;
+        stats[2] = (jlong)native_stats.packets_compressed;
+        stats[3] = (jlong)native_stats.packets_skipped;
+        stats[4] = (jlong)native_stats.bytes_in;
+        stats[5] = (jlong)native_stats.bytes_out;
+        stats[6] = (jlong)native_stats.compress_ns;
+        stats[7] = (jlong)native_stats.recv_bytes_in;
+        stats[8] = (jlong)native_stats.recv_bytes_out;
+        stats[9] = (jlong)native_stats.decompress_ns;
+    }
+
+    (*env)->SetLongArrayRegion(env, result, 0, 10, stats);
+    return result;
+}
+
 JNIEXPORT jint JNICALL
 Java_vn_unlimit_softetherclient_SoftEtherNative_nativeGetLastError(JNIEnv* env, jobject thiz, jlong handle) {
     native_handle_t* h = (native_handle_t*)handle;
@@ -318,6 +790,52 @@ Java_vn_unlimit_softetherclient_SoftEtherNative_nativeGetErrorString(JNIEnv* env
     return (*env)->NewStringUTF(env, error_str);
 }
 
+JNIEXPORT jint JNICALL
+Java_vn_unlimit_softetherclient_SoftEtherNative_nativeGetTlsMode(JNIEnv* env, jobject thiz, jlong handle) {
+    native_handle_t* h = (native_handle_t*)handle;
+    if (!h || !h->conn) return SE_TLS_MODE_NONE;
+
+    return se_connection_get_tls_mode(h->conn);
+}
+
+JNIEXPORT jint JNICALL
+Java_vn_unlimit_softetherclient_SoftEtherNative_nativeGetConnectPhase(JNIEnv* env, jobject thiz, jlong handle) {
+    native_handle_t* h = (native_handle_t*)handle;
+    if (!h || !h->conn) return SE_CONNECT_PHASE_IDLE;
+
+    return se_connection_get_connect_phase(h->conn);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_vn_unlimit_softetherclient_SoftEtherNative_nativeSetSessionCacheFile(JNIEnv* env, jobject thiz, jstring path) {
+    const char* c_path = (*env)->GetStringUTFChars(env, path, NULL);
+    if (!c_path) return JNI_FALSE;
+
+    int result = se_session_cache_set_file(c_path);
+    LOGD("Session cache file %s: %d sessions loaded", c_path, result);
+
+    (*env)->ReleaseStringUTFChars(env, path, c_path);
+    return (result >= 0) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_vn_unlimit_softetherclient_SoftEtherNative_nativeGetSessionCacheStats(JNIEnv* env, jobject thiz) {
+    jlongArray result = (*env)->NewLongArray(env, 4);
+    if (!result) return NULL;
+
+    se_session_cache_stats_t native_stats;
+    se_session_cache_get_stats(&native_stats);
+
+    jlong stats[4];
+    stats[0] = (jlong)native_stats.lookups;
+    stats[1] = (jlong)native_stats.hits;
+    stats[2] = (jlong)native_stats.resumed;
+    stats[3] = (jlong)native_stats.stored;
+
+    (*env)->SetLongArrayRegion(env, result, 0, 4, stats);
+    return result;
+}
+
 // Test helper - get native protocol version
 JNIEXPORT jint JNICALL
 Java_vn_unlimit_softetherclient_SoftEtherNative_nativeGetProtocolVersion(JNIEnv* env, jobject thiz) {
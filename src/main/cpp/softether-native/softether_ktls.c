@@ -0,0 +1,349 @@
+/**
+ * SoftEther VPN Kernel TLS Offload
+ *
+ * Derives the per-direction record keys of an established OpenSSL session
+ * and installs them on the socket with TLS_TX/TLS_RX, after which the
+ * kernel encrypts and decrypts records and the data path uses plain
+ * send()/recvmsg(). TLS 1.3 keys come from the traffic secrets reported
+ * through the keylog callback, TLS 1.2 keys from the key block.
+ */
+
+#include "softether_ktls.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/core_names.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+// ============================================================================
+// Internal Structures
+// ============================================================================
+
+// TLS 1.3 application traffic secrets of one SSL object
+typedef struct {
+    uint8_t client[EVP_MAX_MD_SIZE];
+    uint8_t server[EVP_MAX_MD_SIZE];
+    size_t client_len;
+    size_t server_len;
+} se_ktls_secrets_t;
+
+static int g_secrets_index = -1;
+static pthread_once_t g_secrets_once = PTHREAD_ONCE_INIT;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static void secrets_free(void* parent, void* ptr, CRYPTO_EX_DATA* ad, int idx, long argl, void* argp) {
+    if (!ptr) return;
+    OPENSSL_cleanse(ptr, sizeof(se_ktls_secrets_t));
+    free(ptr);
+}
+
+static void secrets_index_init(void) {
+    g_secrets_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, secrets_free);
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static size_t parse_hex(const char* hex, uint8_t* out, size_t max_len) {
+    size_t len = 0;
+    while (len < max_len) {
+        int hi = hex_value(hex[0]);
+        int lo = hi < 0 ? -1 : hex_value(hex[1]);
+        if (lo < 0) break;
+        out[len++] = (uint8_t)((hi << 4) | lo);
+        hex += 2;
+    }
+    return len;
+}
+
+// Keylog callback; the only lines kept are the first application secrets
+static void keylog_cb(const SSL* ssl, const char* line) {
+    static const char client_label[] = "CLIENT_TRAFFIC_SECRET_0 ";
+    static const char server_label[] = "SERVER_TRAFFIC_SECRET_0 ";
+
+    bool client = strncmp(line, client_label, sizeof(client_label) - 1) == 0;
+    bool server = strncmp(line, server_label, sizeof(server_label) - 1) == 0;
+    if (!client && !server) return;
+
+    // "<label> <client random> <secret>"
+    const char* secret = strrchr(line, ' ');
+    if (!secret) return;
+
+    se_ktls_secrets_t* secrets = (se_ktls_secrets_t*)SSL_get_ex_data(ssl, g_secrets_index);
+    if (!secrets) {
+        secrets = (se_ktls_secrets_t*)calloc(1, sizeof(se_ktls_secrets_t));
+        if (!secrets) return;
+        SSL_set_ex_data((SSL*)ssl, g_secrets_index, secrets);
+    }
+
+    if (client) {
+        secrets->client_len = parse_hex(secret + 1, secrets->client, sizeof(secrets->client));
+    } else {
+        secrets->server_len = parse_hex(secret + 1, secrets->server, sizeof(secrets->server));
+    }
+}
+
+static int kdf_derive(const char* name, OSSL_PARAM* params, uint8_t* out, size_t out_len) {
+    EVP_KDF* kdf = EVP_KDF_fetch(NULL, name, NULL);
+    EVP_KDF_CTX* kctx = kdf ? EVP_KDF_CTX_new(kdf) : NULL;
+    EVP_KDF_free(kdf);
+
+    int ok = kctx && EVP_KDF_derive(kctx, out, out_len, params) > 0;
+    EVP_KDF_CTX_free(kctx);
+    return ok ? 0 : -1;
+}
+
+// HKDF-Expand-Label(secret, label, "", out_len) from RFC 8446 section 7.1
+static int hkdf_expand_label(const EVP_MD* md, const uint8_t* secret, size_t secret_len,
+                             const char* label, uint8_t* out, size_t out_len) {
+    uint8_t info[32];
+    size_t label_len = strlen(label);
+    size_t n = 0;
+
+    info[n++] = (uint8_t)(out_len >> 8);
+    info[n++] = (uint8_t)out_len;
+    info[n++] = (uint8_t)(6 + label_len);
+    memcpy(info + n, "tls13 ", 6);
+    n += 6;
+    memcpy(info + n, label, label_len);
+    n += label_len;
+    info[n++] = 0;  // Empty context
+
+    int mode = EVP_KDF_HKDF_MODE_EXPAND_ONLY;
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_int(OSSL_KDF_PARAM_MODE, &mode),
+        OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, (char*)EVP_MD_get0_name(md), 0),
+        OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY, (void*)secret, secret_len),
+        OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_INFO, info, n),
+        OSSL_PARAM_construct_end()
+    };
+
+    return kdf_derive("HKDF", params, out, out_len);
+}
+
+// TLS 1.2 key block: PRF(master, "key expansion", server_random + client_random)
+static int tls12_key_block(SSL* ssl, const EVP_MD* md, uint8_t* block, size_t len) {
+    uint8_t master[SSL_MAX_MASTER_KEY_LENGTH];
+    size_t master_len = SSL_SESSION_get_master_key(SSL_get_session(ssl), master, sizeof(master));
+    if (master_len == 0) return -1;
+
+    uint8_t seed[13 + 2 * SSL3_RANDOM_SIZE];
+    memcpy(seed, "key expansion", 13);
+    SSL_get_server_random(ssl, seed + 13, SSL3_RANDOM_SIZE);
+    SSL_get_client_random(ssl, seed + 13 + SSL3_RANDOM_SIZE, SSL3_RANDOM_SIZE);
+
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, (char*)EVP_MD_get0_name(md), 0),
+        OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SECRET, master, master_len),
+        OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SEED, seed, sizeof(seed)),
+        OSSL_PARAM_construct_end()
+    };
+
+    int result = kdf_derive("TLS1-PRF", params, block, len);
+    OPENSSL_cleanse(master, sizeof(master));
+    return result;
+}
+
+// ============================================================================
+// SSL Layer Hooks
+// ============================================================================
+
+void se_ktls_setup_ctx(SSL_CTX* ssl_ctx) {
+    pthread_once(&g_secrets_once, secrets_index_init);
+    if (g_secrets_index < 0) return;
+
+    SSL_CTX_set_keylog_callback(ssl_ctx, keylog_cb);
+}
+
+bool se_ktls_cipher_supported(SSL* ssl) {
+    int version = SSL_version(ssl);
+    if (version != TLS1_2_VERSION && version != TLS1_3_VERSION) return false;
+
+    const SSL_CIPHER* cipher = SSL_get_current_cipher(ssl);
+    if (!cipher) return false;
+
+    switch (SSL_CIPHER_get_cipher_nid(cipher)) {
+        case NID_aes_128_gcm:
+        case NID_aes_256_gcm:
+        case NID_chacha20_poly1305:
+            return true;
+        default:
+            return false;
+    }
+}
+
+int se_ktls_crypto_info(SSL* ssl, bool tx, uint64_t seq, se_ktls_crypto_info_t* out) {
+    if (!ssl || !out || !se_ktls_cipher_supported(ssl)) return -1;
+
+    const SSL_CIPHER* cipher = SSL_get_current_cipher(ssl);
+    const EVP_MD* md = SSL_CIPHER_get_handshake_digest(cipher);
+    int nid = SSL_CIPHER_get_cipher_nid(cipher);
+    bool tls13 = SSL_version(ssl) == TLS1_3_VERSION;
+    if (!md) return -1;
+
+    size_t key_len = nid == NID_aes_128_gcm ? 16 : 32;
+    size_t iv_len = nid == NID_chacha20_poly1305 ? 12 : 4;  // TLS 1.2 fixed IV
+    uint8_t key[32];
+    uint8_t iv[12];   // Full nonce base, or the GCM salt for TLS 1.2
+    int result = -1;
+
+    if (tls13) {
+        se_ktls_secrets_t* secrets = (se_ktls_secrets_t*)SSL_get_ex_data(ssl, g_secrets_index);
+        if (!secrets) return -1;
+
+        const uint8_t* secret = tx ? secrets->client : secrets->server;
+        size_t secret_len = tx ? secrets->client_len : secrets->server_len;
+        if (secret_len != (size_t)EVP_MD_get_size(md)) return -1;
+
+        if (hkdf_expand_label(md, secret, secret_len, "key", key, key_len) < 0 ||
+            hkdf_expand_label(md, secret, secret_len, "iv", iv, sizeof(iv)) < 0) {
+            goto done;
+        }
+    } else {
+        // client_write_key | server_write_key | client_write_IV | server_write_IV
+        uint8_t block[2 * 32 + 2 * 12];
+        size_t block_len = 2 * key_len + 2 * iv_len;
+        if (tls12_key_block(ssl, md, block, block_len) < 0) goto done;
+
+        memcpy(key, block + (tx ? 0 : key_len), key_len);
+        memcpy(iv, block + 2 * key_len + (tx ? 0 : iv_len), iv_len);
+        OPENSSL_cleanse(block, sizeof(block));
+    }
+
+    uint8_t rec_seq[8];
+    for (int i = 0; i < 8; i++) {
+        rec_seq[i] = (uint8_t)(seq >> (56 - 8 * i));
+    }
+
+    memset(out, 0, sizeof(*out));
+    out->info.version = tls13 ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+
+    switch (nid) {
+        case NID_aes_128_gcm: {
+            struct tls12_crypto_info_aes_gcm_128* info = &out->aes_gcm_128;
+            info->info.cipher_type = TLS_CIPHER_AES_GCM_128;
+            memcpy(info->key, key, sizeof(info->key));
+            memcpy(info->salt, iv, sizeof(info->salt));
+            // TLS 1.2 carries an explicit nonce per record; start it at the sequence number
+            memcpy(info->iv, tls13 ? iv + 4 : rec_seq, sizeof(info->iv));
+            memcpy(info->rec_seq, rec_seq, sizeof(info->rec_seq));
+            out->len = sizeof(*info);
+            break;
+        }
+        case NID_aes_256_gcm: {
+            struct tls12_crypto_info_aes_gcm_256* info = &out->aes_gcm_256;
+            info->info.cipher_type = TLS_CIPHER_AES_GCM_256;
+            memcpy(info->key, key, sizeof(info->key));
+            memcpy(info->salt, iv, sizeof(info->salt));
+            memcpy(info->iv, tls13 ? iv + 4 : rec_seq, sizeof(info->iv));
+            memcpy(info->rec_seq, rec_seq, sizeof(info->rec_seq));
+            out->len = sizeof(*info);
+            break;
+        }
+        default: {
+            struct tls12_crypto_info_chacha20_poly1305* info = &out->chacha20_poly1305;
+            info->info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+            memcpy(info->key, key, sizeof(info->key));
+            memcpy(info->iv, iv, sizeof(info->iv));
+            memcpy(info->rec_seq, rec_seq, sizeof(info->rec_seq));
+            out->len = sizeof(*info);
+            break;
+        }
+    }
+    result = 0;
+
+done:
+    OPENSSL_cleanse(key, sizeof(key));
+    OPENSSL_cleanse(iv, sizeof(iv));
+    return result;
+}
+
+// ============================================================================
+// Socket Operations
+// ============================================================================
+
+int se_ktls_attach(int fd) {
+    return setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls"));
+}
+
+int se_ktls_enable(SSL* ssl, int fd, bool tx, uint64_t seq) {
+    se_ktls_crypto_info_t crypto;
+    if (se_ktls_crypto_info(ssl, tx, seq, &crypto) < 0) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    int result = setsockopt(fd, SOL_TLS, tx ? TLS_TX : TLS_RX, &crypto.info, crypto.len);
+    OPENSSL_cleanse(&crypto, sizeof(crypto));
+    return result;
+}
+
+ssize_t se_ktls_recv(int fd, uint8_t* buffer, size_t len, uint8_t* record_type) {
+    char control[CMSG_SPACE(sizeof(uint8_t))];
+    struct iovec iov = { buffer, len };
+    struct msghdr msg;
+    ssize_t n;
+
+    do {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        n = recvmsg(fd, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+
+    *record_type = SE_TLS_RECORD_DATA;
+
+    // Non-data records (alerts, post-handshake messages) come with their type attached
+    struct cmsghdr* cmsg = n >= 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg && cmsg->cmsg_level == SOL_TLS && cmsg->cmsg_type == TLS_GET_RECORD_TYPE) {
+        *record_type = *(uint8_t*)CMSG_DATA(cmsg);
+    }
+
+    return n;
+}
+
+void se_ktls_send_close_notify(int fd) {
+    uint8_t alert[2] = { 1, 0 };  // warning, close_notify
+    char control[CMSG_SPACE(sizeof(uint8_t))];
+    struct iovec iov = { alert, sizeof(alert) };
+    struct msghdr msg;
+
+    memset(control, 0, sizeof(control));
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint8_t));
+    *(uint8_t*)CMSG_DATA(cmsg) = SE_TLS_RECORD_ALERT;
+
+    sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
@@ -0,0 +1,87 @@
+/**
+ * SoftEther VPN Kernel TLS Offload - Internal Header
+ *
+ * Hands the TLS record layer of an established OpenSSL session to the
+ * Linux kernel (TCP_ULP "tls"). Used by the SSL layer in
+ * softether_protocol.c, which decides when each direction is switched.
+ */
+
+#ifndef SOFTETHER_KTLS_H
+#define SOFTETHER_KTLS_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/tls.h>
+#include <openssl/ssl.h>
+
+#include "softether_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// TLS record content types seen on a kTLS receive socket
+#define SE_TLS_RECORD_ALERT         21
+#define SE_TLS_RECORD_HANDSHAKE     22
+#define SE_TLS_RECORD_DATA          23
+
+/**
+ * Kernel crypto parameters for one direction
+ */
+typedef struct {
+    union {
+        struct tls_crypto_info info;
+        struct tls12_crypto_info_aes_gcm_128 aes_gcm_128;
+        struct tls12_crypto_info_aes_gcm_256 aes_gcm_256;
+        struct tls12_crypto_info_chacha20_poly1305 chacha20_poly1305;
+    };
+    socklen_t len;
+} se_ktls_crypto_info_t;
+
+/**
+ * Capture TLS 1.3 traffic secrets for every SSL created from this
+ * SSL_CTX. Must be called before SSL_new().
+ */
+void se_ktls_setup_ctx(SSL_CTX* ssl_ctx);
+
+/**
+ * Check whether the negotiated version and cipher can be offloaded.
+ */
+bool se_ktls_cipher_supported(SSL* ssl);
+
+/**
+ * Derive the kernel crypto parameters for one direction of a completed
+ * handshake, starting at record sequence number seq.
+ * Returns 0 on success, -1 if the session cannot be offloaded.
+ */
+int se_ktls_crypto_info(SSL* ssl, bool tx, uint64_t seq, se_ktls_crypto_info_t* out);
+
+/**
+ * Attach the "tls" upper layer protocol to a connected TCP socket.
+ * Returns 0 on success, -1 with errno set if the kernel lacks kTLS.
+ */
+int se_ktls_attach(int fd);
+
+/**
+ * Switch one direction of the socket to kernel TLS.
+ * Returns 0 on success, -1 with errno set.
+ */
+int se_ktls_enable(SSL* ssl, int fd, bool tx, uint64_t seq);
+
+/**
+ * Receive decrypted bytes from a kTLS socket. record_type is set to the
+ * content type of the record the bytes came from.
+ * Returns bytes received, 0 on EOF, -1 on error.
+ */
+ssize_t se_ktls_recv(int fd, uint8_t* buffer, size_t len, uint8_t* record_type);
+
+/**
+ * Send a close_notify alert through a kTLS transmit socket without blocking.
+ */
+void se_ktls_send_close_notify(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOFTETHER_KTLS_H
@@ -0,0 +1,137 @@
+/**
+ * SoftEther VPN Latency Histograms
+ *
+ * Log-linear bucketing, lock-free recording and snapshots, and percentile
+ * queries over snapshots.
+ */
+
+#include "softether_latency.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Values below 2^SUB_BITS get a bucket each; above, each power of two is
+// split into 2^(SUB_BITS - 1) buckets
+#define SUB_BITS        6
+#define SUB_HALF        (1 << (SUB_BITS - 1))
+
+struct se_latency_histogram {
+    uint64_t counts[SE_LATENCY_BUCKETS];
+    uint64_t sum_ns;
+    uint64_t max_ns;
+};
+
+static int bucket_index(uint64_t value) {
+    if (value > SE_LATENCY_MAX_NS) value = SE_LATENCY_MAX_NS;
+
+    int msb = 63 - __builtin_clzll(value | 1);
+    int shift = msb >= SUB_BITS ? msb - (SUB_BITS - 1) : 0;
+    return SUB_HALF * shift + (int)(value >> shift);
+}
+
+// Lowest and highest value counted in a bucket
+static uint64_t bucket_low(int index) {
+    if (index < 2 * SUB_HALF) return (uint64_t)index;
+
+    int shift = index / SUB_HALF - 1;
+    return (uint64_t)(index - SUB_HALF * shift) << shift;
+}
+
+static uint64_t bucket_high(int index) {
+    if (index < 2 * SUB_HALF) return (uint64_t)index;
+
+    int shift = index / SUB_HALF - 1;
+    return ((uint64_t)(index - SUB_HALF * shift + 1) << shift) - 1;
+}
+
+se_latency_histogram_t* se_latency_new(void) {
+    return (se_latency_histogram_t*)calloc(1, sizeof(se_latency_histogram_t));
+}
+
+void se_latency_free(se_latency_histogram_t* histogram) {
+    free(histogram);
+}
+
+uint64_t se_latency_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void se_latency_record(se_latency_histogram_t* histogram, uint64_t latency_ns, uint64_t packets) {
+    if (!histogram || packets == 0) return;
+
+    __atomic_fetch_add(&histogram->counts[bucket_index(latency_ns)], packets, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum_ns, latency_ns * packets, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+    while (latency_ns > max &&
+           !__atomic_compare_exchange_n(&histogram->max_ns, &max, latency_ns, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void se_latency_record_batch(se_latency_histogram_t* histogram, se_latency_batch_t* batch, uint64_t now) {
+    for (int i = 0; i < batch->count; i++) {
+        uint64_t read_ns = batch->read_ns[i];
+        se_latency_record(histogram, now > read_ns ? now - read_ns : 0, batch->packets[i]);
+    }
+    batch->count = 0;
+}
+
+void se_latency_snapshot(se_latency_histogram_t* histogram, se_latency_snapshot_t* snapshot, bool reset) {
+    memset(snapshot, 0, sizeof(se_latency_snapshot_t));
+    if (!histogram) return;
+
+    // Counters are taken one at a time, so a snapshot may hold a sample's
+    // bucket but not its sum; count comes from the buckets
+    for (int i = 0; i < SE_LATENCY_BUCKETS; i++) {
+        uint64_t count = reset ? __atomic_exchange_n(&histogram->counts[i], 0, __ATOMIC_RELAXED)
+                               : __atomic_load_n(&histogram->counts[i], __ATOMIC_RELAXED);
+        if (count == 0) continue;
+        
+        if (snapshot->count == 0) snapshot->min_ns = bucket_low(i);
+        snapshot->counts[i] = count;
+        snapshot->count += count;
+    }
+
+    snapshot->sum_ns = reset ? __atomic_exchange_n(&histogram->sum_ns, 0, __ATOMIC_RELAXED)
+                             : __atomic_load_n(&histogram->sum_ns, __ATOMIC_RELAXED);
+    snapshot->max_ns = reset ? __atomic_exchange_n(&histogram->max_ns, 0, __ATOMIC_RELAXED)
+                             : __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+}
+
+void se_latency_reset(se_latency_histogram_t* histogram) {
+    if (!histogram) return;
+
+    for (int i = 0; i < SE_LATENCY_BUCKETS; i++) {
+        __atomic_store_n(&histogram->counts[i], 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&histogram->sum_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&histogram->max_ns, 0, __ATOMIC_RELAXED);
+}
+
+uint64_t se_latency_percentile(const se_latency_snapshot_t* snapshot, double percentile) {
+    if (!snapshot || snapshot->count == 0) return 0;
+
+    if (percentile < 0) percentile = 0;
+    if (percentile > 100) percentile = 100;
+
+    // Rank of the sample wanted, counting from 1 and rounding up
+    double exact = percentile / 100.0 * (double)snapshot->count;
+    uint64_t rank = (uint64_t)exact;
+    if ((double)rank < exact || rank < 1) rank++;
+    if (rank > snapshot->count) rank = snapshot->count;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < SE_LATENCY_BUCKETS; i++) {
+        seen += snapshot->counts[i];
+        if (seen >= rank) {
+            uint64_t value = bucket_high(i);
+            return snapshot->max_ns && value > snapshot->max_ns ? snapshot->max_ns : value;
+        }
+    }
+
+    return snapshot->max_ns;
+}
@@ -0,0 +1,74 @@
+/**
+ * SoftEther VPN Latency Histograms - Internal Header
+ *
+ * HDR-style histograms of per-packet latency in nanoseconds. Values below
+ * 64 ns get a bucket each; above that every power of two is split into 32
+ * buckets, so a bucket is never wider than about 3% of the values in it,
+ * up to SE_LATENCY_MAX_NS. Recording is a few relaxed atomic adds, safe
+ * from any number of threads. A snapshot that resets takes each counter
+ * with an atomic exchange, so no thread waits for another and every
+ * sample lands in exactly one snapshot.
+ */
+
+#ifndef SOFTETHER_LATENCY_H
+#define SOFTETHER_LATENCY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "softether_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SE_LATENCY_BATCH    64      // Distinct timestamps a send batch tracks
+
+/**
+ * One latency histogram (opaque)
+ */
+typedef struct se_latency_histogram se_latency_histogram_t;
+
+/**
+ * Read times of the packets in a send batch, recorded together once the
+ * batch is written. Packets past SE_LATENCY_BATCH timestamps share the
+ * last one, which overstates their latency by the time spent reading them.
+ */
+typedef struct {
+    uint64_t read_ns[SE_LATENCY_BATCH];
+    uint32_t packets[SE_LATENCY_BATCH];
+    int count;
+} se_latency_batch_t;
+
+se_latency_histogram_t* se_latency_new(void);
+void se_latency_free(se_latency_histogram_t* histogram);
+
+// Monotonic clock for timestamps given to the functions below
+uint64_t se_latency_now(void);
+
+// Record packets samples of latency_ns. NULL histograms are ignored.
+void se_latency_record(se_latency_histogram_t* histogram, uint64_t latency_ns, uint64_t packets);
+
+// Record each packet of the batch as the time from its read until now,
+// then empty the batch
+void se_latency_record_batch(se_latency_histogram_t* histogram, se_latency_batch_t* batch, uint64_t now);
+
+static inline void se_latency_batch_add(se_latency_batch_t* batch, uint64_t read_ns) {
+    if (batch->count < SE_LATENCY_BATCH) {
+        batch->read_ns[batch->count] = read_ns;
+        batch->packets[batch->count++] = 1;
+    } else {
+        batch->packets[SE_LATENCY_BATCH - 1]++;
+    }
+}
+
+// Copy the histogram into snapshot, emptying it when reset is set
+void se_latency_snapshot(se_latency_histogram_t* histogram, se_latency_snapshot_t* snapshot, bool reset);
+
+void se_latency_reset(se_latency_histogram_t* histogram);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOFTETHER_LATENCY_H
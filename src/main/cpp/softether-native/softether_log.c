@@ -0,0 +1,61 @@
+/**
+ * SoftEther VPN Logging
+ *
+ * The host build's log sink. Android builds log straight to liblog and
+ * compile nothing here.
+ */
+
+#include "softether_log.h"
+
+#ifdef SOFTETHER_HOST_BUILD
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#define LOG_MESSAGE_MAX 1024
+
+static pthread_mutex_t g_sink_lock = PTHREAD_MUTEX_INITIALIZER;
+static se_log_sink_t g_sink = NULL;
+static void* g_sink_arg = NULL;
+static int g_min_priority = SE_LOG_DEBUG;
+
+static void stderr_sink(int priority, const char* tag, const char* message, void* arg) {
+    static const char letters[] = "??VDIWEF";
+    char letter = priority >= 0 && priority < (int)sizeof(letters) - 1 ? letters[priority] : '?';
+    fprintf(stderr, "%c/%s: %s\n", letter, tag, message);
+}
+
+void se_log_set_sink(se_log_sink_t sink, void* arg) {
+    pthread_mutex_lock(&g_sink_lock);
+    g_sink = sink;
+    g_sink_arg = arg;
+    pthread_mutex_unlock(&g_sink_lock);
+}
+
+void se_log_set_min_priority(int priority) {
+    __atomic_store_n(&g_min_priority, priority, __ATOMIC_RELAXED);
+}
+
+int se_log_print(int priority, const char* tag, const char* format, ...) {
+    if (priority < __atomic_load_n(&g_min_priority, __ATOMIC_RELAXED)) return 0;
+
+    char message[LOG_MESSAGE_MAX];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    // Under the lock, so a sink being replaced is never called after
+    pthread_mutex_lock(&g_sink_lock);
+    if (g_sink) {
+        g_sink(priority, tag, message, g_sink_arg);
+    } else {
+        stderr_sink(priority, tag, message, NULL);
+    }
+    pthread_mutex_unlock(&g_sink_lock);
+
+    return len;
+}
+
+#endif
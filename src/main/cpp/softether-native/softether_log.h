@@ -0,0 +1,53 @@
+/**
+ * SoftEther VPN Logging - Internal Header
+ *
+ * Every module logs through se_log_print. On Android that is the system
+ * log. Host builds (SOFTETHER_HOST_BUILD) have no liblog, so messages go
+ * to a sink instead: stderr unless replaced, for instance to capture a
+ * test's output or to keep a benchmark quiet.
+ */
+
+#ifndef SOFTETHER_LOG_H
+#define SOFTETHER_LOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef SOFTETHER_HOST_BUILD
+
+// Priorities, numbered as Android's
+#define SE_LOG_DEBUG    3
+#define SE_LOG_INFO     4
+#define SE_LOG_WARN     5
+#define SE_LOG_ERROR    6
+
+typedef void (*se_log_sink_t)(int priority, const char* tag, const char* message, void* arg);
+
+// Replace the sink; NULL restores stderr
+void se_log_set_sink(se_log_sink_t sink, void* arg);
+
+// Drop messages below priority before they are formatted. Default SE_LOG_DEBUG.
+void se_log_set_min_priority(int priority);
+
+int se_log_print(int priority, const char* tag, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#else
+
+#include <android/log.h>
+
+#define SE_LOG_DEBUG    ANDROID_LOG_DEBUG
+#define SE_LOG_INFO     ANDROID_LOG_INFO
+#define SE_LOG_WARN     ANDROID_LOG_WARN
+#define SE_LOG_ERROR    ANDROID_LOG_ERROR
+
+#define se_log_print    __android_log_print
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOFTETHER_LOG_H
@@ -5,10 +5,20 @@
  */
 
 #include "softether_protocol.h"
+#include "softether_session_cache.h"
+#include "softether_ktls.h"
+#include "softether_cipher.h"
+#include "softether_udp.h"
+#include "softether_compress.h"
+#include "softether_dns.h"
+#include "softether_latency.h"
+#include "softether_trace.h"
+#include "softether_log.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -19,12 +29,23 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <poll.h>
-#include <android/log.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <dirent.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/rand.h>
+#include <openssl/x509v3.h>
 
 #define LOG_TAG "SoftEtherProtocol"
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGD(...) se_log_print(SE_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) se_log_print(SE_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define LOGI(...) se_log_print(SE_LOG_INFO, LOG_TAG, __VA_ARGS__)
 
 // ============================================================================
 // Internal Structures
@@ -32,10 +53,59 @@
 
 // SSL context structure definition
 struct se_ssl_context {
-    void* ssl;           // SSL pointer (opaque to avoid OpenSSL header dependency issues)
-    void* ctx;           // SSL_CTX pointer
+    SSL* ssl;
+    SSL_CTX* ctx;
     int socket_fd;
     bool is_initialized;
+    
+    // The SSL object is driven through a ring-buffer BIO: ciphertext is
+    // received straight into net_in and encrypted records are appended to
+    // net_out, so the socket sees a few large recv()/send() calls instead
+    // of one per TLS record.
+    pthread_mutex_t ssl_lock;    // Guards the SSL object
+    pthread_mutex_t out_lock;    // Guards net_out
+    se_ring_t net_in;            // Ciphertext from the socket (receive thread only)
+    se_ring_t net_out;           // Ciphertext waiting for send()
+    bool nonblocking;            // Event loop mode: send()/recv() never block
+    
+    // Kernel TLS offload. Transmit switches right after the handshake;
+    // receive switches once OpenSSL has consumed the socket up to a record
+    // boundary, so the records handed to OpenSSL are counted to know the
+    // kernel's starting sequence number.
+    bool ktls_wanted;
+    bool ktls_tx;                // Kernel encrypts outgoing records
+    bool ktls_rx;                // Kernel decrypts incoming records
+    bool ktls_rx_pending;        // Switch receive at the next record boundary
+    bool rx_seen_data;           // OpenSSL has returned application data
+    uint64_t rx_seq_base;        // Receive sequence number at handshake completion
+    uint64_t rx_records;         // Records consumed by OpenSSL since then
+    uint8_t rx_header[5];        // Partial record header
+    size_t rx_header_len;
+    size_t rx_body_left;         // Bytes left in the current record
+};
+
+#define SE_SSL_NET_IN_SIZE      SE_MAX_PACKET_SIZE
+#define SE_SSL_NET_OUT_SIZE     SE_SEND_BATCH_SIZE
+#define SE_SSL_CA_DIR           "/system/etc/security/cacerts"
+
+// Packet pool size class
+typedef struct {
+    size_t payload_size;         // Inline payload capacity of each packet
+    size_t slab_packets;         // Packets carved from each slab
+    size_t max_slabs;            // Growth limit before falling back to the heap
+    size_t slab_count;
+    void** slabs;
+    se_packet_t* free_list;
+    pthread_mutex_t lock;
+} se_pool_class_t;
+
+#define SE_POOL_CLASS_COUNT 2
+
+// Packet pool structure definition
+struct se_packet_pool {
+    se_pool_class_t classes[SE_POOL_CLASS_COUNT];
+    uint64_t hits;
+    uint64_t misses;
 };
 
 // ============================================================================
@@ -70,6 +140,16 @@ const char* se_state_string(int state) {
     }
 }
 
+const char* se_tls_mode_string(int mode) {
+    switch (mode) {
+        case SE_TLS_MODE_NONE:      return "None";
+        case SE_TLS_MODE_USERSPACE: return "User-space TLS";
+        case SE_TLS_MODE_KTLS_TX:   return "Kernel TLS (transmit)";
+        case SE_TLS_MODE_KTLS:      return "Kernel TLS";
+        default:                    return "Unknown";
+    }
+}
+
 uint32_t se_ip_string_to_int(const char* ip_str) {
     struct in_addr addr;
     if (inet_aton(ip_str, &addr) != 1) {
@@ -91,24 +171,71 @@ static uint64_t get_time_ms(void) {
     return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-static void generate_random_bytes(uint8_t* buffer, size_t len) {
-    for (size_t i = 0; i < len; i++) {
-        buffer[i] = (uint8_t)(rand() & 0xFF);
+// Key material and session identifiers, so always from the CSPRNG
+static int generate_random_bytes(uint8_t* buffer, size_t len) {
+    if (RAND_bytes(buffer, (int)len) != 1) {
+        LOGE("RAND_bytes failed: %s", ERR_error_string(ERR_get_error(), NULL));
+        return -1;
     }
+    return 0;
 }
 
 // ============================================================================
 // Packet Queue Implementation
 // ============================================================================
 
+static void futex_wait(uint32_t* addr, uint32_t expected) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t* addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+// Wake the other side if it announced that it is parked. The fence pairs
+// with the one in queue_park so that either the waiter sees our index
+// update or we see its waiting flag.
+static void queue_signal(uint32_t* waiting, uint32_t* seq) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(seq, 1, __ATOMIC_RELEASE);
+        futex_wake(seq);
+    }
+}
+
+// Park until *index moves away from stuck_value or a signal arrives
+static void queue_park(uint32_t* waiting, uint32_t* seq, const size_t* index, size_t stuck_value) {
+    uint32_t observed = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+    __atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    
+    if (__atomic_load_n(index, __ATOMIC_ACQUIRE) == stuck_value) {
+        futex_wait(seq, observed);
+    }
+    
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+}
+
 se_packet_queue_t* se_packet_queue_new(size_t max_size) {
-    se_packet_queue_t* queue = (se_packet_queue_t*)calloc(1, sizeof(se_packet_queue_t));
-    if (!queue) return NULL;
+    se_packet_queue_t* queue = NULL;
+    if (posix_memalign((void**)&queue, SE_CACHE_LINE_SIZE, sizeof(se_packet_queue_t)) != 0) {
+        return NULL;
+    }
+    memset(queue, 0, sizeof(se_packet_queue_t));
     
     queue->max_size = max_size > 0 ? max_size : 100;
-    pthread_mutex_init(&queue->lock, NULL);
-    pthread_cond_init(&queue->not_empty, NULL);
-    pthread_cond_init(&queue->not_full, NULL);
+    
+    size_t slot_count = 1;
+    while (slot_count < queue->max_size) {
+        slot_count <<= 1;
+    }
+    queue->mask = slot_count - 1;
+    
+    queue->slots = (se_packet_t**)calloc(slot_count, sizeof(se_packet_t*));
+    if (!queue->slots) {
+        free(queue);
+        return NULL;
+    }
     
     return queue;
 }
@@ -117,63 +244,86 @@ void se_packet_queue_free(se_packet_queue_t* queue) {
     if (!queue) return;
     
     se_packet_queue_clear(queue);
-    pthread_mutex_destroy(&queue->lock);
-    pthread_cond_destroy(&queue->not_empty);
-    pthread_cond_destroy(&queue->not_full);
+    free(queue->slots);
     free(queue);
 }
 
-int se_packet_queue_push(se_packet_queue_t* queue, se_packet_t* packet, bool blocking) {
-    if (!queue || !packet) return -1;
+size_t se_packet_queue_push_batch(se_packet_queue_t* queue, se_packet_t** packets, size_t count, bool blocking) {
+    if (!queue || !packets) return 0;
+    
+    size_t pushed = 0;
+    size_t tail = queue->tail;
+    
+    while (pushed < count) {
+        size_t free_slots = queue->max_size - (tail - queue->cached_head);
+        if (free_slots == 0) {
+            // Only touch the consumer's cache line when we look full
+            queue->cached_head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+            free_slots = queue->max_size - (tail - queue->cached_head);
+        }
+        
+        if (free_slots == 0) {
+            if (!blocking) break;
+            queue_park(&queue->producer_waiting, &queue->not_full_seq,
+                       &queue->head, tail - queue->max_size);
+            continue;
+        }
+        
+        size_t n = count - pushed < free_slots ? count - pushed : free_slots;
+        for (size_t i = 0; i < n; i++) {
+            se_packet_t* packet = packets[pushed + i];
+            packet->next = NULL;
+            queue->slots[(tail + i) & queue->mask] = packet;
+        }
+        tail += n;
+        pushed += n;
+        
+        __atomic_store_n(&queue->tail, tail, __ATOMIC_RELEASE);
+        queue_signal(&queue->consumer_waiting, &queue->not_empty_seq);
+    }
     
-    pthread_mutex_lock(&queue->lock);
+    return pushed;
+}
+
+size_t se_packet_queue_pop_batch(se_packet_queue_t* queue, se_packet_t** packets, size_t max_count, bool blocking) {
+    if (!queue || !packets || max_count == 0) return 0;
     
-    while (queue->count >= queue->max_size) {
-        if (!blocking) {
-            pthread_mutex_unlock(&queue->lock);
-            return -1;  // Queue full
-        }
-        pthread_cond_wait(&queue->not_full, &queue->lock);
+    size_t head = queue->head;
+    size_t available = queue->cached_tail - head;
+    
+    while (available == 0) {
+        // Only touch the producer's cache line when we look empty
+        queue->cached_tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+        available = queue->cached_tail - head;
+        if (available > 0) break;
+        
+        if (!blocking) return 0;
+        queue_park(&queue->consumer_waiting, &queue->not_empty_seq, &queue->tail, head);
     }
     
-    packet->next = NULL;
-    if (queue->tail) {
-        queue->tail->next = packet;
-    } else {
-        queue->head = packet;
+    size_t n = available < max_count ? available : max_count;
+    for (size_t i = 0; i < n; i++) {
+        packets[i] = queue->slots[(head + i) & queue->mask];
     }
-    queue->tail = packet;
-    queue->count++;
     
-    pthread_cond_signal(&queue->not_empty);
-    pthread_mutex_unlock(&queue->lock);
+    __atomic_store_n(&queue->head, head + n, __ATOMIC_RELEASE);
+    queue_signal(&queue->producer_waiting, &queue->not_full_seq);
     
-    return 0;
+    return n;
 }
 
-se_packet_t* se_packet_queue_pop(se_packet_queue_t* queue, bool blocking) {
-    if (!queue) return NULL;
-    
-    pthread_mutex_lock(&queue->lock);
+int se_packet_queue_push(se_packet_queue_t* queue, se_packet_t* packet, bool blocking) {
+    if (!queue || !packet) return -1;
     
-    while (queue->count == 0) {
-        if (!blocking) {
-            pthread_mutex_unlock(&queue->lock);
-            return NULL;
-        }
-        pthread_cond_wait(&queue->not_empty, &queue->lock);
-    }
+    return se_packet_queue_push_batch(queue, &packet, 1, blocking) == 1 ? 0 : -1;
+}
+
+se_packet_t* se_packet_queue_pop(se_packet_queue_t* queue, bool blocking) {
+    se_packet_t* packet = NULL;
     
-    se_packet_t* packet = queue->head;
-    queue->head = packet->next;
-    if (!queue->head) {
-        queue->tail = NULL;
+    if (se_packet_queue_pop_batch(queue, &packet, 1, blocking) != 1) {
+        return NULL;
     }
-    queue->count--;
-    packet->next = NULL;
-    
-    pthread_cond_signal(&queue->not_full);
-    pthread_mutex_unlock(&queue->lock);
     
     return packet;
 }
@@ -181,49 +331,191 @@ se_packet_t* se_packet_queue_pop(se_packet_queue_t* queue, bool blocking) {
 size_t se_packet_queue_size(se_packet_queue_t* queue) {
     if (!queue) return 0;
     
-    pthread_mutex_lock(&queue->lock);
-    size_t count = queue->count;
-    pthread_mutex_unlock(&queue->lock);
+    size_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
     
-    return count;
+    return tail - head;
 }
 
 void se_packet_queue_clear(se_packet_queue_t* queue) {
     if (!queue) return;
     
-    pthread_mutex_lock(&queue->lock);
+    se_packet_t* packets[32];
+    size_t n;
     
-    se_packet_t* packet = queue->head;
-    while (packet) {
-        se_packet_t* next = packet->next;
-        se_packet_free(packet);
-        packet = next;
+    while ((n = se_packet_queue_pop_batch(queue, packets, 32, false)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            se_packet_free(packets[i]);
+        }
+    }
+}
+
+// ============================================================================
+// Ring Buffer Implementation
+// ============================================================================
+
+int se_ring_init(se_ring_t* ring, size_t capacity) {
+    if (!ring || capacity == 0 || (capacity & (capacity - 1)) != 0) return -1;
+    
+    ring->data = (uint8_t*)malloc(capacity);
+    if (!ring->data) return -1;
+    
+    ring->capacity = capacity;
+    ring->head = 0;
+    ring->tail = 0;
+    
+    return 0;
+}
+
+void se_ring_destroy(se_ring_t* ring) {
+    if (!ring) return;
+    
+    free(ring->data);
+    ring->data = NULL;
+    ring->capacity = 0;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+void se_ring_reset(se_ring_t* ring) {
+    if (!ring) return;
+    
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+size_t se_ring_used(const se_ring_t* ring) {
+    return ring->tail - ring->head;
+}
+
+size_t se_ring_space(const se_ring_t* ring) {
+    return ring->capacity - (ring->tail - ring->head);
+}
+
+uint8_t* se_ring_write_ptr(se_ring_t* ring, size_t* len) {
+    size_t offset = ring->tail & (ring->capacity - 1);
+    size_t contiguous = ring->capacity - offset;
+    size_t space = se_ring_space(ring);
+    
+    *len = space < contiguous ? space : contiguous;
+    return ring->data + offset;
+}
+
+void se_ring_commit(se_ring_t* ring, size_t len) {
+    ring->tail += len;
+}
+
+const uint8_t* se_ring_read_ptr(const se_ring_t* ring, size_t* len) {
+    size_t offset = ring->head & (ring->capacity - 1);
+    size_t contiguous = ring->capacity - offset;
+    size_t used = se_ring_used(ring);
+    
+    *len = used < contiguous ? used : contiguous;
+    return ring->data + offset;
+}
+
+void se_ring_consume(se_ring_t* ring, size_t len) {
+    ring->head += len;
+}
+
+size_t se_ring_peek(const se_ring_t* ring, size_t offset, uint8_t* dst, size_t len) {
+    size_t used = se_ring_used(ring);
+    if (offset >= used) return 0;
+    if (len > used - offset) len = used - offset;
+    
+    size_t start = (ring->head + offset) & (ring->capacity - 1);
+    size_t first = ring->capacity - start;
+    if (first > len) first = len;
+    
+    memcpy(dst, ring->data + start, first);
+    if (len > first) {
+        memcpy(dst + first, ring->data, len - first);
+    }
+    
+    return len;
+}
+
+int se_ring_iov(const se_ring_t* ring, size_t offset, size_t len, struct iovec iov[2]) {
+    if (offset + len > se_ring_used(ring)) return -1;
+    if (len == 0) return 0;
+    
+    size_t start = (ring->head + offset) & (ring->capacity - 1);
+    size_t first = ring->capacity - start;
+    
+    iov[0].iov_base = ring->data + start;
+    if (first >= len) {
+        iov[0].iov_len = len;
+        return 1;
     }
-    queue->head = NULL;
-    queue->tail = NULL;
-    queue->count = 0;
     
-    pthread_mutex_unlock(&queue->lock);
+    // Region straddles the wrap point
+    iov[0].iov_len = first;
+    iov[1].iov_base = ring->data;
+    iov[1].iov_len = len - first;
+    return 2;
 }
 
 // ============================================================================
 // Packet Operations
 // ============================================================================
 
+// Write a 12-byte frame header: type (4) + flags (4) + payload_len (4)
+static void write_frame_header(uint8_t* buffer, uint32_t type, uint32_t flags, uint32_t payload_len) {
+    buffer[0] = (type >> 24) & 0xFF;
+    buffer[1] = (type >> 16) & 0xFF;
+    buffer[2] = (type >> 8) & 0xFF;
+    buffer[3] = type & 0xFF;
+    
+    buffer[4] = (flags >> 24) & 0xFF;
+    buffer[5] = (flags >> 16) & 0xFF;
+    buffer[6] = (flags >> 8) & 0xFF;
+    buffer[7] = flags & 0xFF;
+    
+    buffer[8] = (payload_len >> 24) & 0xFF;
+    buffer[9] = (payload_len >> 16) & 0xFF;
+    buffer[10] = (payload_len >> 8) & 0xFF;
+    buffer[11] = payload_len & 0xFF;
+}
+
+// Compress the DATA frame at frame in place when that makes it smaller,
+// rewriting its header. compressor may be NULL.
+// Returns the frame length, -1 if the compressed stream broke.
+static int frame_compress(se_compressor_t* compressor, uint8_t* frame, size_t payload_len) {
+    if (!compressor) return (int)(SE_FRAME_HEADER_SIZE + payload_len);
+    
+    const uint8_t* out = NULL;
+    int len = se_compress(compressor, frame + SE_FRAME_HEADER_SIZE, payload_len, &out);
+    if (len < 0) return -1;
+    if (len == 0) return (int)(SE_FRAME_HEADER_SIZE + payload_len);
+    
+    memcpy(frame + SE_FRAME_HEADER_SIZE, out, len);
+    write_frame_header(frame, SE_PACKET_TYPE_DATA, SE_FRAME_FLAG_COMPRESSED, (uint32_t)len);
+    return SE_FRAME_HEADER_SIZE + len;
+}
+
+static size_t packet_block_size(size_t capacity) {
+    return sizeof(se_packet_t) + SE_PACKET_HEADROOM + capacity;
+}
+
+static void packet_init_block(se_packet_t* packet, size_t capacity, se_packet_pool_t* pool, int size_class) {
+    memset(packet, 0, sizeof(se_packet_t));
+    packet->capacity = (uint32_t)capacity;
+    packet->payload = (uint8_t*)(packet + 1) + SE_PACKET_HEADROOM;
+    packet->pool = pool;
+    packet->size_class = size_class;
+}
+
 se_packet_t* se_packet_new(uint32_t type, uint32_t flags, const uint8_t* payload, size_t payload_len) {
-    se_packet_t* packet = (se_packet_t*)calloc(1, sizeof(se_packet_t));
+    // Single allocation: struct, headroom and payload
+    se_packet_t* packet = (se_packet_t*)malloc(packet_block_size(payload_len));
     if (!packet) return NULL;
     
+    packet_init_block(packet, payload_len, NULL, -1);
     packet->type = type;
     packet->flags = flags;
     packet->payload_len = (uint32_t)payload_len;
     
     if (payload_len > 0 && payload) {
-        packet->payload = (uint8_t*)malloc(payload_len);
-        if (!packet->payload) {
-            free(packet);
-            return NULL;
-        }
         memcpy(packet->payload, payload, payload_len);
     }
     
@@ -233,12 +525,29 @@ se_packet_t* se_packet_new(uint32_t type, uint32_t flags, const uint8_t* payload
 void se_packet_free(se_packet_t* packet) {
     if (!packet) return;
     
-    if (packet->payload) {
-        free(packet->payload);
+    if (packet->pool) {
+        se_pool_class_t* cls = &packet->pool->classes[packet->size_class];
+        pthread_mutex_lock(&cls->lock);
+        packet->next = cls->free_list;
+        cls->free_list = packet;
+        pthread_mutex_unlock(&cls->lock);
+        return;
     }
+    
     free(packet);
 }
 
+// Write the frame header into the packet headroom, in front of the payload
+int se_packet_frame(se_packet_t* packet, uint8_t** frame) {
+    if (!packet || !frame) return -1;
+    
+    uint8_t* start = packet->payload - SE_FRAME_HEADER_SIZE;
+    write_frame_header(start, packet->type, packet->flags, packet->payload_len);
+    
+    *frame = start;
+    return SE_FRAME_HEADER_SIZE + packet->payload_len;
+}
+
 int se_packet_serialize(se_packet_t* packet, uint8_t* buffer, size_t buffer_size) {
     if (!packet || !buffer || buffer_size < 12 + packet->payload_len) {
         return -1;
@@ -287,10 +596,201 @@ se_packet_t* se_packet_deserialize(const uint8_t* data, size_t data_len) {
     return se_packet_new(type, flags, data + 12, payload_len);
 }
 
+// ============================================================================
+// Packet Pool Implementation
+// ============================================================================
+
+static void pool_class_init(se_pool_class_t* cls, size_t payload_size, size_t slab_packets, size_t max_slabs) {
+    cls->payload_size = payload_size;
+    cls->slab_packets = slab_packets;
+    cls->max_slabs = max_slabs;
+    pthread_mutex_init(&cls->lock, NULL);
+}
+
+// Carve a new slab into the class free list. Called with cls->lock held.
+static int pool_class_grow(se_packet_pool_t* pool, int size_class) {
+    se_pool_class_t* cls = &pool->classes[size_class];
+    if (cls->slab_count >= cls->max_slabs) return -1;
+    
+    size_t block_size = packet_block_size(cls->payload_size);
+    block_size = (block_size + SE_CACHE_LINE_SIZE - 1) & ~(size_t)(SE_CACHE_LINE_SIZE - 1);
+    
+    // Aligned base, so every block starts on its own cache line
+    uint8_t* slab = NULL;
+    if (posix_memalign((void**)&slab, SE_CACHE_LINE_SIZE, block_size * cls->slab_packets) != 0) {
+        return -1;
+    }
+    
+    cls->slabs[cls->slab_count++] = slab;
+    
+    for (size_t i = 0; i < cls->slab_packets; i++) {
+        se_packet_t* packet = (se_packet_t*)(slab + i * block_size);
+        packet_init_block(packet, cls->payload_size, pool, size_class);
+        packet->next = cls->free_list;
+        cls->free_list = packet;
+    }
+    
+    return 0;
+}
+
+se_packet_pool_t* se_packet_pool_new(void) {
+    se_packet_pool_t* pool = (se_packet_pool_t*)calloc(1, sizeof(se_packet_pool_t));
+    if (!pool) return NULL;
+    
+    // ~1 MB ceiling per class: 8 x 64 MTU-sized packets, 4 x 4 max-size packets
+    pool_class_init(&pool->classes[0], SE_POOL_SMALL_PAYLOAD, 64, 8);
+    pool_class_init(&pool->classes[1], SE_POOL_LARGE_PAYLOAD, 4, 4);
+    
+    for (int i = 0; i < SE_POOL_CLASS_COUNT; i++) {
+        se_pool_class_t* cls = &pool->classes[i];
+        cls->slabs = (void**)calloc(cls->max_slabs, sizeof(void*));
+        if (!cls->slabs) {
+            se_packet_pool_free(pool);
+            return NULL;
+        }
+    }
+    
+    return pool;
+}
+
+// All pooled packets must have been returned before the pool is freed
+void se_packet_pool_free(se_packet_pool_t* pool) {
+    if (!pool) return;
+    
+    for (int i = 0; i < SE_POOL_CLASS_COUNT; i++) {
+        se_pool_class_t* cls = &pool->classes[i];
+        for (size_t j = 0; j < cls->slab_count; j++) {
+            free(cls->slabs[j]);
+        }
+        free(cls->slabs);
+        pthread_mutex_destroy(&cls->lock);
+    }
+    
+    free(pool);
+}
+
+se_packet_t* se_packet_pool_alloc(se_packet_pool_t* pool, size_t capacity) {
+    if (!pool || capacity > SE_POOL_LARGE_PAYLOAD) {
+        return se_packet_new(0, 0, NULL, capacity);
+    }
+    
+    int size_class = capacity <= SE_POOL_SMALL_PAYLOAD ? 0 : 1;
+    se_pool_class_t* cls = &pool->classes[size_class];
+    
+    pthread_mutex_lock(&cls->lock);
+    
+    bool hit = cls->free_list != NULL;
+    if (!hit && pool_class_grow(pool, size_class) < 0) {
+        pthread_mutex_unlock(&cls->lock);
+        __atomic_fetch_add(&pool->misses, 1, __ATOMIC_RELAXED);
+        return se_packet_new(0, 0, NULL, capacity);
+    }
+    
+    se_packet_t* packet = cls->free_list;
+    cls->free_list = packet->next;
+    
+    pthread_mutex_unlock(&cls->lock);
+    
+    __atomic_fetch_add(hit ? &pool->hits : &pool->misses, 1, __ATOMIC_RELAXED);
+    
+    packet->type = 0;
+    packet->flags = 0;
+    packet->payload_len = 0;
+    packet->next = NULL;
+    packet->read_ns = 0;
+    return packet;
+}
+
+se_packet_t* se_packet_new_pooled(se_packet_pool_t* pool, uint32_t type, uint32_t flags,
+                                  const uint8_t* payload, size_t payload_len) {
+    se_packet_t* packet = se_packet_pool_alloc(pool, payload_len);
+    if (!packet) return NULL;
+    
+    packet->type = type;
+    packet->flags = flags;
+    packet->payload_len = (uint32_t)payload_len;
+    
+    if (payload_len > 0 && payload) {
+        memcpy(packet->payload, payload, payload_len);
+    }
+    
+    return packet;
+}
+
+void se_packet_pool_get_counters(se_packet_pool_t* pool, uint64_t* hits, uint64_t* misses) {
+    if (!pool) {
+        *hits = 0;
+        *misses = 0;
+        return;
+    }
+    
+    *hits = __atomic_load_n(&pool->hits, __ATOMIC_RELAXED);
+    *misses = __atomic_load_n(&pool->misses, __ATOMIC_RELAXED);
+}
+
+void se_packet_pool_reset_counters(se_packet_pool_t* pool) {
+    if (!pool) return;
+    
+    __atomic_store_n(&pool->hits, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->misses, 0, __ATOMIC_RELAXED);
+}
+
 // ============================================================================
 // Connection Management
 // ============================================================================
 
+// Statistics pages are never unmapped. A reader that loaded the address
+// just before se_connection_free (the Java poller, say) may still touch
+// it, so freed pages go on this list for the next connection instead.
+typedef struct stats_page_slot {
+    se_stats_page_t page;                // First, so the slot is the page
+    struct stats_page_slot* next;        // Past the fields readers look at
+} stats_page_slot_t;
+
+static stats_page_slot_t* g_stats_pages_free = NULL;
+static pthread_mutex_t g_stats_pages_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static se_stats_page_t* stats_page_acquire(void) {
+    pthread_mutex_lock(&g_stats_pages_lock);
+    stats_page_slot_t* slot = g_stats_pages_free;
+    if (slot) g_stats_pages_free = slot->next;
+    pthread_mutex_unlock(&g_stats_pages_lock);
+    
+    if (slot) {
+        // Clear it the way a publish would, for readers still polling it
+        se_stats_page_t* page = &slot->page;
+        uint64_t* fields = &page->state;
+        uint32_t sequence = page->sequence;
+        __atomic_store_n(&page->sequence, sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        for (uint32_t i = 0; i < page->field_count; i++) {
+            __atomic_store_n(&fields[i], 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&page->sequence, sequence + 2, __ATOMIC_RELEASE);
+        return page;
+    }
+    
+    // A page of its own, so readers polling it share no cache line with the data path
+    void* memory = mmap(NULL, sizeof(stats_page_slot_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return NULL;
+    
+    se_stats_page_t* page = &((stats_page_slot_t*)memory)->page;
+    page->magic = SE_STATS_PAGE_MAGIC;
+    page->version = SE_STATS_PAGE_VERSION;
+    page->field_count = (uint32_t)((sizeof(se_stats_page_t) - offsetof(se_stats_page_t, state)) / sizeof(uint64_t));
+    return page;
+}
+
+static void stats_page_release(se_stats_page_t* page) {
+    if (!page) return;
+    
+    stats_page_slot_t* slot = (stats_page_slot_t*)page;
+    pthread_mutex_lock(&g_stats_pages_lock);
+    slot->next = g_stats_pages_free;
+    g_stats_pages_free = slot;
+    pthread_mutex_unlock(&g_stats_pages_lock);
+}
+
 se_connection_t* se_connection_new(void) {
     se_connection_t* conn = (se_connection_t*)calloc(1, sizeof(se_connection_t));
     if (!conn) return NULL;
@@ -298,21 +798,36 @@ se_connection_t* se_connection_new(void) {
     conn->state = SE_STATE_DISCONNECTED;
     conn->socket_fd = -1;
     conn->tun_fd = -1;
+    conn->joining_fd = -1;
     
     pthread_mutex_init(&conn->lock, NULL);
     pthread_cond_init(&conn->cond, NULL);
+    pthread_mutex_init(&conn->send_lock, NULL);
+    pthread_mutex_init(&conn->tap_lock, NULL);
     
+    conn->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    conn->packet_pool = se_packet_pool_new();
     conn->send_queue = se_packet_queue_new(100);
     conn->recv_queue = se_packet_queue_new(100);
+    conn->latency[SE_LATENCY_TUN_TO_WIRE] = se_latency_new();
+    conn->latency[SE_LATENCY_WIRE_TO_TUN] = se_latency_new();
     
-    if (!conn->send_queue || !conn->recv_queue) {
+    pthread_mutex_init(&conn->stats_page_lock, NULL);
+    conn->stats_page = stats_page_acquire();
+    
+    if (conn->wakeup_fd < 0 || !conn->packet_pool || !conn->send_queue || !conn->recv_queue ||
+        !conn->latency[SE_LATENCY_TUN_TO_WIRE] || !conn->latency[SE_LATENCY_WIRE_TO_TUN] ||
+        !conn->stats_page || se_ring_init(&conn->recv_ring, SE_RECV_RING_SIZE) < 0) {
         se_connection_free(conn);
         return NULL;
     }
     
     // Generate random session ID
-    generate_random_bytes(conn->session_id, 16);
-    conn->session_key = (uint32_t)rand();
+    if (generate_random_bytes(conn->session_id, 16) < 0 ||
+        generate_random_bytes((uint8_t*)&conn->session_key, sizeof(conn->session_key)) < 0) {
+        se_connection_free(conn);
+        return NULL;
+    }
     
     LOGD("Created new connection context");
     return conn;
@@ -325,20 +840,143 @@ void se_connection_free(se_connection_t* conn) {
     
     se_packet_queue_free(conn->send_queue);
     se_packet_queue_free(conn->recv_queue);
+    se_packet_pool_free(conn->packet_pool);
+    se_ring_destroy(&conn->recv_ring);
+    se_latency_free(conn->latency[SE_LATENCY_TUN_TO_WIRE]);
+    se_latency_free(conn->latency[SE_LATENCY_WIRE_TO_TUN]);
+    stats_page_release(conn->stats_page);
+    if (conn->tap) {
+        munmap(conn->tap, conn->tap_size);
+    }
+    
+    if (conn->wakeup_fd >= 0) {
+        close(conn->wakeup_fd);
+    }
     
     pthread_mutex_destroy(&conn->lock);
     pthread_cond_destroy(&conn->cond);
+    pthread_mutex_destroy(&conn->send_lock);
+    pthread_mutex_destroy(&conn->stats_page_lock);
+    pthread_mutex_destroy(&conn->tap_lock);
     
     free(conn);
     LOGD("Freed connection context");
 }
 
+// Hand [tail, head) of the tap ring to on_packets_tapped, which releases
+// it. Records that arrive while a batch is out wait for the next
+// notification after its release.
+static void tap_notify(se_connection_t* conn) {
+    se_packet_tap_t* tap = conn->tap;
+    
+    if (__atomic_exchange_n(&conn->tap_notifying, true, __ATOMIC_ACQUIRE)) return;
+    
+    uint32_t head = __atomic_load_n(&tap->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = tap->tail;
+    if (head != tail && conn->on_packets_tapped) {
+        conn->on_packets_tapped(conn, tap, tail, head);
+    } else {
+        se_connection_release_packet_tap(conn, head);
+    }
+}
+
+// Copy a packet delivered to the TUN into the tap ring, dropping it if the
+// ring is full, and notify once enough packets or time have gone by
+void se_tap_packet(se_connection_t* conn, const struct iovec* iov, int iovcnt, size_t len) {
+    if (!__atomic_load_n(&conn->tap_enabled, __ATOMIC_ACQUIRE)) return;
+    
+    se_packet_tap_t* tap = conn->tap;
+    uint64_t now = se_latency_now();
+    bool notify = false;
+    
+    pthread_mutex_lock(&conn->tap_lock);
+    
+    uint32_t captured = len < tap->snap_len ? (uint32_t)len : tap->snap_len;
+    uint32_t size = ((uint32_t)sizeof(se_tap_record_t) + captured + SE_TAP_RECORD_ALIGN - 1) &
+                    ~(uint32_t)(SE_TAP_RECORD_ALIGN - 1);
+    uint32_t head = tap->head;
+    uint32_t offset = head & (tap->capacity - 1);
+    uint32_t skip = tap->capacity - offset < size ? tap->capacity - offset : 0;
+    
+    if (head - __atomic_load_n(&tap->tail, __ATOMIC_ACQUIRE) + skip + size > tap->capacity) {
+        __atomic_store_n(&tap->dropped, tap->dropped + 1, __ATOMIC_RELAXED);
+    } else {
+        uint8_t* data = (uint8_t*)tap + SE_TAP_HEADER_SIZE;
+        if (skip > 0) {
+            se_tap_record_t* filler = (se_tap_record_t*)(data + offset);
+            memset(filler, 0, sizeof(*filler));
+            filler->direction = SE_TAP_WRAP;
+            offset = 0;
+        }
+    
+        se_tap_record_t* record = (se_tap_record_t*)(data + offset);
+        record->timestamp_ns = now;
+        record->length = len > UINT16_MAX ? UINT16_MAX : (uint16_t)len;
+        record->captured = (uint16_t)captured;
+        record->direction = SE_TAP_RECEIVED;
+        record->reserved = 0;
+    
+        uint8_t* out = (uint8_t*)(record + 1);
+        for (int i = 0; i < iovcnt && captured > 0; i++) {
+            size_t n = iov[i].iov_len < captured ? iov[i].iov_len : captured;
+            memcpy(out, iov[i].iov_base, n);
+            out += n;
+            captured -= (uint32_t)n;
+        }
+    
+        __atomic_store_n(&tap->head, head + skip + size, __ATOMIC_RELEASE);
+        __atomic_store_n(&tap->packets, tap->packets + 1, __ATOMIC_RELAXED);
+        conn->tap_pending++;
+    }
+    
+    if (conn->tap_pending > 0 && (conn->tap_pending >= conn->tap_notify_packets ||
+                                  now - conn->tap_notified_ns >= conn->tap_notify_ns)) {
+        conn->tap_pending = 0;
+        conn->tap_notified_ns = now;
+        notify = true;
+    }
+    
+    pthread_mutex_unlock(&conn->tap_lock);
+    
+    if (notify) tap_notify(conn);
+}
+
+// Notify about records that arrived too slowly to trigger it themselves.
+// Unless forced, only once the notification interval has passed.
+static void tap_flush(se_connection_t* conn, bool force) {
+    se_packet_tap_t* tap = __atomic_load_n(&conn->tap, __ATOMIC_ACQUIRE);
+    if (!tap) return;
+    
+    uint64_t now = se_latency_now();
+    bool notify = false;
+    
+    pthread_mutex_lock(&conn->tap_lock);
+    if (__atomic_load_n(&tap->tail, __ATOMIC_ACQUIRE) != tap->head &&
+        (force || now - conn->tap_notified_ns >= conn->tap_notify_ns)) {
+        conn->tap_pending = 0;
+        conn->tap_notified_ns = now;
+        notify = true;
+    }
+    pthread_mutex_unlock(&conn->tap_lock);
+    
+    if (notify) tap_notify(conn);
+}
+
+// Wake the send thread out of poll() so it re-checks its inputs
+static void wakeup_send_thread(se_connection_t* conn) {
+    if (conn->wakeup_fd < 0) return;
+    
+    uint64_t one = 1;
+    ssize_t n = write(conn->wakeup_fd, &one, sizeof(one));
+    (void)n;  // EAGAIN means a wakeup is already pending
+}
+
 // ============================================================================
 // Socket and Network Operations
 // ============================================================================
 
-static int create_socket(void) {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
+static int create_socket(int family) {
+    int fd = socket(family, SOCK_STREAM, 0);
     if (fd < 0) {
         LOGE("Failed to create socket: %s", strerror(errno));
         return -1;
@@ -361,866 +999,4307 @@ static int create_socket(void) {
     return fd;
 }
 
-static int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen, int timeout_ms) {
-    // Set non-blocking
-    int flags = fcntl(fd, F_GETFL, 0);
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-    
-    int result = connect(fd, addr, addrlen);
-    if (result < 0 && errno != EINPROGRESS) {
-        LOGE("Connect failed immediately: %s", strerror(errno));
-        return -1;
+// Order resolved addresses for Happy Eyeballs (RFC 8305 section 4): keep
+// the system's preference order but alternate address families, and set
+// the port. Returns the number of addresses stored.
+static int order_addresses(const struct sockaddr_storage* resolved, int resolved_count, int port,
+                           struct sockaddr_storage* addrs, int max_addrs) {
+    // Alternate families, IPv6 first (RFC 8305 section 4)
+    int count = 0;
+    int next[2] = { 0, 0 };
+    static const int families[2] = { AF_INET6, AF_INET };
+    bool take_v6 = true;
+    
+    while (count < max_addrs) {
+        // Advance each cursor to its next address of the right family
+        for (int f = 0; f < 2; f++) {
+            while (next[f] < resolved_count && resolved[next[f]].ss_family != families[f]) next[f]++;
+        }
+        
+        int f = take_v6 ? 0 : 1;
+        if (next[f] >= resolved_count) f = 1 - f;
+        if (next[f] >= resolved_count) break;
+        
+        addrs[count] = resolved[next[f]++];
+        if (addrs[count].ss_family == AF_INET6) {
+            ((struct sockaddr_in6*)&addrs[count])->sin6_port = htons(port);
+        } else {
+            ((struct sockaddr_in*)&addrs[count])->sin_port = htons(port);
+        }
+        count++;
+        take_v6 = !take_v6;
     }
     
-    if (result == 0) {
-        // Connected immediately
-        fcntl(fd, F_SETFL, flags);
+    return count;
+}
+
+// Resolve every A/AAAA record for hostname in Happy Eyeballs order.
+// Returns the number of addresses stored, 0 if resolution failed.
+static int resolve_addresses(const char* hostname, int port, struct sockaddr_storage* addrs, int max_addrs,
+                             int timeout_ms) {
+    struct sockaddr_storage resolved[SE_MAX_CONNECT_ATTEMPTS];
+    int resolved_count = se_dns_resolve(hostname, resolved, SE_MAX_CONNECT_ATTEMPTS, timeout_ms);
+    if (resolved_count <= 0) {
+        LOGE("Failed to resolve hostname %s: %s", hostname,
+             resolved_count == 0 ? "no addresses" :
+             resolved_count == SE_DNS_RESOLVE_FAILED ? "lookup failed" : "timed out");
         return 0;
     }
     
-    // Wait for connection with timeout
-    struct pollfd pfd;
-    pfd.fd = fd;
-    pfd.events = POLLOUT;
-    
-    result = poll(&pfd, 1, timeout_ms);
-    if (result <= 0) {
-        LOGE("Connection timeout or error: %s", result == 0 ? "timeout" : strerror(errno));
-        return -1;
-    }
-    
-    // Check if connection succeeded
-    int so_error;
-    socklen_t len = sizeof(so_error);
-    getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
-    
-    if (so_error != 0) {
-        LOGE("Connection failed: %s", strerror(so_error));
-        return -1;
+    return order_addresses(resolved, resolved_count, port, addrs, max_addrs);
+}
+
+static socklen_t sockaddr_len(const struct sockaddr_storage* addr) {
+    return addr->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+static void sockaddr_to_string(const struct sockaddr_storage* addr, char* buffer, size_t buffer_size) {
+    const void* src = addr->ss_family == AF_INET6
+        ? (const void*)&((const struct sockaddr_in6*)addr)->sin6_addr
+        : (const void*)&((const struct sockaddr_in*)addr)->sin_addr;
+    if (!inet_ntop(addr->ss_family, src, buffer, buffer_size)) {
+        snprintf(buffer, buffer_size, "?");
     }
-    
-    // Restore blocking mode
-    fcntl(fd, F_SETFL, flags);
-    
-    return 0;
 }
 
-static int resolve_and_connect(const char* hostname, int port, int timeout_ms) {
-    LOGD("Resolving %s:%d", hostname, port);
-    
-    struct hostent* host = gethostbyname(hostname);
-    if (!host || !host->h_addr_list[0]) {
-        LOGE("Failed to resolve hostname: %s", hostname);
+// Start a non-blocking connect for attempt index. Returns the socket, or
+// -1 with the attempt marked failed.
+static int start_connect_attempt(const struct sockaddr_storage* addr, se_connect_attempt_t* attempt,
+                                 uint64_t start_ms) {
+    attempt->family = addr->ss_family;
+    attempt->start_ms = (uint32_t)(get_time_ms() - start_ms);
+    attempt->error = -1;
+    sockaddr_to_string(addr, attempt->address, sizeof(attempt->address));
+    
+    int fd = create_socket(addr->ss_family);
+    if (fd < 0) {
+        attempt->error = errno;
         return -1;
     }
     
-    int fd = create_socket();
-    if (fd < 0) return -1;
-    
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    memcpy(&addr.sin_addr, host->h_addr_list[0], sizeof(struct in_addr));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
     
-    char ip_str[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &addr.sin_addr, ip_str, sizeof(ip_str));
-    LOGD("Connecting to %s:%d", ip_str, port);
-    
-    if (connect_with_timeout(fd, (struct sockaddr*)&addr, sizeof(addr), timeout_ms) < 0) {
+    if (connect(fd, (const struct sockaddr*)addr, sockaddr_len(addr)) < 0 && errno != EINPROGRESS) {
+        attempt->error = errno;
         close(fd);
         return -1;
     }
     
-    LOGD("Connected successfully");
     return fd;
 }
 
-// ============================================================================
-// SSL/TLS Operations (simplified - actual SSL implementation needed)
-// ============================================================================
+// Happy Eyeballs race (RFC 8305): start the next attempt every
+// SE_CONNECT_ATTEMPT_DELAY_MS, or as soon as one fails, and keep the first
+// socket to connect. Driven by race_connect for blocking connects and by
+// the connect loop for asynchronous ones.
+typedef struct {
+    const struct sockaddr_storage* addrs;
+    int count;
+    struct pollfd pending[SE_MAX_CONNECT_ATTEMPTS];
+    int pending_attempt[SE_MAX_CONNECT_ATTEMPTS];
+    int pending_count;
+    int next;                    // Next address to try
+    uint64_t start_ms;
+    uint64_t deadline;
+    uint64_t next_start;
+    se_connect_report_t* report;
+} se_race_t;
 
-// Note: Full SSL implementation would require OpenSSL
-// This is a simplified version for the protocol structure
+#define SE_RACE_RUNNING     -1
+#define SE_RACE_FAILED      -2
 
-static se_ssl_context_t* ssl_context_new(int socket_fd, bool verify_cert) {
-    se_ssl_context_t* ctx = (se_ssl_context_t*)calloc(1, sizeof(se_ssl_context_t));
-    if (!ctx) return NULL;
-    
-    ctx->socket_fd = socket_fd;
-    ctx->is_initialized = false;
-    
-    // TODO: Initialize actual SSL context here
-    // For now, we just store the socket fd
-    
-    return ctx;
+static void race_init(se_race_t* race, const struct sockaddr_storage* addrs, int count, int timeout_ms,
+                      se_connect_report_t* report) {
+    memset(race, 0, sizeof(*race));
+    race->addrs = addrs;
+    race->count = count > SE_MAX_CONNECT_ATTEMPTS ? SE_MAX_CONNECT_ATTEMPTS : count;
+    race->start_ms = get_time_ms();
+    race->deadline = race->start_ms + (uint64_t)timeout_ms;
+    race->next_start = race->start_ms;
+    race->report = report;
 }
 
-static void ssl_context_free(se_ssl_context_t* ctx) {
-    if (!ctx) return;
-    
-    // TODO: Cleanup SSL context
-    
-    free(ctx);
+// When the race next needs attention without socket activity
+static uint64_t race_wake_ms(const se_race_t* race) {
+    uint64_t wake = race->deadline;
+    if (race->next < race->count && race->next_start < wake) wake = race->next_start;
+    return wake;
 }
 
-static int ssl_handshake(se_ssl_context_t* ctx) {
-    if (!ctx) return -1;
+// Start the attempts that are due, then wait up to the next wake time
+// (not at all unless block) for pending sockets.
+// Returns the connected socket, SE_RACE_RUNNING or SE_RACE_FAILED.
+static int race_step(se_race_t* race, bool block) {
+    se_connect_report_t* report = race->report;
+    uint64_t now = get_time_ms();
+    if (now >= race->deadline) return SE_RACE_FAILED;
+    
+    while (race->next < race->count && (race->pending_count == 0 || now >= race->next_start)) {
+        int index = race->next++;
+        se_connect_attempt_t* attempt = &report->attempts[index];
+        report->attempt_count = race->next;
+        
+        int fd = start_connect_attempt(&race->addrs[index], attempt, race->start_ms);
+        now = get_time_ms();
+        if (fd < 0) {
+            attempt->duration_ms = (uint32_t)(now - race->start_ms) - attempt->start_ms;
+            LOGD("Connect to %s failed: %s", attempt->address, strerror(attempt->error));
+            race->next_start = now;  // Failed outright; move straight on to the next address
+            continue;
+        }
+        
+        int i = race->pending_count++;
+        race->pending[i].fd = fd;
+        race->pending[i].events = POLLOUT;
+        race->pending[i].revents = 0;
+        race->pending_attempt[i] = index;
+        race->next_start = now + SE_CONNECT_ATTEMPT_DELAY_MS;
+    }
     
-    // TODO: Perform actual SSL handshake
-    // For testing, we'll simulate success
+    if (race->pending_count == 0) return SE_RACE_FAILED;  // Every address failed
     
-    LOGD("SSL handshake (simulated)");
-    ctx->is_initialized = true;
+    uint64_t wake = race_wake_ms(race);
+    int ready = poll(race->pending, race->pending_count, block && wake > now ? (int)(wake - now) : 0);
+    if (ready < 0 && errno != EINTR) return SE_RACE_FAILED;
+    if (ready <= 0) return SE_RACE_RUNNING;
     
-    return 0;
-}
-
-static int ssl_read(se_ssl_context_t* ctx, uint8_t* buffer, size_t len) {
-    if (!ctx || ctx->socket_fd < 0) return -1;
+    for (int i = 0; i < race->pending_count; i++) {
+        if (!race->pending[i].revents) continue;
+        
+        int fd = race->pending[i].fd;
+        int index = race->pending_attempt[i];
+        se_connect_attempt_t* attempt = &report->attempts[index];
+        int so_error = 0;
+        socklen_t len = sizeof(so_error);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+        
+        attempt->duration_ms = (uint32_t)(get_time_ms() - race->start_ms) - attempt->start_ms;
+        attempt->error = so_error;
+        
+        race->pending[i] = race->pending[race->pending_count - 1];
+        race->pending_attempt[i] = race->pending_attempt[race->pending_count - 1];
+        race->pending_count--;
+        i--;
+        
+        if (so_error == 0) {
+            report->winner = index;
+            return fd;
+        }
+        
+        LOGD("Connect to %s failed: %s", attempt->address, strerror(so_error));
+        close(fd);
+        race->next_start = get_time_ms();  // Don't wait out the delay after a failure
+    }
     
-    // For now, just read directly from socket
-    // In real implementation, this would use SSL_read
-    return recv(ctx->socket_fd, buffer, len, 0);
+    if (race->pending_count == 0 && race->next >= race->count) return SE_RACE_FAILED;
+    return SE_RACE_RUNNING;
 }
 
-static int ssl_write(se_ssl_context_t* ctx, const uint8_t* data, size_t len) {
-    if (!ctx || ctx->socket_fd < 0) return -1;
+// Abandon the attempts that lost the race (error stays -1)
+static void race_end(se_race_t* race) {
+    se_connect_report_t* report = race->report;
+    
+    for (int i = 0; i < race->pending_count; i++) {
+        se_connect_attempt_t* attempt = &report->attempts[race->pending_attempt[i]];
+        attempt->duration_ms = (uint32_t)(get_time_ms() - race->start_ms) - attempt->start_ms;
+        close(race->pending[i].fd);
+    }
+    race->pending_count = 0;
     
-    // For now, just write directly to socket
-    // In real implementation, this would use SSL_write
-    return send(ctx->socket_fd, data, len, MSG_NOSIGNAL);
+    report->connect_ms = (uint32_t)(get_time_ms() - race->start_ms);
 }
 
-// ============================================================================
-// Protocol Functions
-// ============================================================================
-
-int se_protocol_send_hello(se_connection_t* conn) {
-    if (!conn || conn->socket_fd < 0) return -1;
+// Race connects to addrs. Returns the connected (blocking) socket or -1.
+static int race_connect(const struct sockaddr_storage* addrs, int count, int timeout_ms,
+                        se_connect_report_t* report) {
+    se_race_t race;
+    race_init(&race, addrs, count, timeout_ms, report);
+    
+    int winner_fd = SE_RACE_RUNNING;
+    while (winner_fd == SE_RACE_RUNNING) {
+        winner_fd = race_step(&race, true);
+    }
     
-    LOGD("Sending hello packet");
+    race_end(&race);
     
-    // Build hello packet
-    uint8_t hello[64];
-    memset(hello, 0, sizeof(hello));
+    if (winner_fd < 0) return -1;
     
-    // Protocol signature
-    hello[0] = 'S';
-    hello[1] = 'T';
-    hello[2] = 'V';
-    hello[3] = 'P';
+    fcntl(winner_fd, F_SETFL, fcntl(winner_fd, F_GETFL, 0) & ~O_NONBLOCK);
+    return winner_fd;
+}
+
+static int resolve_and_connect(const char* hostname, int port, int timeout_ms, se_connect_report_t* report) {
+    LOGD("Resolving %s:%d", hostname, port);
     
-    // Version
-    hello[4] = SE_VERSION_MAJOR;
-    hello[5] = SE_VERSION_MINOR;
-    hello[6] = (SE_VERSION_BUILD >> 8) & 0xFF;
-    hello[7] = SE_VERSION_BUILD & 0xFF;
+    memset(report, 0, sizeof(se_connect_report_t));
+    report->winner = -1;
     
-    // Client capabilities
-    hello[8] = conn->params.use_encrypt ? 1 : 0;
-    hello[9] = conn->params.use_compress ? 1 : 0;
+    uint64_t resolve_start = get_time_ms();
+    struct sockaddr_storage addrs[SE_MAX_CONNECT_ATTEMPTS];
+    int count = resolve_addresses(hostname, port, addrs, SE_MAX_CONNECT_ATTEMPTS, timeout_ms);
+    report->resolve_ms = (uint32_t)(get_time_ms() - resolve_start);
+    report->address_count = count;
     
-    // Session ID
-    memcpy(hello + 16, conn->session_id, 16);
+    if (count == 0) return -1;
     
-    // Write to socket
-    int result = ssl_write(conn->ssl_ctx, hello, sizeof(hello));
-    if (result != sizeof(hello)) {
-        LOGE("Failed to send hello: %d", result);
+    int remaining = timeout_ms - (int)report->resolve_ms;
+    if (remaining <= 0) {
+        LOGE("Connect timeout while resolving %s", hostname);
         return -1;
     }
     
-    LOGD("Hello packet sent");
-    return 0;
+    int fd = race_connect(addrs, count, remaining, report);
+    if (fd < 0) {
+        LOGE("Failed to connect to any of %d addresses for %s", count, hostname);
+        return -1;
+    }
+    
+    const se_connect_attempt_t* winner = &report->attempts[report->winner];
+    LOGD("Connected to %s:%d (attempt %d of %d, %u ms; resolve %u ms, total connect %u ms)",
+         winner->address, port, report->winner + 1, report->attempt_count,
+         winner->duration_ms, report->resolve_ms, report->connect_ms);
+    return fd;
 }
 
-int se_protocol_recv_hello(se_connection_t* conn) {
-    if (!conn || !conn->ssl_ctx) return -1;
-    
-    LOGD("Receiving hello response");
-    
-    uint8_t response[64];
-    int total = 0;
-    
-    while (total < 64) {
-        int n = ssl_read(conn->ssl_ctx, response + total, 64 - total);
-        if (n <= 0) {
-            LOGE("Failed to receive hello response: %d", n);
-            return -1;
+// ============================================================================
+// SSL/TLS Operations
+// ============================================================================
+
+static BIO_METHOD* g_ring_bio_method = NULL;
+static pthread_once_t g_ring_bio_once = PTHREAD_ONCE_INIT;
+
+// Follow record boundaries in the ciphertext handed to OpenSSL. With
+// read-ahead off OpenSSL reads exactly one record at a time, so this
+// matches the records it has processed.
+static void ssl_track_records(se_ssl_context_t* ctx, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        if (ctx->rx_body_left > 0) {
+            size_t n = len < ctx->rx_body_left ? len : ctx->rx_body_left;
+            ctx->rx_body_left -= n;
+            data += n;
+            len -= n;
+            if (ctx->rx_body_left == 0) ctx->rx_records++;
+            continue;
+        }
+        
+        ctx->rx_header[ctx->rx_header_len++] = *data++;
+        len--;
+        if (ctx->rx_header_len == sizeof(ctx->rx_header)) {
+            ctx->rx_header_len = 0;
+            ctx->rx_body_left = ((size_t)ctx->rx_header[3] << 8) | ctx->rx_header[4];
+            if (ctx->rx_body_left == 0) ctx->rx_records++;
         }
-        total += n;
     }
+}
+
+// Bytes still needed to complete the record OpenSSL is reading, 0 at a boundary
+static size_t ssl_record_remaining(const se_ssl_context_t* ctx) {
+    if (ctx->rx_header_len > 0) return sizeof(ctx->rx_header) - ctx->rx_header_len;
+    return ctx->rx_body_left;
+}
+
+// BIO read: hand OpenSSL ciphertext already sitting in net_in
+static int ring_bio_read(BIO* bio, char* out, int len) {
+    se_ssl_context_t* ctx = (se_ssl_context_t*)BIO_get_data(bio);
+    BIO_clear_retry_flags(bio);
     
-    // Verify signature
-    if (response[0] != 'S' || response[1] != 'T' || 
-        response[2] != 'V' || response[3] != 'P') {
-        LOGE("Invalid protocol signature in hello response");
+    if (len <= 0) return 0;
+    
+    size_t n = se_ring_peek(&ctx->net_in, 0, (uint8_t*)out, (size_t)len);
+    if (n == 0) {
+        BIO_set_retry_read(bio);
         return -1;
     }
     
-    // Get server version
-    conn->server_version = ((uint16_t)response[4] << 8) | response[5];
-    conn->server_build = ((uint16_t)response[6] << 8) | response[7];
-    
-    LOGD("Server version: %d.%d (build %d)", 
-         conn->server_version >> 8, conn->server_version & 0xFF, conn->server_build);
+    if (ctx->ktls_rx_pending) {
+        ssl_track_records(ctx, (const uint8_t*)out, n);
+    }
     
-    return 0;
+    se_ring_consume(&ctx->net_in, n);
+    return (int)n;
 }
 
-int se_protocol_send_auth(se_connection_t* conn) {
-    if (!conn) return -1;
-    
-    LOGD("Sending authentication request");
-    
-    // Build auth packet
-    size_t username_len = strlen(conn->params.username);
-    size_t password_len = strlen(conn->params.password);
-    size_t hubname_len = strlen(conn->params.hub_name);
+// BIO write: queue encrypted records in net_out until the next flush
+static int ring_bio_write(BIO* bio, const char* in, int len) {
+    se_ssl_context_t* ctx = (se_ssl_context_t*)BIO_get_data(bio);
+    BIO_clear_retry_flags(bio);
     
-    size_t payload_len = 4 + username_len + 4 + password_len + 4 + hubname_len;
-    uint8_t* payload = (uint8_t*)malloc(payload_len);
-    if (!payload) return -1;
-    
-    size_t offset = 0;
-    
-    // Username length + data
-    payload[offset++] = (username_len >> 24) & 0xFF;
-    payload[offset++] = (username_len >> 16) & 0xFF;
-    payload[offset++] = (username_len >> 8) & 0xFF;
-    payload[offset++] = username_len & 0xFF;
-    memcpy(payload + offset, conn->params.username, username_len);
-    offset += username_len;
+    if (len <= 0) return 0;
     
-    // Password length + data
-    payload[offset++] = (password_len >> 24) & 0xFF;
-    payload[offset++] = (password_len >> 16) & 0xFF;
-    payload[offset++] = (password_len >> 8) & 0xFF;
-    payload[offset++] = password_len & 0xFF;
-    memcpy(payload + offset, conn->params.password, password_len);
-    offset += password_len;
+    pthread_mutex_lock(&ctx->out_lock);
     
-    // Hub name length + data
-    payload[offset++] = (hubname_len >> 24) & 0xFF;
-    payload[offset++] = (hubname_len >> 16) & 0xFF;
-    payload[offset++] = (hubname_len >> 8) & 0xFF;
-    payload[offset++] = hubname_len & 0xFF;
-    memcpy(payload + offset, conn->params.hub_name, hubname_len);
+    size_t total = 0;
+    while (total < (size_t)len) {
+        size_t space;
+        uint8_t* dst = se_ring_write_ptr(&ctx->net_out, &space);
+        if (space == 0) break;
+        
+        size_t n = (size_t)len - total < space ? (size_t)len - total : space;
+        memcpy(dst, in + total, n);
+        se_ring_commit(&ctx->net_out, n);
+        total += n;
+    }
     
-    // Create and send packet
-    se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_AUTH_REQUEST, 0, payload, payload_len);
-    free(payload);
+    pthread_mutex_unlock(&ctx->out_lock);
     
-    if (!packet) return -1;
+    if (total == 0) {
+        BIO_set_retry_write(bio);
+        return -1;
+    }
     
-    uint8_t buffer[SE_MAX_PACKET_SIZE];
-    int len = se_packet_serialize(packet, buffer, sizeof(buffer));
-    se_packet_free(packet);
+    return (int)total;
+}
+
+static long ring_bio_ctrl(BIO* bio, int cmd, long num, void* ptr) {
+    switch (cmd) {
+        case BIO_CTRL_FLUSH:
+            return 1;  // Flushed explicitly by ssl_flush_output
+        default:
+            return 0;
+    }
+}
+
+static void ring_bio_method_init(void) {
+    BIO_METHOD* method = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "se_ring");
+    if (!method) return;
+    
+    BIO_meth_set_read(method, ring_bio_read);
+    BIO_meth_set_write(method, ring_bio_write);
+    BIO_meth_set_ctrl(method, ring_bio_ctrl);
+    g_ring_bio_method = method;
+}
+
+// Push everything queued in net_out to the socket
+static int ssl_flush_output(se_ssl_context_t* ctx) {
+    int result = 0;
     
-    if (len < 0) return -1;
+    pthread_mutex_lock(&ctx->out_lock);
     
-    int result = ssl_write(conn->ssl_ctx, buffer, len);
-    if (result != len) {
-        LOGE("Failed to send auth packet");
-        return -1;
+    while (se_ring_used(&ctx->net_out) > 0) {
+        size_t len;
+        const uint8_t* data = se_ring_read_ptr(&ctx->net_out, &len);
+        
+        ssize_t n = send(ctx->socket_fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // Non-blocking: leave the rest queued until the socket is writable
+            if (ctx->nonblocking && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            result = -1;
+            break;
+        }
+        se_ring_consume(&ctx->net_out, (size_t)n);
     }
     
-    LOGD("Authentication request sent");
-    return 0;
+    pthread_mutex_unlock(&ctx->out_lock);
+    return result;
 }
 
-int se_protocol_recv_auth_response(se_connection_t* conn) {
-    if (!conn || !conn->ssl_ctx) return -1;
-    
-    LOGD("Receiving authentication response");
+// Bytes queued in net_out that the socket has not accepted yet
+static size_t ssl_pending_output(se_ssl_context_t* ctx) {
+    pthread_mutex_lock(&ctx->out_lock);
+    size_t pending = se_ring_used(&ctx->net_out);
+    pthread_mutex_unlock(&ctx->out_lock);
+    return pending;
+}
+
+// Switch the socket between blocking and non-blocking I/O. Non-blocking
+// reads fail with EAGAIN; writes queue what the socket does not take.
+static int ssl_set_nonblocking(se_ssl_context_t* ctx, bool nonblocking) {
+    int flags = fcntl(ctx->socket_fd, F_GETFL, 0);
+    if (flags < 0) return -1;
     
-    // Read packet header
-    uint8_t header[12];
-    int total = 0;
+    flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    if (fcntl(ctx->socket_fd, F_SETFL, flags) < 0) return -1;
     
-    while (total < 12) {
-        int n = ssl_read(conn->ssl_ctx, header + total, 12 - total);
-        if (n <= 0) {
-            LOGE("Failed to receive auth response header");
+    ctx->nonblocking = nonblocking;
+    return 0;
+}
+
+// Receive as much ciphertext as fits into net_in (at most max_len bytes
+// when max_len is non-zero) with a single recv().
+// Returns bytes received, 0 on EOF, -1 on error or timeout.
+static int ssl_fill_input(se_ssl_context_t* ctx, int timeout_ms, size_t max_len) {
+    if (timeout_ms >= 0) {
+        struct pollfd pfd;
+        pfd.fd = ctx->socket_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready <= 0) {
+            if (ready == 0) errno = ETIMEDOUT;
             return -1;
         }
-        total += n;
     }
     
-    uint32_t type = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
-                    ((uint32_t)header[2] << 8) | (uint32_t)header[3];
-    uint32_t payload_len = ((uint32_t)header[8] << 24) | ((uint32_t)header[9] << 16) |
-                           ((uint32_t)header[10] << 8) | (uint32_t)header[11];
+    size_t space;
+    uint8_t* dst = se_ring_write_ptr(&ctx->net_in, &space);
+    if (space == 0) return -1;  // A record never exceeds the ring
+    if (max_len > 0 && space > max_len) space = max_len;
     
-    if (type != SE_PACKET_TYPE_AUTH_RESPONSE) {
-        LOGE("Unexpected packet type: %u", type);
-        return -1;
+    ssize_t n;
+    do {
+        n = recv(ctx->socket_fd, dst, space, 0);
+    } while (n < 0 && errno == EINTR);
+    
+    if (n > 0) {
+        se_ring_commit(&ctx->net_in, (size_t)n);
     }
     
-    // Read payload
-    if (payload_len > 0) {
-        uint8_t* payload = (uint8_t*)malloc(payload_len);
-        if (!payload) return -1;
+    return (int)n;
+}
+
+// Android keeps its trust store as one PEM file per CA, named with a hash
+// OpenSSL's CApath lookup does not use, so load every file explicitly.
+static void ssl_load_system_cas(SSL_CTX* ssl_ctx) {
+    X509_STORE* store = SSL_CTX_get_cert_store(ssl_ctx);
+    DIR* dir = opendir(SE_SSL_CA_DIR);
+    if (!dir) {
+        SSL_CTX_set_default_verify_paths(ssl_ctx);
+        return;
+    }
+    
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
         
-        total = 0;
-        while (total < (int)payload_len) {
-            int n = ssl_read(conn->ssl_ctx, payload + total, payload_len - total);
-            if (n <= 0) {
-                free(payload);
-                return -1;
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", SE_SSL_CA_DIR, entry->d_name);
+        X509_STORE_load_file(store, path);
+    }
+    
+    closedir(dir);
+    ERR_clear_error();
+}
+
+// One client SSL_CTX per (verify, kTLS) combination, built on first use
+// and kept for the life of the process: the CA store is read once instead
+// of on every connect and transport, and every connection shares the same
+// session-cache hook.
+static SSL_CTX* g_shared_ctx[2][2];
+static pthread_mutex_t g_shared_ctx_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Returns a new reference to the shared context; release it with SSL_CTX_free
+static SSL_CTX* ssl_shared_ctx_get(bool verify_cert, bool use_ktls) {
+    pthread_mutex_lock(&g_shared_ctx_lock);
+    
+    SSL_CTX* ssl_ctx = g_shared_ctx[verify_cert][use_ktls];
+    if (!ssl_ctx) {
+        ssl_ctx = SSL_CTX_new(TLS_client_method());
+        if (ssl_ctx) {
+            SSL_CTX_set_min_proto_version(ssl_ctx, TLS1_2_VERSION);
+            se_cipher_setup_ctx(ssl_ctx);  // AES-GCM or ChaCha20 first, by CPU
+            SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+            se_session_cache_setup_ctx(ssl_ctx);
+            if (use_ktls) {
+                se_ktls_setup_ctx(ssl_ctx);
             }
-            total += n;
-        }
-        
-        // Check auth result (first 4 bytes)
-        uint32_t auth_result = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) |
-                               ((uint32_t)payload[2] << 8) | (uint32_t)payload[3];
-        
-        free(payload);
-        
-        if (auth_result != 0) {
-            LOGE("Authentication failed: %u", auth_result);
-            return -1;
+            
+            if (verify_cert) {
+                ssl_load_system_cas(ssl_ctx);
+                SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER, NULL);
+            } else {
+                SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
+            }
+            g_shared_ctx[verify_cert][use_ktls] = ssl_ctx;
         }
     }
+    if (ssl_ctx) SSL_CTX_up_ref(ssl_ctx);
     
-    LOGD("Authentication successful");
-    return 0;
+    pthread_mutex_unlock(&g_shared_ctx_lock);
+    return ssl_ctx;
 }
 
-int se_protocol_send_dhcp_request(se_connection_t* conn) {
-    if (!conn) return -1;
-    
-    LOGD("Sending DHCP request");
+static void ssl_context_free(se_ssl_context_t* ctx);
+
+static se_ssl_context_t* ssl_context_new(int socket_fd, const char* hostname, int port,
+                                         bool verify_cert, bool use_ktls) {
+    pthread_once(&g_ring_bio_once, ring_bio_method_init);
+    if (!g_ring_bio_method) return NULL;
     
-    // Simple DHCP request
-    uint8_t request[16];
-    memset(request, 0, sizeof(request));
-    memcpy(request, conn->session_id, 16);
+    se_ssl_context_t* ctx = (se_ssl_context_t*)calloc(1, sizeof(se_ssl_context_t));
+    if (!ctx) return NULL;
     
-    se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_DHCP_REQUEST, 0, request, sizeof(request));
-    if (!packet) return -1;
+    ctx->socket_fd = socket_fd;
+    ctx->is_initialized = false;
+    ctx->ktls_wanted = use_ktls;
+    pthread_mutex_init(&ctx->ssl_lock, NULL);
+    pthread_mutex_init(&ctx->out_lock, NULL);
     
-    uint8_t buffer[SE_MAX_PACKET_SIZE];
-    int len = se_packet_serialize(packet, buffer, sizeof(buffer));
-    se_packet_free(packet);
+    if (se_ring_init(&ctx->net_in, SE_SSL_NET_IN_SIZE) < 0 ||
+        se_ring_init(&ctx->net_out, SE_SSL_NET_OUT_SIZE) < 0) {
+        ssl_context_free(ctx);
+        return NULL;
+    }
     
-    if (len < 0) return -1;
+    ctx->ctx = ssl_shared_ctx_get(verify_cert, use_ktls);
+    if (!ctx->ctx) {
+        ssl_context_free(ctx);
+        return NULL;
+    }
     
-    int result = ssl_write(conn->ssl_ctx, buffer, len);
-    if (result != len) {
-        LOGE("Failed to send DHCP request");
-        return -1;
+    ctx->ssl = SSL_new(ctx->ctx);
+    BIO* bio = BIO_new(g_ring_bio_method);
+    if (!ctx->ssl || !bio) {
+        BIO_free(bio);
+        ssl_context_free(ctx);
+        return NULL;
     }
     
-    return 0;
-}
-
-int se_protocol_recv_dhcp_response(se_connection_t* conn) {
-    if (!conn || !conn->ssl_ctx) return -1;
-    
-    LOGD("Receiving DHCP response");
+    BIO_set_data(bio, ctx);
+    BIO_set_init(bio, 1);
+    SSL_set_bio(ctx->ssl, bio, bio);
     
-    // Read packet header
-    uint8_t header[12];
-    int total = 0;
+    // Offer a cached session (ticket or PSK) for this server if we have one
+    se_session_cache_attach(ctx->ssl, hostname, port, verify_cert);
     
-    while (total < 12) {
-        int n = ssl_read(conn->ssl_ctx, header + total, 12 - total);
-        if (n <= 0) {
-            LOGE("Failed to receive DHCP response header");
-            return -1;
+    // SNI and hostname verification only make sense for names, not literals
+    struct in6_addr literal;
+    bool is_literal = inet_pton(AF_INET, hostname, &literal) == 1 ||
+                      inet_pton(AF_INET6, hostname, &literal) == 1;
+    if (!is_literal) {
+        SSL_set_tlsext_host_name(ctx->ssl, hostname);
+    }
+    if (verify_cert) {
+        if (is_literal) {
+            X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ctx->ssl), hostname);
+        } else {
+            SSL_set1_host(ctx->ssl, hostname);
         }
-        total += n;
     }
     
-    uint32_t type = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
-                    ((uint32_t)header[2] << 8) | (uint32_t)header[3];
-    uint32_t payload_len = ((uint32_t)header[8] << 24) | ((uint32_t)header[9] << 16) |
-                           ((uint32_t)header[10] << 8) | (uint32_t)header[11];
-    
-    if (type != SE_PACKET_TYPE_DHCP_RESPONSE) {
-        LOGE("Unexpected packet type: %u", type);
-        return -1;
-    }
+    return ctx;
+}
+
+static void ssl_context_free(se_ssl_context_t* ctx) {
+    if (!ctx) return;
     
-    // Read payload
-    if (payload_len >= 24) {
-        uint8_t* payload = (uint8_t*)malloc(payload_len);
-        if (!payload) return -1;
-        
-        total = 0;
-        while (total < (int)payload_len) {
-            int n = ssl_read(conn->ssl_ctx, payload + total, payload_len - total);
-            if (n <= 0) {
-                free(payload);
-                return -1;
+    if (ctx->ssl) {
+        if (ctx->is_initialized && ctx->ktls_tx) {
+            // OpenSSL's write state is stale once the kernel owns transmit
+            se_ktls_send_close_notify(ctx->socket_fd);
+        } else if (ctx->is_initialized) {
+            // Best-effort close_notify; never block on a dead peer here
+            SSL_shutdown(ctx->ssl);
+            size_t len;
+            const uint8_t* data = se_ring_read_ptr(&ctx->net_out, &len);
+            if (len > 0) {
+                send(ctx->socket_fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
             }
-            total += n;
         }
-        
-        // Parse network config
-        conn->net_config.client_ip = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) |
-                                     ((uint32_t)payload[2] << 8) | (uint32_t)payload[3];
-        conn->net_config.subnet_mask = ((uint32_t)payload[4] << 24) | ((uint32_t)payload[5] << 16) |
-                                       ((uint32_t)payload[6] << 8) | (uint32_t)payload[7];
-        conn->net_config.gateway = ((uint32_t)payload[8] << 24) | ((uint32_t)payload[9] << 16) |
-                                   ((uint32_t)payload[10] << 8) | (uint32_t)payload[11];
-        conn->net_config.dns1 = ((uint32_t)payload[12] << 24) | ((uint32_t)payload[13] << 16) |
-                                ((uint32_t)payload[14] << 8) | (uint32_t)payload[15];
-        
-        free(payload);
-        
-        char ip_str[16];
-        se_ip_int_to_string(conn->net_config.client_ip, ip_str, sizeof(ip_str));
-        LOGD("DHCP response received - IP: %s", ip_str);
+        SSL_free(ctx->ssl);
     }
+    SSL_CTX_free(ctx->ctx);  // Our reference; the shared context stays
     
-    return 0;
+    se_ring_destroy(&ctx->net_in);
+    se_ring_destroy(&ctx->net_out);
+    pthread_mutex_destroy(&ctx->ssl_lock);
+    pthread_mutex_destroy(&ctx->out_lock);
+    
+    free(ctx);
 }
 
-int se_protocol_send_keepalive(se_connection_t* conn) {
-    if (!conn || !conn->ssl_ctx) return -1;
+// Hand the record layer to the kernel after the handshake. Any failure
+// leaves the session on user-space TLS.
+static void ssl_enable_ktls(se_ssl_context_t* ctx) {
+    if (!se_ktls_cipher_supported(ctx->ssl)) {
+        LOGD("kTLS: %s %s cannot be offloaded, using user-space TLS",
+             SSL_get_version(ctx->ssl), SSL_get_cipher_name(ctx->ssl));
+        return;
+    }
     
-    se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_KEEPALIVE, 0, NULL, 0);
-    if (!packet) return -1;
+    if (se_ktls_attach(ctx->socket_fd) < 0) {
+        LOGD("kTLS unavailable (%s), using user-space TLS", strerror(errno));
+        return;
+    }
     
-    uint8_t buffer[64];
-    int len = se_packet_serialize(packet, buffer, sizeof(buffer));
-    se_packet_free(packet);
+    // In TLS 1.2 each side's Finished was record 0 under the new keys;
+    // TLS 1.3 application keys have not been used yet.
+    uint64_t seq = SSL_version(ctx->ssl) == TLS1_3_VERSION ? 0 : 1;
     
-    if (len < 0) return -1;
+    if (se_ktls_enable(ctx->ssl, ctx->socket_fd, true, seq) < 0) {
+        LOGD("kTLS transmit setup failed (%s), using user-space TLS", strerror(errno));
+        return;
+    }
     
-    int result = ssl_write(conn->ssl_ctx, buffer, len);
-    return (result == len) ? 0 : -1;
+    ctx->ktls_tx = true;
+    ctx->rx_seq_base = seq;
+    ctx->rx_records = 0;
+    ctx->ktls_rx_pending = true;
 }
 
-// ============================================================================
-// Thread Functions
-// ============================================================================
+// Switch receive to the kernel once OpenSSL has consumed everything read
+// from the socket and stopped at a record boundary. Waiting for the first
+// application data lets OpenSSL see the TLS 1.3 tickets the server sends
+// right after the handshake, so they still reach the session cache.
+static bool ssl_try_enable_ktls_rx(se_ssl_context_t* ctx) {
+    if (!ctx->rx_seen_data || se_ring_used(&ctx->net_in) > 0 || ssl_record_remaining(ctx) > 0) {
+        return false;
+    }
+    
+    ctx->ktls_rx_pending = false;
+    
+    uint64_t seq = ctx->rx_seq_base + ctx->rx_records;
+    if (se_ktls_enable(ctx->ssl, ctx->socket_fd, false, seq) < 0) {
+        LOGD("kTLS receive setup failed (%s), decrypting in user space", strerror(errno));
+        return false;
+    }
+    
+    __atomic_store_n(&ctx->ktls_rx, true, __ATOMIC_RELEASE);
+    LOGD("kTLS receive enabled at record %llu", (unsigned long long)seq);
+    return true;
+}
 
-void* se_recv_thread(void* arg) {
-    se_connection_t* conn = (se_connection_t*)arg;
-    if (!conn) return NULL;
+static int ssl_tls_mode(se_ssl_context_t* ctx) {
+    if (!ctx || !ctx->is_initialized) return SE_TLS_MODE_NONE;
+    if (!ctx->ktls_tx) return SE_TLS_MODE_USERSPACE;
+    return __atomic_load_n(&ctx->ktls_rx, __ATOMIC_ACQUIRE) ? SE_TLS_MODE_KTLS : SE_TLS_MODE_KTLS_TX;
+}
+
+// Only TLS 1.3 session tickets are expected after the handshake; anything
+// else (KeyUpdate in particular) needs OpenSSL and cannot be followed.
+static bool ktls_handshake_ignorable(const uint8_t* data, size_t len) {
+    while (len >= 4) {
+        size_t msg_len = ((size_t)data[1] << 16) | ((size_t)data[2] << 8) | data[3];
+        if (data[0] != 4) return false;  // new_session_ticket
+        if (msg_len > len - 4) break;
+        data += 4 + msg_len;
+        len -= 4 + msg_len;
+    }
+    return true;
+}
+
+// Read application data from a socket the kernel decrypts
+static int ktls_read(se_ssl_context_t* ctx, uint8_t* buffer, size_t len) {
+    while (true) {
+        uint8_t type;
+        ssize_t n = se_ktls_recv(ctx->socket_fd, buffer, len, &type);
+        if (n <= 0 || type == SE_TLS_RECORD_DATA) return (int)n;
+        
+        if (type == SE_TLS_RECORD_ALERT) {
+            if (n >= 2 && buffer[1] == 0) return 0;  // close_notify
+            LOGE("kTLS: received alert %d", n >= 2 ? buffer[1] : -1);
+            errno = ECONNRESET;
+            return -1;
+        }
+        
+        if (type != SE_TLS_RECORD_HANDSHAKE || !ktls_handshake_ignorable(buffer, (size_t)n)) {
+            LOGE("kTLS: unsupported record type %d after handshake", type);
+            errno = EPROTO;
+            return -1;
+        }
+    }
+}
+
+// Advance the handshake as far as the data received so far allows.
+// Returns 1 once it has completed and every record has been sent, 0 when
+// it has to wait for the socket (*want_read: for input rather than for
+// room to send), -1 on failure.
+static int ssl_handshake_step(se_ssl_context_t* ctx, bool* want_read) {
+    *want_read = false;
+    
+    if (!SSL_is_init_finished(ctx->ssl)) {
+        int result = SSL_connect(ctx->ssl);
+        if (result != 1) {
+            int error = SSL_get_error(ctx->ssl, result);
+            if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
+                unsigned long err = ERR_get_error();
+                LOGE("SSL handshake failed: %s", err ? ERR_error_string(err, NULL) : "connection closed");
+                return -1;
+            }
+            *want_read = error == SSL_ERROR_WANT_READ;
+        }
+    }
     
-    LOGD("Receive thread started");
+    if (ssl_flush_output(ctx) < 0) {
+        LOGE("SSL handshake send failed: %s", strerror(errno));
+        return -1;
+    }
     
-    uint8_t buffer[SE_MAX_PACKET_SIZE];
+    // Non-blocking sockets may still hold part of the last flight
+    if (!SSL_is_init_finished(ctx->ssl) || ssl_pending_output(ctx) > 0) return 0;
+    return 1;
+}
+
+// Bookkeeping once the handshake is done and net_out has drained
+static void ssl_handshake_complete(se_ssl_context_t* ctx, uint64_t start_ms) {
+    se_session_cache_handshake_done(ctx->ssl);
+    
+    LOGD("SSL handshake completed in %llu ms (%s, %s%s)",
+         (unsigned long long)(get_time_ms() - start_ms),
+         SSL_get_version(ctx->ssl), SSL_get_cipher_name(ctx->ssl),
+         SSL_session_reused(ctx->ssl) ? ", resumed" : "");
+    ctx->is_initialized = true;
     
-    while (conn->threads_running) {
-        // Read packet header
-        int total = 0;
-        while (total < 12 && conn->threads_running) {
-            int n = ssl_read(conn->ssl_ctx, buffer + total, 12 - total);
-            if (n <= 0) {
-                if (conn->threads_running) {
-                    LOGE("Receive error: %d", n);
-                    pthread_mutex_lock(&conn->lock);
-                    conn->state = SE_STATE_ERROR;
-                    conn->last_error = SE_ERR_NETWORK_ERROR;
-                    pthread_mutex_unlock(&conn->lock);
-                }
-                goto recv_thread_exit;
+    if (ctx->ktls_wanted) {
+        ssl_enable_ktls(ctx);
+    }
+}
+
+static int ssl_handshake(se_ssl_context_t* ctx) {
+    if (!ctx) return -1;
+    
+    uint64_t start_ms = get_time_ms();
+    
+    while (true) {
+        bool want_read;
+        int result = ssl_handshake_step(ctx, &want_read);
+        if (result == 1) break;
+        if (result < 0) return -1;
+        
+        if (want_read) {
+            int elapsed = (int)(get_time_ms() - start_ms);
+            int remaining = SE_HANDSHAKE_TIMEOUT_MS - elapsed;
+            errno = 0;
+            if (remaining <= 0 || ssl_fill_input(ctx, remaining, 0) <= 0) {
+                LOGE("SSL handshake receive failed: %s", errno ? strerror(errno) : "connection closed");
+                return -1;
             }
-            total += n;
         }
+    }
+    
+    ssl_handshake_complete(ctx, start_ms);
+    return 0;
+}
+
+static int ssl_read(se_ssl_context_t* ctx, uint8_t* buffer, size_t len) {
+    if (!ctx || ctx->socket_fd < 0) return -1;
+    if (ctx->ktls_rx) return ktls_read(ctx, buffer, len);
+    
+    while (true) {
+        size_t n = 0;
         
-        if (!conn->threads_running) break;
+        pthread_mutex_lock(&ctx->ssl_lock);
+        BIO* wbio = SSL_get_wbio(ctx->ssl);
+        uint64_t written = BIO_number_written(wbio);
+        int ok = SSL_read_ex(ctx->ssl, buffer, len, &n);
+        int error = ok ? SSL_ERROR_NONE : SSL_get_error(ctx->ssl, 0);
+        bool produced = BIO_number_written(wbio) != written;
+        pthread_mutex_unlock(&ctx->ssl_lock);
         
-        uint32_t type = ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) |
-                        ((uint32_t)buffer[2] << 8) | (uint32_t)buffer[3];
-        uint32_t payload_len = ((uint32_t)buffer[8] << 24) | ((uint32_t)buffer[9] << 16) |
-                               ((uint32_t)buffer[10] << 8) | (uint32_t)buffer[11];
-        
-        // Read payload
-        if (payload_len > 0) {
-            total = 0;
-            while (total < (int)payload_len && conn->threads_running) {
-                int n = ssl_read(conn->ssl_ctx, buffer + 12 + total, payload_len - total);
-                if (n <= 0) {
-                    LOGE("Receive payload error: %d", n);
-                    goto recv_thread_exit;
-                }
-                total += n;
+        // Reading occasionally produces records of our own (alerts, key updates)
+        if (produced) {
+            if (ctx->ktls_tx) {
+                LOGE("kTLS: OpenSSL needs to reply but the kernel owns transmit");
+                return -1;
             }
+            if (ssl_flush_output(ctx) < 0) return -1;
         }
         
-        if (!conn->threads_running) break;
+        if (ok) {
+            ctx->rx_seen_data = true;
+            return (int)n;
+        }
         
-        // Handle packet based on type
-        switch (type) {
-            case SE_PACKET_TYPE_DATA:
-                // Queue data packet
-                if (conn->tun_fd >= 0) {
-                    write(conn->tun_fd, buffer + 12, payload_len);
-                    pthread_mutex_lock(&conn->lock);
-                    conn->stats.bytes_received += payload_len;
-                    conn->stats.packets_received++;
-                    pthread_mutex_unlock(&conn->lock);
+        switch (error) {
+            case SSL_ERROR_WANT_READ: {
+                size_t max_len = 0;
+                if (ctx->ktls_rx_pending) {
+                    if (ssl_try_enable_ktls_rx(ctx)) return ktls_read(ctx, buffer, len);
+                    // Stop at the end of the current record so a boundary is reached
+                    max_len = ssl_record_remaining(ctx);
                 }
-                break;
                 
-            case SE_PACKET_TYPE_KEEPALIVE:
-                // Keepalive received, no action needed
+                // Wait for ciphertext without holding ssl_lock so writers proceed
+                int received = ssl_fill_input(ctx, -1, max_len);
+                if (received <= 0) return received;
                 break;
-                
-            case SE_PACKET_TYPE_DISCONNECT:
-                LOGD("Disconnect packet received");
-                goto recv_thread_exit;
-                
-            default:
-                LOGD("Unknown packet type: %u", type);
+            }
+            case SSL_ERROR_WANT_WRITE:
+                if (ssl_flush_output(ctx) < 0) return -1;
                 break;
+            case SSL_ERROR_ZERO_RETURN:
+                return 0;
+            default:
+                ERR_clear_error();
+                return -1;
         }
     }
-    
-recv_thread_exit:
-    LOGD("Receive thread exiting");
-    return NULL;
 }
 
-void* se_send_thread(void* arg) {
-    se_connection_t* conn = (se_connection_t*)arg;
-    if (!conn) return NULL;
-    
-    LOGD("Send thread started");
-    
-    uint8_t buffer[SE_MAX_PACKET_SIZE];
-    
-    while (conn->threads_running) {
-        // Read from TUN interface
-        if (conn->tun_fd >= 0) {
-            ssize_t len = read(conn->tun_fd, buffer + 12, SE_MAX_PACKET_SIZE - 12);
-            if (len > 0) {
-                // Build packet header
-                buffer[0] = 0; buffer[1] = 0; buffer[2] = 0; buffer[3] = SE_PACKET_TYPE_DATA;
-                buffer[4] = 0; buffer[5] = 0; buffer[6] = 0; buffer[7] = 0;
-                buffer[8] = (len >> 24) & 0xFF;
-                buffer[9] = (len >> 16) & 0xFF;
-                buffer[10] = (len >> 8) & 0xFF;
-                buffer[11] = len & 0xFF;
-                
-                // Send packet
-                int result = ssl_write(conn->ssl_ctx, buffer, 12 + len);
-                if (result == 12 + len) {
-                    pthread_mutex_lock(&conn->lock);
-                    conn->stats.bytes_sent += len;
-                    conn->stats.packets_sent++;
-                    pthread_mutex_unlock(&conn->lock);
-                }
-            }
+// Non-blocking kTLS transmit: send what the socket takes and keep the
+// rest as plaintext in net_out, which ssl_flush_output sends later.
+static int ktls_write_queued(se_ssl_context_t* ctx, const uint8_t* data, size_t len) {
+    size_t sent = 0;
+    
+    pthread_mutex_lock(&ctx->out_lock);
+    
+    if (se_ring_used(&ctx->net_out) == 0) {
+        ssize_t n;
+        do {
+            n = send(ctx->socket_fd, data, len, MSG_NOSIGNAL);
+        } while (n < 0 && errno == EINTR);
+        
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            pthread_mutex_unlock(&ctx->out_lock);
+            return -1;
         }
+        sent = n > 0 ? (size_t)n : 0;
+    }
+    
+    while (sent < len) {
+        size_t space;
+        uint8_t* dst = se_ring_write_ptr(&ctx->net_out, &space);
+        if (space == 0) break;
         
-        // Small delay to prevent busy waiting
-        usleep(1000);
+        size_t n = len - sent < space ? len - sent : space;
+        memcpy(dst, data + sent, n);
+        se_ring_commit(&ctx->net_out, n);
+        sent += n;
     }
     
-    LOGD("Send thread exiting");
-    return NULL;
+    pthread_mutex_unlock(&ctx->out_lock);
+    
+    if (sent == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return (int)sent;
 }
 
-void* se_keepalive_thread(void* arg) {
-    se_connection_t* conn = (se_connection_t*)arg;
-    if (!conn) return NULL;
+static int ssl_write(se_ssl_context_t* ctx, const uint8_t* data, size_t len) {
+    if (!ctx || ctx->socket_fd < 0) return -1;
     
-    LOGD("Keepalive thread started");
+    if (ctx->ktls_tx && ctx->nonblocking) return ktls_write_queued(ctx, data, len);
     
-    while (conn->threads_running) {
-        if (se_protocol_send_keepalive(conn) < 0) {
-            LOGE("Failed to send keepalive");
-            break;
-        }
+    if (ctx->ktls_tx) {
+        // The kernel frames and encrypts; no copy through net_out
+        ssize_t n;
+        do {
+            n = send(ctx->socket_fd, data, len, MSG_NOSIGNAL);
+        } while (n < 0 && errno == EINTR);
+        return (int)n;
+    }
+    
+    while (true) {
+        size_t n = 0;
         
-        // Sleep for keepalive interval
-        for (int i = 0; i < SE_KEEPALIVE_INTERVAL_MS / 100 && conn->threads_running; i++) {
-            usleep(100000);  // 100ms
+        pthread_mutex_lock(&ctx->ssl_lock);
+        int ok = SSL_write_ex(ctx->ssl, data, len, &n);
+        int error = ok ? SSL_ERROR_NONE : SSL_get_error(ctx->ssl, 0);
+        pthread_mutex_unlock(&ctx->ssl_lock);
+        
+        // Records were encrypted straight into net_out; push them out
+        if (ssl_flush_output(ctx) < 0) return -1;
+        
+        if (ok) return (int)n;
+        
+        if (error != SSL_ERROR_WANT_WRITE) {
+            ERR_clear_error();
+            return -1;
+        }
+        if (ctx->nonblocking && ssl_pending_output(ctx) > 0) {
+            // Callers in event loop mode keep writes well below net_out's size
+            errno = EAGAIN;
+            return -1;
         }
+        // net_out filled up mid-write: flushed above, retry with the same buffer
     }
+}
+
+// Write the whole buffer, retrying on short writes
+static int ssl_write_all(se_ssl_context_t* ctx, const uint8_t* data, size_t len) {
+    size_t total = 0;
     
-    LOGD("Keepalive thread exiting");
-    return NULL;
+    while (total < len) {
+        int n = ssl_write(ctx, data + total, len - total);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return -1;
+        }
+        total += n;
+    }
+    
+    return (int)total;
 }
 
 // ============================================================================
-// Main Connection Functions
+// Protocol Functions
 // ============================================================================
 
-int se_connection_connect(se_connection_t* conn, const se_connection_params_t* params) {
-    if (!conn || !params) {
-        LOGE("Invalid parameters");
-        return SE_ERR_INVALID_PARAM;
+// Compression algorithm to ask for: zlib unless the caller picked another
+static int compress_requested(const se_connection_params_t* params) {
+    if (params->compress_algorithm == SE_COMPRESS_LZ) return SE_COMPRESS_LZ;
+    return SE_COMPRESS_ZLIB;
+}
+
+static int protocol_send_hello(se_connection_t* conn, se_ssl_context_t* ssl_ctx) {
+    LOGD("Sending hello packet");
+    
+    // Build hello packet
+    uint8_t hello[64];
+    memset(hello, 0, sizeof(hello));
+    
+    // Protocol signature
+    hello[0] = 'S';
+    hello[1] = 'T';
+    hello[2] = 'V';
+    hello[3] = 'P';
+    
+    // Version
+    hello[4] = SE_VERSION_MAJOR;
+    hello[5] = SE_VERSION_MINOR;
+    hello[6] = (SE_VERSION_BUILD >> 8) & 0xFF;
+    hello[7] = SE_VERSION_BUILD & 0xFF;
+    
+    // Client capabilities
+    hello[8] = conn->params.use_encrypt ? 1 : 0;
+    hello[9] = conn->params.use_compress ? (uint8_t)compress_requested(&conn->params) : SE_COMPRESS_NONE;
+    hello[10] = (uint8_t)conn->params.max_connections;
+    hello[11] = conn->params.half_duplex ? 1 : 0;
+    
+    // UDP acceleration: preferred AEAD and our half of the key material
+    if (conn->params.use_udp_acceleration) {
+        hello[12] = se_cipher_prefer_aes_gcm() ? SE_UDP_AEAD_AES_256_GCM : SE_UDP_AEAD_CHACHA20_POLY1305;
+        memcpy(hello + 32, conn->udp_client_random, SE_UDP_RANDOM_SIZE);
     }
     
-    pthread_mutex_lock(&conn->lock);
+    // Session ID
+    memcpy(hello + 16, conn->session_id, 16);
     
-    if (conn->state != SE_STATE_DISCONNECTED) {
-        pthread_mutex_unlock(&conn->lock);
-        LOGE("Connection already in progress");
-        return SE_ERR_INVALID_PARAM;
+    // Write to socket
+    int result = ssl_write(ssl_ctx, hello, sizeof(hello));
+    if (result != sizeof(hello)) {
+        LOGE("Failed to send hello: %d", result);
+        return -1;
+    }
+    
+    LOGD("Hello packet sent");
+    return 0;
+}
+
+int se_protocol_send_hello(se_connection_t* conn) {
+    if (!conn || conn->socket_fd < 0) return -1;
+    return protocol_send_hello(conn, conn->ssl_ctx);
+}
+
+// Check the 64-byte hello response and take the server's offers from it
+static int protocol_parse_hello(se_connection_t* conn, se_ssl_context_t* ssl_ctx, const uint8_t* response) {
+    // Verify signature
+    if (response[0] != 'S' || response[1] != 'T' || 
+        response[2] != 'V' || response[3] != 'P') {
+        LOGE("Invalid protocol signature in hello response");
+        return -1;
+    }
+    
+    // Get server version
+    conn->server_version = ((uint16_t)response[4] << 8) | response[5];
+    conn->server_build = ((uint16_t)response[6] << 8) | response[7];
+    
+    // Connections the server accepts for this session; older servers send 0
+    conn->server_max_connections = response[10] > 0 ? response[10] : 1;
+    
+    // Compression the server agreed to; it may decline or pick zlib
+    if (ssl_ctx == conn->ssl_ctx && conn->params.use_compress &&
+        (response[9] == SE_COMPRESS_ZLIB || response[9] == SE_COMPRESS_LZ)) {
+        conn->compress_algorithm = response[9];
+    }
+    
+    // UDP offer: chosen AEAD, server port and the server's key material.
+    // Additional connections repeat the hello but not the offer.
+    if (ssl_ctx == conn->ssl_ctx && conn->params.use_udp_acceleration) {
+        conn->udp_aead = response[12];
+        conn->udp_port = ((uint16_t)response[14] << 8) | response[15];
+        memcpy(conn->udp_server_random, response + 32, SE_UDP_RANDOM_SIZE);
+    }
+    
+    LOGD("Server version: %d.%d (build %d)", 
+         conn->server_version >> 8, conn->server_version & 0xFF, conn->server_build);
+    
+    return 0;
+}
+
+static int protocol_recv_hello(se_connection_t* conn, se_ssl_context_t* ssl_ctx) {
+    LOGD("Receiving hello response");
+    
+    uint8_t response[64];
+    int total = 0;
+    
+    while (total < 64) {
+        int n = ssl_read(ssl_ctx, response + total, 64 - total);
+        if (n <= 0) {
+            LOGE("Failed to receive hello response: %d", n);
+            return -1;
+        }
+        total += n;
+    }
+    
+    return protocol_parse_hello(conn, ssl_ctx, response);
+}
+
+int se_protocol_recv_hello(se_connection_t* conn) {
+    if (!conn || !conn->ssl_ctx) return -1;
+    return protocol_recv_hello(conn, conn->ssl_ctx);
+}
+
+int se_protocol_send_auth(se_connection_t* conn) {
+    if (!conn) return -1;
+    
+    LOGD("Sending authentication request");
+    
+    // Build auth packet
+    size_t username_len = strlen(conn->params.username);
+    size_t password_len = strlen(conn->params.password);
+    size_t hubname_len = strlen(conn->params.hub_name);
+    
+    size_t payload_len = 4 + username_len + 4 + password_len + 4 + hubname_len;
+    uint8_t* payload = (uint8_t*)malloc(payload_len);
+    if (!payload) return -1;
+    
+    size_t offset = 0;
+    
+    // Username length + data
+    payload[offset++] = (username_len >> 24) & 0xFF;
+    payload[offset++] = (username_len >> 16) & 0xFF;
+    payload[offset++] = (username_len >> 8) & 0xFF;
+    payload[offset++] = username_len & 0xFF;
+    memcpy(payload + offset, conn->params.username, username_len);
+    offset += username_len;
+    
+    // Password length + data
+    payload[offset++] = (password_len >> 24) & 0xFF;
+    payload[offset++] = (password_len >> 16) & 0xFF;
+    payload[offset++] = (password_len >> 8) & 0xFF;
+    payload[offset++] = password_len & 0xFF;
+    memcpy(payload + offset, conn->params.password, password_len);
+    offset += password_len;
+    
+    // Hub name length + data
+    payload[offset++] = (hubname_len >> 24) & 0xFF;
+    payload[offset++] = (hubname_len >> 16) & 0xFF;
+    payload[offset++] = (hubname_len >> 8) & 0xFF;
+    payload[offset++] = hubname_len & 0xFF;
+    memcpy(payload + offset, conn->params.hub_name, hubname_len);
+    
+    // Create and send packet
+    se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_AUTH_REQUEST, 0, payload, payload_len);
+    free(payload);
+    
+    if (!packet) return -1;
+    
+    // Header goes into the packet headroom, so the frame is sent in place
+    uint8_t* frame;
+    int len = se_packet_frame(packet, &frame);
+    int result = ssl_write_all(conn->ssl_ctx, frame, len);
+    se_packet_free(packet);
+    
+    if (result != len) {
+        LOGE("Failed to send auth packet");
+        return -1;
+    }
+    
+    LOGD("Authentication request sent");
+    return 0;
+}
+
+// Check an auth response payload and keep the session key it carries.
+// An empty payload counts as success.
+static int protocol_parse_auth_response(se_connection_t* conn, const uint8_t* payload, size_t payload_len) {
+    if (payload_len >= 4) {
+        // Check auth result (first 4 bytes)
+        uint32_t auth_result = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) |
+                               ((uint32_t)payload[2] << 8) | (uint32_t)payload[3];
+        
+        // Session key that additional connections present to join
+        if (payload_len >= 8) {
+            conn->session_key = ((uint32_t)payload[4] << 24) | ((uint32_t)payload[5] << 16) |
+                                ((uint32_t)payload[6] << 8) | (uint32_t)payload[7];
+        }
+        
+        if (auth_result != 0) {
+            LOGE("Authentication failed: %u", auth_result);
+            return -1;
+        }
+    }
+    
+    LOGD("Authentication successful");
+    return 0;
+}
+
+int se_protocol_recv_auth_response(se_connection_t* conn) {
+    if (!conn || !conn->ssl_ctx) return -1;
+    
+    LOGD("Receiving authentication response");
+    
+    // Read packet header
+    uint8_t header[12];
+    int total = 0;
+    
+    while (total < 12) {
+        int n = ssl_read(conn->ssl_ctx, header + total, 12 - total);
+        if (n <= 0) {
+            LOGE("Failed to receive auth response header");
+            return -1;
+        }
+        total += n;
+    }
+    
+    uint32_t type = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+                    ((uint32_t)header[2] << 8) | (uint32_t)header[3];
+    uint32_t payload_len = ((uint32_t)header[8] << 24) | ((uint32_t)header[9] << 16) |
+                           ((uint32_t)header[10] << 8) | (uint32_t)header[11];
+    
+    if (type != SE_PACKET_TYPE_AUTH_RESPONSE) {
+        LOGE("Unexpected packet type: %u", type);
+        return -1;
+    }
+    
+    // Read payload
+    uint8_t* payload = NULL;
+    if (payload_len > 0) {
+        payload = (uint8_t*)malloc(payload_len);
+        if (!payload) return -1;
+        
+        total = 0;
+        while (total < (int)payload_len) {
+            int n = ssl_read(conn->ssl_ctx, payload + total, payload_len - total);
+            if (n <= 0) {
+                free(payload);
+                return -1;
+            }
+            total += n;
+        }
+    }
+    
+    int result = protocol_parse_auth_response(conn, payload, payload_len);
+    free(payload);
+    return result;
+}
+
+int se_protocol_send_dhcp_request(se_connection_t* conn) {
+    if (!conn) return -1;
+    
+    LOGD("Sending DHCP request");
+    
+    // Simple DHCP request
+    uint8_t request[16];
+    memset(request, 0, sizeof(request));
+    memcpy(request, conn->session_id, 16);
+    
+    se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_DHCP_REQUEST, 0, request, sizeof(request));
+    if (!packet) return -1;
+    
+    uint8_t* frame;
+    int len = se_packet_frame(packet, &frame);
+    int result = ssl_write_all(conn->ssl_ctx, frame, len);
+    se_packet_free(packet);
+    
+    if (result != len) {
+        LOGE("Failed to send DHCP request");
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Take the network configuration from a DHCP response payload
+static int protocol_parse_dhcp_response(se_connection_t* conn, const uint8_t* payload, size_t payload_len) {
+    if (payload_len < 24) return 0;
+    
+    // Parse network config
+    conn->net_config.client_ip = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) |
+                                 ((uint32_t)payload[2] << 8) | (uint32_t)payload[3];
+    conn->net_config.subnet_mask = ((uint32_t)payload[4] << 24) | ((uint32_t)payload[5] << 16) |
+                                   ((uint32_t)payload[6] << 8) | (uint32_t)payload[7];
+    conn->net_config.gateway = ((uint32_t)payload[8] << 24) | ((uint32_t)payload[9] << 16) |
+                               ((uint32_t)payload[10] << 8) | (uint32_t)payload[11];
+    conn->net_config.dns1 = ((uint32_t)payload[12] << 24) | ((uint32_t)payload[13] << 16) |
+                            ((uint32_t)payload[14] << 8) | (uint32_t)payload[15];
+    
+    char ip_str[16];
+    se_ip_int_to_string(conn->net_config.client_ip, ip_str, sizeof(ip_str));
+    LOGD("DHCP response received - IP: %s", ip_str);
+    
+    return 0;
+}
+
+int se_protocol_recv_dhcp_response(se_connection_t* conn) {
+    if (!conn || !conn->ssl_ctx) return -1;
+    
+    LOGD("Receiving DHCP response");
+    
+    // Read packet header
+    uint8_t header[12];
+    int total = 0;
+    
+    while (total < 12) {
+        int n = ssl_read(conn->ssl_ctx, header + total, 12 - total);
+        if (n <= 0) {
+            LOGE("Failed to receive DHCP response header");
+            return -1;
+        }
+        total += n;
+    }
+    
+    uint32_t type = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+                    ((uint32_t)header[2] << 8) | (uint32_t)header[3];
+    uint32_t payload_len = ((uint32_t)header[8] << 24) | ((uint32_t)header[9] << 16) |
+                           ((uint32_t)header[10] << 8) | (uint32_t)header[11];
+    
+    if (type != SE_PACKET_TYPE_DHCP_RESPONSE) {
+        LOGE("Unexpected packet type: %u", type);
+        return -1;
+    }
+    
+    // Read payload
+    if (payload_len >= 24) {
+        uint8_t* payload = (uint8_t*)malloc(payload_len);
+        if (!payload) return -1;
+        
+        total = 0;
+        while (total < (int)payload_len) {
+            int n = ssl_read(conn->ssl_ctx, payload + total, payload_len - total);
+            if (n <= 0) {
+                free(payload);
+                return -1;
+            }
+            total += n;
+        }
+        
+        protocol_parse_dhcp_response(conn, payload, payload_len);
+        free(payload);
+    }
+    
+    return 0;
+}
+
+int se_protocol_send_keepalive(se_connection_t* conn) {
+    if (!conn || !conn->ssl_ctx) return -1;
+    
+    se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_KEEPALIVE, 0, NULL, 0);
+    if (!packet) return -1;
+    
+    uint8_t buffer[64];
+    int len = se_packet_serialize(packet, buffer, sizeof(buffer));
+    se_packet_free(packet);
+    
+    if (len < 0) return -1;
+    
+    pthread_mutex_lock(&conn->send_lock);
+    int result = ssl_write_all(conn->ssl_ctx, buffer, len);
+    pthread_mutex_unlock(&conn->send_lock);
+    
+    return (result == len) ? 0 : -1;
+}
+
+// ============================================================================
+// Transport Connections
+// ============================================================================
+
+static void transport_free(se_transport_t* transport);
+
+static se_transport_t* transport_new(se_connection_t* conn, int index, int role) {
+    se_transport_t* transport = (se_transport_t*)calloc(1, sizeof(se_transport_t));
+    if (!transport) return NULL;
+    
+    transport->conn = conn;
+    transport->index = index;
+    transport->role = role;
+    transport->socket_fd = -1;
+    pthread_mutex_init(&transport->own_lock, NULL);
+    
+    if (index == 0) {
+        transport->socket_fd = conn->socket_fd;
+        transport->ssl_ctx = conn->ssl_ctx;
+        transport->recv_ring = &conn->recv_ring;
+        transport->send_lock = &conn->send_lock;
+    } else {
+        if (se_ring_init(&transport->own_ring, SE_RECV_RING_SIZE) < 0) {
+            pthread_mutex_destroy(&transport->own_lock);
+            free(transport);
+            return NULL;
+        }
+        transport->recv_ring = &transport->own_ring;
+        transport->send_lock = &transport->own_lock;
+    }
+    
+    // Each TLS stream carries its own compressed streams
+    if (conn->compress_algorithm != SE_COMPRESS_NONE) {
+        transport->compressor = se_compressor_new(conn->compress_algorithm, false);
+        transport->decompressor = se_compressor_new(conn->compress_algorithm, true);
+        if (!transport->compressor || !transport->decompressor) {
+            transport_free(transport);
+            return NULL;
+        }
+    }
+    
+    return transport;
+}
+
+// Transport 0's socket and SSL context belong to the connection
+static void transport_free(se_transport_t* transport) {
+    if (!transport) return;
+    
+    se_packet_queue_free(transport->send_queue);
+    se_compressor_free(transport->compressor);
+    se_compressor_free(transport->decompressor);
+    
+    if (transport->index > 0) {
+        ssl_context_free(transport->ssl_ctx);
+        if (transport->socket_fd >= 0) {
+            close(transport->socket_fd);
+        }
+        se_ring_destroy(&transport->own_ring);
+    }
+    
+    pthread_mutex_destroy(&transport->own_lock);
+    free(transport);
+}
+
+static int ssl_read_exact(se_ssl_context_t* ctx, uint8_t* buffer, size_t len) {
+    size_t total = 0;
+    
+    while (total < len) {
+        int n = ssl_read(ctx, buffer + total, len - total);
+        if (n <= 0) return -1;
+        total += n;
+    }
+    
+    return 0;
+}
+
+// Open one more TCP/TLS connection to the server and join it to the
+// authenticated session with the session ID and key.
+// Returns 0 on success, -1 on failure.
+static int transport_join(se_connection_t* conn, se_transport_t* transport) {
+    const se_connection_params_t* params = &conn->params;
+    se_connect_report_t report;
+    
+    // The resolver cache and TLS session cache make this much cheaper
+    // than the first connection, and the server has just answered
+    transport->socket_fd = resolve_and_connect(params->server_host, params->server_port,
+                                               SE_HANDSHAKE_TIMEOUT_MS, &report);
+    if (transport->socket_fd < 0) return -1;
+    
+    // Let a cancel shut the socket down instead of waiting the join out
+    pthread_mutex_lock(&conn->lock);
+    bool cancelled = conn->join_cancelled;
+    if (!cancelled) conn->joining_fd = transport->socket_fd;
+    pthread_mutex_unlock(&conn->lock);
+    if (cancelled) return -1;
+    
+    // Bound every blocking read and write of the join; cleared once joined
+    struct timeval timeout = { SE_HANDSHAKE_TIMEOUT_MS / 1000, 0 };
+    setsockopt(transport->socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(transport->socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    
+    transport->ssl_ctx = ssl_context_new(transport->socket_fd, params->server_host, params->server_port,
+                                         params->verify_server_cert, params->use_ktls);
+    if (!transport->ssl_ctx || ssl_handshake(transport->ssl_ctx) < 0) return -1;
+    
+    if (protocol_send_hello(conn, transport->ssl_ctx) < 0 ||
+        protocol_recv_hello(conn, transport->ssl_ctx) < 0) {
+        return -1;
+    }
+    
+    uint8_t request[21];
+    memcpy(request, conn->session_id, 16);
+    request[16] = (conn->session_key >> 24) & 0xFF;
+    request[17] = (conn->session_key >> 16) & 0xFF;
+    request[18] = (conn->session_key >> 8) & 0xFF;
+    request[19] = conn->session_key & 0xFF;
+    request[20] = (uint8_t)transport->role;
+    
+    se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_ADD_CONNECTION, 0, request, sizeof(request));
+    if (!packet) return -1;
+    
+    uint8_t* frame;
+    int len = se_packet_frame(packet, &frame);
+    int result = ssl_write_all(transport->ssl_ctx, frame, len);
+    se_packet_free(packet);
+    if (result != len) return -1;
+    
+    // The server answers with an auth response
+    uint8_t header[SE_FRAME_HEADER_SIZE];
+    uint8_t payload[64];
+    if (ssl_read_exact(transport->ssl_ctx, header, sizeof(header)) < 0) return -1;
+    
+    uint32_t type = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+                    ((uint32_t)header[2] << 8) | (uint32_t)header[3];
+    uint32_t payload_len = ((uint32_t)header[8] << 24) | ((uint32_t)header[9] << 16) |
+                           ((uint32_t)header[10] << 8) | (uint32_t)header[11];
+    
+    if (type != SE_PACKET_TYPE_AUTH_RESPONSE || payload_len < 4 || payload_len > sizeof(payload) ||
+        ssl_read_exact(transport->ssl_ctx, payload, payload_len) < 0) {
+        LOGE("Unexpected reply to additional connection: type=%u len=%u", type, payload_len);
+        return -1;
+    }
+    
+    uint32_t join_result = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) |
+                           ((uint32_t)payload[2] << 8) | (uint32_t)payload[3];
+    if (join_result != 0) {
+        LOGE("Server refused additional connection: %u", join_result);
+        return -1;
+    }
+    
+    struct timeval none = { 0, 0 };
+    setsockopt(transport->socket_fd, SOL_SOCKET, SO_RCVTIMEO, &none, sizeof(none));
+    setsockopt(transport->socket_fd, SOL_SOCKET, SO_SNDTIMEO, &none, sizeof(none));
+    return 0;
+}
+
+// Build the transport list: the authenticated connection plus as many
+// additional connections as both sides allow. An additional connection
+// that fails to join ends the attempt; the session runs with fewer.
+static int transports_open(se_connection_t* conn) {
+    int wanted = conn->params.max_connections;
+    if (wanted < 1) wanted = 1;
+    if (wanted > SE_MAX_CONNECTIONS) wanted = SE_MAX_CONNECTIONS;
+    if (wanted > conn->server_max_connections) wanted = conn->server_max_connections;
+    
+    bool half_duplex = conn->params.half_duplex && wanted > 1;
+    
+    se_transport_t* transports[SE_MAX_CONNECTIONS];
+    int count = 0;
+    
+    transports[0] = transport_new(conn, 0, SE_TRANSPORT_ROLE_BOTH);
+    if (!transports[0]) return -1;
+    count = 1;
+    
+    while (count < wanted) {
+        // Half-duplex: additional connections alternate download and upload;
+        // transport 0 keeps both directions for control frames
+        int role = !half_duplex ? SE_TRANSPORT_ROLE_BOTH
+                 : (count % 2 == 1 ? SE_TRANSPORT_ROLE_DOWNLOAD : SE_TRANSPORT_ROLE_UPLOAD);
+        
+        pthread_mutex_lock(&conn->lock);
+        bool cancelled = conn->join_cancelled;
+        pthread_mutex_unlock(&conn->lock);
+        if (cancelled) break;
+        
+        se_transport_t* transport = transport_new(conn, count, role);
+        if (!transport) break;
+        
+        int joined = transport_join(conn, transport);
+        
+        pthread_mutex_lock(&conn->lock);
+        conn->joining_fd = -1;
+        pthread_mutex_unlock(&conn->lock);
+        
+        if (joined < 0) {
+            LOGE("Additional connection %d failed to join, continuing with %d", count, count);
+            transport_free(transport);
+            break;
+        }
+        transports[count++] = transport;
+    }
+    
+    int upload_map[SE_MAX_CONNECTIONS];
+    int upload_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (transports[i]->role != SE_TRANSPORT_ROLE_DOWNLOAD) {
+            upload_map[upload_count++] = i;
+        }
+    }
+    
+    // Striping needs a queue per transport that carries client traffic
+    for (int i = 0; upload_count > 1 && i < upload_count; i++) {
+        se_transport_t* transport = transports[upload_map[i]];
+        transport->send_queue = se_packet_queue_new(SE_TRANSPORT_QUEUE_SIZE);
+        if (!transport->send_queue) {
+            for (int j = 0; j < count; j++) transport_free(transports[j]);
+            return -1;
+        }
+    }
+    
+    uint64_t now = get_time_ms();
+    for (int i = 0; i < count; i++) {
+        transports[i]->active = true;
+        transports[i]->start_ms = now;
+    }
+    
+    pthread_mutex_lock(&conn->lock);
+    memcpy(conn->transports, transports, sizeof(se_transport_t*) * count);
+    conn->transport_count = count;
+    memcpy(conn->upload_map, upload_map, sizeof(int) * upload_count);
+    conn->upload_count = upload_count;
+    pthread_mutex_unlock(&conn->lock);
+    
+    LOGD("Session uses %d connection(s)%s, %d carrying uploads", count,
+         half_duplex ? " in half-duplex" : "", upload_count);
+    return 0;
+}
+
+// Stop and free every transport. Runs in se_connection_disconnect after
+// the send, receive and keepalive threads of transport 0 are joined.
+static void transports_close(se_connection_t* conn) {
+    pthread_mutex_lock(&conn->lock);
+    se_transport_t* transports[SE_MAX_CONNECTIONS];
+    int count = conn->transport_count;
+    memcpy(transports, conn->transports, sizeof(se_transport_t*) * count);
+    pthread_mutex_unlock(&conn->lock);
+    
+    for (int i = 0; i < count; i++) {
+        se_transport_t* transport = transports[i];
+        
+        // The send thread has stopped, so this thread is now the only producer
+        if (transport->send_thread) {
+            se_packet_t* stop = se_packet_new(SE_PACKET_TYPE_DISCONNECT, 0, NULL, 0);
+            if (stop && se_packet_queue_push(transport->send_queue, stop, true) < 0) {
+                se_packet_free(stop);
+            }
+            pthread_join(transport->send_thread, NULL);
+            transport->send_thread = 0;
+        }
+        if (transport->recv_thread) {
+            pthread_join(transport->recv_thread, NULL);
+            transport->recv_thread = 0;
+        }
+    }
+    
+    pthread_mutex_lock(&conn->lock);
+    conn->transport_count = 0;
+    conn->upload_count = 0;
+    pthread_mutex_unlock(&conn->lock);
+    
+    for (int i = 0; i < count; i++) {
+        transport_free(transports[i]);
+    }
+}
+
+// ============================================================================
+// Thread Functions
+// ============================================================================
+
+// Mark the connection as failed from inside a worker thread
+static void recv_thread_fail(se_connection_t* conn, int error) {
+    if (!conn->threads_running) return;
+    
+    pthread_mutex_lock(&conn->lock);
+    conn->state = SE_STATE_ERROR;
+    conn->last_error = error;
+    conn->stats.errors++;
+    pthread_mutex_unlock(&conn->lock);
+}
+
+// Add to a transport's counters (read concurrently by the stats getter)
+static void transport_account(uint64_t* counter_bytes, uint64_t* counter_packets, uint64_t bytes, uint64_t packets) {
+    __atomic_fetch_add(counter_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(counter_packets, packets, __ATOMIC_RELAXED);
+}
+
+// Dispatch every complete frame buffered in the transport's ring. Returns
+// 0 to keep receiving, 1 when the server sent a disconnect, -1 on a
+// protocol error.
+static int recv_dispatch_frames(se_connection_t* conn, se_transport_t* transport) {
+    se_ring_t* ring = transport->recv_ring;
+    se_latency_histogram_t* latency = conn->latency[SE_LATENCY_WIRE_TO_TUN];
+    uint64_t bytes = 0;
+    uint64_t packets = 0;
+    uint64_t errors = 0;
+    int result = 0;
+    
+    // A frame left partial arrived with an earlier read; the rest with the last one
+    uint64_t header_ns = transport->frame_start_ns ? transport->frame_start_ns : transport->received_ns;
+    transport->frame_start_ns = 0;
+    
+    while (se_ring_used(ring) >= SE_FRAME_HEADER_SIZE) {
+        uint8_t header[SE_FRAME_HEADER_SIZE];
+        se_ring_peek(ring, 0, header, SE_FRAME_HEADER_SIZE);
+        
+        uint32_t type = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+                        ((uint32_t)header[2] << 8) | (uint32_t)header[3];
+        uint32_t flags = ((uint32_t)header[4] << 24) | ((uint32_t)header[5] << 16) |
+                         ((uint32_t)header[6] << 8) | (uint32_t)header[7];
+        uint32_t payload_len = ((uint32_t)header[8] << 24) | ((uint32_t)header[9] << 16) |
+                               ((uint32_t)header[10] << 8) | (uint32_t)header[11];
+        
+        if (payload_len > SE_MAX_FRAME_PAYLOAD) {
+            SE_TRACE(OVERSIZED_FRAME, type, payload_len);
+            if (transport->index == 0) {
+                recv_thread_fail(conn, SE_ERR_PROTOCOL_MISMATCH);
+            }
+            result = -1;
+            break;
+        }
+        
+        if (se_ring_used(ring) < SE_FRAME_HEADER_SIZE + payload_len) {
+            transport->frame_start_ns = header_ns;
+            break;  // Wait for the rest of the frame
+        }
+        
+        // Handle packet based on type
+        switch (type) {
+            case SE_PACKET_TYPE_DATA:
+                if (flags & SE_FRAME_FLAG_COMPRESSED) {
+                    // Decompress even without a TUN fd to keep the stream in step
+                    struct iovec iov[2];
+                    int iovcnt = se_ring_iov(ring, SE_FRAME_HEADER_SIZE, payload_len, iov);
+                    const uint8_t* packet = NULL;
+                    int len = transport->decompressor
+                        ? se_decompress(transport->decompressor, iov, iovcnt, &packet) : -1;
+                    if (len < 0) {
+                        SE_TRACE(BAD_COMPRESSED_FRAME, transport->index);
+                        if (transport->index == 0) {
+                            recv_thread_fail(conn, SE_ERR_PROTOCOL_MISMATCH);
+                        }
+                        result = -1;
+                        break;
+                    }
+                    if (conn->tun_fd >= 0) {
+                        ssize_t n = write(conn->tun_fd, packet, (size_t)len);
+                        if (n != len) {
+                            SE_TRACE(TUN_WRITE_ERROR, n, len);
+                            errors++;
+                            break;
+                        }
+                        struct iovec out = { (void*)packet, (size_t)len };
+                        se_tap_packet(conn, &out, 1, (size_t)len);
+                        se_latency_record(latency, se_latency_now() - header_ns, 1);
+                        bytes += (uint64_t)len;
+                        packets++;
+                    }
+                } else if (conn->tun_fd >= 0 && payload_len > 0) {
+                    // Payload may straddle the wrap point; writev keeps it one TUN packet
+                    struct iovec iov[2];
+                    int iovcnt = se_ring_iov(ring, SE_FRAME_HEADER_SIZE, payload_len, iov);
+                    ssize_t n = writev(conn->tun_fd, iov, iovcnt);
+                    if (n != (ssize_t)payload_len) {
+                        SE_TRACE(TUN_WRITE_ERROR, n, payload_len);
+                        errors++;
+                        break;
+                    }
+                    se_tap_packet(conn, iov, iovcnt, payload_len);
+                    se_latency_record(latency, se_latency_now() - header_ns, 1);
+                    bytes += payload_len;
+                    packets++;
+                }
+                break;
+                
+            case SE_PACKET_TYPE_KEEPALIVE:
+                // Keepalive received, no action needed
+                break;
+                
+            case SE_PACKET_TYPE_DISCONNECT:
+                LOGD("Disconnect packet received");
+                result = 1;
+                break;
+                
+            default:
+                SE_TRACE(UNKNOWN_PACKET, type);
+                break;
+        }
+        
+        if (result != 0) break;
+        se_ring_consume(ring, SE_FRAME_HEADER_SIZE + payload_len);
+        header_ns = transport->received_ns;
+    }
+    
+    if (packets > 0 || errors > 0) {
+        pthread_mutex_lock(&conn->lock);
+        conn->stats.bytes_received += bytes;
+        conn->stats.packets_received += packets;
+        conn->stats.errors += errors;
+        pthread_mutex_unlock(&conn->lock);
+        
+        transport_account(&transport->bytes_received, &transport->packets_received, bytes, packets);
+    }
+    
+    return result;
+}
+
+// Publish the switch to kernel receive once the SSL layer has made it
+static void recv_check_ktls_rx(se_connection_t* conn, bool* ktls_rx_pending) {
+    if (!*ktls_rx_pending || ssl_tls_mode(conn->ssl_ctx) != SE_TLS_MODE_KTLS) return;
+    
+    *ktls_rx_pending = false;
+    pthread_mutex_lock(&conn->lock);
+    conn->tls_mode = SE_TLS_MODE_KTLS;
+    pthread_mutex_unlock(&conn->lock);
+    LOGD("TLS record layer: %s", se_tls_mode_string(SE_TLS_MODE_KTLS));
+}
+
+// Receive loop of one transport. Losing transport 0 fails the session;
+// any other transport just stops carrying traffic.
+static void transport_receive(se_connection_t* conn, se_transport_t* transport) {
+    se_ring_t* ring = transport->recv_ring;
+    se_ring_reset(ring);
+    transport->frame_start_ns = 0;
+    
+    // Receive offload may switch on after the first few reads
+    bool ktls_rx_pending = ssl_tls_mode(transport->ssl_ctx) == SE_TLS_MODE_KTLS_TX;
+    
+    while (conn->threads_running) {
+        if (recv_dispatch_frames(conn, transport) != 0) break;
+        
+        // Refill with as much as the stream will give us in one read. A
+        // partial frame is at most SE_MAX_PACKET_SIZE, so space remains.
+        size_t space;
+        uint8_t* dst = se_ring_write_ptr(ring, &space);
+        
+        int n = ssl_read(transport->ssl_ctx, dst, space);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            if (conn->threads_running) {
+                SE_TRACE(RECEIVE_ERROR, transport->index, n);
+            }
+            if (transport->index == 0) {
+                recv_thread_fail(conn, SE_ERR_NETWORK_ERROR);
+            }
+            break;
+        }
+        se_ring_commit(ring, (size_t)n);
+        transport->received_ns = se_latency_now();
+        
+        if (transport->index == 0) {
+            recv_check_ktls_rx(conn, &ktls_rx_pending);
+        }
+    }
+    
+    transport->active = false;
+}
+
+void* se_recv_thread(void* arg) {
+    se_connection_t* conn = (se_connection_t*)arg;
+    if (!conn) return NULL;
+    
+    LOGD("Receive thread started");
+    transport_receive(conn, conn->transports[0]);
+    LOGD("Receive thread exiting");
+    return NULL;
+}
+
+// Receive thread of an additional transport
+static void* transport_recv_thread(void* arg) {
+    se_transport_t* transport = (se_transport_t*)arg;
+    transport_receive(transport->conn, transport);
+    LOGD("Connection %d receive thread exiting", transport->index);
+    return NULL;
+}
+
+// Send a batch of coalesced frames with a single ssl_write and account for
+// it, recording the latency of the TUN packets in it
+static int send_thread_flush(se_connection_t* conn, const uint8_t* batch, size_t len,
+                             uint64_t bytes, uint64_t packets, se_latency_batch_t* latency) {
+    if (len == 0) return 0;
+    
+    pthread_mutex_lock(&conn->send_lock);
+    int result = ssl_write_all(conn->ssl_ctx, batch, len);
+    pthread_mutex_unlock(&conn->send_lock);
+    
+    se_latency_record_batch(result == (int)len ? conn->latency[SE_LATENCY_TUN_TO_WIRE] : NULL,
+                            latency, se_latency_now());
+    
+    if (result != (int)len) {
+        if (conn->threads_running) {
+            SE_TRACE(SEND_ERROR, 0, errno);
+            pthread_mutex_lock(&conn->lock);
+            conn->state = SE_STATE_ERROR;
+            conn->last_error = SE_ERR_NETWORK_ERROR;
+            conn->stats.errors++;
+            pthread_mutex_unlock(&conn->lock);
+        }
+        return -1;
+    }
+    
+    pthread_mutex_lock(&conn->lock);
+    conn->stats.bytes_sent += bytes;
+    conn->stats.packets_sent += packets;
+    pthread_mutex_unlock(&conn->lock);
+    
+    se_transport_t* transport = conn->transports[0];
+    transport_account(&transport->bytes_sent, &transport->packets_sent, bytes, packets);
+    
+    return 0;
+}
+
+// Drain everything pending on the TUN fd and the send queue, coalescing
+// frames into as few ssl_write calls as the batch buffer allows
+static int send_thread_drain(se_connection_t* conn, int tun_fd, uint8_t* batch) {
+    size_t used = 0;
+    uint64_t bytes = 0;
+    uint64_t packets = 0;
+    bool tun_pending = tun_fd >= 0;
+    bool queue_pending = true;
+    se_latency_batch_t latency;
+    latency.count = 0;
+    
+    // With several upload connections transport 0's writer owns its compressor
+    se_compressor_t* compressor = conn->upload_count <= 1 ? conn->transports[0]->compressor : NULL;
+    
+    while ((tun_pending || queue_pending) && conn->threads_running) {
+        // Flush once another maximum-size frame might not fit
+        if (SE_SEND_BATCH_SIZE - used < SE_MAX_PACKET_SIZE) {
+            if (send_thread_flush(conn, batch, used, bytes, packets, &latency) < 0) return -1;
+            used = 0;
+            bytes = 0;
+            packets = 0;
+        }
+        
+        if (queue_pending) {
+            se_packet_t* packet = se_packet_queue_pop(conn->send_queue, false);
+            if (packet) {
+                int len = se_packet_serialize(packet, batch + used, SE_SEND_BATCH_SIZE - used);
+                if (len > 0 && packet->type == SE_PACKET_TYPE_DATA) {
+                    len = frame_compress(compressor, batch + used, packet->payload_len);
+                    if (len < 0) {
+                        se_packet_free(packet);
+                        recv_thread_fail(conn, SE_ERR_PROTOCOL_MISMATCH);
+                        return -1;
+                    }
+                }
+                if (len > 0) {
+                    used += len;
+                    bytes += packet->payload_len;
+                    packets++;
+                } else {
+                    SE_TRACE(PACKET_TOO_BIG, packet->payload_len);
+                }
+                se_packet_free(packet);
+                continue;
+            }
+            queue_pending = false;
+        }
+        
+        if (tun_pending) {
+            // Read straight into the batch, leaving room for the frame header
+            ssize_t len = read(tun_fd, batch + used + 12, SE_MAX_PACKET_SIZE - 12);
+            if (len > 0) {
+                se_latency_batch_add(&latency, se_latency_now());
+                write_frame_header(batch + used, SE_PACKET_TYPE_DATA, 0, (uint32_t)len);
+                int frame_len = frame_compress(compressor, batch + used, (size_t)len);
+                if (frame_len < 0) {
+                    recv_thread_fail(conn, SE_ERR_PROTOCOL_MISMATCH);
+                    return -1;
+                }
+                used += frame_len;
+                bytes += len;
+                packets++;
+            } else if (len < 0 && errno == EINTR) {
+                continue;
+            } else {
+                if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    SE_TRACE(TUN_READ_ERROR, errno);
+                }
+                tun_pending = false;
+            }
+        }
+    }
+    
+    return send_thread_flush(conn, batch, used, bytes, packets, &latency);
+}
+
+// Send a batch of frames read by send_thread_udp over UDP. After a socket
+// error, the frames from the first one the UDP socket refused to the end
+// of the batch go over TLS. A batch lost to a full device queue (nothing
+// sent) is dropped, as se_udp_channel_send reports it.
+static int send_thread_udp_batch(se_connection_t* conn, uint8_t* batch, size_t used,
+                                 struct iovec* payloads, int count, se_latency_batch_t* latency) {
+    int sent = se_udp_channel_send(conn->udp, SE_UDP_MSG_DATA, payloads, count);
+    if (sent == 0) return 0;
+    if (sent < 0) {
+        SE_TRACE(UDP_SEND_FAILED, errno);
+        sent = 0;
+    }
+    
+    // SE_UDP_BATCH fits the latency batch, so entries match datagrams
+    se_latency_batch_t rest;
+    rest.count = count - sent;
+    memcpy(rest.read_ns, latency->read_ns + sent, (size_t)rest.count * sizeof(rest.read_ns[0]));
+    memcpy(rest.packets, latency->packets + sent, (size_t)rest.count * sizeof(rest.packets[0]));
+    
+    if (sent > 0) {
+        uint64_t bytes = 0;
+        for (int i = 0; i < sent; i++) bytes += payloads[i].iov_len;
+        
+        latency->count = sent;
+        se_latency_record_batch(conn->latency[SE_LATENCY_TUN_TO_WIRE], latency, se_latency_now());
+        
+        pthread_mutex_lock(&conn->lock);
+        conn->stats.bytes_sent += bytes;
+        conn->stats.packets_sent += sent;
+        pthread_mutex_unlock(&conn->lock);
+    }
+    
+    if (sent == count) return 0;
+    
+    // The frames are contiguous, each behind its header
+    uint8_t* tail = (uint8_t*)payloads[sent].iov_base - SE_FRAME_HEADER_SIZE;
+    uint64_t bytes = 0;
+    for (int i = sent; i < count; i++) bytes += payloads[i].iov_len;
+    return send_thread_flush(conn, tail, (size_t)(batch + used - tail), bytes, count - sent, &rest);
+}
+
+// UDP counterpart of send_thread_drain: TUN packets go out in sendmmsg
+// batches. Queued control packets, packets too big for a datagram and
+// datagrams the UDP socket fails to send go over TLS. A packet too big
+// ends the batch, so it does not overtake the packets read before it.
+static int send_thread_udp(se_connection_t* conn, int tun_fd, uint8_t* batch) {
+    struct iovec payloads[SE_UDP_BATCH];
+    bool tun_pending = tun_fd >= 0;
+    se_latency_batch_t latency;
+    
+    while (tun_pending && conn->threads_running) {
+        size_t used = 0;
+        int count = 0;
+        size_t oversize = 0;
+        uint64_t oversize_ns = 0;
+        latency.count = 0;
+        
+        // Read each packet behind room for a frame header, so the batch can
+        // go over TLS as it is
+        while (count < SE_UDP_BATCH) {
+            uint8_t* frame = batch + used;
+            ssize_t len = read(tun_fd, frame + SE_FRAME_HEADER_SIZE, SE_MAX_PACKET_SIZE - SE_FRAME_HEADER_SIZE);
+            if (len > 0) {
+                uint64_t read_ns = se_latency_now();
+                write_frame_header(frame, SE_PACKET_TYPE_DATA, 0, (uint32_t)len);
+                if ((size_t)len > SE_UDP_MAX_PAYLOAD) {
+                    oversize = (size_t)len;
+                    oversize_ns = read_ns;
+                    break;
+                }
+                se_latency_batch_add(&latency, read_ns);
+                payloads[count].iov_base = frame + SE_FRAME_HEADER_SIZE;
+                payloads[count].iov_len = (size_t)len;
+                used += SE_FRAME_HEADER_SIZE + len;
+                count++;
+            } else if (len < 0 && errno == EINTR) {
+                continue;
+            } else {
+                if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    SE_TRACE(TUN_READ_ERROR, errno);
+                }
+                tun_pending = false;
+                break;
+            }
+        }
+        
+        if (count == 0 && oversize == 0) break;
+        
+        if (count > 0 && send_thread_udp_batch(conn, batch, used, payloads, count, &latency) < 0) return -1;
+        
+        if (oversize > 0) {
+            se_latency_batch_t single;
+            single.count = 0;
+            se_latency_batch_add(&single, oversize_ns);
+            if (send_thread_flush(conn, batch + used, SE_FRAME_HEADER_SIZE + oversize, oversize, 1, &single) < 0) {
+                return -1;
+            }
+        }
+    }
+    
+    // Control packets queued by se_connection_send_packet stay on TLS
+    return send_thread_drain(conn, -1, batch);
+}
+
+// ============================================================================
+// Multi-Connection Striping
+// ============================================================================
+
+static uint32_t hash_bytes(uint32_t hash, const uint8_t* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619u;  // FNV-1a
+    }
+    return hash;
+}
+
+// Hash the flow an IP packet belongs to: addresses and protocol, plus
+// ports for unfragmented TCP and UDP. Every packet of a flow maps to the
+// same transport, so striping never reorders a flow.
+uint32_t se_packet_flow_hash(const uint8_t* packet, size_t len) {
+    uint32_t hash = 2166136261u;
+    if (len < 1) return hash;
+    
+    size_t ports_offset = 0;
+    int protocol = -1;
+    
+    if ((packet[0] >> 4) == 4 && len >= 20) {
+        size_t header_len = (size_t)(packet[0] & 0x0F) * 4;
+        bool fragmented = (((packet[6] & 0x3F) << 8) | packet[7]) != 0;  // MF or offset
+        protocol = packet[9];
+        hash = hash_bytes(hash, packet + 12, 8);
+        if (!fragmented) ports_offset = header_len;
+    } else if ((packet[0] >> 4) == 6 && len >= 40) {
+        protocol = packet[6];
+        hash = hash_bytes(hash, packet + 8, 32);
+        ports_offset = 40;
+    }
+    
+    if (protocol >= 0) {
+        uint8_t proto = (uint8_t)protocol;
+        hash = hash_bytes(hash, &proto, 1);
+        if ((protocol == IPPROTO_TCP || protocol == IPPROTO_UDP) && ports_offset > 0 && len >= ports_offset + 4) {
+            hash = hash_bytes(hash, packet + ports_offset, 4);
+        }
+    }
+    
+    // Final avalanche so the low bits used for the modulo are well mixed
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+// Queue a packet on the transport its flow maps to. A transport that
+// dropped out hands its flows to the next live one; a full queue drops
+// the packet, like a router would.
+static void stripe_packet(se_connection_t* conn, se_packet_t* packet) {
+    uint32_t hash = se_packet_flow_hash(packet->payload, packet->payload_len);
+    
+    for (int i = 0; i < conn->upload_count; i++) {
+        se_transport_t* transport = conn->transports[conn->upload_map[(hash + i) % conn->upload_count]];
+        if (!transport->active) continue;
+        
+        if (se_packet_queue_push(transport->send_queue, packet, false) < 0) {
+            __atomic_fetch_add(&transport->drops, 1, __ATOMIC_RELAXED);
+            se_packet_free(packet);
+        }
+        return;
+    }
+    
+    se_packet_free(packet);  // No connection left to carry it
+}
+
+// Multi-connection counterpart of send_thread_drain: spread everything
+// pending on the send queue and the TUN fd over the transport queues
+static int send_thread_stripe(se_connection_t* conn, int tun_fd) {
+    size_t capacity = conn->params.mtu > 0 && conn->params.mtu <= SE_POOL_SMALL_PAYLOAD
+        ? SE_POOL_SMALL_PAYLOAD : SE_MAX_FRAME_PAYLOAD;
+    
+    while (conn->threads_running) {
+        se_packet_t* packet = se_packet_queue_pop(conn->send_queue, false);
+        if (packet) {
+            stripe_packet(conn, packet);
+            continue;
+        }
+        
+        if (tun_fd < 0) break;
+        
+        packet = se_packet_pool_alloc(conn->packet_pool, capacity);
+        if (!packet) return -1;
+        
+        ssize_t len = read(tun_fd, packet->payload, packet->capacity);
+        if (len <= 0) {
+            se_packet_free(packet);
+            if (len < 0 && errno == EINTR) continue;
+            if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                SE_TRACE(TUN_READ_ERROR, errno);
+            }
+            break;
+        }
+        
+        packet->type = SE_PACKET_TYPE_DATA;
+        packet->payload_len = (uint32_t)len;
+        packet->read_ns = se_latency_now();
+        stripe_packet(conn, packet);
+    }
+    
+    return 0;
+}
+
+// Send a transport's batch of coalesced frames with one ssl_write and
+// account for it. A failed write takes the transport out of the rotation.
+static int transport_flush(se_transport_t* transport, const uint8_t* batch, size_t len,
+                           uint64_t bytes, uint64_t packets, se_latency_batch_t* latency) {
+    se_connection_t* conn = transport->conn;
+    if (len == 0) return 0;
+    
+    pthread_mutex_lock(transport->send_lock);
+    int result = ssl_write_all(transport->ssl_ctx, batch, len);
+    pthread_mutex_unlock(transport->send_lock);
+    
+    se_latency_record_batch(result == (int)len ? conn->latency[SE_LATENCY_TUN_TO_WIRE] : NULL,
+                            latency, se_latency_now());
+    
+    if (result != (int)len) {
+        if (conn->threads_running) {
+            SE_TRACE(SEND_ERROR, transport->index, errno);
+            if (transport->index == 0) {
+                recv_thread_fail(conn, SE_ERR_NETWORK_ERROR);
+            }
+        }
+        transport->active = false;
+        return -1;
+    }
+    
+    pthread_mutex_lock(&conn->lock);
+    conn->stats.bytes_sent += bytes;
+    conn->stats.packets_sent += packets;
+    pthread_mutex_unlock(&conn->lock);
+    
+    transport_account(&transport->bytes_sent, &transport->packets_sent, bytes, packets);
+    return 0;
+}
+
+// Writer of one transport in multi-connection mode: coalesce whatever is
+// queued into as few ssl_write calls as the batch buffer allows. A packet
+// of type SE_PACKET_TYPE_DISCONNECT queued by se_connection_disconnect
+// stops it.
+static void* transport_send_thread(void* arg) {
+    se_transport_t* transport = (se_transport_t*)arg;
+    
+    uint8_t* batch = (uint8_t*)malloc(SE_SEND_BATCH_SIZE);
+    if (!batch) {
+        LOGE("Failed to allocate send batch buffer");
+        transport->active = false;
+    }
+    
+    bool running = true;
+    while (running) {
+        se_packet_t* packets[64];
+        size_t count = se_packet_queue_pop_batch(transport->send_queue, packets, 64, true);
+        
+        size_t used = 0;
+        uint64_t bytes = 0;
+        uint64_t sent = 0;
+        se_latency_batch_t latency;
+        latency.count = 0;
+        
+        for (size_t i = 0; i < count; i++) {
+            se_packet_t* packet = packets[i];
+            if (packet->type == SE_PACKET_TYPE_DISCONNECT) {
+                running = false;
+            } else if (batch && transport->active) {
+                // Flush once the frame might not fit, compressed at its worst
+                if (SE_SEND_BATCH_SIZE - used <
+                    SE_FRAME_HEADER_SIZE + packet->payload_len + SE_COMPRESS_MAX_EXPANSION) {
+                    transport_flush(transport, batch, used, bytes, sent, &latency);
+                    used = 0;
+                    bytes = 0;
+                    sent = 0;
+                }
+                
+                int len = 0;
+                if (transport->active) {
+                    len = se_packet_serialize(packet, batch + used, SE_SEND_BATCH_SIZE - used);
+                }
+                if (len < 0) {
+                    SE_TRACE(PACKET_TOO_BIG, packet->payload_len);
+                    __atomic_fetch_add(&transport->drops, 1, __ATOMIC_RELAXED);
+                } else if (len > 0 && packet->type == SE_PACKET_TYPE_DATA) {
+                    len = frame_compress(transport->compressor, batch + used, packet->payload_len);
+                    if (len < 0) {
+                        transport->active = false;
+                        if (transport->index == 0) {
+                            recv_thread_fail(transport->conn, SE_ERR_PROTOCOL_MISMATCH);
+                        }
+                    }
+                }
+                if (len > 0) {
+                    used += len;
+                    bytes += packet->payload_len;
+                    sent++;
+                    if (packet->read_ns) se_latency_batch_add(&latency, packet->read_ns);
+                }
+            }
+            se_packet_free(packet);
+        }
+        
+        transport_flush(transport, batch, used, bytes, sent, &latency);
+    }
+    
+    free(batch);
+    LOGD("Connection %d send thread exiting", transport->index);
+    return NULL;
+}
+
+void* se_send_thread(void* arg) {
+    se_connection_t* conn = (se_connection_t*)arg;
+    if (!conn) return NULL;
+    
+    LOGD("Send thread started");
+    
+    uint8_t* batch = (uint8_t*)malloc(SE_SEND_BATCH_SIZE);
+    if (!batch) {
+        LOGE("Failed to allocate send batch buffer");
+        return NULL;
+    }
+    
+    int tun_fd = -1;
+    
+    // Sleep in poll() until the TUN fd is readable or someone signals
+    // wakeup_fd (queued packet, TUN fd change or shutdown), then drain
+    // everything that is pending in one pass.
+    while (conn->threads_running) {
+        // Pick up TUN fd changes made through se_connection_set_tun_fd
+        if (conn->tun_fd != tun_fd) {
+            tun_fd = conn->tun_fd;
+            if (tun_fd >= 0) {
+                int flags = fcntl(tun_fd, F_GETFL, 0);
+                fcntl(tun_fd, F_SETFL, flags | O_NONBLOCK);
+            }
+        }
+        
+        struct pollfd pfds[2];
+        pfds[0].fd = conn->wakeup_fd;
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+        pfds[1].fd = tun_fd;  // Negative fds are ignored by poll()
+        pfds[1].events = POLLIN;
+        pfds[1].revents = 0;
+        
+        int ready = poll(pfds, 2, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            LOGE("Send poll error: %s", strerror(errno));
+            recv_thread_fail(conn, SE_ERR_NETWORK_ERROR);
+            break;
+        }
+        
+        if (pfds[0].revents & POLLIN) {
+            uint64_t value;
+            ssize_t n = read(conn->wakeup_fd, &value, sizeof(value));
+            (void)n;
+        }
+        
+        if (!conn->threads_running) break;
+        
+        if (pfds[1].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            LOGE("TUN interface closed");
+            recv_thread_fail(conn, SE_ERR_TUN_FAILED);
+            break;
+        }
+        
+        int result;
+        if (conn->udp_state == SE_UDP_STATE_ACTIVE) {
+            result = send_thread_udp(conn, tun_fd, batch);
+        } else if (conn->upload_count > 1) {
+            result = send_thread_stripe(conn, tun_fd);
+        } else {
+            result = send_thread_drain(conn, tun_fd, batch);
+        }
+        if (result < 0) break;
+    }
+    
+    free(batch);
+    
+    LOGD("Send thread exiting");
+    return NULL;
+}
+
+// Rate of a counter between two updates; counters that went backwards
+// were reset and count from zero
+static uint64_t stats_page_rate(uint64_t now, uint64_t before, uint64_t elapsed_ms) {
+    if (elapsed_ms == 0) return 0;
+    if (now < before) before = 0;
+    return (now - before) * 1000 / elapsed_ms;
+}
+
+// Republish the statistics page. Unless forced, only once the interval
+// has passed since the last update. Takes conn->lock briefly to read the
+// counters; readers of the page only ever see the seqlock.
+void se_stats_page_publish(se_connection_t* conn, bool force) {
+    se_stats_page_t* page = conn->stats_page;
+    if (!page) return;
+    
+    pthread_mutex_lock(&conn->stats_page_lock);
+    
+    uint64_t now = get_time_ms();
+    if (!force && now - conn->stats_page_ms < SE_STATS_PAGE_INTERVAL_MS) {
+        pthread_mutex_unlock(&conn->stats_page_lock);
+        return;
+    }
+    
+    se_stats_page_t next;
+    memset(&next, 0, sizeof(next));
+    
+    pthread_mutex_lock(&conn->lock);
+    
+    next.state = (uint64_t)conn->state;
+    next.bytes_sent = conn->stats.bytes_sent;
+    next.bytes_received = conn->stats.bytes_received;
+    next.packets_sent = conn->stats.packets_sent;
+    next.packets_received = conn->stats.packets_received;
+    next.errors = conn->stats.errors;
+    if (conn->state == SE_STATE_CONNECTED && conn->stats.start_time_ms > 0) {
+        next.uptime_ms = now - conn->stats.start_time_ms;
+    }
+    
+    next.send_queue = se_packet_queue_size(conn->send_queue);
+    next.recv_queue = se_packet_queue_size(conn->recv_queue);
+    for (int i = 0; i < conn->transport_count; i++) {
+        se_transport_t* transport = conn->transports[i];
+        next.drops += __atomic_load_n(&transport->drops, __ATOMIC_RELAXED);
+        next.send_queue += se_packet_queue_size(transport->send_queue);
+    }
+    
+    struct tcp_info info;
+    socklen_t info_len = sizeof(info);
+    if (conn->socket_fd >= 0 && getsockopt(conn->socket_fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0) {
+        next.rtt_us = info.tcpi_rtt;
+        next.rtt_var_us = info.tcpi_rttvar;
+    }
+    
+    next.connects = conn->connects;
+    next.reconnects = conn->connects > 1 ? conn->connects - 1 : 0;
+    next.connect_failures = conn->connect_history_count - conn->connects;
+    
+    pthread_mutex_unlock(&conn->lock);
+    
+    uint64_t elapsed = now - conn->stats_page_ms;
+    uint64_t* totals = conn->stats_page_totals;
+    bool state_changed = next.state != page->state;
+    bool bytes_changed = next.bytes_sent != totals[0] || next.bytes_received != totals[1];
+    if (elapsed == 0) {
+        next.send_rate = page->send_rate;
+        next.recv_rate = page->recv_rate;
+        next.send_packet_rate = page->send_packet_rate;
+        next.recv_packet_rate = page->recv_packet_rate;
+    } else {
+        next.send_rate = stats_page_rate(next.bytes_sent, totals[0], elapsed);
+        next.recv_rate = stats_page_rate(next.bytes_received, totals[1], elapsed);
+        next.send_packet_rate = stats_page_rate(next.packets_sent, totals[2], elapsed);
+        next.recv_packet_rate = stats_page_rate(next.packets_received, totals[3], elapsed);
+    }
+    totals[0] = next.bytes_sent;
+    totals[1] = next.bytes_received;
+    totals[2] = next.packets_sent;
+    totals[3] = next.packets_received;
+    next.update_ms = now;
+    conn->stats_page_ms = now;
+    
+    uint64_t* fields = &page->state;
+    const uint64_t* values = &next.state;
+    uint32_t sequence = page->sequence;
+    
+    __atomic_store_n(&page->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (uint32_t i = 0; i < page->field_count; i++) {
+        __atomic_store_n(&fields[i], values[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&page->sequence, sequence + 2, __ATOMIC_RELEASE);
+    
+    // Under the lock, so concurrent updates report in the order they published
+    if (state_changed && conn->on_state_changed) {
+        conn->on_state_changed(conn, (int)next.state);
+    }
+    if (bytes_changed && conn->on_bytes_transferred) {
+        conn->on_bytes_transferred(conn, next.bytes_sent, next.bytes_received);
+    }
+    
+    pthread_mutex_unlock(&conn->stats_page_lock);
+}
+
+static void transport_send_keepalive(se_transport_t* transport) {
+    if (!transport->active) return;
+    
+    uint8_t frame[SE_FRAME_HEADER_SIZE];
+    write_frame_header(frame, SE_PACKET_TYPE_KEEPALIVE, 0, 0);
+    
+    pthread_mutex_lock(transport->send_lock);
+    int result = ssl_write_all(transport->ssl_ctx, frame, sizeof(frame));
+    pthread_mutex_unlock(transport->send_lock);
+    
+    if (result != (int)sizeof(frame)) {
+        LOGE("Failed to send keepalive on connection %d", transport->index);
+        transport->active = false;
+    }
+}
+
+void* se_keepalive_thread(void* arg) {
+    se_connection_t* conn = (se_connection_t*)arg;
+    if (!conn) return NULL;
+    
+    LOGD("Keepalive thread started");
+    
+    while (conn->threads_running) {
+        if (se_protocol_send_keepalive(conn) < 0) {
+            LOGE("Failed to send keepalive");
+            break;
+        }
+        
+        // Additional connections need their own keepalives to stay open
+        for (int i = 1; i < conn->transport_count; i++) {
+            transport_send_keepalive(conn->transports[i]);
+        }
+        
+        // Sleep for keepalive interval, writing out data path traces meanwhile
+        for (int i = 0; i < SE_KEEPALIVE_INTERVAL_MS / 100 && conn->threads_running; i++) {
+            se_stats_page_publish(conn, false);
+            tap_flush(conn, false);
+            se_trace_log_pending();
+            usleep(100000);  // 100ms
+        }
+    }
+    
+    LOGD("Keepalive thread exiting");
+    return NULL;
+}
+
+// ============================================================================
+// UDP Acceleration
+// ============================================================================
+
+#define SE_UDP_RECV_BUDGET      8       // recvmmsg batches per wakeup
+
+// Open the UDP channel to the address the TLS connection reached. Without
+// one the session keeps all data on TLS.
+static void udp_open(se_connection_t* conn) {
+    conn->udp_state = SE_UDP_STATE_DISABLED;
+    conn->udp_fallbacks = 0;
+    if (!conn->params.use_udp_acceleration) return;
+    
+    if (conn->udp_aead == SE_UDP_AEAD_NONE || conn->udp_port == 0) {
+        LOGD("Server does not offer UDP acceleration");
+        return;
+    }
+    
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getpeername(conn->socket_fd, (struct sockaddr*)&addr, &addr_len) < 0) return;
+    
+    if (addr.ss_family == AF_INET6) {
+        ((struct sockaddr_in6*)&addr)->sin6_port = htons(conn->udp_port);
+    } else {
+        ((struct sockaddr_in*)&addr)->sin_port = htons(conn->udp_port);
+    }
+    
+    int fd = socket(addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, addr_len) < 0) {
+        LOGE("Failed to open UDP channel: %s", strerror(errno));
+        if (fd >= 0) close(fd);
+        return;
+    }
+    
+    int buffer_size = SE_SEND_BATCH_SIZE * 2;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    
+    se_udp_keys_t keys;
+    se_udp_derive_keys(conn->udp_client_random, conn->udp_server_random, true, &keys);
+    se_udp_channel_t* udp = se_udp_channel_new(fd, conn->udp_aead, &keys);
+    OPENSSL_cleanse(&keys, sizeof(keys));
+    
+    if (!udp) {
+        LOGE("Failed to create UDP channel");
+        close(fd);
+        return;
+    }
+    
+    pthread_mutex_lock(&conn->lock);
+    conn->udp = udp;
+    conn->udp_state = SE_UDP_STATE_PROBING;
+    pthread_mutex_unlock(&conn->lock);
+    
+    LOGD("UDP acceleration offered on port %u (%s)", conn->udp_port,
+         conn->udp_aead == SE_UDP_AEAD_AES_256_GCM ? "AES-256-GCM" : "ChaCha20-Poly1305");
+}
+
+static void udp_close(se_connection_t* conn) {
+    pthread_mutex_lock(&conn->lock);
+    se_udp_channel_t* udp = conn->udp;
+    conn->udp = NULL;
+    conn->udp_state = SE_UDP_STATE_DISABLED;
+    pthread_mutex_unlock(&conn->lock);
+    
+    se_udp_channel_free(udp);
+}
+
+// Move data between UDP and TLS as the UDP path starts or stops passing
+static void udp_update_state(se_connection_t* conn, uint64_t now) {
+    uint64_t last_rx = se_udp_channel_last_rx_ms(conn->udp);
+    bool passing = last_rx > 0 && (last_rx >= now || now - last_rx < SE_UDP_DEAD_MS);
+    
+    if (passing && conn->udp_state == SE_UDP_STATE_PROBING) {
+        conn->udp_state = SE_UDP_STATE_ACTIVE;
+        LOGD("UDP path is passing, sending data over UDP");
+    } else if (!passing && conn->udp_state == SE_UDP_STATE_ACTIVE) {
+        conn->udp_state = SE_UDP_STATE_PROBING;
+        __atomic_fetch_add(&conn->udp_fallbacks, 1, __ATOMIC_RELAXED);
+        LOGD("No UDP from the server for %d ms, falling back to TLS", SE_UDP_DEAD_MS);
+    }
+}
+
+typedef struct {
+    se_connection_t* conn;
+    uint64_t bytes;
+    uint64_t packets;
+    uint64_t errors;         // Failed or short TUN writes
+    uint64_t received_ns;    // When the current batch of datagrams was read
+} udp_rx_t;
+
+// Probes only refresh liveness; data goes to the TUN device
+static void udp_deliver(void* arg, uint8_t type, const uint8_t* payload, size_t len) {
+    udp_rx_t* rx = (udp_rx_t*)arg;
+    if (type != SE_UDP_MSG_DATA || len == 0 || rx->conn->tun_fd < 0) return;
+    
+    ssize_t n = write(rx->conn->tun_fd, payload, len);
+    if (n != (ssize_t)len) {
+        SE_TRACE(TUN_WRITE_ERROR, n, len);
+        rx->errors++;
+        return;
+    }
+    struct iovec out = { (void*)payload, len };
+    se_tap_packet(rx->conn, &out, 1, len);
+    se_latency_record(rx->conn->latency[SE_LATENCY_WIRE_TO_TUN], se_latency_now() - rx->received_ns, 1);
+    rx->bytes += len;
+    rx->packets++;
+}
+
+// Receive from the UDP channel and probe it every SE_UDP_PROBE_INTERVAL_MS.
+// The send thread follows conn->udp_state to pick UDP or TLS.
+void* se_udp_thread(void* arg) {
+    se_connection_t* conn = (se_connection_t*)arg;
+    if (!conn || !conn->udp) return NULL;
+    
+    LOGD("UDP thread started");
+    
+    se_udp_channel_t* udp = conn->udp;
+    uint64_t next_probe = 0;
+    
+    while (conn->threads_running) {
+        uint64_t now = get_time_ms();
+        if (now >= next_probe) {
+            struct iovec probe = { NULL, 0 };
+            se_udp_channel_send(udp, SE_UDP_MSG_PROBE, &probe, 1);
+            next_probe = now + SE_UDP_PROBE_INTERVAL_MS;
+        }
+        udp_update_state(conn, now);
+        
+        // Wake at least every 100ms to notice shutdown, like the keepalive thread
+        uint64_t wait = next_probe - now;
+        struct pollfd pfd = { se_udp_channel_fd(udp), POLLIN, 0 };
+        int ready = poll(&pfd, 1, wait < 100 ? (int)wait : 100);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            LOGE("UDP poll error: %s", strerror(errno));
+            break;
+        }
+        if (ready == 0) continue;
+        
+        udp_rx_t rx = { conn, 0, 0, 0, 0 };
+        for (int i = 0; i < SE_UDP_RECV_BUDGET; i++) {
+            rx.received_ns = se_latency_now();
+            int n = se_udp_channel_recv(udp, udp_deliver, &rx);
+            if (n < 0) {
+                SE_TRACE(UDP_RECEIVE_ERROR, errno);
+            }
+            if (n <= 0) break;
+        }
+        
+        if (rx.packets > 0 || rx.errors > 0) {
+            pthread_mutex_lock(&conn->lock);
+            conn->stats.bytes_received += rx.bytes;
+            conn->stats.packets_received += rx.packets;
+            conn->stats.errors += rx.errors;
+            pthread_mutex_unlock(&conn->lock);
+        }
+        udp_update_state(conn, get_time_ms());
+    }
+    
+    LOGD("UDP thread exiting");
+    return NULL;
+}
+
+// ============================================================================
+// Event Loop Mode
+// ============================================================================
+
+// In event loop mode a single thread does the work of the receive, send
+// and keepalive threads. It owns the socket, the SSL object, the TUN fd
+// and the receive ring outright, so nothing is locked per packet and a
+// packet crosses no thread boundary; conn->lock is only taken to publish
+// statistics once per batch.
+
+#define SE_LOOP_BATCH_SIZE      (SE_SEND_BATCH_SIZE / 2)  // Leaves net_out room for record overhead
+#define SE_LOOP_READ_BUDGET     16      // ssl_read calls per wakeup before serving the TUN
+#define SE_LOOP_CLOSE_FLUSH_MS  1000    // Wait for queued output when disconnecting
+
+enum {
+    SE_LOOP_WAKEUP,     // conn->wakeup_fd: queued packets, TUN fd change, shutdown
+    SE_LOOP_SOCKET,
+    SE_LOOP_TIMER,      // Keepalive timerfd
+    SE_LOOP_STATS,      // Statistics page timerfd
+    SE_LOOP_TUN
+};
+
+static int loop_watch(int epoll_fd, int op, int fd, int tag, uint32_t events) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.u32 = tag;
+    return epoll_ctl(epoll_fd, op, fd, &event);
+}
+
+// Change the events watched on fd only when they differ from *current
+static void loop_set_events(int epoll_fd, int fd, int tag, uint32_t events, uint32_t* current) {
+    if (events == *current) return;
+    if (loop_watch(epoll_fd, EPOLL_CTL_MOD, fd, tag, events) == 0) {
+        *current = events;
+    }
+}
+
+// Read and dispatch until the socket would block or the read budget is
+// spent. Returns 1 if input may still be buffered, 0 once drained, -1 to
+// stop the loop.
+static int loop_receive(se_connection_t* conn, bool* ktls_rx_pending) {
+    se_ring_t* ring = &conn->recv_ring;
+    se_transport_t* transport = conn->transports[0];
+    
+    for (int i = 0; i < SE_LOOP_READ_BUDGET; i++) {
+        size_t space;
+        uint8_t* dst = se_ring_write_ptr(ring, &space);
+        
+        int n = ssl_read(conn->ssl_ctx, dst, space);
+        if (n <= 0) {
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+            if (n < 0 && errno == EINTR) continue;
+            if (conn->threads_running) {
+                SE_TRACE(RECEIVE_ERROR, 0, n);
+            }
+            recv_thread_fail(conn, SE_ERR_NETWORK_ERROR);
+            return -1;
+        }
+        se_ring_commit(ring, (size_t)n);
+        transport->received_ns = se_latency_now();
+        
+        recv_check_ktls_rx(conn, ktls_rx_pending);
+        
+        if (recv_dispatch_frames(conn, transport) != 0) return -1;
+    }
+    
+    return 1;
+}
+
+// Fill one batch from the send queue and the TUN fd, led by a keepalive
+// frame if one is due, and hand it to the SSL layer. *more is set when
+// the batch filled up before the sources ran dry.
+// Returns 0 on success, -1 on a send error.
+static int loop_send(se_connection_t* conn, int tun_fd, uint8_t* batch, bool keepalive, bool* more) {
+    size_t used = 0;
+    uint64_t bytes = 0;
+    uint64_t packets = 0;
+    bool queue_pending = true;
+    bool tun_pending = tun_fd >= 0;
+    se_compressor_t* compressor = conn->transports[0]->compressor;
+    se_latency_batch_t latency;
+    latency.count = 0;
+    
+    if (keepalive) {
+        write_frame_header(batch, SE_PACKET_TYPE_KEEPALIVE, 0, 0);
+        used = SE_FRAME_HEADER_SIZE;
+    }
+    
+    *more = false;
+    while (queue_pending || tun_pending) {
+        if (SE_LOOP_BATCH_SIZE - used < SE_MAX_PACKET_SIZE) {
+            *more = true;
+            break;
+        }
+        
+        if (queue_pending) {
+            se_packet_t* packet = se_packet_queue_pop(conn->send_queue, false);
+            if (packet) {
+                int len = se_packet_serialize(packet, batch + used, SE_LOOP_BATCH_SIZE - used);
+                if (len > 0 && packet->type == SE_PACKET_TYPE_DATA) {
+                    len = frame_compress(compressor, batch + used, packet->payload_len);
+                    if (len < 0) {
+                        se_packet_free(packet);
+                        recv_thread_fail(conn, SE_ERR_PROTOCOL_MISMATCH);
+                        return -1;
+                    }
+                }
+                if (len > 0) {
+                    used += len;
+                    bytes += packet->payload_len;
+                    packets++;
+                } else {
+                    SE_TRACE(PACKET_TOO_BIG, packet->payload_len);
+                }
+                se_packet_free(packet);
+                continue;
+            }
+            queue_pending = false;
+        }
+        
+        if (tun_pending) {
+            ssize_t len = read(tun_fd, batch + used + SE_FRAME_HEADER_SIZE, SE_MAX_FRAME_PAYLOAD);
+            if (len > 0) {
+                se_latency_batch_add(&latency, se_latency_now());
+                write_frame_header(batch + used, SE_PACKET_TYPE_DATA, 0, (uint32_t)len);
+                int frame_len = frame_compress(compressor, batch + used, (size_t)len);
+                if (frame_len < 0) {
+                    recv_thread_fail(conn, SE_ERR_PROTOCOL_MISMATCH);
+                    return -1;
+                }
+                used += frame_len;
+                bytes += len;
+                packets++;
+            } else if (len < 0 && errno == EINTR) {
+                continue;
+            } else {
+                if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    SE_TRACE(TUN_READ_ERROR, errno);
+                }
+                tun_pending = false;
+            }
+        }
+    }
+    
+    if (used == 0) return 0;
+    
+    // The batch always fits net_out, so the write completes even when the
+    // socket takes none of it; the remainder goes out on EPOLLOUT
+    if (ssl_write_all(conn->ssl_ctx, batch, used) != (int)used) {
+        if (conn->threads_running) {
+            SE_TRACE(SEND_ERROR, 0, errno);
+        }
+        recv_thread_fail(conn, SE_ERR_NETWORK_ERROR);
+        return -1;
+    }
+    
+    // Sealed into records; whatever the socket did not take goes out on EPOLLOUT
+    se_latency_record_batch(conn->latency[SE_LATENCY_TUN_TO_WIRE], &latency, se_latency_now());
+    
+    if (packets > 0) {
+        pthread_mutex_lock(&conn->lock);
+        conn->stats.bytes_sent += bytes;
+        conn->stats.packets_sent += packets;
+        pthread_mutex_unlock(&conn->lock);
+        
+        se_transport_t* transport = conn->transports[0];
+        transport_account(&transport->bytes_sent, &transport->packets_sent, bytes, packets);
+    }
+    
+    return 0;
+}
+
+// Queue a disconnect frame and give the socket a moment to take it
+static void loop_send_disconnect(se_connection_t* conn) {
+    uint8_t frame[SE_FRAME_HEADER_SIZE];
+    write_frame_header(frame, SE_PACKET_TYPE_DISCONNECT, 0, 0);
+    if (ssl_write_all(conn->ssl_ctx, frame, sizeof(frame)) != (int)sizeof(frame)) return;
+    
+    uint64_t deadline = get_time_ms() + SE_LOOP_CLOSE_FLUSH_MS;
+    while (ssl_pending_output(conn->ssl_ctx) > 0) {
+        if (ssl_flush_output(conn->ssl_ctx) < 0) return;
+        if (ssl_pending_output(conn->ssl_ctx) == 0) return;
+        
+        uint64_t now = get_time_ms();
+        if (now >= deadline) return;
+        
+        struct pollfd pfd = { conn->socket_fd, POLLOUT, 0 };
+        poll(&pfd, 1, (int)(deadline - now));
+    }
+}
+
+void* se_event_loop_thread(void* arg) {
+    se_connection_t* conn = (se_connection_t*)arg;
+    if (!conn) return NULL;
+    
+    LOGD("Event loop started");
+    
+    uint8_t* batch = (uint8_t*)malloc(SE_LOOP_BATCH_SIZE);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    int stats_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    int tun_fd = -1;
+    uint32_t socket_events = EPOLLIN;
+    uint32_t tun_events = 0;
+    
+    if (!batch || epoll_fd < 0 || timer_fd < 0 || stats_fd < 0 ||
+        loop_watch(epoll_fd, EPOLL_CTL_ADD, conn->wakeup_fd, SE_LOOP_WAKEUP, EPOLLIN) < 0 ||
+        loop_watch(epoll_fd, EPOLL_CTL_ADD, conn->socket_fd, SE_LOOP_SOCKET, socket_events) < 0 ||
+        loop_watch(epoll_fd, EPOLL_CTL_ADD, timer_fd, SE_LOOP_TIMER, EPOLLIN) < 0 ||
+        loop_watch(epoll_fd, EPOLL_CTL_ADD, stats_fd, SE_LOOP_STATS, EPOLLIN) < 0 ||
+        ssl_set_nonblocking(conn->ssl_ctx, true) < 0) {
+        LOGE("Failed to set up event loop: %s", strerror(errno));
+        recv_thread_fail(conn, SE_ERR_OUT_OF_MEMORY);
+        goto loop_exit;
+    }
+    
+    // First keepalive right away, then every interval, like the keepalive thread
+    struct itimerspec keepalive_timer;
+    keepalive_timer.it_interval.tv_sec = SE_KEEPALIVE_INTERVAL_MS / 1000;
+    keepalive_timer.it_interval.tv_nsec = (SE_KEEPALIVE_INTERVAL_MS % 1000) * 1000000L;
+    keepalive_timer.it_value.tv_sec = 0;
+    keepalive_timer.it_value.tv_nsec = 1;
+    timerfd_settime(timer_fd, 0, &keepalive_timer, NULL);
+    
+    struct itimerspec stats_timer;
+    stats_timer.it_interval.tv_sec = SE_STATS_PAGE_INTERVAL_MS / 1000;
+    stats_timer.it_interval.tv_nsec = (SE_STATS_PAGE_INTERVAL_MS % 1000) * 1000000L;
+    stats_timer.it_value = stats_timer.it_interval;
+    timerfd_settime(stats_fd, 0, &stats_timer, NULL);
+    
+    se_ring_reset(&conn->recv_ring);
+    conn->transports[0]->frame_start_ns = 0;
+    
+    bool ktls_rx_pending = ssl_tls_mode(conn->ssl_ctx) == SE_TLS_MODE_KTLS_TX;
+    bool recv_more = false;      // Input left behind when the read budget ran out
+    bool send_more = true;       // The send queue or TUN may have packets
+    bool keepalive_due = false;
+    
+    while (conn->threads_running) {
+        // Pick up TUN fd changes made through se_connection_set_tun_fd
+        if (conn->tun_fd != tun_fd) {
+            if (tun_fd >= 0) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, tun_fd, NULL);
+            }
+            tun_fd = conn->tun_fd;
+            tun_events = 0;
+            if (tun_fd >= 0) {
+                int flags = fcntl(tun_fd, F_GETFL, 0);
+                fcntl(tun_fd, F_SETFL, flags | O_NONBLOCK);
+                loop_watch(epoll_fd, EPOLL_CTL_ADD, tun_fd, SE_LOOP_TUN, 0);
+            }
+            send_more = true;
+        }
+        
+        // While output is queued, stop taking packets from the TUN and
+        // wait for the socket to drain instead
+        bool output_pending = ssl_pending_output(conn->ssl_ctx) > 0;
+        loop_set_events(epoll_fd, conn->socket_fd, SE_LOOP_SOCKET,
+                        output_pending ? (EPOLLIN | EPOLLOUT) : EPOLLIN, &socket_events);
+        if (tun_fd >= 0) {
+            loop_set_events(epoll_fd, tun_fd, SE_LOOP_TUN, output_pending ? 0 : EPOLLIN, &tun_events);
+        }
+        
+        bool busy = recv_more || (send_more && !output_pending);
+        struct epoll_event events[4];
+        int ready = epoll_wait(epoll_fd, events, 4, busy ? 0 : -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            LOGE("Event loop wait error: %s", strerror(errno));
+            recv_thread_fail(conn, SE_ERR_NETWORK_ERROR);
+            break;
+        }
+        
+        for (int i = 0; i < ready; i++) {
+            uint64_t value;
+            ssize_t n;
+            
+            switch (events[i].data.u32) {
+                case SE_LOOP_WAKEUP:
+                    n = read(conn->wakeup_fd, &value, sizeof(value));
+                    (void)n;
+                    send_more = true;
+                    break;
+                    
+                case SE_LOOP_TIMER:
+                    n = read(timer_fd, &value, sizeof(value));
+                    (void)n;
+                    keepalive_due = true;
+                    se_trace_log_pending();
+                    break;
+                    
+                case SE_LOOP_STATS:
+                    n = read(stats_fd, &value, sizeof(value));
+                    (void)n;
+                    se_stats_page_publish(conn, true);
+                    tap_flush(conn, false);
+                    break;
+                    
+                case SE_LOOP_SOCKET:
+                    if (events[i].events & EPOLLOUT) {
+                        if (ssl_flush_output(conn->ssl_ctx) < 0) {
+                            SE_TRACE(SEND_ERROR, 0, errno);
+                            recv_thread_fail(conn, SE_ERR_NETWORK_ERROR);
+                            goto loop_exit;
+                        }
+                    }
+                    if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                        recv_more = true;
+                    }
+                    break;
+                    
+                case SE_LOOP_TUN:
+                    if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                        LOGE("TUN interface closed");
+                        recv_thread_fail(conn, SE_ERR_TUN_FAILED);
+                        goto loop_exit;
+                    }
+                    send_more = true;
+                    break;
+            }
+        }
+        
+        if (!conn->threads_running) break;
+        
+        if (recv_more) {
+            int result = loop_receive(conn, &ktls_rx_pending);
+            if (result < 0) goto loop_exit;
+            recv_more = result > 0;
+        }
+        
+        if ((send_more || keepalive_due) && ssl_pending_output(conn->ssl_ctx) == 0) {
+            if (loop_send(conn, tun_fd, batch, keepalive_due, &send_more) < 0) goto loop_exit;
+            keepalive_due = false;
+        }
+    }
+    
+    // se_connection_disconnect leaves the goodbye to the thread that owns the stream
+    if (!conn->threads_running) {
+        loop_send_disconnect(conn);
+    }
+    
+loop_exit:
+    if (timer_fd >= 0) close(timer_fd);
+    if (stats_fd >= 0) close(stats_fd);
+    if (epoll_fd >= 0) close(epoll_fd);
+    free(batch);
+    
+    LOGD("Event loop exiting");
+    return NULL;
+}
+
+// ============================================================================
+// Main Connection Functions
+// ============================================================================
+
+// Close the phase the connect is in at now and enter phase; entering
+// SE_CONNECT_PHASE_IDLE closes the last one. Needs conn->lock.
+static void connect_timing_enter_locked(se_connection_t* conn, int phase, uint64_t now) {
+    se_connect_timing_t* timing = &conn->connect_timing;
+    
+    if (conn->connect_phase != SE_CONNECT_PHASE_IDLE && now > conn->connect_phase_start_ms) {
+        timing->phase_ms[conn->connect_phase] += (uint32_t)(now - conn->connect_phase_start_ms);
+    }
+    conn->connect_phase = phase;
+    conn->connect_phase_start_ms = now;
+    if (phase != SE_CONNECT_PHASE_IDLE) timing->last_phase = phase;
+    timing->total_ms = (uint32_t)(now - timing->start_ms);
+}
+
+static void connect_timing_enter(se_connection_t* conn, int phase, uint64_t now) {
+    pthread_mutex_lock(&conn->lock);
+    connect_timing_enter_locked(conn, phase, now);
+    pthread_mutex_unlock(&conn->lock);
+}
+
+// Start timing a connect, in the resolve phase. Needs conn->lock.
+static void connect_timing_begin(se_connection_t* conn, bool async) {
+    memset(&conn->connect_timing, 0, sizeof(se_connect_timing_t));
+    conn->connect_timing.start_ms = get_time_ms();
+    conn->connect_timing.async = async;
+    conn->connect_phase = SE_CONNECT_PHASE_IDLE;
+    connect_timing_enter_locked(conn, SE_CONNECT_PHASE_RESOLVE, conn->connect_timing.start_ms);
+}
+
+// Record how a connect ended and add it to the history
+static void connect_timing_end(se_connection_t* conn, int result) {
+    pthread_mutex_lock(&conn->lock);
+    connect_timing_enter_locked(conn, SE_CONNECT_PHASE_IDLE, get_time_ms());
+    conn->connect_timing.result = result;
+    if (result == SE_ERR_SUCCESS) conn->connects++;
+    
+    se_connect_timing_t timing = conn->connect_timing;
+    conn->connect_history[conn->connect_history_count++ % SE_CONNECT_HISTORY_SIZE] = timing;
+    pthread_mutex_unlock(&conn->lock);
+    
+    se_stats_page_publish(conn, true);
+    
+    const uint32_t* ms = timing.phase_ms;
+    LOGD("Connect finished in %u ms (%s): resolve %u, tcp %u, tls %u, hello %u, auth %u, dhcp %u, session %u",
+         timing.total_ms, result == SE_CONNECT_CANCELLED ? "Cancelled" : se_error_string(result),
+         ms[SE_CONNECT_PHASE_RESOLVE], ms[SE_CONNECT_PHASE_TCP], ms[SE_CONNECT_PHASE_TLS],
+         ms[SE_CONNECT_PHASE_HELLO], ms[SE_CONNECT_PHASE_AUTH], ms[SE_CONNECT_PHASE_DHCP],
+         ms[SE_CONNECT_PHASE_SESSION]);
+}
+
+// Drop the TLS session and socket of a connect that failed
+static void connect_abort(se_connection_t* conn, int error) {
+    ssl_context_free(conn->ssl_ctx);
+    conn->ssl_ctx = NULL;
+    if (conn->socket_fd >= 0) {
+        close(conn->socket_fd);
+        conn->socket_fd = -1;
+    }
+    pthread_mutex_lock(&conn->lock);
+    conn->state = SE_STATE_ERROR;
+    conn->last_error = error;
+    pthread_mutex_unlock(&conn->lock);
+}
+
+// Last steps of both connect paths, once DHCP has answered: open the
+// additional connections and the UDP channel, start the threads and mark
+// the connection connected. Blocks while additional connections join.
+static int connect_start_session(se_connection_t* conn) {
+    // Step 6: Additional connections
+    if (transports_open(conn) < 0) {
+        connect_abort(conn, SE_ERR_OUT_OF_MEMORY);
+        return SE_ERR_OUT_OF_MEMORY;
+    }
+    
+    udp_open(conn);
+    
+    if (conn->params.use_event_loop && (conn->transport_count > 1 || conn->udp)) {
+        LOGD("Event loop drives a single TLS connection; using worker threads for %d connection(s)%s",
+             conn->transport_count, conn->udp ? " and UDP" : "");
+        conn->params.use_event_loop = false;
+    }
+    
+    // Step 7: Start threads
+    conn->threads_running = true;
+    conn->stats.start_time_ms = get_time_ms();
+    
+    if (conn->params.use_event_loop) {
+        LOGD("Starting event loop");
+        pthread_create(&conn->loop_thread, NULL, se_event_loop_thread, conn);
+    } else {
+        LOGD("Starting worker threads");
+        for (int i = 0; i < conn->transport_count; i++) {
+            se_transport_t* transport = conn->transports[i];
+            if (i > 0) {
+                pthread_create(&transport->recv_thread, NULL, transport_recv_thread, transport);
+            }
+            if (transport->send_queue) {
+                pthread_create(&transport->send_thread, NULL, transport_send_thread, transport);
+            }
+        }
+        pthread_create(&conn->recv_thread, NULL, se_recv_thread, conn);
+        pthread_create(&conn->send_thread, NULL, se_send_thread, conn);
+        pthread_create(&conn->keepalive_thread, NULL, se_keepalive_thread, conn);
+        if (conn->udp) {
+            pthread_create(&conn->udp_thread, NULL, se_udp_thread, conn);
+        }
+    }
+    
+    pthread_mutex_lock(&conn->lock);
+    conn->state = SE_STATE_CONNECTED;
+    conn->tls_mode = ssl_tls_mode(conn->ssl_ctx);
+    pthread_mutex_unlock(&conn->lock);
+    
+    LOGD("Connection established successfully (%s)", se_tls_mode_string(conn->tls_mode));
+    return SE_ERR_SUCCESS;
+}
+
+// Steps 1 to 7 of a blocking connect. Returns SE_ERR_*, with the
+// connection in SE_STATE_ERROR on failure.
+static int connect_blocking(se_connection_t* conn, const se_connection_params_t* params) {
+    // Step 1: Establish TCP connection
+    LOGD("Connecting to %s:%d", params->server_host, params->server_port);
+    
+    se_connect_report_t report;
+    uint64_t start_ms = get_time_ms();
+    conn->socket_fd = resolve_and_connect(params->server_host, params->server_port,
+                                          SE_CONNECT_TIMEOUT_MS, &report);
+    
+    pthread_mutex_lock(&conn->lock);
+    memcpy(&conn->connect_report, &report, sizeof(se_connect_report_t));
+    if (report.address_count > 0) {
+        connect_timing_enter_locked(conn, SE_CONNECT_PHASE_TCP, start_ms + report.resolve_ms);
+    }
+    pthread_mutex_unlock(&conn->lock);
+    
+    if (conn->socket_fd < 0) {
+        pthread_mutex_lock(&conn->lock);
+        conn->state = SE_STATE_ERROR;
+        conn->last_error = SE_ERR_CONNECT_FAILED;
+        pthread_mutex_unlock(&conn->lock);
+        return SE_ERR_CONNECT_FAILED;
+    }
+    
+    // Step 2: SSL/TLS handshake
+    LOGD("Starting SSL handshake");
+    connect_timing_enter(conn, SE_CONNECT_PHASE_TLS, get_time_ms());
+    
+    conn->ssl_ctx = ssl_context_new(conn->socket_fd, params->server_host, params->server_port,
+                                    params->verify_server_cert, params->use_ktls);
+    if (!conn->ssl_ctx) {
+        close(conn->socket_fd);
+        conn->socket_fd = -1;
+        pthread_mutex_lock(&conn->lock);
+        conn->state = SE_STATE_ERROR;
+        conn->last_error = SE_ERR_OUT_OF_MEMORY;
+        pthread_mutex_unlock(&conn->lock);
+        return SE_ERR_OUT_OF_MEMORY;
+    }
+    
+    if (ssl_handshake(conn->ssl_ctx) < 0) {
+        ssl_context_free(conn->ssl_ctx);
+        conn->ssl_ctx = NULL;
+        close(conn->socket_fd);
+        conn->socket_fd = -1;
+        pthread_mutex_lock(&conn->lock);
+        conn->state = SE_STATE_ERROR;
+        conn->last_error = SE_ERR_SSL_HANDSHAKE_FAILED;
+        pthread_mutex_unlock(&conn->lock);
+        return SE_ERR_SSL_HANDSHAKE_FAILED;
+    }
+    
+    LOGD("TLS record layer: %s", se_tls_mode_string(ssl_tls_mode(conn->ssl_ctx)));
+    
+    // Step 3: Protocol handshake
+    LOGD("Starting protocol handshake");
+    connect_timing_enter(conn, SE_CONNECT_PHASE_HELLO, get_time_ms());
+    
+    conn->udp_aead = SE_UDP_AEAD_NONE;
+    conn->udp_port = 0;
+    conn->compress_algorithm = SE_COMPRESS_NONE;
+    if (params->use_udp_acceleration &&
+        generate_random_bytes(conn->udp_client_random, SE_UDP_RANDOM_SIZE) < 0) {
+        LOGE("No key material for UDP acceleration, not offering it");
+        conn->params.use_udp_acceleration = false;
+    }
+    
+    if (se_protocol_send_hello(conn) < 0) {
+        goto connect_failed;
+    }
+    
+    if (se_protocol_recv_hello(conn) < 0) {
+        goto connect_failed;
+    }
+    
+    // Step 4: Authentication
+    LOGD("Authenticating");
+    connect_timing_enter(conn, SE_CONNECT_PHASE_AUTH, get_time_ms());
+    
+    if (se_protocol_send_auth(conn) < 0) {
+        goto connect_failed;
+    }
+    
+    if (se_protocol_recv_auth_response(conn) < 0) {
+        pthread_mutex_lock(&conn->lock);
+        conn->state = SE_STATE_ERROR;
+        conn->last_error = SE_ERR_AUTH_FAILED;
+        pthread_mutex_unlock(&conn->lock);
+        return SE_ERR_AUTH_FAILED;
+    }
+    
+    // Step 5: DHCP request
+    LOGD("Requesting DHCP configuration");
+    connect_timing_enter(conn, SE_CONNECT_PHASE_DHCP, get_time_ms());
+    
+    if (se_protocol_send_dhcp_request(conn) < 0) {
+        goto connect_failed;
+    }
+    
+    if (se_protocol_recv_dhcp_response(conn) < 0) {
+        pthread_mutex_lock(&conn->lock);
+        conn->state = SE_STATE_ERROR;
+        conn->last_error = SE_ERR_DHCP_FAILED;
+        pthread_mutex_unlock(&conn->lock);
+        return SE_ERR_DHCP_FAILED;
+    }
+    
+    // Steps 6 and 7: additional connections, UDP channel and threads
+    connect_timing_enter(conn, SE_CONNECT_PHASE_SESSION, get_time_ms());
+    return connect_start_session(conn);
+    
+connect_failed:
+    connect_abort(conn, SE_ERR_PROTOCOL_MISMATCH);
+    return SE_ERR_PROTOCOL_MISMATCH;
+}
+
+int se_connection_connect(se_connection_t* conn, const se_connection_params_t* params) {
+    if (!conn || !params) {
+        LOGE("Invalid parameters");
+        return SE_ERR_INVALID_PARAM;
+    }
+    
+    pthread_mutex_lock(&conn->lock);
+    
+    if (conn->state != SE_STATE_DISCONNECTED) {
+        pthread_mutex_unlock(&conn->lock);
+        LOGE("Connection already in progress");
+        return SE_ERR_INVALID_PARAM;
+    }
+    
+    conn->state = SE_STATE_CONNECTING;
+    conn->tls_mode = SE_TLS_MODE_NONE;
+    memcpy(&conn->params, params, sizeof(se_connection_params_t));
+    connect_timing_begin(conn, false);
+    
+    pthread_mutex_unlock(&conn->lock);
+    
+    int result = connect_blocking(conn, params);
+    connect_timing_end(conn, result);
+    if (result != SE_ERR_SUCCESS) return result;
+    
+    // Call connected callback
+    if (conn->on_connected) {
+        conn->on_connected(conn, &conn->net_config);
+    }
+    
+    return SE_ERR_SUCCESS;
+}
+
+void se_connection_disconnect(se_connection_t* conn) {
+    if (!conn) return;
+    
+    // An asynchronous connect in flight is cancelled; one that got as far
+    // as the session phase is left connected and torn down below
+    se_connection_cancel_connect(conn);
+    
+    pthread_mutex_lock(&conn->lock);
+    
+    if (conn->state == SE_STATE_DISCONNECTED || conn->state == SE_STATE_DISCONNECTING) {
+        pthread_mutex_unlock(&conn->lock);
+        return;
+    }
+    
+    conn->state = SE_STATE_DISCONNECTING;
+    conn->threads_running = false;
+    
+    pthread_mutex_unlock(&conn->lock);
+    
+    LOGD("Disconnecting...");
+    
+    wakeup_send_thread(conn);
+    
+    // Unblock the threads of additional connections; the server closes
+    // transport 0 once it sees the disconnect frame
+    for (int i = 1; i < conn->transport_count; i++) {
+        shutdown(conn->transports[i]->socket_fd, SHUT_RDWR);
+    }
+    
+    // Send disconnect packet (the event loop sends its own)
+    if (conn->ssl_ctx && !conn->params.use_event_loop) {
+        se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_DISCONNECT, 0, NULL, 0);
+        if (packet) {
+            uint8_t buffer[64];
+            int len = se_packet_serialize(packet, buffer, sizeof(buffer));
+            if (len > 0) {
+                pthread_mutex_lock(&conn->send_lock);
+                ssl_write_all(conn->ssl_ctx, buffer, len);
+                pthread_mutex_unlock(&conn->send_lock);
+            }
+            se_packet_free(packet);
+        }
+    }
+    
+    // Wait for threads to finish
+    if (conn->recv_thread) {
+        pthread_join(conn->recv_thread, NULL);
+        conn->recv_thread = 0;
+    }
+    if (conn->send_thread) {
+        pthread_join(conn->send_thread, NULL);
+        conn->send_thread = 0;
+    }
+    if (conn->keepalive_thread) {
+        pthread_join(conn->keepalive_thread, NULL);
+        conn->keepalive_thread = 0;
+    }
+    if (conn->loop_thread) {
+        pthread_join(conn->loop_thread, NULL);
+        conn->loop_thread = 0;
+    }
+    if (conn->udp_thread) {
+        pthread_join(conn->udp_thread, NULL);
+        conn->udp_thread = 0;
+    }
+    
+    transports_close(conn);
+    udp_close(conn);
+    
+    // Whatever the data path traced or tapped on its way down
+    se_trace_log_pending();
+    tap_flush(conn, true);
+    
+    // Cleanup SSL
+    if (conn->ssl_ctx) {
+        ssl_context_free(conn->ssl_ctx);
+        conn->ssl_ctx = NULL;
+    }
+    
+    // Close socket
+    if (conn->socket_fd >= 0) {
+        close(conn->socket_fd);
+        conn->socket_fd = -1;
+    }
+    
+    pthread_mutex_lock(&conn->lock);
+    conn->state = SE_STATE_DISCONNECTED;
+    conn->tls_mode = SE_TLS_MODE_NONE;
+    pthread_mutex_unlock(&conn->lock);
+    
+    se_stats_page_publish(conn, true);
+    
+    LOGD("Disconnected");
+    
+    // Call disconnected callback
+    if (conn->on_disconnected) {
+        conn->on_disconnected(conn, 0);
+    }
+}
+
+int se_connection_get_state(se_connection_t* conn) {
+    if (!conn) return SE_STATE_ERROR;
+    
+    pthread_mutex_lock(&conn->lock);
+    int state = conn->state;
+    pthread_mutex_unlock(&conn->lock);
+    
+    return state;
+}
+
+int se_connection_get_last_error(se_connection_t* conn) {
+    if (!conn) return SE_ERR_INVALID_PARAM;
+    
+    pthread_mutex_lock(&conn->lock);
+    int error = conn->last_error;
+    pthread_mutex_unlock(&conn->lock);
+    
+    return error;
+}
+
+const char* se_connection_get_error_string(se_connection_t* conn) {
+    if (!conn) return "Invalid connection";
+    return se_error_string(conn->last_error);
+}
+
+int se_connection_get_tls_mode(se_connection_t* conn) {
+    if (!conn) return SE_TLS_MODE_NONE;
+    
+    pthread_mutex_lock(&conn->lock);
+    int mode = conn->tls_mode;
+    pthread_mutex_unlock(&conn->lock);
+    
+    return mode;
+}
+
+void se_connection_get_connect_report(se_connection_t* conn, se_connect_report_t* report) {
+    if (!conn || !report) return;
+    
+    pthread_mutex_lock(&conn->lock);
+    memcpy(report, &conn->connect_report, sizeof(se_connect_report_t));
+    pthread_mutex_unlock(&conn->lock);
+}
+
+int se_connection_get_connect_timing(se_connection_t* conn, se_connect_timing_t* timing) {
+    if (!conn || !timing) return -1;
+    
+    pthread_mutex_lock(&conn->lock);
+    memcpy(timing, &conn->connect_timing, sizeof(se_connect_timing_t));
+    int phase = conn->connect_phase;
+    uint64_t phase_start_ms = conn->connect_phase_start_ms;
+    pthread_mutex_unlock(&conn->lock);
+    
+    if (timing->start_ms == 0) return -1;
+    
+    // Count a connect in flight up to now
+    if (phase != SE_CONNECT_PHASE_IDLE) {
+        uint64_t now = get_time_ms();
+        timing->phase_ms[phase] += (uint32_t)(now - phase_start_ms);
+        timing->total_ms = (uint32_t)(now - timing->start_ms);
+    }
+    
+    return 0;
+}
+
+int se_connection_get_connect_history(se_connection_t* conn, se_connect_timing_t* timings, int max_timings) {
+    if (!conn || !timings || max_timings <= 0) return 0;
+    
+    pthread_mutex_lock(&conn->lock);
+    
+    uint32_t total = conn->connect_history_count;
+    int count = total < SE_CONNECT_HISTORY_SIZE ? (int)total : SE_CONNECT_HISTORY_SIZE;
+    if (count > max_timings) count = max_timings;
+    
+    for (int i = 0; i < count; i++) {
+        timings[i] = conn->connect_history[(total - 1 - (uint32_t)i) % SE_CONNECT_HISTORY_SIZE];
+    }
+    
+    pthread_mutex_unlock(&conn->lock);
+    return count;
+}
+
+int se_connection_get_transport_stats(se_connection_t* conn, se_transport_stats_t* stats, int max_stats) {
+    if (!conn || !stats || max_stats <= 0) return -1;
+    
+    uint64_t now = get_time_ms();
+    
+    pthread_mutex_lock(&conn->lock);
+    
+    int count = conn->transport_count < max_stats ? conn->transport_count : max_stats;
+    for (int i = 0; i < count; i++) {
+        se_transport_t* transport = conn->transports[i];
+        se_transport_stats_t* out = &stats[i];
+        
+        out->role = transport->role;
+        out->active = transport->active;
+        out->bytes_sent = __atomic_load_n(&transport->bytes_sent, __ATOMIC_RELAXED);
+        out->bytes_received = __atomic_load_n(&transport->bytes_received, __ATOMIC_RELAXED);
+        out->packets_sent = __atomic_load_n(&transport->packets_sent, __ATOMIC_RELAXED);
+        out->packets_received = __atomic_load_n(&transport->packets_received, __ATOMIC_RELAXED);
+        out->drops = __atomic_load_n(&transport->drops, __ATOMIC_RELAXED);
+        out->uptime_ms = now - transport->start_ms;
+        out->send_rate = out->uptime_ms > 0 ? out->bytes_sent * 1000 / out->uptime_ms : 0;
+        out->recv_rate = out->uptime_ms > 0 ? out->bytes_received * 1000 / out->uptime_ms : 0;
+    }
+    
+    pthread_mutex_unlock(&conn->lock);
+    
+    return count;
+}
+
+int se_connection_get_udp_stats(se_connection_t* conn, se_udp_stats_t* stats) {
+    if (!conn || !stats) return -1;
+    
+    memset(stats, 0, sizeof(se_udp_stats_t));
+    
+    pthread_mutex_lock(&conn->lock);
+    stats->state = conn->udp_state;
+    if (conn->udp) {
+        se_udp_channel_get_counters(conn->udp, stats);
+    }
+    stats->fallbacks = __atomic_load_n(&conn->udp_fallbacks, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&conn->lock);
+    
+    return 0;
+}
+
+int se_connection_get_compress_stats(se_connection_t* conn, se_compress_stats_t* stats) {
+    if (!conn || !stats) return -1;
+    
+    memset(stats, 0, sizeof(se_compress_stats_t));
+    
+    pthread_mutex_lock(&conn->lock);
+    stats->algorithm = conn->compress_algorithm;
+    for (int i = 0; i < conn->transport_count; i++) {
+        se_compressor_add_stats(conn->transports[i]->compressor, stats);
+        se_compressor_add_stats(conn->transports[i]->decompressor, stats);
+    }
+    pthread_mutex_unlock(&conn->lock);
+    
+    return 0;
+}
+
+int se_connection_set_tun_fd(se_connection_t* conn, int tun_fd) {
+    if (!conn) return -1;
+    
+    pthread_mutex_lock(&conn->lock);
+    conn->tun_fd = tun_fd;
+    pthread_mutex_unlock(&conn->lock);
+    
+    wakeup_send_thread(conn);
+    
+    return 0;
+}
+
+int se_connection_send_packet(se_connection_t* conn, const uint8_t* data, size_t len) {
+    if (!conn || !data || len == 0) return -1;
+    
+    se_packet_t* packet = se_packet_new_pooled(conn->packet_pool, SE_PACKET_TYPE_DATA, 0, data, len);
+    if (!packet) return -1;
+    
+    int result = se_packet_queue_push(conn->send_queue, packet, false);
+    if (result < 0) {
+        se_packet_free(packet);
+        return result;
+    }
+    
+    wakeup_send_thread(conn);
+    
+    return result;
+}
+
+int se_connection_recv_packet(se_connection_t* conn, uint8_t* buffer, size_t buffer_size) {
+    if (!conn || !buffer || buffer_size == 0) return -1;
+    
+    se_packet_t* packet = se_packet_queue_pop(conn->recv_queue, false);
+    if (!packet) return 0;  // No packet available
+    
+    size_t copy_len = packet->payload_len < buffer_size ? packet->payload_len : buffer_size;
+    memcpy(buffer, packet->payload, copy_len);
+    se_packet_free(packet);
+    
+    return (int)copy_len;
+}
+
+void se_connection_get_statistics(se_connection_t* conn, se_statistics_t* stats) {
+    if (!conn || !stats) return;
+    
+    pthread_mutex_lock(&conn->lock);
+    memcpy(stats, &conn->stats, sizeof(se_statistics_t));
+    pthread_mutex_unlock(&conn->lock);
+    
+    se_packet_pool_get_counters(conn->packet_pool, &stats->pool_hits, &stats->pool_misses);
+}
+
+void se_connection_reset_statistics(se_connection_t* conn) {
+    if (!conn) return;
+    
+    uint64_t now = get_time_ms();
+    
+    pthread_mutex_lock(&conn->lock);
+    memset(&conn->stats, 0, sizeof(se_statistics_t));
+    for (int i = 0; i < conn->transport_count; i++) {
+        se_transport_t* transport = conn->transports[i];
+        __atomic_store_n(&transport->bytes_sent, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&transport->bytes_received, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&transport->packets_sent, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&transport->packets_received, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&transport->drops, 0, __ATOMIC_RELAXED);
+        se_compressor_reset_counters(transport->compressor);
+        se_compressor_reset_counters(transport->decompressor);
+        transport->start_ms = now;
+    }
+    pthread_mutex_unlock(&conn->lock);
+    
+    se_packet_pool_reset_counters(conn->packet_pool);
+    se_latency_reset(conn->latency[SE_LATENCY_TUN_TO_WIRE]);
+    se_latency_reset(conn->latency[SE_LATENCY_WIRE_TO_TUN]);
+    
+    se_stats_page_publish(conn, true);
+}
+
+const se_stats_page_t* se_connection_get_stats_page(se_connection_t* conn) {
+    return conn ? conn->stats_page : NULL;
+}
+
+int se_connection_enable_packet_tap(se_connection_t* conn, uint32_t capacity, uint32_t snap_len,
+                                    uint32_t notify_packets, uint32_t notify_us) {
+    if (!conn) return -1;
+    
+    pthread_mutex_lock(&conn->tap_lock);
+    
+    if (!conn->tap) {
+        uint32_t size = SE_TAP_MIN_CAPACITY;
+        while (size < capacity && size < SE_TAP_MAX_CAPACITY) size <<= 1;
+    
+        void* map = mmap(NULL, SE_TAP_HEADER_SIZE + size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            pthread_mutex_unlock(&conn->tap_lock);
+            LOGE("Failed to map a %u byte packet tap", size);
+            return -1;
+        }
+    
+        se_packet_tap_t* tap = (se_packet_tap_t*)map;
+        tap->magic = SE_TAP_MAGIC;
+        tap->version = SE_TAP_VERSION;
+        tap->capacity = size;
+        conn->tap_size = SE_TAP_HEADER_SIZE + size;
+        __atomic_store_n(&conn->tap, tap, __ATOMIC_RELEASE);
+    }
+    
+    // Leave room for two records, so one full-size packet never starves the ring
+    uint32_t max_snap = conn->tap->capacity / 2 - (uint32_t)sizeof(se_tap_record_t);
+    if (max_snap > UINT16_MAX) max_snap = UINT16_MAX;
+    conn->tap->snap_len = snap_len == 0 || snap_len > max_snap ? max_snap : snap_len;
+    conn->tap_notify_packets = notify_packets ? notify_packets : SE_TAP_DEFAULT_NOTIFY_PACKETS;
+    conn->tap_notify_ns = (uint64_t)(notify_us ? notify_us : SE_TAP_DEFAULT_NOTIFY_US) * 1000;
+    __atomic_store_n(&conn->tap_enabled, true, __ATOMIC_RELEASE);
+    
+    pthread_mutex_unlock(&conn->tap_lock);
+    return 0;
+}
+
+void se_connection_release_packet_tap(se_connection_t* conn, uint32_t head) {
+    if (!conn || !conn->tap) return;
+    
+    __atomic_store_n(&conn->tap->tail, head, __ATOMIC_RELEASE);
+    __atomic_store_n(&conn->tap_notifying, false, __ATOMIC_RELEASE);
+}
+
+void se_connection_disable_packet_tap(se_connection_t* conn) {
+    if (!conn) return;
+    
+    __atomic_store_n(&conn->tap_enabled, false, __ATOMIC_RELEASE);
+    tap_flush(conn, true);
+}
+
+const se_packet_tap_t* se_connection_get_packet_tap(se_connection_t* conn) {
+    return conn ? __atomic_load_n(&conn->tap, __ATOMIC_ACQUIRE) : NULL;
+}
+
+int se_connection_get_latency(se_connection_t* conn, int path, se_latency_snapshot_t* snapshot, bool reset) {
+    if (!conn || !snapshot || path < 0 || path >= SE_LATENCY_PATH_COUNT) return -1;
+    
+    se_latency_snapshot(conn->latency[path], snapshot, reset);
+    return 0;
+}
+
+// ============================================================================
+// Asynchronous Connect
+// ============================================================================
+
+// One thread runs every asynchronous connect in the process. Each connect
+// is a state machine that moves through the SE_CONNECT_PHASE_* phases as
+// its socket becomes ready, the resolver answers or a deadline passes, so
+// no phase waits in a blocking call and any number of connects share the
+// thread. The session phase is the exception: additional connections join
+// with blocking, time-limited connects (to a server that has just
+// answered), so it runs on a thread of its own per connect, which starts
+// the session threads and then calls on_connected.
+
+#define SE_CONNECT_LOOP_EVENTS  32
+
+typedef struct se_connect_op {
+    se_connection_t* conn;
+    struct se_connect_op* next;
+    int phase;                   // SE_CONNECT_PHASE_*
+    bool cancelled;
+    bool ready;                  // Socket or resolver activity since the last step
+    int error;                   // SE_ERR_* once failed
+    uint64_t start_ms;
+    uint64_t phase_start_ms;
+    uint64_t deadline;           // Of the current phase
+    
+    // Resolve and TCP phases
+    struct sockaddr_storage addrs[SE_MAX_CONNECT_ATTEMPTS];
+    se_race_t race;
+    bool racing;                 // race holds attempt sockets
+    se_connect_report_t report;
+    uint32_t socket_events;      // Watched on conn->socket_fd, 0 if none
+    
+    // Request of the current phase and the reply read so far
+    bool request_sent;
+    uint8_t* reply;
+    size_t reply_len;
+    size_t reply_capacity;
+} se_connect_op_t;
+
+static struct {
+    pthread_mutex_t lock;        // Guards the lists and every conn->connect_op
+    pthread_cond_t released;     // An op let go of its connection
+    int epoll_fd;
+    int wakeup_fd;               // New or cancelled connects, DNS answers
+    pthread_t thread;
+    se_connect_op_t* ops;        // In flight
+    se_connect_op_t* completed;  // Outcome not delivered yet
+} g_connect = { .lock = PTHREAD_MUTEX_INITIALIZER, .released = PTHREAD_COND_INITIALIZER,
+                .epoll_fd = -1, .wakeup_fd = -1 };
+
+static pthread_once_t g_connect_once = PTHREAD_ONCE_INIT;
+static bool g_connect_started = false;
+
+static void connect_wakeup(void) {
+    uint64_t one = 1;
+    ssize_t n = write(g_connect.wakeup_fd, &one, sizeof(one));
+    (void)n;  // EAGAIN means a wakeup is already pending
+}
+
+static void connect_set_phase(se_connect_op_t* op, int phase, int timeout_ms) {
+    op->phase = phase;
+    op->phase_start_ms = get_time_ms();
+    op->deadline = op->phase_start_ms + (uint64_t)timeout_ms;
+    op->request_sent = false;
+    op->reply_len = 0;
+    
+    connect_timing_enter(op->conn, phase, op->phase_start_ms);
+}
+
+static uint64_t connect_wake_ms(const se_connect_op_t* op) {
+    return op->racing ? race_wake_ms(&op->race) : op->deadline;
+}
+
+// Watch the connection's socket for events, replacing what was watched
+static void connect_watch(se_connect_op_t* op, uint32_t events) {
+    if (events == op->socket_events) return;
+    
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = op;
+    
+    int fd = op->conn->socket_fd;
+    int result = epoll_ctl(g_connect.epoll_fd, op->socket_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event);
+    if (result < 0 && errno == EEXIST) {
+        // Still registered from the race it won
+        result = epoll_ctl(g_connect.epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    }
+    if (result == 0) op->socket_events = events;
+}
+
+static void connect_unwatch(se_connect_op_t* op) {
+    if (op->conn->socket_fd >= 0) {
+        epoll_ctl(g_connect.epoll_fd, EPOLL_CTL_DEL, op->conn->socket_fd, NULL);
+    }
+    op->socket_events = 0;
+}
+
+// Wait for input, and for room to send while records are queued
+static int connect_wait(se_connect_op_t* op) {
+    uint32_t events = EPOLLIN;
+    if (ssl_pending_output(op->conn->ssl_ctx) > 0) events |= EPOLLOUT;
+    connect_watch(op, events);
+    return 0;
+}
+
+// Watch the attempts the race has started; closed attempts drop out of
+// the epoll set by themselves
+static int connect_wait_race(se_connect_op_t* op) {
+    for (int i = 0; i < op->race.pending_count; i++) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLOUT;
+        event.data.ptr = op;
+        epoll_ctl(g_connect.epoll_fd, EPOLL_CTL_ADD, op->race.pending[i].fd, &event);  // EEXIST if watched
+    }
+    return 0;
+}
+
+static void connect_publish_report(se_connect_op_t* op) {
+    pthread_mutex_lock(&op->conn->lock);
+    memcpy(&op->conn->connect_report, &op->report, sizeof(se_connect_report_t));
+    pthread_mutex_unlock(&op->conn->lock);
+}
+
+// Close whatever the connect has opened so far
+static void connect_drop(se_connect_op_t* op) {
+    se_connection_t* conn = op->conn;
+    
+    if (op->racing) {
+        race_end(&op->race);
+        op->racing = false;
+    }
+    connect_unwatch(op);
+    
+    ssl_context_free(conn->ssl_ctx);
+    conn->ssl_ctx = NULL;
+    if (conn->socket_fd >= 0) {
+        close(conn->socket_fd);
+        conn->socket_fd = -1;
+    }
+}
+
+static int connect_fail(se_connect_op_t* op, int error) {
+    LOGE("Connect to %s failed in phase %d: %s", op->conn->params.server_host, op->phase,
+         se_error_string(error));
+    connect_drop(op);
+    op->error = error;
+    return -1;
+}
+
+// Read until the reply holds need bytes.
+// Returns 1 once it does, 0 to wait for the socket, -1 on failure.
+static int connect_read(se_connect_op_t* op, size_t need) {
+    if (need > op->reply_capacity) {
+        uint8_t* reply = (uint8_t*)realloc(op->reply, need);
+        if (!reply) return -1;
+        op->reply = reply;
+        op->reply_capacity = need;
+    }
+    
+    while (op->reply_len < need) {
+        errno = 0;
+        int n = ssl_read(op->conn->ssl_ctx, op->reply + op->reply_len, need - op->reply_len);
+        if (n > 0) {
+            op->reply_len += (size_t)n;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        return -1;
+    }
+    
+    return 1;
+}
+
+// Read one frame of the expected type. Returns 1 with its payload, 0 to
+// wait for the socket, -1 on failure.
+static int connect_read_frame(se_connect_op_t* op, uint32_t expected_type,
+                              const uint8_t** payload, size_t* payload_len) {
+    int result = connect_read(op, SE_FRAME_HEADER_SIZE);
+    if (result <= 0) return result;
+    
+    const uint8_t* header = op->reply;
+    uint32_t type = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+                    ((uint32_t)header[2] << 8) | (uint32_t)header[3];
+    uint32_t len = ((uint32_t)header[8] << 24) | ((uint32_t)header[9] << 16) |
+                   ((uint32_t)header[10] << 8) | (uint32_t)header[11];
+    
+    if (type != expected_type || len > SE_MAX_FRAME_PAYLOAD) {
+        LOGE("Unexpected packet type: %u (%u bytes)", type, len);
+        return -1;
+    }
+    
+    result = connect_read(op, SE_FRAME_HEADER_SIZE + len);
+    if (result <= 0) return result;
+    
+    *payload = op->reply + SE_FRAME_HEADER_SIZE;
+    *payload_len = len;
+    return 1;
+}
+
+// Advance a connect as far as it goes without blocking.
+// Returns 1 once DHCP has answered, 0 to wait, -1 on failure.
+static int connect_step(se_connect_op_t* op) {
+    se_connection_t* conn = op->conn;
+    const se_connection_params_t* params = &conn->params;
+    
+    while (true) {
+        uint64_t now = get_time_ms();
+        
+        if (now >= op->deadline) {
+            // Resolve and TCP share SE_CONNECT_TIMEOUT_MS and fail like a
+            // blocking connect; later phases report a timeout
+            int error = op->phase <= SE_CONNECT_PHASE_TCP ? SE_ERR_CONNECT_FAILED
+                      : op->phase == SE_CONNECT_PHASE_TLS ? SE_ERR_SSL_HANDSHAKE_FAILED
+                      : SE_ERR_TIMEOUT;
+            if (op->racing) {
+                race_end(&op->race);
+                op->racing = false;
+                connect_publish_report(op);
+            }
+            return connect_fail(op, error);
+        }
+        
+        // Send what the socket did not take earlier
+        if (conn->ssl_ctx && ssl_flush_output(conn->ssl_ctx) < 0) {
+            return connect_fail(op, SE_ERR_NETWORK_ERROR);
+        }
+        
+        switch (op->phase) {
+            case SE_CONNECT_PHASE_RESOLVE: {
+                // Polled whenever the resolver finishes a lookup
+                struct sockaddr_storage resolved[SE_MAX_CONNECT_ATTEMPTS];
+                int count = se_dns_resolve(params->server_host, resolved, SE_MAX_CONNECT_ATTEMPTS, 0);
+                if (count == SE_DNS_RESOLVE_TIMEOUT) return 0;
+                
+                op->report.resolve_ms = (uint32_t)(now - op->start_ms);
+                if (count < 0) {
+                    LOGE("Failed to resolve hostname %s: lookup failed", params->server_host);
+                    connect_publish_report(op);
+                    return connect_fail(op, SE_ERR_CONNECT_FAILED);
+                }
+                
+                op->report.address_count = order_addresses(resolved, count, params->server_port,
+                                                           op->addrs, SE_MAX_CONNECT_ATTEMPTS);
+                if (op->report.address_count == 0) {
+                    LOGE("Failed to resolve hostname %s: no addresses", params->server_host);
+                    connect_publish_report(op);
+                    return connect_fail(op, SE_ERR_CONNECT_FAILED);
+                }
+                
+                int remaining = (int)(op->deadline - now);
+                connect_set_phase(op, SE_CONNECT_PHASE_TCP, remaining);
+                race_init(&op->race, op->addrs, op->report.address_count, remaining, &op->report);
+                op->racing = true;
+                break;
+            }
+            
+            case SE_CONNECT_PHASE_TCP: {
+                int fd = race_step(&op->race, false);
+                if (fd == SE_RACE_RUNNING) return connect_wait_race(op);
+                
+                race_end(&op->race);
+                op->racing = false;
+                connect_publish_report(op);
+                
+                if (fd < 0) {
+                    LOGE("Failed to connect to any of %d addresses for %s",
+                         op->report.address_count, params->server_host);
+                    return connect_fail(op, SE_ERR_CONNECT_FAILED);
+                }
+                
+                const se_connect_attempt_t* winner = &op->report.attempts[op->report.winner];
+                LOGD("Connected to %s:%d (attempt %d of %d, %u ms; resolve %u ms, total connect %u ms)",
+                     winner->address, params->server_port, op->report.winner + 1, op->report.attempt_count,
+                     winner->duration_ms, op->report.resolve_ms, op->report.connect_ms);
+                
+                conn->socket_fd = fd;
+                connect_set_phase(op, SE_CONNECT_PHASE_TLS, SE_HANDSHAKE_TIMEOUT_MS);
+                break;
+            }
+            
+            case SE_CONNECT_PHASE_TLS: {
+                if (!conn->ssl_ctx) {
+                    conn->ssl_ctx = ssl_context_new(conn->socket_fd, params->server_host, params->server_port,
+                                                    params->verify_server_cert, params->use_ktls);
+                    if (!conn->ssl_ctx) return connect_fail(op, SE_ERR_OUT_OF_MEMORY);
+                    if (ssl_set_nonblocking(conn->ssl_ctx, true) < 0) {
+                        return connect_fail(op, SE_ERR_NETWORK_ERROR);
+                    }
+                }
+                
+                bool want_read;
+                int result = ssl_handshake_step(conn->ssl_ctx, &want_read);
+                if (result < 0) return connect_fail(op, SE_ERR_SSL_HANDSHAKE_FAILED);
+                
+                if (result == 0) {
+                    if (!want_read) return connect_wait(op);
+                    
+                    errno = 0;
+                    int received = ssl_fill_input(conn->ssl_ctx, -1, 0);
+                    if (received > 0) break;
+                    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return connect_wait(op);
+                    
+                    LOGE("SSL handshake receive failed: %s", received == 0 ? "connection closed" : strerror(errno));
+                    return connect_fail(op, SE_ERR_SSL_HANDSHAKE_FAILED);
+                }
+                
+                ssl_handshake_complete(conn->ssl_ctx, op->phase_start_ms);
+                LOGD("TLS record layer: %s", se_tls_mode_string(ssl_tls_mode(conn->ssl_ctx)));
+                connect_set_phase(op, SE_CONNECT_PHASE_HELLO, SE_HANDSHAKE_TIMEOUT_MS);
+                break;
+            }
+            
+            case SE_CONNECT_PHASE_HELLO: {
+                if (!op->request_sent) {
+                    if (protocol_send_hello(conn, conn->ssl_ctx) < 0) {
+                        return connect_fail(op, SE_ERR_PROTOCOL_MISMATCH);
+                    }
+                    op->request_sent = true;
+                }
+                
+                int result = connect_read(op, 64);
+                if (result == 0) return connect_wait(op);
+                if (result < 0 || protocol_parse_hello(conn, conn->ssl_ctx, op->reply) < 0) {
+                    return connect_fail(op, SE_ERR_PROTOCOL_MISMATCH);
+                }
+                
+                LOGD("Authenticating");
+                connect_set_phase(op, SE_CONNECT_PHASE_AUTH, SE_HANDSHAKE_TIMEOUT_MS);
+                break;
+            }
+            
+            case SE_CONNECT_PHASE_AUTH: {
+                if (!op->request_sent) {
+                    if (se_protocol_send_auth(conn) < 0) return connect_fail(op, SE_ERR_PROTOCOL_MISMATCH);
+                    op->request_sent = true;
+                }
+                
+                const uint8_t* payload;
+                size_t payload_len;
+                int result = connect_read_frame(op, SE_PACKET_TYPE_AUTH_RESPONSE, &payload, &payload_len);
+                if (result == 0) return connect_wait(op);
+                if (result < 0 || protocol_parse_auth_response(conn, payload, payload_len) < 0) {
+                    return connect_fail(op, SE_ERR_AUTH_FAILED);
+                }
+                
+                LOGD("Requesting DHCP configuration");
+                connect_set_phase(op, SE_CONNECT_PHASE_DHCP, SE_DHCP_TIMEOUT_MS);
+                break;
+            }
+            
+            case SE_CONNECT_PHASE_DHCP: {
+                if (!op->request_sent) {
+                    if (se_protocol_send_dhcp_request(conn) < 0) {
+                        return connect_fail(op, SE_ERR_PROTOCOL_MISMATCH);
+                    }
+                    op->request_sent = true;
+                }
+                
+                const uint8_t* payload;
+                size_t payload_len;
+                int result = connect_read_frame(op, SE_PACKET_TYPE_DHCP_RESPONSE, &payload, &payload_len);
+                if (result == 0) return connect_wait(op);
+                if (result < 0) return connect_fail(op, SE_ERR_DHCP_FAILED);
+                
+                protocol_parse_dhcp_response(conn, payload, payload_len);
+                connect_unwatch(op);
+                return 1;
+            }
+            
+            default:
+                return connect_fail(op, SE_ERR_INVALID_PARAM);
+        }
     }
+}
+
+// Detach a finished op from its connection (state < 0 keeps the state the
+// connect left), record its result, free it and wake cancellers. Needs
+// g_connect.lock.
+static void connect_release(se_connect_op_t* op, int state, int result) {
+    se_connection_t* conn = op->conn;
     
-    conn->state = SE_STATE_CONNECTING;
-    memcpy(&conn->params, params, sizeof(se_connection_params_t));
+    connect_timing_end(conn, result);
     
+    pthread_mutex_lock(&conn->lock);
+    if (state >= 0) conn->state = state;
+    conn->connect_op = NULL;
     pthread_mutex_unlock(&conn->lock);
     
-    // Step 1: Establish TCP connection
-    LOGD("Connecting to %s:%d", params->server_host, params->server_port);
-    
-    conn->socket_fd = resolve_and_connect(params->server_host, params->server_port, SE_CONNECT_TIMEOUT_MS);
-    if (conn->socket_fd < 0) {
-        pthread_mutex_lock(&conn->lock);
-        conn->state = SE_STATE_ERROR;
-        conn->last_error = SE_ERR_CONNECT_FAILED;
-        pthread_mutex_unlock(&conn->lock);
-        return SE_ERR_CONNECT_FAILED;
+    free(op->reply);
+    free(op);
+    pthread_cond_broadcast(&g_connect.released);
+}
+
+static bool connect_unlink(se_connect_op_t** list, se_connect_op_t* op) {
+    for (se_connect_op_t** link = list; *link; link = &(*link)->next) {
+        if (*link == op) {
+            *link = op->next;
+            return true;
+        }
     }
-    
-    // Step 2: SSL/TLS handshake
-    LOGD("Starting SSL handshake");
-    
-    conn->ssl_ctx = ssl_context_new(conn->socket_fd, params->verify_server_cert);
-    if (!conn->ssl_ctx) {
-        close(conn->socket_fd);
-        conn->socket_fd = -1;
+    return false;
+}
+
+// Report the outcome of a finished op and release it. Called and returns
+// with g_connect.lock held; drops it around the callbacks.
+static void connect_finish(se_connect_op_t* op, int error) {
+    se_connection_t* conn = op->conn;
+    
+    // Cancelled during the session phase: the canceller disconnects
+    bool notify = !op->cancelled;
+    if (error != SE_ERR_SUCCESS) {
         pthread_mutex_lock(&conn->lock);
-        conn->state = SE_STATE_ERROR;
-        conn->last_error = SE_ERR_OUT_OF_MEMORY;
+        conn->last_error = error;
         pthread_mutex_unlock(&conn->lock);
-        return SE_ERR_OUT_OF_MEMORY;
     }
+    connect_release(op, error == SE_ERR_SUCCESS ? -1 : SE_STATE_ERROR, error);
     
-    if (ssl_handshake(conn->ssl_ctx) < 0) {
-        ssl_context_free(conn->ssl_ctx);
-        conn->ssl_ctx = NULL;
-        close(conn->socket_fd);
-        conn->socket_fd = -1;
-        pthread_mutex_lock(&conn->lock);
-        conn->state = SE_STATE_ERROR;
-        conn->last_error = SE_ERR_SSL_HANDSHAKE_FAILED;
-        pthread_mutex_unlock(&conn->lock);
-        return SE_ERR_SSL_HANDSHAKE_FAILED;
-    }
+    if (!notify) return;
     
-    // Step 3: Protocol handshake
-    LOGD("Starting protocol handshake");
+    pthread_mutex_unlock(&g_connect.lock);
     
-    if (se_protocol_send_hello(conn) < 0) {
-        goto connect_failed;
+    if (error == SE_ERR_SUCCESS) {
+        if (conn->on_connected) conn->on_connected(conn, &conn->net_config);
+    } else if (conn->on_error) {
+        conn->on_error(conn, error, se_error_string(error));
     }
     
-    if (se_protocol_recv_hello(conn) < 0) {
-        goto connect_failed;
+    pthread_mutex_lock(&g_connect.lock);
+}
+
+// The session phase of one connect, off the connect thread: joins can
+// block for seconds and must not hold up every other connect.
+static void* connect_session_thread(void* arg) {
+    se_connect_op_t* op = (se_connect_op_t*)arg;
+    se_connection_t* conn = op->conn;
+    int error;
+    
+    // The session threads use blocking I/O; send the last queued bytes first
+    if (ssl_set_nonblocking(conn->ssl_ctx, false) < 0 || ssl_flush_output(conn->ssl_ctx) < 0) {
+        error = SE_ERR_NETWORK_ERROR;
+        connect_abort(conn, error);
+    } else {
+        error = connect_start_session(conn);
     }
     
-    // Step 4: Authentication
-    LOGD("Authenticating");
-    
-    if (se_protocol_send_auth(conn) < 0) {
-        goto connect_failed;
+    pthread_mutex_lock(&g_connect.lock);
+    connect_finish(op, error);
+    pthread_mutex_unlock(&g_connect.lock);
+    return NULL;
+}
+
+// Report the outcome of a completed op, handing a successful one to a
+// session thread. Called and returns with g_connect.lock held.
+static void connect_deliver(se_connect_op_t* op) {
+    se_connection_t* conn = op->conn;
+    
+    if (op->cancelled) {
+        connect_drop(op);
+        connect_release(op, SE_STATE_DISCONNECTED, SE_CONNECT_CANCELLED);
+        return;
     }
     
-    if (se_protocol_recv_auth_response(conn) < 0) {
-        pthread_mutex_lock(&conn->lock);
-        conn->state = SE_STATE_ERROR;
-        conn->last_error = SE_ERR_AUTH_FAILED;
-        pthread_mutex_unlock(&conn->lock);
-        return SE_ERR_AUTH_FAILED;
+    if (op->error == SE_ERR_SUCCESS) {
+        op->phase = SE_CONNECT_PHASE_SESSION;
+        connect_timing_enter(conn, SE_CONNECT_PHASE_SESSION, get_time_ms());
+        
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        bool started = pthread_create(&thread, &attr, connect_session_thread, op) == 0;
+        pthread_attr_destroy(&attr);
+        if (started) return;
+        
+        LOGE("Failed to start session thread: %s", strerror(errno));
+        connect_abort(conn, SE_ERR_OUT_OF_MEMORY);
+        op->error = SE_ERR_OUT_OF_MEMORY;
     }
     
-    // Step 5: DHCP request
-    LOGD("Requesting DHCP configuration");
-    
-    if (se_protocol_send_dhcp_request(conn) < 0) {
-        goto connect_failed;
+    connect_finish(op, op->error);
+}
+
+// Step every op that is due, then deliver what completed.
+// Needs g_connect.lock.
+static void connect_run(void) {
+    uint64_t now = get_time_ms();
+    se_connect_op_t** link = &g_connect.ops;
+    
+    while (*link) {
+        se_connect_op_t* op = *link;
+        int result = 0;
+        
+        if (op->cancelled) {
+            *link = op->next;
+            connect_drop(op);
+            connect_release(op, SE_STATE_DISCONNECTED, SE_CONNECT_CANCELLED);
+            continue;
+        }
+        
+        if (op->ready || now >= connect_wake_ms(op)) {
+            op->ready = false;
+            result = connect_step(op);
+        }
+        
+        if (result == 0) {
+            link = &op->next;
+            continue;
+        }
+        
+        *link = op->next;
+        op->next = g_connect.completed;
+        g_connect.completed = op;
     }
     
-    if (se_protocol_recv_dhcp_response(conn) < 0) {
-        pthread_mutex_lock(&conn->lock);
-        conn->state = SE_STATE_ERROR;
-        conn->last_error = SE_ERR_DHCP_FAILED;
-        pthread_mutex_unlock(&conn->lock);
-        return SE_ERR_DHCP_FAILED;
+    // Callbacks may cancel or start connects, so take one at a time
+    while (g_connect.completed) {
+        se_connect_op_t* op = g_connect.completed;
+        g_connect.completed = op->next;
+        connect_deliver(op);
     }
+}
+
+static void* connect_loop_thread(void* arg) {
+    struct epoll_event events[SE_CONNECT_LOOP_EVENTS];
     
-    // Step 6: Start threads
-    LOGD("Starting worker threads");
-    
-    conn->threads_running = true;
-    conn->stats.start_time_ms = get_time_ms();
-    
-    pthread_create(&conn->recv_thread, NULL, se_recv_thread, conn);
-    pthread_create(&conn->send_thread, NULL, se_send_thread, conn);
-    pthread_create(&conn->keepalive_thread, NULL, se_keepalive_thread, conn);
-    
-    pthread_mutex_lock(&conn->lock);
-    conn->state = SE_STATE_CONNECTED;
-    pthread_mutex_unlock(&conn->lock);
-    
-    LOGD("Connection established successfully");
+    pthread_mutex_lock(&g_connect.lock);
     
-    // Call connected callback
-    if (conn->on_connected) {
-        conn->on_connected(conn, &conn->net_config);
+    while (true) {
+        connect_run();
+        
+        uint64_t now = get_time_ms();
+        uint64_t wake = UINT64_MAX;
+        for (se_connect_op_t* op = g_connect.ops; op; op = op->next) {
+            uint64_t op_wake = connect_wake_ms(op);
+            if (op_wake < wake) wake = op_wake;
+        }
+        int timeout = wake == UINT64_MAX ? -1 : wake > now ? (int)(wake - now) : 0;
+        
+        pthread_mutex_unlock(&g_connect.lock);
+        int count = epoll_wait(g_connect.epoll_fd, events, SE_CONNECT_LOOP_EVENTS, timeout);
+        pthread_mutex_lock(&g_connect.lock);
+        
+        // Only this thread frees ops, so the pointers are still valid
+        for (int i = 0; i < count; i++) {
+            se_connect_op_t* op = (se_connect_op_t*)events[i].data.ptr;
+            if (op) {
+                op->ready = true;
+                continue;
+            }
+            
+            // New or cancelled connects, or a resolver answer: look at every op
+            uint64_t value;
+            ssize_t n = read(g_connect.wakeup_fd, &value, sizeof(value));
+            (void)n;
+            for (op = g_connect.ops; op; op = op->next) {
+                op->ready = true;
+            }
+        }
     }
     
-    return SE_ERR_SUCCESS;
-    
-connect_failed:
-    ssl_context_free(conn->ssl_ctx);
-    conn->ssl_ctx = NULL;
-    close(conn->socket_fd);
-    conn->socket_fd = -1;
-    pthread_mutex_lock(&conn->lock);
-    conn->state = SE_STATE_ERROR;
-    conn->last_error = SE_ERR_PROTOCOL_MISMATCH;
-    pthread_mutex_unlock(&conn->lock);
-    return SE_ERR_PROTOCOL_MISMATCH;
+    return NULL;
 }
 
-void se_connection_disconnect(se_connection_t* conn) {
-    if (!conn) return;
-    
-    pthread_mutex_lock(&conn->lock);
+static void connect_loop_init(void) {
+    g_connect.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    g_connect.wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    
+    if (g_connect.epoll_fd >= 0 && g_connect.wakeup_fd >= 0 &&
+        epoll_ctl(g_connect.epoll_fd, EPOLL_CTL_ADD, g_connect.wakeup_fd, &event) == 0) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        g_connect_started = pthread_create(&g_connect.thread, &attr, connect_loop_thread, NULL) == 0;
+        pthread_attr_destroy(&attr);
+    }
     
-    if (conn->state == SE_STATE_DISCONNECTED || conn->state == SE_STATE_DISCONNECTING) {
-        pthread_mutex_unlock(&conn->lock);
+    if (!g_connect_started) {
+        LOGE("Failed to start connect thread: %s", strerror(errno));
         return;
     }
     
-    conn->state = SE_STATE_DISCONNECTING;
-    conn->threads_running = false;
+    se_dns_set_notify_fd(g_connect.wakeup_fd);
+}
+
+int se_connection_connect_async(se_connection_t* conn, const se_connection_params_t* params) {
+    if (!conn || !params) {
+        LOGE("Invalid parameters");
+        return SE_ERR_INVALID_PARAM;
+    }
     
-    pthread_mutex_unlock(&conn->lock);
+    pthread_once(&g_connect_once, connect_loop_init);
+    if (!g_connect_started) return SE_ERR_OUT_OF_MEMORY;
     
-    LOGD("Disconnecting...");
+    se_connect_op_t* op = (se_connect_op_t*)calloc(1, sizeof(se_connect_op_t));
+    if (!op) return SE_ERR_OUT_OF_MEMORY;
     
-    // Send disconnect packet
-    if (conn->ssl_ctx) {
-        se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_DISCONNECT, 0, NULL, 0);
-        if (packet) {
-            uint8_t buffer[64];
-            int len = se_packet_serialize(packet, buffer, sizeof(buffer));
-            if (len > 0) {
-                ssl_write(conn->ssl_ctx, buffer, len);
-            }
-            se_packet_free(packet);
-        }
-    }
+    // Build the shared SSL_CTX (reading the CA store) now rather than in
+    // the TLS phase, where it would hold g_connect.lock for every connect
+    SSL_CTX_free(ssl_shared_ctx_get(params->verify_server_cert, params->use_ktls));
     
-    // Wait for threads to finish
-    if (conn->recv_thread) {
-        pthread_join(conn->recv_thread, NULL);
-        conn->recv_thread = 0;
-    }
-    if (conn->send_thread) {
-        pthread_join(conn->send_thread, NULL);
-        conn->send_thread = 0;
-    }
-    if (conn->keepalive_thread) {
-        pthread_join(conn->keepalive_thread, NULL);
-        conn->keepalive_thread = 0;
-    }
+    pthread_mutex_lock(&g_connect.lock);
+    pthread_mutex_lock(&conn->lock);
     
-    // Cleanup SSL
-    if (conn->ssl_ctx) {
-        ssl_context_free(conn->ssl_ctx);
-        conn->ssl_ctx = NULL;
+    if (conn->state != SE_STATE_DISCONNECTED) {
+        pthread_mutex_unlock(&conn->lock);
+        pthread_mutex_unlock(&g_connect.lock);
+        free(op);
+        LOGE("Connection already in progress");
+        return SE_ERR_INVALID_PARAM;
     }
     
-    // Close socket
-    if (conn->socket_fd >= 0) {
-        close(conn->socket_fd);
-        conn->socket_fd = -1;
-    }
+    conn->state = SE_STATE_CONNECTING;
+    conn->tls_mode = SE_TLS_MODE_NONE;
+    memcpy(&conn->params, params, sizeof(se_connection_params_t));
+    memset(&conn->connect_report, 0, sizeof(se_connect_report_t));
+    conn->connect_report.winner = -1;
+    conn->join_cancelled = false;
+    connect_timing_begin(conn, true);
     
-    pthread_mutex_lock(&conn->lock);
-    conn->state = SE_STATE_DISCONNECTED;
     pthread_mutex_unlock(&conn->lock);
     
-    LOGD("Disconnected");
-    
-    // Call disconnected callback
-    if (conn->on_disconnected) {
-        conn->on_disconnected(conn, 0);
+    conn->udp_aead = SE_UDP_AEAD_NONE;
+    conn->udp_port = 0;
+    conn->compress_algorithm = SE_COMPRESS_NONE;
+    if (params->use_udp_acceleration &&
+        generate_random_bytes(conn->udp_client_random, SE_UDP_RANDOM_SIZE) < 0) {
+        LOGE("No key material for UDP acceleration, not offering it");
+        conn->params.use_udp_acceleration = false;
     }
-}
-
-int se_connection_get_state(se_connection_t* conn) {
-    if (!conn) return SE_STATE_ERROR;
     
-    pthread_mutex_lock(&conn->lock);
-    int state = conn->state;
-    pthread_mutex_unlock(&conn->lock);
+    op->conn = conn;
+    op->start_ms = get_time_ms();
+    op->report.winner = -1;
+    op->ready = true;
+    connect_set_phase(op, SE_CONNECT_PHASE_RESOLVE, SE_CONNECT_TIMEOUT_MS);
     
-    return state;
-}
-
-int se_connection_get_last_error(se_connection_t* conn) {
-    if (!conn) return SE_ERR_INVALID_PARAM;
+    op->next = g_connect.ops;
+    g_connect.ops = op;
+    conn->connect_op = op;
     
-    pthread_mutex_lock(&conn->lock);
-    int error = conn->last_error;
-    pthread_mutex_unlock(&conn->lock);
+    pthread_mutex_unlock(&g_connect.lock);
     
-    return error;
-}
-
-const char* se_connection_get_error_string(se_connection_t* conn) {
-    if (!conn) return "Invalid connection";
-    return se_error_string(conn->last_error);
+    LOGD("Connecting to %s:%d asynchronously", params->server_host, params->server_port);
+    connect_wakeup();
+    return SE_ERR_SUCCESS;
 }
 
-int se_connection_set_tun_fd(se_connection_t* conn, int tun_fd) {
+int se_connection_cancel_connect(se_connection_t* conn) {
     if (!conn) return -1;
     
-    pthread_mutex_lock(&conn->lock);
-    conn->tun_fd = tun_fd;
-    pthread_mutex_unlock(&conn->lock);
-    
-    return 0;
-}
-
-int se_connection_send_packet(se_connection_t* conn, const uint8_t* data, size_t len) {
-    if (!conn || !data || len == 0) return -1;
-    
-    se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_DATA, 0, data, len);
-    if (!packet) return -1;
+    pthread_mutex_lock(&g_connect.lock);
     
-    int result = se_packet_queue_push(conn->send_queue, packet, false);
-    if (result < 0) {
-        se_packet_free(packet);
+    se_connect_op_t* op = conn->connect_op;
+    if (!op) {
+        pthread_mutex_unlock(&g_connect.lock);
+        return -1;
     }
     
-    return result;
-}
-
-int se_connection_recv_packet(se_connection_t* conn, uint8_t* buffer, size_t buffer_size) {
-    if (!conn || !buffer || buffer_size == 0) return -1;
+    op->cancelled = true;
     
-    se_packet_t* packet = se_packet_queue_pop(conn->recv_queue, false);
-    if (!packet) return 0;  // No packet available
+    if (op->phase == SE_CONNECT_PHASE_SESSION) {
+        // Its session thread stops joining and finishes promptly: the join
+        // in progress is shut down and every other step is time-limited
+        pthread_mutex_lock(&conn->lock);
+        conn->join_cancelled = true;
+        if (conn->joining_fd >= 0) shutdown(conn->joining_fd, SHUT_RDWR);
+        pthread_mutex_unlock(&conn->lock);
+        
+        while (conn->connect_op == op) {
+            pthread_cond_wait(&g_connect.released, &g_connect.lock);
+        }
+    } else if (pthread_equal(pthread_self(), g_connect.thread)) {
+        // From a callback on the connect thread, which is not stepping op
+        if (connect_unlink(&g_connect.ops, op) || connect_unlink(&g_connect.completed, op)) {
+            connect_drop(op);
+            connect_release(op, SE_STATE_DISCONNECTED, SE_CONNECT_CANCELLED);
+        }
+    } else {
+        connect_wakeup();
+        while (conn->connect_op == op) {
+            pthread_cond_wait(&g_connect.released, &g_connect.lock);
+        }
+    }
     
-    size_t copy_len = packet->payload_len < buffer_size ? packet->payload_len : buffer_size;
-    memcpy(buffer, packet->payload, copy_len);
-    se_packet_free(packet);
+    pthread_mutex_unlock(&g_connect.lock);
     
-    return (int)copy_len;
+    LOGD("Asynchronous connect cancelled");
+    return 0;
 }
 
-void se_connection_get_statistics(se_connection_t* conn, se_statistics_t* stats) {
-    if (!conn || !stats) return;
+int se_connection_get_connect_phase(se_connection_t* conn) {
+    if (!conn) return SE_CONNECT_PHASE_IDLE;
     
     pthread_mutex_lock(&conn->lock);
-    memcpy(stats, &conn->stats, sizeof(se_statistics_t));
+    int phase = conn->connect_phase;
     pthread_mutex_unlock(&conn->lock);
-}
-
-void se_connection_reset_statistics(se_connection_t* conn) {
-    if (!conn) return;
     
-    pthread_mutex_lock(&conn->lock);
-    memset(&conn->stats, 0, sizeof(se_statistics_t));
-    pthread_mutex_unlock(&conn->lock);
+    return phase;
 }
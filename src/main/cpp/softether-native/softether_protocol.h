@@ -15,6 +15,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <pthread.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -38,6 +40,20 @@ extern "C" {
 #define SE_STATE_DISCONNECTING  3
 #define SE_STATE_ERROR          4
 
+// Connect phases
+#define SE_CONNECT_PHASE_IDLE       0   // No connect in flight
+#define SE_CONNECT_PHASE_RESOLVE    1
+#define SE_CONNECT_PHASE_TCP        2   // Happy Eyeballs race
+#define SE_CONNECT_PHASE_TLS        3
+#define SE_CONNECT_PHASE_HELLO      4
+#define SE_CONNECT_PHASE_AUTH       5
+#define SE_CONNECT_PHASE_DHCP       6
+#define SE_CONNECT_PHASE_SESSION    7   // Additional connections, UDP channel, threads
+#define SE_CONNECT_PHASE_COUNT      8
+
+#define SE_CONNECT_HISTORY_SIZE     8   // Finished connects remembered per connection
+#define SE_CONNECT_CANCELLED        -1  // se_connect_timing_t result of a cancelled connect
+
 // Error codes
 #define SE_ERR_SUCCESS              0
 #define SE_ERR_INVALID_PARAM        1
@@ -51,6 +67,12 @@ extern "C" {
 #define SE_ERR_NETWORK_ERROR        9
 #define SE_ERR_OUT_OF_MEMORY        10
 
+// TLS record layer modes
+#define SE_TLS_MODE_NONE        0   // No established TLS session
+#define SE_TLS_MODE_USERSPACE   1   // OpenSSL encrypts and decrypts
+#define SE_TLS_MODE_KTLS_TX     2   // Kernel encrypts, OpenSSL decrypts
+#define SE_TLS_MODE_KTLS        3   // Kernel encrypts and decrypts
+
 // Buffer sizes
 #define SE_MAX_HOSTNAME_LEN     256
 #define SE_MAX_USERNAME_LEN     256
@@ -59,6 +81,16 @@ extern "C" {
 #define SE_MAX_PACKET_SIZE      65536
 #define SE_MAX_RECV_BUFFER      65536
 #define SE_MAX_SEND_BUFFER      65536
+#define SE_SEND_BATCH_SIZE      (4 * SE_MAX_PACKET_SIZE)  // Coalesced frames per ssl_write
+#define SE_RECV_RING_SIZE       (4 * SE_MAX_PACKET_SIZE)  // Must be a power of two
+#define SE_FRAME_HEADER_SIZE    12
+#define SE_CACHE_LINE_SIZE      64
+#define SE_PACKET_HEADROOM      64     // Frame header plus room for TLS/Ethernet headers
+
+// Packet pool size classes (payload bytes)
+#define SE_POOL_SMALL_PAYLOAD   2048   // Anything up to a TUN MTU
+#define SE_POOL_LARGE_PAYLOAD   SE_MAX_FRAME_PAYLOAD
+#define SE_MAX_FRAME_PAYLOAD    (SE_MAX_PACKET_SIZE - SE_FRAME_HEADER_SIZE)
 
 // Default ports
 #define SE_DEFAULT_PORT_HTTPS   443
@@ -71,6 +103,36 @@ extern "C" {
 #define SE_HANDSHAKE_TIMEOUT_MS 10000
 #define SE_DHCP_TIMEOUT_MS      30000
 #define SE_KEEPALIVE_INTERVAL_MS 5000
+#define SE_CONNECT_ATTEMPT_DELAY_MS 250   // Happy Eyeballs stagger (RFC 8305)
+#define SE_STATS_PAGE_INTERVAL_MS 500   // Statistics page refresh while connected
+
+#define SE_MAX_CONNECT_ATTEMPTS 16
+
+// Parallel TCP/TLS connections per session (SoftEther max_connection)
+#define SE_MAX_CONNECTIONS      32
+#define SE_TRANSPORT_QUEUE_SIZE 256    // Striped packets waiting per connection
+
+// Transport connection roles
+#define SE_TRANSPORT_ROLE_BOTH      0   // Carries traffic in both directions
+#define SE_TRANSPORT_ROLE_UPLOAD    1   // Client to server only (half-duplex)
+#define SE_TRANSPORT_ROLE_DOWNLOAD  2   // Server to client only (half-duplex)
+
+// UDP acceleration
+#define SE_UDP_PROBE_INTERVAL_MS    1000   // Probe the UDP path this often
+#define SE_UDP_DEAD_MS              3500   // Fall back to TLS after this long without a datagram
+
+// UDP acceleration states
+#define SE_UDP_STATE_DISABLED   0   // Not requested or not offered by the server
+#define SE_UDP_STATE_PROBING    1   // Data goes over TLS until a probe is answered
+#define SE_UDP_STATE_ACTIVE     2   // Data goes over UDP
+
+// Data channel compression, as sent in hello[9]
+#define SE_COMPRESS_NONE        0
+#define SE_COMPRESS_ZLIB        1   // Raw deflate stream, for SoftEther interop
+#define SE_COMPRESS_LZ          2   // LZ4-style, much cheaper on CPU
+
+// Frame header flags
+#define SE_FRAME_FLAG_COMPRESSED    0x00000001  // Payload is a compressed DATA packet
 
 // ============================================================================
 // Data Structures
@@ -87,11 +149,17 @@ typedef struct {
     char password[SE_MAX_PASSWORD_LEN];
     bool use_encrypt;
     bool use_compress;
+    int compress_algorithm;  // SE_COMPRESS_*, 0 picks zlib when use_compress is set
     int proxy_type;      // 0: None, 1: HTTP, 2: SOCKS5
     char proxy_host[SE_MAX_HOSTNAME_LEN];
     int proxy_port;
     int reconnect_retries;
     bool verify_server_cert;
+    bool use_ktls;       // Offload the TLS record layer to the kernel when supported
+    bool use_event_loop; // One epoll thread instead of receive/send/keepalive threads
+    int max_connections; // Parallel TCP/TLS connections, 1..SE_MAX_CONNECTIONS (0 means 1)
+    bool half_duplex;    // Dedicate each additional connection to one direction
+    bool use_udp_acceleration; // Carry data over an encrypted UDP channel when the server offers one
     int mtu;
 } se_connection_params_t;
 
@@ -118,13 +186,276 @@ typedef struct {
     uint64_t packets_received;
     uint64_t errors;
     uint64_t start_time_ms;
+    uint64_t pool_hits;      // Packets served from a pool free list
+    uint64_t pool_misses;    // Packets that needed a new slab or the heap
 } se_statistics_t;
 
+/**
+ * One TCP connect attempt made while racing the server's addresses
+ */
+typedef struct {
+    char address[46];        // Numeric IPv4 or IPv6 address
+    int family;              // AF_INET or AF_INET6
+    uint32_t start_ms;       // Offset from the first attempt
+    uint32_t duration_ms;    // Until it connected, failed or lost the race
+    int error;               // 0 if connected, errno if failed, -1 if abandoned
+} se_connect_attempt_t;
+
+/**
+ * Timing of the most recent TCP connect
+ */
+typedef struct {
+    uint32_t resolve_ms;
+    uint32_t connect_ms;     // First attempt until the winner connected
+    int address_count;       // Addresses resolved
+    int attempt_count;       // Attempts started
+    int winner;              // Index into attempts, -1 if none connected
+    se_connect_attempt_t attempts[SE_MAX_CONNECT_ATTEMPTS];
+} se_connect_report_t;
+
+/**
+ * Where the time of one connect went, phase by phase
+ */
+typedef struct {
+    uint64_t start_ms;       // Monotonic clock when the connect started
+    uint32_t total_ms;       // Until it finished, or so far
+    uint32_t phase_ms[SE_CONNECT_PHASE_COUNT];  // By SE_CONNECT_PHASE_*; IDLE is unused
+    int last_phase;          // Phase reached; the one that failed if result is an error
+    int result;              // SE_ERR_* or SE_CONNECT_CANCELLED
+    bool async;              // Started by se_connection_connect_async
+} se_connect_timing_t;
+
+/**
+ * Byte ring buffer
+ *
+ * head and tail are free-running counters; the buffer offset is the
+ * counter masked by (capacity - 1), so capacity must be a power of two.
+ */
+typedef struct {
+    uint8_t* data;
+    size_t capacity;
+    size_t head;         // Next byte to read
+    size_t tail;         // Next byte to write
+} se_ring_t;
+
+/**
+ * TLS session cache counters (process-wide)
+ */
+typedef struct {
+    uint64_t lookups;        // Handshakes that consulted the cache
+    uint64_t hits;           // Lookups that offered a cached session
+    uint64_t resumed;        // Handshakes the server completed as resumptions
+    uint64_t stored;         // Sessions and tickets stored
+} se_session_cache_stats_t;
+
+/**
+ * DNS resolver counters (process-wide)
+ */
+typedef struct {
+    uint64_t lookups;        // se_dns_resolve() calls for hostnames
+    uint64_t cache_hits;     // Answered from a live cache entry
+    uint64_t negative_hits;  // Answered from a cached NXDOMAIN or held failure
+    uint64_t queries;        // Lookups performed by the resolver thread
+    uint64_t refreshes;      // Queries that refreshed a hot entry before expiry
+    uint64_t failures;       // Queries that produced no answer
+} se_dns_stats_t;
+
+/**
+ * Per-connection transfer counters of a multi-connection session
+ */
+typedef struct {
+    int role;                // SE_TRANSPORT_ROLE_*
+    bool active;             // False once the connection failed or closed
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t packets_sent;
+    uint64_t packets_received;
+    uint64_t drops;          // Packets dropped because the connection's queue was full
+    uint64_t uptime_ms;      // Since the connection joined or counters were reset
+    uint64_t send_rate;      // Average bytes per second over uptime_ms
+    uint64_t recv_rate;
+} se_transport_stats_t;
+
+/**
+ * UDP acceleration counters
+ */
+typedef struct {
+    int state;               // SE_UDP_STATE_*
+    uint64_t datagrams_sent;
+    uint64_t datagrams_received;
+    uint64_t bytes_sent;     // Payload bytes, probes included
+    uint64_t bytes_received;
+    uint64_t rejected;       // Datagrams that failed authentication or were replays
+    uint64_t fallbacks;      // Times data moved back to TLS because UDP stopped passing
+} se_udp_stats_t;
+
+/**
+ * Data channel compression counters, summed over all connections
+ */
+typedef struct {
+    int algorithm;           // SE_COMPRESS_* agreed with the server
+    uint64_t packets_in;     // DATA packets offered to the compressor
+    uint64_t packets_compressed;
+    uint64_t packets_skipped;    // Judged incompressible without trying
+    uint64_t bytes_in;       // Payload bytes before compression
+    uint64_t bytes_out;      // Payload bytes sent for them, compressed or not
+    uint64_t compress_ns;    // CPU time spent compressing
+    uint64_t recv_bytes_in;  // Compressed payload bytes received
+    uint64_t recv_bytes_out; // Bytes they decompressed to
+    uint64_t decompress_ns;
+} se_compress_stats_t;
+
+// Latency histogram paths
+#define SE_LATENCY_TUN_TO_WIRE  0   // TUN read until the frame is written to the socket
+#define SE_LATENCY_WIRE_TO_TUN  1   // Frame header received until the packet is written to TUN
+#define SE_LATENCY_PATH_COUNT   2
+
+#define SE_LATENCY_BUCKETS      1024
+#define SE_LATENCY_MAX_NS       ((1ULL << 36) - 1)  // About 68 s; larger values count here
+
+/**
+ * Copy of one per-packet latency histogram (see softether_latency.h for
+ * the bucket layout). Query it with se_latency_percentile().
+ */
+typedef struct {
+    uint64_t count;          // Packets recorded
+    uint64_t sum_ns;
+    uint64_t min_ns;         // Lowest value of the lowest bucket used
+    uint64_t max_ns;
+    uint64_t counts[SE_LATENCY_BUCKETS];
+} se_latency_snapshot_t;
+
+// Statistics page header
+#define SE_STATS_PAGE_MAGIC     0x54534553  // "SEST" in memory order
+#define SE_STATS_PAGE_VERSION   1
+
+/**
+ * Statistics page, republished every SE_STATS_PAGE_INTERVAL_MS and on
+ * state changes. Readers never lock: the writer makes sequence odd,
+ * stores the fields and makes it even again, so a copy taken between two
+ * equal, even reads of sequence is consistent. Every field after the
+ * header is a naturally aligned uint64_t, in this order for good; new
+ * fields go at the end and raise field_count.
+ */
+typedef struct {
+    uint32_t magic;          // SE_STATS_PAGE_MAGIC
+    uint32_t version;        // SE_STATS_PAGE_VERSION
+    uint32_t sequence;       // Odd while the fields are being written
+    uint32_t field_count;    // uint64_t fields below
+    uint64_t state;          // SE_STATE_*
+    uint64_t update_ms;      // Monotonic clock of this update
+    uint64_t uptime_ms;      // Since the session started, 0 when not connected
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t packets_sent;
+    uint64_t packets_received;
+    uint64_t errors;
+    uint64_t drops;          // Packets dropped on full queues
+    uint64_t send_queue;     // Packets waiting to be sent, striping queues included
+    uint64_t recv_queue;     // Packets waiting for se_connection_recv_packet
+    uint64_t rtt_us;         // Kernel smoothed RTT of the first connection
+    uint64_t rtt_var_us;
+    uint64_t connects;       // Connects that established a session
+    uint64_t reconnects;     // Of those, the ones after the first
+    uint64_t connect_failures;   // Connects that failed or were cancelled
+    uint64_t send_rate;      // Bytes per second since the previous update
+    uint64_t recv_rate;
+    uint64_t send_packet_rate;
+    uint64_t recv_packet_rate;
+} se_stats_page_t;
+
+// Packet tap ring
+#define SE_TAP_MAGIC            0x50415445  // "ETAP" in memory order
+#define SE_TAP_VERSION          1
+#define SE_TAP_HEADER_SIZE      64          // Ring data starts this far into the mapping
+#define SE_TAP_RECORD_ALIGN     16
+#define SE_TAP_MIN_CAPACITY     4096
+#define SE_TAP_MAX_CAPACITY     (16 * 1024 * 1024)
+#define SE_TAP_DEFAULT_NOTIFY_PACKETS 64
+#define SE_TAP_DEFAULT_NOTIFY_US      10000
+
+// Packet tap record directions
+#define SE_TAP_RECEIVED         0           // Server to TUN
+#define SE_TAP_WRAP             0xFFFF      // Filler: the next record is at offset 0
+
+/**
+ * Packet tap ring: copies of received packets for monitoring, in one
+ * mapping the JNI layer shares as a direct ByteBuffer. head and tail are
+ * free-running byte counts, masked by capacity - 1 into the data that
+ * follows this header. Records are SE_TAP_RECORD_ALIGN aligned: an
+ * se_tap_record_t, then captured bytes of the packet. on_packets_tapped
+ * hands the reader [tail, head), which stays its own until it calls
+ * se_connection_release_packet_tap; no other notification comes before.
+ */
+typedef struct {
+    uint32_t magic;          // SE_TAP_MAGIC
+    uint32_t version;        // SE_TAP_VERSION
+    uint32_t capacity;       // Data bytes, a power of two
+    uint32_t snap_len;       // Packet bytes kept per record
+    uint32_t head;           // Written by the data threads
+    uint32_t tail;           // Advanced after each notification
+    uint64_t packets;        // Packets recorded
+    uint64_t dropped;        // Packets lost to a full ring
+    uint8_t reserved[24];
+} se_packet_tap_t;
+
+typedef struct {
+    uint64_t timestamp_ns;   // CLOCK_MONOTONIC
+    uint16_t length;         // Packet length
+    uint16_t captured;       // Bytes that follow, at most snap_len
+    uint16_t direction;      // SE_TAP_*
+    uint16_t reserved;
+} se_tap_record_t;
+
 /**
  * SSL/TLS context (opaque)
  */
 typedef struct se_ssl_context se_ssl_context_t;
 
+/**
+ * Packet pool (opaque)
+ */
+typedef struct se_packet_pool se_packet_pool_t;
+
+/**
+ * One TCP/TLS connection of a session
+ *
+ * Transport 0 is the connection that authenticated: its socket, SSL
+ * context, receive ring and send lock are the connection's own. Further
+ * transports join the session with SE_PACKET_TYPE_ADD_CONNECTION.
+ */
+typedef struct se_transport {
+    struct se_connection* conn;
+    int index;
+    int role;                        // SE_TRANSPORT_ROLE_*
+    int socket_fd;
+    se_ssl_context_t* ssl_ctx;
+    se_ring_t* recv_ring;            // &conn->recv_ring for transport 0
+    pthread_mutex_t* send_lock;      // &conn->send_lock for transport 0
+    struct se_packet_queue* send_queue;  // Packets striped to this transport (multi-connection only)
+    struct se_compressor* compressor;    // Used by whichever thread writes DATA frames
+    struct se_compressor* decompressor;  // Used by the receive thread
+    pthread_t recv_thread;           // Transports other than 0
+    pthread_t send_thread;           // Multi-connection only
+    volatile bool active;
+    uint64_t start_ms;
+    
+    // Receive latency: time of the last read into recv_ring, and when the
+    // header of a partial frame left in it arrived (0 if none)
+    uint64_t received_ns;
+    uint64_t frame_start_ns;
+    
+    // Counters, updated with relaxed atomics
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t packets_sent;
+    uint64_t packets_received;
+    uint64_t drops;
+    
+    se_ring_t own_ring;
+    pthread_mutex_t own_lock;
+} se_transport_t;
+
 /**
  * Connection context
  */
@@ -137,6 +468,7 @@ typedef struct se_connection {
     // Socket
     int socket_fd;
     se_ssl_context_t* ssl_ctx;
+    int tls_mode;                // SE_TLS_MODE_*, guarded by lock
     
     // Parameters
     se_connection_params_t params;
@@ -151,18 +483,54 @@ typedef struct se_connection {
     pthread_t recv_thread;
     pthread_t send_thread;
     pthread_t keepalive_thread;
+    pthread_t loop_thread;       // Event loop mode only
     volatile bool threads_running;
     
     // Synchronization
     pthread_mutex_t lock;
     pthread_cond_t cond;
+    pthread_mutex_t send_lock;   // Serializes writes to the SSL stream
+    int wakeup_fd;               // eventfd that wakes the send thread or event loop
+    
+    // Transport connections; transports[0] wraps socket_fd/ssl_ctx.
+    // Set up by connect and torn down by disconnect, guarded by lock.
+    se_transport_t* transports[SE_MAX_CONNECTIONS];
+    int transport_count;
+    int upload_map[SE_MAX_CONNECTIONS];  // Transports that carry client traffic
+    int upload_count;
     
     // Packet queues
     struct se_packet_queue* send_queue;
     struct se_packet_queue* recv_queue;
     
+    // Receive ring, filled with large reads by the receive thread
+    se_ring_t recv_ring;
+    
+    // Packet allocator for queued packets
+    se_packet_pool_t* packet_pool;
+    
     // Statistics
     se_statistics_t stats;
+    se_connect_report_t connect_report;
+    struct se_latency_histogram* latency[SE_LATENCY_PATH_COUNT];  // By SE_LATENCY_*
+    uint32_t connects;           // Connects that established a session
+    
+    // Statistics page and what its rates are measured against
+    se_stats_page_t* stats_page;
+    pthread_mutex_t stats_page_lock;     // Serializes writers; readers never take it
+    uint64_t stats_page_ms;
+    uint64_t stats_page_totals[4];       // Bytes and packets sent and received
+    
+    // Packet tap, mapped on first enable and kept until se_connection_free
+    se_packet_tap_t* tap;
+    size_t tap_size;
+    bool tap_enabled;
+    pthread_mutex_t tap_lock;            // Serializes the data threads writing records
+    uint32_t tap_notify_packets;
+    uint64_t tap_notify_ns;
+    uint32_t tap_pending;                // Records since the last notification
+    uint64_t tap_notified_ns;
+    bool tap_notifying;                  // A thread is inside on_packets_tapped
     
     // Session ID
     uint8_t session_id[16];
@@ -171,37 +539,87 @@ typedef struct se_connection {
     // Protocol version
     uint16_t server_version;
     uint16_t server_build;
+    int server_max_connections;  // Connections the server accepts per session
+    
+    // UDP acceleration, negotiated in the hello exchange
+    struct se_udp_channel* udp;
+    pthread_t udp_thread;
+    volatile int udp_state;      // SE_UDP_STATE_*, written by the UDP thread
+    int udp_aead;                // SE_UDP_AEAD_* the server chose, 0 if none
+    uint16_t udp_port;           // Server UDP port
+    uint8_t udp_client_random[32];
+    uint8_t udp_server_random[32];
+    uint64_t udp_fallbacks;
+    
+    // Data channel compression, negotiated in the hello exchange
+    int compress_algorithm;      // SE_COMPRESS_*
+    
+    // Asynchronous connect, owned by the connect loop while in flight
+    struct se_connect_op* connect_op;
+    int joining_fd;              // Additional connection being joined, -1 if none (lock)
+    bool join_cancelled;         // Cancel arrived in the session phase: stop joining (lock)
+    
+    // Connect phase and timing, guarded by lock
+    int connect_phase;           // SE_CONNECT_PHASE_*
+    uint64_t connect_phase_start_ms;
+    se_connect_timing_t connect_timing;      // Connect in flight or the last one
+    se_connect_timing_t connect_history[SE_CONNECT_HISTORY_SIZE];  // Ring of finished connects
+    uint32_t connect_history_count;          // Connects ever finished
     
     // Callbacks
     void (*on_connected)(struct se_connection* conn, const se_network_config_t* config);
     void (*on_disconnected)(struct se_connection* conn, int reason);
     void (*on_error)(struct se_connection* conn, int error_code, const char* message);
-    void (*on_packet)(struct se_connection* conn, const uint8_t* data, size_t len);
+    void (*on_packets_tapped)(struct se_connection* conn, const se_packet_tap_t* tap,
+                              uint32_t tail, uint32_t head);
+    // With each statistics page update that moved the state or byte totals,
+    // under the page lock: they must not reset or publish statistics
+    void (*on_state_changed)(struct se_connection* conn, int state);
+    void (*on_bytes_transferred)(struct se_connection* conn, uint64_t sent, uint64_t received);
     void* user_data;
 } se_connection_t;
 
 /**
  * Packet structure
+ *
+ * The payload is stored inline in the same allocation, after
+ * SE_PACKET_HEADROOM spare bytes so headers can be prepended in place.
  */
 typedef struct se_packet {
     uint32_t type;
     uint32_t flags;
     uint32_t payload_len;
+    uint32_t capacity;               // Inline payload bytes available
     uint8_t* payload;
     struct se_packet* next;
+    se_packet_pool_t* pool;          // Owning pool, NULL for heap packets
+    int size_class;
+    uint64_t read_ns;                // When read from TUN (se_latency_now), 0 otherwise
 } se_packet_t;
 
 /**
  * Packet queue
+ *
+ * Bounded lock-free single-producer/single-consumer ring. Exactly one
+ * thread may push and exactly one thread may pop (or clear) at a time.
+ * Blocked callers park on a futex only when the ring is empty or full.
  */
 typedef struct se_packet_queue {
-    se_packet_t* head;
-    se_packet_t* tail;
-    size_t count;
+    se_packet_t** slots;
+    size_t mask;                 // Slot count - 1 (power of two)
     size_t max_size;
-    pthread_mutex_t lock;
-    pthread_cond_t not_empty;
-    pthread_cond_t not_full;
+    
+    // Consumer side
+    size_t head __attribute__((aligned(SE_CACHE_LINE_SIZE)));
+    size_t cached_tail;
+    uint32_t consumer_waiting;
+    uint32_t not_empty_seq;      // Futex word, bumped when a waiting consumer is woken
+    
+    // Producer side
+    size_t tail __attribute__((aligned(SE_CACHE_LINE_SIZE)));
+    size_t cached_head;
+    uint32_t producer_waiting;
+    uint32_t not_full_seq;       // Futex word, bumped when a waiting producer is woken
 } se_packet_queue_t;
 
 // ============================================================================
@@ -213,6 +631,7 @@ typedef struct se_packet_queue {
 #define SE_PACKET_TYPE_KEEPALIVE    0x0003  // Keepalive
 #define SE_PACKET_TYPE_AUTH_REQUEST 0x0010  // Authentication request
 #define SE_PACKET_TYPE_AUTH_RESPONSE 0x0011 // Authentication response
+#define SE_PACKET_TYPE_ADD_CONNECTION 0x0012 // Join an authenticated session
 #define SE_PACKET_TYPE_DHCP_REQUEST 0x0020  // DHCP request
 #define SE_PACKET_TYPE_DHCP_RESPONSE 0x0021 // DHCP response
 #define SE_PACKET_TYPE_DISCONNECT   0x00FF  // Disconnect
@@ -226,22 +645,103 @@ se_connection_t* se_connection_new(void);
 void se_connection_free(se_connection_t* conn);
 int se_connection_connect(se_connection_t* conn, const se_connection_params_t* params);
 void se_connection_disconnect(se_connection_t* conn);
+
+// Asynchronous connect, driven by one process-wide connect thread that
+// serves any number of connections. se_connection_connect_async returns
+// once the connect has started; its outcome arrives on the connect thread
+// through on_connected or on_error. Cancelling (se_connection_disconnect
+// cancels too) delivers neither and waits until the connect has let go of
+// the connection; a connect already in SE_CONNECT_PHASE_SESSION finishes
+// first and is left connected. se_connection_cancel_connect returns -1 if
+// no asynchronous connect was in flight.
+int se_connection_connect_async(se_connection_t* conn, const se_connection_params_t* params);
+int se_connection_cancel_connect(se_connection_t* conn);
+int se_connection_get_connect_phase(se_connection_t* conn);
 int se_connection_get_state(se_connection_t* conn);
 int se_connection_get_last_error(se_connection_t* conn);
 const char* se_connection_get_error_string(se_connection_t* conn);
+int se_connection_get_tls_mode(se_connection_t* conn);
+void se_connection_get_connect_report(se_connection_t* conn, se_connect_report_t* report);
+
+// Phase timing of the connect in flight, or of the last one if none is.
+// Returns -1 if the connection never connected.
+int se_connection_get_connect_timing(se_connection_t* conn, se_connect_timing_t* timing);
+
+// Copy up to max_timings finished connects, newest first, and return how
+// many were copied
+int se_connection_get_connect_history(se_connection_t* conn, se_connect_timing_t* timings, int max_timings);
+int se_connection_get_transport_stats(se_connection_t* conn, se_transport_stats_t* stats, int max_stats);
+int se_connection_get_udp_stats(se_connection_t* conn, se_udp_stats_t* stats);
+int se_connection_get_compress_stats(se_connection_t* conn, se_compress_stats_t* stats);
 
 // Network operations
 int se_connection_set_tun_fd(se_connection_t* conn, int tun_fd);
-int se_connection_send_packet(se_connection_t* conn, const uint8_t* data, size_t len);
+int se_connection_send_packet(se_connection_t* conn, const uint8_t* data, size_t len);  // Single producer
 int se_connection_recv_packet(se_connection_t* conn, uint8_t* buffer, size_t buffer_size);
 
 // Statistics
 void se_connection_get_statistics(se_connection_t* conn, se_statistics_t* stats);
 void se_connection_reset_statistics(se_connection_t* conn);
 
+// Per-packet latency of one path (SE_LATENCY_*). With reset set the
+// histogram restarts empty; the data threads never wait for either.
+int se_connection_get_latency(se_connection_t* conn, int path, se_latency_snapshot_t* snapshot, bool reset);
+
+// Statistics page of the connection, updated until se_connection_free.
+// The memory stays mapped after that and is reused by a later connection,
+// so a reader racing the free sees stale or zeroed fields, never a fault.
+// Its size is sizeof(se_stats_page_t).
+const se_stats_page_t* se_connection_get_stats_page(se_connection_t* conn);
+
+// Copy received packets into the packet tap ring and call on_packets_tapped
+// at most once per notify_packets packets or notify_us microseconds, plus a
+// late call for stragglers from the keepalive tick. The first call maps
+// SE_TAP_HEADER_SIZE + capacity bytes (rounded up to a power of two);
+// later calls keep the ring and change only the other settings. Returns
+// -1 if the ring cannot be mapped.
+int se_connection_enable_packet_tap(se_connection_t* conn, uint32_t capacity, uint32_t snap_len,
+                                    uint32_t notify_packets, uint32_t notify_us);
+void se_connection_disable_packet_tap(se_connection_t* conn);
+
+// Give the tap ring up to head back to the data threads, from inside
+// on_packets_tapped or any time after it
+void se_connection_release_packet_tap(se_connection_t* conn, uint32_t head);
+
+// The packet tap ring, NULL until enabled, valid until se_connection_free.
+// Its size is SE_TAP_HEADER_SIZE + capacity.
+const se_packet_tap_t* se_connection_get_packet_tap(se_connection_t* conn);
+
+// Latency at or below which the given percentage (0 to 100) of the
+// snapshot's packets fall, to within the bucket width; 0 if it is empty
+uint64_t se_latency_percentile(const se_latency_snapshot_t* snapshot, double percentile);
+
+// TLS session cache (shared by all connections, survives se_connection_free)
+int se_session_cache_set_file(const char* path);
+int se_session_cache_flush(void);
+int se_session_cache_load(const char* path);
+int se_session_cache_save(const char* path);
+void se_session_cache_clear(void);
+void se_session_cache_get_stats(se_session_cache_stats_t* stats);
+
+// DNS resolver (shared by all connections). se_dns_resolve returns the
+// number of addresses (port 0), 0 if the name does not exist or has no
+// addresses, SE_DNS_RESOLVE_TIMEOUT when no answer came in time (or on
+// bad arguments) and SE_DNS_RESOLVE_FAILED when the lookup itself failed:
+// every server timed out or answered SERVFAIL. Failures are held for a
+// few seconds, so an immediate retry gets the same error.
+#define SE_DNS_RESOLVE_TIMEOUT  (-1)
+#define SE_DNS_RESOLVE_FAILED   (-2)
+
+int se_dns_set_servers(const char* servers);  // "ip[:port],..."; NULL or "" uses the system resolver
+int se_dns_resolve(const char* hostname, struct sockaddr_storage* addrs, int max_addrs, int timeout_ms);
+void se_dns_prefetch(const char* hostname);
+void se_dns_flush(void);
+void se_dns_get_stats(se_dns_stats_t* stats);
+
 // Utility functions
 const char* se_error_string(int error_code);
 const char* se_state_string(int state);
+const char* se_tls_mode_string(int mode);
 uint32_t se_ip_string_to_int(const char* ip_str);
 void se_ip_int_to_string(uint32_t ip, char* buffer, size_t buffer_size);
 
@@ -250,13 +750,38 @@ se_packet_queue_t* se_packet_queue_new(size_t max_size);
 void se_packet_queue_free(se_packet_queue_t* queue);
 int se_packet_queue_push(se_packet_queue_t* queue, se_packet_t* packet, bool blocking);
 se_packet_t* se_packet_queue_pop(se_packet_queue_t* queue, bool blocking);
+size_t se_packet_queue_push_batch(se_packet_queue_t* queue, se_packet_t** packets, size_t count, bool blocking);
+size_t se_packet_queue_pop_batch(se_packet_queue_t* queue, se_packet_t** packets, size_t max_count, bool blocking);
 size_t se_packet_queue_size(se_packet_queue_t* queue);
 void se_packet_queue_clear(se_packet_queue_t* queue);
 
+// Packet pool operations
+se_packet_pool_t* se_packet_pool_new(void);
+void se_packet_pool_free(se_packet_pool_t* pool);
+se_packet_t* se_packet_pool_alloc(se_packet_pool_t* pool, size_t capacity);
+se_packet_t* se_packet_new_pooled(se_packet_pool_t* pool, uint32_t type, uint32_t flags,
+                                  const uint8_t* payload, size_t payload_len);
+void se_packet_pool_get_counters(se_packet_pool_t* pool, uint64_t* hits, uint64_t* misses);
+void se_packet_pool_reset_counters(se_packet_pool_t* pool);
+
+// Ring buffer operations
+int se_ring_init(se_ring_t* ring, size_t capacity);
+void se_ring_destroy(se_ring_t* ring);
+void se_ring_reset(se_ring_t* ring);
+size_t se_ring_used(const se_ring_t* ring);
+size_t se_ring_space(const se_ring_t* ring);
+uint8_t* se_ring_write_ptr(se_ring_t* ring, size_t* len);
+void se_ring_commit(se_ring_t* ring, size_t len);
+const uint8_t* se_ring_read_ptr(const se_ring_t* ring, size_t* len);
+void se_ring_consume(se_ring_t* ring, size_t len);
+size_t se_ring_peek(const se_ring_t* ring, size_t offset, uint8_t* dst, size_t len);
+int se_ring_iov(const se_ring_t* ring, size_t offset, size_t len, struct iovec iov[2]);
+
 // Packet operations
 se_packet_t* se_packet_new(uint32_t type, uint32_t flags, const uint8_t* payload, size_t payload_len);
 void se_packet_free(se_packet_t* packet);
 int se_packet_serialize(se_packet_t* packet, uint8_t* buffer, size_t buffer_size);
+int se_packet_frame(se_packet_t* packet, uint8_t** frame);
 se_packet_t* se_packet_deserialize(const uint8_t* data, size_t data_len);
 
 // Internal protocol functions (exposed for testing)
@@ -267,11 +792,16 @@ int se_protocol_recv_auth_response(se_connection_t* conn);
 int se_protocol_send_dhcp_request(se_connection_t* conn);
 int se_protocol_recv_dhcp_response(se_connection_t* conn);
 int se_protocol_send_keepalive(se_connection_t* conn);
+uint32_t se_packet_flow_hash(const uint8_t* packet, size_t len);
+void se_stats_page_publish(se_connection_t* conn, bool force);
+void se_tap_packet(se_connection_t* conn, const struct iovec* iov, int iovcnt, size_t len);
 
 // Thread functions
 void* se_recv_thread(void* arg);
 void* se_send_thread(void* arg);
 void* se_keepalive_thread(void* arg);
+void* se_event_loop_thread(void* arg);
+void* se_udp_thread(void* arg);
 
 #ifdef __cplusplus
 }
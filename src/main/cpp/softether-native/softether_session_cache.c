@@ -0,0 +1,357 @@
+/**
+ * SoftEther VPN TLS Session Cache
+ *
+ * Process-wide client session cache keyed by "host:port" and the verify
+ * mode, so a session from an unverified handshake is never resumed by a
+ * connection that requires a verified certificate. Sessions outlive
+ * individual connections so that reconnects resume instead of running a
+ * full handshake, and the cache can be persisted to a file owned by the app.
+ */
+
+#include "softether_session_cache.h"
+#include "softether_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define LOG_TAG "SoftEtherSessionCache"
+#define LOGD(...) se_log_print(SE_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) se_log_print(SE_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define LOGI(...) se_log_print(SE_LOG_INFO, LOG_TAG, __VA_ARGS__)
+
+// ============================================================================
+// Internal Structures
+// ============================================================================
+
+#define SE_SESSION_CACHE_SIZE       32
+#define SE_SESSION_FILE_MAGIC       0x53455343  // "SESC"
+#define SE_SESSION_FILE_VERSION     2           // 2: verify mode in the key
+#define SE_SESSION_MAX_DER_LEN      16384
+
+typedef struct {
+    char key[SE_SESSION_CACHE_KEY_LEN];
+    SSL_SESSION* session;
+    uint64_t last_used;
+} se_session_entry_t;
+
+static struct {
+    pthread_mutex_t lock;
+    se_session_entry_t entries[SE_SESSION_CACHE_SIZE];
+    uint64_t clock;
+    char file_path[512];
+    se_session_cache_stats_t stats;
+} g_cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int g_key_index = -1;
+static pthread_once_t g_key_index_once = PTHREAD_ONCE_INIT;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static void key_free(void* parent, void* ptr, CRYPTO_EX_DATA* ad, int idx, long argl, void* argp) {
+    free(ptr);
+}
+
+static void key_index_init(void) {
+    g_key_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, key_free);
+}
+
+static bool session_expired(SSL_SESSION* session) {
+    return SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) < (long)time(NULL);
+}
+
+// Find the entry for key. Called with g_cache.lock held.
+static se_session_entry_t* find_entry(const char* key) {
+    for (int i = 0; i < SE_SESSION_CACHE_SIZE; i++) {
+        se_session_entry_t* entry = &g_cache.entries[i];
+        if (entry->session && strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Store a session, taking ownership of one reference. Called with g_cache.lock held.
+static void store_entry(const char* key, SSL_SESSION* session) {
+    se_session_entry_t* slot = find_entry(key);
+
+    if (!slot) {
+        // Take an empty slot, or evict the least recently used one
+        slot = &g_cache.entries[0];
+        for (int i = 0; i < SE_SESSION_CACHE_SIZE; i++) {
+            se_session_entry_t* entry = &g_cache.entries[i];
+            if (!entry->session) {
+                slot = entry;
+                break;
+            }
+            if (entry->last_used < slot->last_used) {
+                slot = entry;
+            }
+        }
+    }
+
+    if (slot->session) {
+        SSL_SESSION_free(slot->session);
+    }
+
+    strncpy(slot->key, key, sizeof(slot->key) - 1);
+    slot->key[sizeof(slot->key) - 1] = '\0';
+    slot->session = session;
+    slot->last_used = ++g_cache.clock;
+}
+
+static void write_u32(uint8_t* buffer, uint32_t value) {
+    buffer[0] = (value >> 24) & 0xFF;
+    buffer[1] = (value >> 16) & 0xFF;
+    buffer[2] = (value >> 8) & 0xFF;
+    buffer[3] = value & 0xFF;
+}
+
+static uint32_t read_u32(const uint8_t* buffer) {
+    return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) |
+           ((uint32_t)buffer[2] << 8) | (uint32_t)buffer[3];
+}
+
+// OpenSSL new-session callback; TLS 1.3 tickets arrive here after the handshake
+static int new_session_cb(SSL* ssl, SSL_SESSION* session) {
+    const char* key = (const char*)SSL_get_ex_data(ssl, g_key_index);
+    if (!key || !SSL_SESSION_is_resumable(session)) {
+        return 0;
+    }
+
+    // A verifying connection that got here anyway must not leave a session
+    // behind for the next one to skip verification with
+    if ((SSL_get_verify_mode(ssl) & SSL_VERIFY_PEER) && SSL_get_verify_result(ssl) != X509_V_OK) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&g_cache.lock);
+    store_entry(key, session);
+    g_cache.stats.stored++;
+    pthread_mutex_unlock(&g_cache.lock);
+
+    LOGD("Stored TLS session for %s", key);
+    return 1;  // We keep the reference
+}
+
+// ============================================================================
+// SSL Layer Hooks
+// ============================================================================
+
+void se_session_cache_setup_ctx(SSL_CTX* ssl_ctx) {
+    pthread_once(&g_key_index_once, key_index_init);
+
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ssl_ctx, new_session_cb);
+}
+
+void se_session_cache_attach(SSL* ssl, const char* host, int port, bool verify_cert) {
+    if (g_key_index < 0) return;
+
+    char* key = (char*)malloc(SE_SESSION_CACHE_KEY_LEN);
+    if (!key) return;
+    snprintf(key, SE_SESSION_CACHE_KEY_LEN, "%s:%d/%s", host, port, verify_cert ? "verified" : "unverified");
+    SSL_set_ex_data(ssl, g_key_index, key);
+
+    pthread_mutex_lock(&g_cache.lock);
+
+    g_cache.stats.lookups++;
+
+    se_session_entry_t* entry = find_entry(key);
+    if (entry && session_expired(entry->session)) {
+        SSL_SESSION_free(entry->session);
+        entry->session = NULL;
+        entry = NULL;
+    }
+
+    if (entry && SSL_set_session(ssl, entry->session) == 1) {
+        entry->last_used = ++g_cache.clock;
+        g_cache.stats.hits++;
+
+        // TLS 1.3 tickets are single use (RFC 8446 C.4); the SSL holds its
+        // own reference now, and the new handshake brings fresh tickets
+        if (SSL_SESSION_get_protocol_version(entry->session) >= TLS1_3_VERSION) {
+            SSL_SESSION_free(entry->session);
+            entry->session = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&g_cache.lock);
+}
+
+void se_session_cache_handshake_done(SSL* ssl) {
+    if (!SSL_session_reused(ssl)) return;
+
+    pthread_mutex_lock(&g_cache.lock);
+    g_cache.stats.resumed++;
+    pthread_mutex_unlock(&g_cache.lock);
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+int se_session_cache_load(const char* path) {
+    if (!path) return -1;
+
+    FILE* file = fopen(path, "rb");
+    if (!file) return -1;
+
+    uint8_t header[12];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        read_u32(header) != SE_SESSION_FILE_MAGIC ||
+        read_u32(header + 4) != SE_SESSION_FILE_VERSION) {
+        LOGE("Invalid session cache file: %s", path);
+        fclose(file);
+        return -1;
+    }
+
+    uint32_t count = read_u32(header + 8);
+    int loaded = 0;
+    uint8_t* der = (uint8_t*)malloc(SE_SESSION_MAX_DER_LEN);
+    if (!der) {
+        fclose(file);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count && i < SE_SESSION_CACHE_SIZE; i++) {
+        uint8_t lengths[8];
+        if (fread(lengths, 1, sizeof(lengths), file) != sizeof(lengths)) break;
+
+        uint32_t key_len = read_u32(lengths);
+        uint32_t der_len = read_u32(lengths + 4);
+        if (key_len == 0 || key_len >= SE_SESSION_CACHE_KEY_LEN || der_len > SE_SESSION_MAX_DER_LEN) break;
+
+        char key[SE_SESSION_CACHE_KEY_LEN];
+        if (fread(key, 1, key_len, file) != key_len) break;
+        key[key_len] = '\0';
+        if (fread(der, 1, der_len, file) != der_len) break;
+
+        const uint8_t* p = der;
+        SSL_SESSION* session = d2i_SSL_SESSION(NULL, &p, der_len);
+        if (!session) continue;
+
+        if (session_expired(session) || !SSL_SESSION_is_resumable(session)) {
+            SSL_SESSION_free(session);
+            continue;
+        }
+
+        pthread_mutex_lock(&g_cache.lock);
+        store_entry(key, session);
+        pthread_mutex_unlock(&g_cache.lock);
+        loaded++;
+    }
+
+    free(der);
+    fclose(file);
+
+    LOGD("Loaded %d TLS sessions from %s", loaded, path);
+    return loaded;
+}
+
+int se_session_cache_save(const char* path) {
+    if (!path) return -1;
+
+    char tmp_path[sizeof(g_cache.file_path) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE* file = fopen(tmp_path, "wb");
+    if (!file) {
+        LOGE("Failed to open session cache file: %s", tmp_path);
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_cache.lock);
+
+    uint32_t count = 0;
+    for (int i = 0; i < SE_SESSION_CACHE_SIZE; i++) {
+        SSL_SESSION* session = g_cache.entries[i].session;
+        if (session && !session_expired(session)) count++;
+    }
+
+    uint8_t header[12];
+    write_u32(header, SE_SESSION_FILE_MAGIC);
+    write_u32(header + 4, SE_SESSION_FILE_VERSION);
+    write_u32(header + 8, count);
+    bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+
+    for (int i = 0; i < SE_SESSION_CACHE_SIZE && ok; i++) {
+        se_session_entry_t* entry = &g_cache.entries[i];
+        if (!entry->session || session_expired(entry->session)) continue;
+
+        uint8_t* der = NULL;
+        int der_len = i2d_SSL_SESSION(entry->session, &der);
+        uint32_t key_len = (uint32_t)strlen(entry->key);
+
+        uint8_t lengths[8];
+        write_u32(lengths, key_len);
+        write_u32(lengths + 4, der_len > 0 ? (uint32_t)der_len : 0);
+
+        ok = der_len > 0 &&
+             fwrite(lengths, 1, sizeof(lengths), file) == sizeof(lengths) &&
+             fwrite(entry->key, 1, key_len, file) == key_len &&
+             fwrite(der, 1, der_len, file) == (size_t)der_len;
+        OPENSSL_free(der);
+    }
+
+    pthread_mutex_unlock(&g_cache.lock);
+
+    if (fclose(file) != 0) ok = false;
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        LOGE("Failed to write session cache file: %s", path);
+        remove(tmp_path);
+        return -1;
+    }
+
+    return (int)count;
+}
+
+int se_session_cache_set_file(const char* path) {
+    if (!path || strlen(path) >= sizeof(g_cache.file_path)) return -1;
+
+    pthread_mutex_lock(&g_cache.lock);
+    strncpy(g_cache.file_path, path, sizeof(g_cache.file_path) - 1);
+    pthread_mutex_unlock(&g_cache.lock);
+
+    // A missing file just means nothing has been cached yet
+    int loaded = se_session_cache_load(path);
+    return loaded < 0 ? 0 : loaded;
+}
+
+int se_session_cache_flush(void) {
+    char path[sizeof(g_cache.file_path)];
+
+    pthread_mutex_lock(&g_cache.lock);
+    memcpy(path, g_cache.file_path, sizeof(path));
+    pthread_mutex_unlock(&g_cache.lock);
+
+    if (path[0] == '\0') return 0;
+    return se_session_cache_save(path);
+}
+
+void se_session_cache_clear(void) {
+    pthread_mutex_lock(&g_cache.lock);
+
+    for (int i = 0; i < SE_SESSION_CACHE_SIZE; i++) {
+        se_session_entry_t* entry = &g_cache.entries[i];
+        if (entry->session) {
+            SSL_SESSION_free(entry->session);
+            entry->session = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&g_cache.lock);
+}
+
+void se_session_cache_get_stats(se_session_cache_stats_t* stats) {
+    if (!stats) return;
+
+    pthread_mutex_lock(&g_cache.lock);
+    memcpy(stats, &g_cache.stats, sizeof(se_session_cache_stats_t));
+    pthread_mutex_unlock(&g_cache.lock);
+}
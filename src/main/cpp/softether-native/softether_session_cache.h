@@ -0,0 +1,44 @@
+/**
+ * SoftEther VPN TLS Session Cache - Internal Header
+ *
+ * Hooks used by the SSL layer in softether_protocol.c. The public API
+ * (load/save/stats) is declared in softether_protocol.h.
+ */
+
+#ifndef SOFTETHER_SESSION_CACHE_H
+#define SOFTETHER_SESSION_CACHE_H
+
+#include <openssl/ssl.h>
+
+#include "softether_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SE_SESSION_CACHE_KEY_LEN    (SE_MAX_HOSTNAME_LEN + 16)
+
+/**
+ * Enable client-side session caching on an SSL_CTX so that new sessions
+ * (including TLS 1.3 tickets delivered after the handshake) are stored.
+ */
+void se_session_cache_setup_ctx(SSL_CTX* ssl_ctx);
+
+/**
+ * Tag an SSL object with its host:port key and offer a cached session
+ * for resumption if one exists. Sessions are only offered to connections
+ * with the same verify mode they were made under, and a TLS 1.3 session
+ * is handed out once; the server sends fresh tickets for the next one.
+ */
+void se_session_cache_attach(SSL* ssl, const char* host, int port, bool verify_cert);
+
+/**
+ * Record the outcome of a completed handshake.
+ */
+void se_session_cache_handshake_done(SSL* ssl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOFTETHER_SESSION_CACHE_H
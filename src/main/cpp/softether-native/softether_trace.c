@@ -0,0 +1,240 @@
+/**
+ * SoftEther VPN Data Path Tracing
+ *
+ * Per-thread single-producer rings, a timestamp-ordered drain across them,
+ * and lazy formatting into the system log.
+ */
+
+#include "softether_trace.h"
+#include "softether_log.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#define LOG_TAG "SoftEtherTrace"
+#define LOGE(...) se_log_print(SE_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+#define RING_MASK   (SE_TRACE_RING_SIZE - 1)
+
+/**
+ * A thread's ring. The owner advances head, the drain advances tail.
+ * Rings outlive their threads and are handed to new threads once empty,
+ * so the list never grows past the peak thread count.
+ */
+typedef struct se_trace_ring {
+    se_trace_record_t records[SE_TRACE_RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    uint64_t dropped;
+    int tid;
+    bool owned;
+    struct se_trace_ring* next;
+} se_trace_ring_t;
+
+static const struct {
+    const char* name;
+    int level;
+    const char* format;
+} g_events[SE_TRACE_EVENT_COUNT] = {
+#define SE_TRACE_ENTRY(name, level, format) { #name, level, format },
+    SE_TRACE_EVENTS(SE_TRACE_ENTRY)
+#undef SE_TRACE_ENTRY
+};
+
+static pthread_mutex_t g_rings_lock = PTHREAD_MUTEX_INITIALIZER;   // Guards the list and attach
+static pthread_mutex_t g_drain_lock = PTHREAD_MUTEX_INITIALIZER;   // One drain at a time
+static se_trace_ring_t* g_rings = NULL;
+static pthread_key_t g_ring_key;
+static pthread_once_t g_ring_key_once = PTHREAD_ONCE_INIT;
+
+static __thread se_trace_ring_t* t_ring = NULL;
+
+// Thread exit: the ring stays listed so its records can still be drained
+static void ring_detach(void* value) {
+    se_trace_ring_t* ring = (se_trace_ring_t*)value;
+    __atomic_store_n(&ring->owned, false, __ATOMIC_RELEASE);
+}
+
+static void ring_key_create(void) {
+    pthread_key_create(&g_ring_key, ring_detach);
+}
+
+static se_trace_ring_t* ring_attach(void) {
+    pthread_once(&g_ring_key_once, ring_key_create);
+
+    pthread_mutex_lock(&g_rings_lock);
+
+    se_trace_ring_t* ring = g_rings;
+    for (; ring; ring = ring->next) {
+        if (!__atomic_load_n(&ring->owned, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head) {
+            break;
+        }
+    }
+    if (!ring) {
+        ring = (se_trace_ring_t*)calloc(1, sizeof(se_trace_ring_t));
+        if (ring) {
+            ring->next = g_rings;
+            g_rings = ring;
+        }
+    }
+    if (ring) {
+        ring->tid = (int)syscall(SYS_gettid);
+        ring->owned = true;
+        pthread_setspecific(g_ring_key, ring);
+    }
+
+    pthread_mutex_unlock(&g_rings_lock);
+
+    t_ring = ring;
+    return ring;
+}
+
+void se_trace_write(uint32_t event, int32_t a, int32_t b, int32_t c, int32_t d, int32_t e) {
+    se_trace_ring_t* ring = t_ring ? t_ring : ring_attach();
+    if (!ring) return;
+
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == SE_TRACE_RING_SIZE) {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    se_trace_record_t* record = &ring->records[head & RING_MASK];
+    record->timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    record->event = event;
+    record->args[0] = a;
+    record->args[1] = b;
+    record->args[2] = c;
+    record->args[3] = d;
+    record->args[4] = e;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int se_trace_drain(se_trace_sink_t sink, void* arg, int max) {
+    int drained = 0;
+
+    pthread_mutex_lock(&g_drain_lock);
+
+    // Rings are only ever prepended, so the list read here stays valid
+    pthread_mutex_lock(&g_rings_lock);
+    se_trace_ring_t* rings = g_rings;
+    pthread_mutex_unlock(&g_rings_lock);
+
+    // Merge by timestamp: take the oldest head record among the rings
+    while (drained < max) {
+        se_trace_ring_t* oldest = NULL;
+        for (se_trace_ring_t* ring = rings; ring; ring = ring->next) {
+            uint32_t tail = ring->tail;
+            if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) continue;
+            if (!oldest || ring->records[tail & RING_MASK].timestamp_ns <
+                           oldest->records[oldest->tail & RING_MASK].timestamp_ns) {
+                oldest = ring;
+            }
+        }
+        if (!oldest) break;
+
+        // Copy out first: once the ring is empty a new thread may take it
+        se_trace_record_t record = oldest->records[oldest->tail & RING_MASK];
+        int tid = oldest->tid;
+        __atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+
+        sink(&record, tid, arg);
+        drained++;
+    }
+
+    pthread_mutex_unlock(&g_drain_lock);
+    return drained;
+}
+
+int se_trace_format(const se_trace_record_t* record, char* buffer, size_t size) {
+    if (record->event >= SE_TRACE_EVENT_COUNT) {
+        return snprintf(buffer, size, "Unknown trace event %u", record->event);
+    }
+
+    const char* p = g_events[record->event].format;
+    int next = 0;
+    size_t len = 0;
+
+    // Only the conversions the event table uses; anything else is copied
+    while (*p) {
+        char piece[64];
+        const char* text = piece;
+        size_t n;
+        if (p[0] == '%' && p[1] && strchr("dumx", p[1]) && next < SE_TRACE_ARGS) {
+            int32_t value = record->args[next++];
+            switch (p[1]) {
+                case 'd': snprintf(piece, sizeof(piece), "%d", value); break;
+                case 'u': snprintf(piece, sizeof(piece), "%u", (uint32_t)value); break;
+                case 'x': snprintf(piece, sizeof(piece), "%x", (uint32_t)value); break;
+                default:  text = strerror(value); break;
+            }
+            n = strlen(text);
+            p += 2;
+        } else {
+            n = strcspn(p + 1, "%") + 1;
+            text = p;
+            p += n;
+        }
+        if (len + 1 < size) {
+            size_t room = size - len - 1;
+            memcpy(buffer + len, text, n < room ? n : room);
+        }
+        len += n;
+    }
+    if (size > 0) buffer[len < size ? len : size - 1] = '\0';
+
+    return (int)len;
+}
+
+const char* se_trace_event_name(uint32_t event) {
+    return event < SE_TRACE_EVENT_COUNT ? g_events[event].name : "UNKNOWN";
+}
+
+int se_trace_event_level(uint32_t event) {
+    return event < SE_TRACE_EVENT_COUNT ? g_events[event].level : SE_TRACE_DEBUG;
+}
+
+uint64_t se_trace_take_dropped(void) {
+    uint64_t dropped = 0;
+
+    pthread_mutex_lock(&g_rings_lock);
+    for (se_trace_ring_t* ring = g_rings; ring; ring = ring->next) {
+        dropped += __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&g_rings_lock);
+
+    return dropped;
+}
+
+static void log_sink(const se_trace_record_t* record, int tid, void* arg) {
+    (void)arg;
+    char text[256];
+    se_trace_format(record, text, sizeof(text));
+
+    int priority = se_trace_event_level(record->event) == SE_TRACE_ERROR ? SE_LOG_ERROR :
+                   se_trace_event_level(record->event) == SE_TRACE_INFO ? SE_LOG_INFO :
+                   SE_LOG_DEBUG;
+    se_log_print(priority, LOG_TAG, "[%d] %s", tid, text);
+}
+
+int se_trace_log_pending(void) {
+    int logged = se_trace_drain(log_sink, NULL, SE_TRACE_LOG_MAX);
+
+    uint64_t dropped = se_trace_take_dropped();
+    if (dropped > 0) {
+        LOGE("Trace rings full, %llu records dropped", (unsigned long long)dropped);
+    }
+
+    return logged;
+}
@@ -0,0 +1,123 @@
+/**
+ * SoftEther VPN Data Path Tracing - Internal Header
+ *
+ * Binary trace points for the packet paths, where a synchronous log call
+ * per event turns an error storm into a bottleneck. A trace point stores
+ * an event ID, a timestamp and up to SE_TRACE_ARGS integers in a ring
+ * owned by the calling thread, without locks or syscalls. Records are
+ * formatted only when drained, from whichever thread drains them.
+ *
+ * Trace points above SE_TRACE_LEVEL compile to nothing. Release builds
+ * (NDEBUG) keep errors only; define SE_TRACE_LEVEL to override.
+ */
+
+#ifndef SOFTETHER_TRACE_H
+#define SOFTETHER_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SE_TRACE_ERROR      1
+#define SE_TRACE_INFO       2
+#define SE_TRACE_DEBUG      3
+
+#ifndef SE_TRACE_LEVEL
+#ifdef NDEBUG
+#define SE_TRACE_LEVEL      SE_TRACE_ERROR
+#else
+#define SE_TRACE_LEVEL      SE_TRACE_DEBUG
+#endif
+#endif
+
+#define SE_TRACE_ARGS       5       // Integer arguments per record
+#define SE_TRACE_RING_SIZE  512     // Records per thread, power of two
+#define SE_TRACE_LOG_MAX    256     // Records se_trace_log_pending writes per call
+
+/**
+ * Trace events: X(name, level, format). Formats take the record's
+ * arguments in order; %d, %u and %x print one, %m prints strerror() of
+ * one.
+ */
+#define SE_TRACE_EVENTS(X) \
+    X(OVERSIZED_FRAME,      SE_TRACE_ERROR, "Oversized frame: type=%u payload_len=%u") \
+    X(BAD_COMPRESSED_FRAME, SE_TRACE_ERROR, "Undecodable compressed frame on connection %d") \
+    X(UNKNOWN_PACKET,       SE_TRACE_DEBUG, "Unknown packet type: %u") \
+    X(RECEIVE_ERROR,        SE_TRACE_ERROR, "Receive error on connection %d: %d") \
+    X(SEND_ERROR,           SE_TRACE_ERROR, "Send error on connection %d: %m") \
+    X(PACKET_TOO_BIG,       SE_TRACE_ERROR, "Dropping oversized packet: %u bytes") \
+    X(TUN_READ_ERROR,       SE_TRACE_ERROR, "TUN read error: %m") \
+    X(TUN_WRITE_ERROR,      SE_TRACE_ERROR, "TUN write error: %d of %u bytes written") \
+    X(UDP_SEND_FAILED,      SE_TRACE_DEBUG, "UDP send failed (%m), sending the batch over TLS") \
+    X(UDP_RECEIVE_ERROR,    SE_TRACE_DEBUG, "UDP receive error: %m")
+
+typedef enum {
+#define SE_TRACE_ENUM(name, level, format) SE_TRACE_##name,
+    SE_TRACE_EVENTS(SE_TRACE_ENUM)
+#undef SE_TRACE_ENUM
+    SE_TRACE_EVENT_COUNT
+} se_trace_event_t;
+
+enum {
+#define SE_TRACE_ENUM(name, level, format) SE_TRACE_LEVEL_##name = level,
+    SE_TRACE_EVENTS(SE_TRACE_ENUM)
+#undef SE_TRACE_ENUM
+};
+
+/**
+ * One trace record
+ */
+typedef struct {
+    uint64_t timestamp_ns;          // CLOCK_MONOTONIC
+    uint32_t event;                 // se_trace_event_t
+    int32_t args[SE_TRACE_ARGS];
+} se_trace_record_t;
+
+/**
+ * Record an event: SE_TRACE(RECEIVE_ERROR, index, n). Missing arguments
+ * are zero.
+ */
+#define SE_TRACE(event, ...) \
+    SE_TRACE_WRITE(SE_TRACE_##event, SE_TRACE_LEVEL_##event, ##__VA_ARGS__, 0, 0, 0, 0, 0)
+
+#define SE_TRACE_WRITE(event, level, a, b, c, d, e, ...) \
+    do { \
+        if ((level) <= SE_TRACE_LEVEL) { \
+            se_trace_write((event), (int32_t)(a), (int32_t)(b), (int32_t)(c), (int32_t)(d), (int32_t)(e)); \
+        } \
+    } while (0)
+
+// Append a record to the calling thread's ring. A full ring drops it.
+void se_trace_write(uint32_t event, int32_t a, int32_t b, int32_t c, int32_t d, int32_t e);
+
+/**
+ * Called once per drained record, oldest first across all threads.
+ * tid is the thread that wrote it.
+ */
+typedef void (*se_trace_sink_t)(const se_trace_record_t* record, int tid, void* arg);
+
+// Hand up to max pending records to sink. Returns the number drained.
+int se_trace_drain(se_trace_sink_t sink, void* arg, int max);
+
+// Format a record as its event's message. Returns the length snprintf would.
+int se_trace_format(const se_trace_record_t* record, char* buffer, size_t size);
+
+const char* se_trace_event_name(uint32_t event);
+
+int se_trace_event_level(uint32_t event);
+
+// Records lost to full rings since the last call
+uint64_t se_trace_take_dropped(void);
+
+// Drain up to SE_TRACE_LOG_MAX records to the system log, then report
+// records lost to full rings. Returns the number logged.
+int se_trace_log_pending(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOFTETHER_TRACE_H
@@ -0,0 +1,93 @@
+/**
+ * SoftEther VPN TUN Batch I/O - Internal Header
+ *
+ * Moves many packets between a TUN fd and one flat buffer per call, for
+ * JNI entry points that take a direct ByteBuffer instead of a byte[] per
+ * packet. Each packet in the buffer is preceded by its length as a 16-bit
+ * big-endian integer, which is ByteBuffer's default order. The fd must be
+ * non-blocking; these helpers never change its flags.
+ */
+
+#ifndef SOFTETHER_TUN_BATCH_H
+#define SOFTETHER_TUN_BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SE_TUN_BATCH_PREFIX     2       // Length bytes before each packet
+#define SE_TUN_BATCH_MAX_PACKET 65535   // Largest length the prefix can carry
+
+/**
+ * Read packets until the fd has no more or the next one of up to
+ * max_packet bytes might not fit. Returns the bytes of buffer used, 0 if
+ * nothing was waiting, -1 with errno set if the first read failed.
+ * packets, if set, receives the number read.
+ */
+static inline int se_tun_read_batch(int fd, uint8_t* buffer, size_t capacity, size_t max_packet,
+                                    int* packets) {
+    size_t used = 0;
+    int count = 0;
+
+    if (max_packet > SE_TUN_BATCH_MAX_PACKET) max_packet = SE_TUN_BATCH_MAX_PACKET;
+
+    while (capacity - used >= SE_TUN_BATCH_PREFIX + max_packet) {
+        ssize_t len = read(fd, buffer + used + SE_TUN_BATCH_PREFIX, max_packet);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK || used > 0) break;
+            return -1;
+        }
+        if (len == 0) break;
+
+        buffer[used] = (uint8_t)(len >> 8);
+        buffer[used + 1] = (uint8_t)len;
+        used += SE_TUN_BATCH_PREFIX + (size_t)len;
+        count++;
+    }
+
+    if (packets) *packets = count;
+    return (int)used;
+}
+
+/**
+ * Write the packets in buffer[0, length), one write() each. Stops early
+ * when the fd is full or a write fails, and at a truncated packet at the
+ * end. Returns the bytes consumed, which the caller resubmits from, or -1
+ * with errno set if the first write failed for any reason but a full fd.
+ * packets, if set, receives the number written.
+ */
+static inline int se_tun_write_batch(int fd, const uint8_t* buffer, size_t length, int* packets) {
+    size_t used = 0;
+    int count = 0;
+
+    while (length - used >= SE_TUN_BATCH_PREFIX) {
+        size_t len = ((size_t)buffer[used] << 8) | buffer[used + 1];
+        if (length - used - SE_TUN_BATCH_PREFIX < len) break;
+
+        if (len > 0) {
+            ssize_t written = write(fd, buffer + used + SE_TUN_BATCH_PREFIX, len);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK || used > 0) break;
+                return -1;
+            }
+            count++;
+        }
+        used += SE_TUN_BATCH_PREFIX + len;
+    }
+
+    if (packets) *packets = count;
+    return (int)used;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOFTETHER_TUN_BATCH_H
@@ -0,0 +1,379 @@
+/**
+ * SoftEther VPN UDP Acceleration
+ *
+ * Sealing, replay protection and batched socket I/O for the UDP data
+ * channel. The channel knows nothing about sessions or fallback; the
+ * protocol layer watches se_udp_channel_last_rx_ms() to decide whether
+ * datagrams are still getting through.
+ */
+
+#include "softether_udp.h"
+#include "softether_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <openssl/evp.h>
+
+#define LOG_TAG "SoftEtherUdp"
+#define LOGD(...) se_log_print(SE_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) se_log_print(SE_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+#define SE_UDP_NONCE_SIZE       12
+
+struct se_udp_channel {
+    int fd;
+    uint32_t cookie;
+
+    // Send side, shared by the send thread and the prober
+    pthread_mutex_t seal_lock;
+    EVP_CIPHER_CTX* seal_ctx;
+    uint64_t send_seq;
+    uint8_t* send_buffers;                  // SE_UDP_BATCH datagrams
+    struct mmsghdr send_msgs[SE_UDP_BATCH];
+    struct iovec send_iov[SE_UDP_BATCH];
+
+    // Receive side, one thread
+    EVP_CIPHER_CTX* open_ctx;
+    uint64_t recv_max_seq;                  // Highest sequence accepted
+    uint64_t recv_window;                   // Bit n set: recv_max_seq - n was seen
+    uint8_t* recv_buffers;
+    struct mmsghdr recv_msgs[SE_UDP_BATCH];
+    struct iovec recv_iov[SE_UDP_BATCH];
+    uint64_t last_rx_ms;
+
+    // Counters, updated with relaxed atomics
+    uint64_t datagrams_sent;
+    uint64_t datagrams_received;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t rejected;
+};
+
+static uint64_t get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void put_be32(uint8_t* out, uint32_t value) {
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+static uint32_t get_be32(const uint8_t* in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+static void put_be64(uint8_t* out, uint64_t value) {
+    put_be32(out, (uint32_t)(value >> 32));
+    put_be32(out + 4, (uint32_t)value);
+}
+
+static uint64_t get_be64(const uint8_t* in) {
+    return ((uint64_t)get_be32(in) << 32) | get_be32(in + 4);
+}
+
+// ============================================================================
+// Keys
+// ============================================================================
+
+static void derive(const char* label, const uint8_t* client_random, const uint8_t* server_random,
+                   uint8_t out[SE_UDP_KEY_SIZE]) {
+    EVP_MD_CTX* md = EVP_MD_CTX_new();
+    unsigned int len = 0;
+
+    EVP_DigestInit_ex(md, EVP_sha256(), NULL);
+    EVP_DigestUpdate(md, label, strlen(label));
+    EVP_DigestUpdate(md, client_random, SE_UDP_RANDOM_SIZE);
+    EVP_DigestUpdate(md, server_random, SE_UDP_RANDOM_SIZE);
+    EVP_DigestFinal_ex(md, out, &len);
+    EVP_MD_CTX_free(md);
+}
+
+void se_udp_derive_keys(const uint8_t client_random[SE_UDP_RANDOM_SIZE],
+                        const uint8_t server_random[SE_UDP_RANDOM_SIZE],
+                        bool client, se_udp_keys_t* keys) {
+    uint8_t upstream[SE_UDP_KEY_SIZE];
+    uint8_t downstream[SE_UDP_KEY_SIZE];
+    uint8_t cookie[SE_UDP_KEY_SIZE];
+
+    derive("softether udp client key", client_random, server_random, upstream);
+    derive("softether udp server key", client_random, server_random, downstream);
+    derive("softether udp cookie", client_random, server_random, cookie);
+
+    keys->cookie = get_be32(cookie);
+    memcpy(keys->send_key, client ? upstream : downstream, SE_UDP_KEY_SIZE);
+    memcpy(keys->recv_key, client ? downstream : upstream, SE_UDP_KEY_SIZE);
+
+    OPENSSL_cleanse(upstream, sizeof(upstream));
+    OPENSSL_cleanse(downstream, sizeof(downstream));
+}
+
+static const EVP_CIPHER* aead_cipher(int aead) {
+    switch (aead) {
+        case SE_UDP_AEAD_AES_256_GCM:
+            return EVP_aes_256_gcm();
+        case SE_UDP_AEAD_CHACHA20_POLY1305:
+            return EVP_chacha20_poly1305();
+        default:
+            return NULL;
+    }
+}
+
+static EVP_CIPHER_CTX* aead_ctx_new(const EVP_CIPHER* cipher, const uint8_t* key, bool encrypt) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) return NULL;
+
+    if (EVP_CipherInit_ex(ctx, cipher, NULL, NULL, NULL, encrypt) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, SE_UDP_NONCE_SIZE, NULL) != 1 ||
+        EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, encrypt) != 1) {
+        EVP_CIPHER_CTX_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+// ============================================================================
+// Channel
+// ============================================================================
+
+se_udp_channel_t* se_udp_channel_new(int fd, int aead, const se_udp_keys_t* keys) {
+    const EVP_CIPHER* cipher = aead_cipher(aead);
+    if (!cipher || fd < 0) return NULL;
+
+    se_udp_channel_t* channel = (se_udp_channel_t*)calloc(1, sizeof(se_udp_channel_t));
+    if (!channel) return NULL;
+
+    channel->fd = fd;
+    channel->cookie = keys->cookie;
+    pthread_mutex_init(&channel->seal_lock, NULL);
+    channel->seal_ctx = aead_ctx_new(cipher, keys->send_key, true);
+    channel->open_ctx = aead_ctx_new(cipher, keys->recv_key, false);
+    channel->send_buffers = (uint8_t*)malloc(SE_UDP_BATCH * SE_UDP_MAX_DATAGRAM);
+    channel->recv_buffers = (uint8_t*)malloc(SE_UDP_BATCH * SE_UDP_MAX_DATAGRAM);
+
+    if (!channel->seal_ctx || !channel->open_ctx || !channel->send_buffers || !channel->recv_buffers) {
+        channel->fd = -1;  // The caller still owns the socket
+        se_udp_channel_free(channel);
+        return NULL;
+    }
+
+    for (int i = 0; i < SE_UDP_BATCH; i++) {
+        channel->recv_iov[i].iov_base = channel->recv_buffers + i * SE_UDP_MAX_DATAGRAM;
+        channel->recv_iov[i].iov_len = SE_UDP_MAX_DATAGRAM;
+        channel->recv_msgs[i].msg_hdr.msg_iov = &channel->recv_iov[i];
+        channel->recv_msgs[i].msg_hdr.msg_iovlen = 1;
+        channel->send_msgs[i].msg_hdr.msg_iov = &channel->send_iov[i];
+        channel->send_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    return channel;
+}
+
+void se_udp_channel_free(se_udp_channel_t* channel) {
+    if (!channel) return;
+
+    if (channel->fd >= 0) {
+        close(channel->fd);
+    }
+    EVP_CIPHER_CTX_free(channel->seal_ctx);
+    EVP_CIPHER_CTX_free(channel->open_ctx);
+    free(channel->send_buffers);
+    free(channel->recv_buffers);
+    pthread_mutex_destroy(&channel->seal_lock);
+    free(channel);
+}
+
+int se_udp_channel_fd(se_udp_channel_t* channel) {
+    return channel ? channel->fd : -1;
+}
+
+// Seal one message into out. Called with seal_lock held.
+static int channel_seal(se_udp_channel_t* channel, uint8_t type, const uint8_t* payload, size_t len,
+                        uint8_t* out) {
+    uint64_t seq = ++channel->send_seq;
+    uint8_t nonce[SE_UDP_NONCE_SIZE] = { 0 };
+    put_be64(nonce + 4, seq);
+
+    put_be32(out, channel->cookie);
+    put_be64(out + 4, seq);
+
+    EVP_CIPHER_CTX* ctx = channel->seal_ctx;
+    uint8_t* body = out + SE_UDP_HEADER_SIZE;
+    int n;
+
+    if (EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce) != 1 ||
+        EVP_EncryptUpdate(ctx, NULL, &n, out, SE_UDP_HEADER_SIZE) != 1 ||
+        EVP_EncryptUpdate(ctx, body, &n, &type, 1) != 1 ||
+        (len > 0 && EVP_EncryptUpdate(ctx, body + 1, &n, payload, (int)len) != 1) ||
+        EVP_EncryptFinal_ex(ctx, body + 1 + len, &n) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, SE_UDP_TAG_SIZE, body + 1 + len) != 1) {
+        return -1;
+    }
+
+    return (int)(SE_UDP_OVERHEAD + len);
+}
+
+int se_udp_channel_send(se_udp_channel_t* channel, uint8_t type, const struct iovec* payloads, int count) {
+    if (!channel || count <= 0) return 0;
+    if (count > SE_UDP_BATCH) count = SE_UDP_BATCH;
+
+    pthread_mutex_lock(&channel->seal_lock);
+
+    uint64_t bytes = 0;
+    for (int i = 0; i < count; i++) {
+        uint8_t* out = channel->send_buffers + i * SE_UDP_MAX_DATAGRAM;
+        int len = payloads[i].iov_len <= SE_UDP_MAX_PAYLOAD
+                ? channel_seal(channel, type, (const uint8_t*)payloads[i].iov_base, payloads[i].iov_len, out)
+                : -1;
+        if (len < 0) {
+            pthread_mutex_unlock(&channel->seal_lock);
+            errno = EMSGSIZE;
+            return -1;
+        }
+        channel->send_iov[i].iov_base = out;
+        channel->send_iov[i].iov_len = (size_t)len;
+        bytes += payloads[i].iov_len;
+    }
+
+    // The socket blocks, so a full send buffer holds the sender back the
+    // same way the TLS stream does
+    int sent = 0;
+    while (sent < count) {
+        int n = sendmmsg(channel->fd, channel->send_msgs + sent, (unsigned int)(count - sent), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        sent += n;
+    }
+
+    pthread_mutex_unlock(&channel->seal_lock);
+
+    if (sent == 0) {
+        // ENOBUFS means the device queue was full; the batch is lost like
+        // on any congested link
+        return errno == ENOBUFS ? 0 : -1;
+    }
+
+    if (sent < count) {
+        bytes = 0;
+        for (int i = 0; i < sent; i++) bytes += payloads[i].iov_len;
+    }
+    __atomic_fetch_add(&channel->datagrams_sent, (uint64_t)sent, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&channel->bytes_sent, bytes, __ATOMIC_RELAXED);
+    return sent;
+}
+
+// Sliding window replay check (RFC 4303 section 3.4.3)
+static bool replay_check(const se_udp_channel_t* channel, uint64_t seq) {
+    if (seq == 0) return false;
+    if (seq > channel->recv_max_seq) return true;
+
+    uint64_t age = channel->recv_max_seq - seq;
+    return age < SE_UDP_REPLAY_WINDOW && !(channel->recv_window & (1ull << age));
+}
+
+static void replay_update(se_udp_channel_t* channel, uint64_t seq) {
+    if (seq > channel->recv_max_seq) {
+        uint64_t shift = seq - channel->recv_max_seq;
+        channel->recv_window = shift < SE_UDP_REPLAY_WINDOW ? (channel->recv_window << shift) | 1 : 1;
+        channel->recv_max_seq = seq;
+    } else {
+        channel->recv_window |= 1ull << (channel->recv_max_seq - seq);
+    }
+}
+
+// Authenticate and decrypt a datagram in place. Returns the plaintext
+// length (type byte included), -1 if it must be dropped.
+static int channel_open(se_udp_channel_t* channel, uint8_t* datagram, size_t len) {
+    if (len < SE_UDP_OVERHEAD || get_be32(datagram) != channel->cookie) return -1;
+
+    uint64_t seq = get_be64(datagram + 4);
+    if (!replay_check(channel, seq)) return -1;
+
+    uint8_t nonce[SE_UDP_NONCE_SIZE] = { 0 };
+    put_be64(nonce + 4, seq);
+
+    EVP_CIPHER_CTX* ctx = channel->open_ctx;
+    uint8_t* body = datagram + SE_UDP_HEADER_SIZE;
+    int body_len = (int)(len - SE_UDP_HEADER_SIZE - SE_UDP_TAG_SIZE);
+    int n;
+
+    if (EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce) != 1 ||
+        EVP_DecryptUpdate(ctx, NULL, &n, datagram, SE_UDP_HEADER_SIZE) != 1 ||
+        EVP_DecryptUpdate(ctx, body, &n, body, body_len) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, SE_UDP_TAG_SIZE, body + body_len) != 1 ||
+        EVP_DecryptFinal_ex(ctx, body + body_len, &n) != 1) {
+        return -1;
+    }
+
+    replay_update(channel, seq);
+    return body_len;
+}
+
+int se_udp_channel_recv(se_udp_channel_t* channel, se_udp_deliver_fn deliver, void* arg) {
+    if (!channel) return -1;
+
+    int count;
+    do {
+        count = recvmmsg(channel->fd, channel->recv_msgs, SE_UDP_BATCH, MSG_DONTWAIT, NULL);
+    } while (count < 0 && errno == EINTR);
+
+    if (count < 0) {
+        // ICMP errors from a closed port are reported here; they only mean
+        // the server is not listening yet, which probing handles
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED) ? 0 : -1;
+    }
+
+    uint64_t accepted = 0;
+    uint64_t bytes = 0;
+    uint64_t rejected = 0;
+
+    for (int i = 0; i < count; i++) {
+        uint8_t* datagram = channel->recv_buffers + i * SE_UDP_MAX_DATAGRAM;
+        int len = (channel->recv_msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+                ? -1 : channel_open(channel, datagram, channel->recv_msgs[i].msg_len);
+        if (len < 1) {
+            rejected++;
+            continue;
+        }
+
+        uint8_t* body = datagram + SE_UDP_HEADER_SIZE;
+        accepted++;
+        bytes += (uint64_t)len - 1;
+        deliver(arg, body[0], body + 1, (size_t)len - 1);
+    }
+
+    if (accepted > 0) {
+        __atomic_store_n(&channel->last_rx_ms, get_time_ms(), __ATOMIC_RELAXED);
+        __atomic_fetch_add(&channel->datagrams_received, accepted, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&channel->bytes_received, bytes, __ATOMIC_RELAXED);
+    }
+    if (rejected > 0) {
+        __atomic_fetch_add(&channel->rejected, rejected, __ATOMIC_RELAXED);
+    }
+
+    return count;
+}
+
+uint64_t se_udp_channel_last_rx_ms(se_udp_channel_t* channel) {
+    return channel ? __atomic_load_n(&channel->last_rx_ms, __ATOMIC_RELAXED) : 0;
+}
+
+void se_udp_channel_get_counters(se_udp_channel_t* channel, se_udp_stats_t* stats) {
+    stats->datagrams_sent = __atomic_load_n(&channel->datagrams_sent, __ATOMIC_RELAXED);
+    stats->datagrams_received = __atomic_load_n(&channel->datagrams_received, __ATOMIC_RELAXED);
+    stats->bytes_sent = __atomic_load_n(&channel->bytes_sent, __ATOMIC_RELAXED);
+    stats->bytes_received = __atomic_load_n(&channel->bytes_received, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&channel->rejected, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,124 @@
+/**
+ * SoftEther VPN UDP Acceleration - Internal Header
+ *
+ * An AEAD-protected UDP channel that carries data packets next to the
+ * TLS stream, so tunneled TCP is not stacked on the session's own TCP
+ * connection. Negotiated in the hello exchange; softether_protocol.c
+ * decides when the channel is used and falls back to the TLS stream
+ * while datagrams are not getting through.
+ *
+ * Datagram layout:
+ *
+ *   cookie (4) | sequence (8) | AEAD(type (1) | payload) | tag (16)
+ *
+ * The cookie identifies the session to the server. The nonce is the
+ * sequence number, unique per direction because each direction has its
+ * own key; cookie and sequence are authenticated as associated data.
+ */
+
+#ifndef SOFTETHER_UDP_H
+#define SOFTETHER_UDP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "softether_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SE_UDP_RANDOM_SIZE      32      // Hello contribution of each side
+#define SE_UDP_KEY_SIZE         32
+#define SE_UDP_HEADER_SIZE      12      // Cookie + sequence number
+#define SE_UDP_TAG_SIZE         16
+#define SE_UDP_OVERHEAD         (SE_UDP_HEADER_SIZE + 1 + SE_UDP_TAG_SIZE)
+#define SE_UDP_MAX_DATAGRAM     2048
+#define SE_UDP_MAX_PAYLOAD      (SE_UDP_MAX_DATAGRAM - SE_UDP_OVERHEAD)
+#define SE_UDP_BATCH            32      // Datagrams per sendmmsg/recvmmsg
+#define SE_UDP_REPLAY_WINDOW    64
+
+// AEAD algorithms, as sent in the hello
+#define SE_UDP_AEAD_NONE                0
+#define SE_UDP_AEAD_AES_256_GCM         1
+#define SE_UDP_AEAD_CHACHA20_POLY1305   2
+
+// Message types inside a datagram
+#define SE_UDP_MSG_DATA         0       // One IP packet
+#define SE_UDP_MSG_PROBE        1       // Liveness probe; the server answers with a probe
+
+/**
+ * Keys and cookie of one side of a channel
+ */
+typedef struct {
+    uint32_t cookie;
+    uint8_t send_key[SE_UDP_KEY_SIZE];
+    uint8_t recv_key[SE_UDP_KEY_SIZE];
+} se_udp_keys_t;
+
+/**
+ * UDP channel (opaque)
+ */
+typedef struct se_udp_channel se_udp_channel_t;
+
+/**
+ * Called for every authenticated message se_udp_channel_recv() takes in
+ */
+typedef void (*se_udp_deliver_fn)(void* arg, uint8_t type, const uint8_t* payload, size_t len);
+
+/**
+ * Derive the session cookie and per-direction keys from both sides'
+ * hello randoms. The client and the server get mirrored send/recv keys.
+ */
+void se_udp_derive_keys(const uint8_t client_random[SE_UDP_RANDOM_SIZE],
+                        const uint8_t server_random[SE_UDP_RANDOM_SIZE],
+                        bool client, se_udp_keys_t* keys);
+
+/**
+ * Create a channel on a connected UDP socket, which it takes over.
+ * Returns NULL if the AEAD is unknown or memory runs out.
+ */
+se_udp_channel_t* se_udp_channel_new(int fd, int aead, const se_udp_keys_t* keys);
+
+/**
+ * Close the socket and free the channel
+ */
+void se_udp_channel_free(se_udp_channel_t* channel);
+
+int se_udp_channel_fd(se_udp_channel_t* channel);
+
+/**
+ * Seal each iovec as one message of the given type and send them with
+ * sendmmsg, blocking while the socket buffer is full. Safe to call from
+ * several threads.
+ * Returns the number of messages sent (fewer after a socket error part
+ * way), -1 on a socket error or a payload over SE_UDP_MAX_PAYLOAD.
+ */
+int se_udp_channel_send(se_udp_channel_t* channel, uint8_t type, const struct iovec* payloads, int count);
+
+/**
+ * Take in one recvmmsg batch without blocking and pass every message that
+ * authenticates and is not a replay to deliver. One thread at a time.
+ * Returns datagrams received (including rejected ones), 0 if none were
+ * waiting, -1 on a socket error.
+ */
+int se_udp_channel_recv(se_udp_channel_t* channel, se_udp_deliver_fn deliver, void* arg);
+
+/**
+ * Monotonic time in ms of the last authenticated datagram, 0 if none yet
+ */
+uint64_t se_udp_channel_last_rx_ms(se_udp_channel_t* channel);
+
+/**
+ * Fill the datagram and byte counters of stats; state and fallbacks are
+ * left to the caller
+ */
+void se_udp_channel_get_counters(se_udp_channel_t* channel, se_udp_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOFTETHER_UDP_H
@@ -0,0 +1,1395 @@
+/**
+ * SoftEther VPN Core Tests
+ *
+ * Host-build checks of the protocol core: frame serialization, the SPSC
+ * packet queue, compression round trips, the TUN batch helpers, the DNS
+ * resolver (against a stand-in server on loopback), UDP sealing and the
+ * replay window, flow hashing for striping, latency histograms, trace
+ * rings, the statistics page seqlock, the packet tap ring, the TLS
+ * session cache, asynchronous connects (against the mock server from
+ * bench/, cancelled in each phase) and the log sink. Built with
+ * -DSOFTETHER_BUILD_TESTS=ON (the host default) and run by ctest.
+ */
+
+#include "softether_protocol.h"
+#include "softether_compress.h"
+#include "softether_tun_batch.h"
+#include "softether_session_cache.h"
+#include "softether_udp.h"
+#include "softether_latency.h"
+#include "softether_trace.h"
+#include "softether_log.h"
+#include "mock_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static int g_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            g_failures++; \
+        } \
+    } while (0)
+
+static void fill_packet(uint8_t* buffer, size_t len, uint32_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        buffer[i] = (uint8_t)((i * 31 + seed) % 251);
+    }
+}
+
+static void test_packet_roundtrip(void) {
+    uint8_t payload[1500];
+    uint8_t frame[1500 + 12];
+    fill_packet(payload, sizeof(payload), 7);
+
+    se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_DATA, 0x5a, payload, sizeof(payload));
+    CHECK(packet != NULL);
+    if (!packet) return;
+
+    int len = se_packet_serialize(packet, frame, sizeof(frame));
+    CHECK(len == (int)sizeof(frame));
+    CHECK(se_packet_serialize(packet, frame, sizeof(frame) - 1) == -1);
+
+    se_packet_t* copy = se_packet_deserialize(frame, (size_t)len);
+    CHECK(copy != NULL);
+    if (copy) {
+        CHECK(copy->type == SE_PACKET_TYPE_DATA);
+        CHECK(copy->flags == 0x5a);
+        CHECK(copy->payload_len == sizeof(payload));
+        CHECK(memcmp(copy->payload, payload, sizeof(payload)) == 0);
+        se_packet_free(copy);
+    }
+    CHECK(se_packet_deserialize(frame, (size_t)len - 1) == NULL);
+
+    se_packet_free(packet);
+}
+
+static void test_pool_alignment(void) {
+    se_packet_pool_t* pool = se_packet_pool_new();
+    CHECK(pool != NULL);
+    if (!pool) return;
+
+    se_packet_t* packets[8];
+    for (int i = 0; i < 8; i++) {
+        packets[i] = se_packet_pool_alloc(pool, i % 2 ? SE_POOL_LARGE_PAYLOAD : 1400);
+        CHECK(packets[i] != NULL && packets[i]->pool == pool);
+        CHECK(((uintptr_t)packets[i] % SE_CACHE_LINE_SIZE) == 0);
+    }
+    for (int i = 0; i < 8; i++) se_packet_free(packets[i]);
+
+    se_packet_pool_free(pool);
+}
+
+#define QUEUE_PACKETS 100000
+
+static void* queue_producer(void* arg) {
+    se_packet_queue_t* queue = arg;
+    for (uint32_t i = 0; i < QUEUE_PACKETS; i++) {
+        se_packet_t* packet = se_packet_new(SE_PACKET_TYPE_DATA, i, NULL, 0);
+        if (!packet || se_packet_queue_push(queue, packet, true) < 0) {
+            se_packet_free(packet);
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void test_queue_cross_thread(void) {
+    se_packet_queue_t* queue = se_packet_queue_new(64);
+    CHECK(queue != NULL);
+    if (!queue) return;
+
+    pthread_t producer;
+    pthread_create(&producer, NULL, queue_producer, queue);
+
+    bool ordered = true;
+    for (uint32_t i = 0; i < QUEUE_PACKETS; i++) {
+        se_packet_t* packet = se_packet_queue_pop(queue, true);
+        if (!packet) {
+            ordered = false;
+            break;
+        }
+        if (packet->flags != i) ordered = false;
+        se_packet_free(packet);
+    }
+    pthread_join(producer, NULL);
+
+    CHECK(ordered);
+    CHECK(se_packet_queue_size(queue) == 0);
+    CHECK(se_packet_queue_pop(queue, false) == NULL);
+
+    se_packet_queue_free(queue);
+}
+
+static void test_compress_roundtrip(int algorithm) {
+    se_compressor_t* compressor = se_compressor_new(algorithm, false);
+    se_compressor_t* decompressor = se_compressor_new(algorithm, true);
+    CHECK(compressor != NULL);
+    CHECK(decompressor != NULL);
+
+    // Repetitive enough to compress under either algorithm
+    uint8_t packet[1400];
+    for (size_t i = 0; i < sizeof(packet); i++) packet[i] = (uint8_t)("abcdefgh"[i % 8]);
+
+    for (int round = 0; compressor && decompressor && round < 4; round++) {
+        const uint8_t* compressed = NULL;
+        int len = se_compress(compressor, packet, sizeof(packet), &compressed);
+        CHECK(len > 0 && len < (int)sizeof(packet));
+        if (len <= 0) break;
+
+        // Split in two, as the receive ring may
+        struct iovec in[2] = {
+            { (void*)compressed, (size_t)len / 2 },
+            { (void*)(compressed + len / 2), (size_t)len - (size_t)len / 2 },
+        };
+        const uint8_t* out = NULL;
+        int out_len = se_decompress(decompressor, in, 2, &out);
+        CHECK(out_len == (int)sizeof(packet));
+        CHECK(out_len == (int)sizeof(packet) && memcmp(out, packet, sizeof(packet)) == 0);
+    }
+
+    se_compressor_free(compressor);
+    se_compressor_free(decompressor);
+}
+
+static void test_tun_batch(void) {
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == 0);
+    for (int i = 0; i < 2; i++) fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL, 0) | O_NONBLOCK);
+
+    static const size_t sizes[] = { 60, 1400, 576 };
+    uint8_t batch[8192];
+    size_t batch_len = 0;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        batch[batch_len] = (uint8_t)(sizes[i] >> 8);
+        batch[batch_len + 1] = (uint8_t)sizes[i];
+        fill_packet(batch + batch_len + SE_TUN_BATCH_PREFIX, sizes[i], (uint32_t)i);
+        batch_len += SE_TUN_BATCH_PREFIX + sizes[i];
+    }
+
+    int packets = 0;
+    CHECK(se_tun_write_batch(fds[0], batch, batch_len, &packets) == (int)batch_len);
+    CHECK(packets == 3);
+
+    uint8_t read_back[8192];
+    CHECK(se_tun_read_batch(fds[1], read_back, sizeof(read_back), 1500, &packets) == (int)batch_len);
+    CHECK(packets == 3);
+    CHECK(memcmp(read_back, batch, batch_len) == 0);
+
+    // Nothing waiting
+    CHECK(se_tun_read_batch(fds[1], read_back, sizeof(read_back), 1500, &packets) == 0);
+    CHECK(packets == 0);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// Stand-in DNS server on loopback. Names under .test get canned answers:
+// good (A 192.0.2.1, no AAAA), spoofed (a reply for another question
+// first, then A 192.0.2.2), servfail (SERVFAIL) and missing (NXDOMAIN).
+// Questions for held.test wait while holding is set.
+typedef struct {
+    int fd;
+    int port;
+    volatile bool holding;
+    volatile int held;
+    volatile bool stopping;
+} dns_stub_t;
+
+static size_t dns_stub_message(uint8_t* msg, uint16_t id, const char* name, int qtype,
+                               int rcode, const uint8_t* addr4) {
+    memset(msg, 0, 12);
+    msg[0] = (uint8_t)(id >> 8);
+    msg[1] = (uint8_t)id;
+    msg[2] = 0x81;               // QR, RD
+    msg[3] = (uint8_t)(0x80 | rcode);
+    msg[5] = 1;
+    msg[7] = addr4 ? 1 : 0;
+
+    size_t off = 12;
+    for (const char* label = name; *label;) {
+        const char* dot = strchr(label, '.');
+        size_t len = dot ? (size_t)(dot - label) : strlen(label);
+        msg[off++] = (uint8_t)len;
+        memcpy(msg + off, label, len);
+        off += len;
+        label += len + (dot ? 1 : 0);
+    }
+    msg[off++] = 0;
+    msg[off++] = 0;
+    msg[off++] = (uint8_t)qtype;
+    msg[off++] = 0;
+    msg[off++] = 1;              // IN
+
+    if (addr4) {
+        static const uint8_t rr[] = { 0xC0, 12, 0, 1, 0, 1, 0, 0, 0, 30, 0, 4 };
+        memcpy(msg + off, rr, sizeof(rr));
+        memcpy(msg + off + sizeof(rr), addr4, 4);
+        off += sizeof(rr) + 4;
+    }
+    return off;
+}
+
+static void* dns_stub_thread(void* arg) {
+    dns_stub_t* stub = arg;
+    static const uint8_t good[4] = { 192, 0, 2, 1 };
+    static const uint8_t spoofed[4] = { 192, 0, 2, 2 };
+    static const uint8_t bogus[4] = { 203, 0, 113, 66 };
+
+    while (!stub->stopping) {
+        struct pollfd pfd = { stub->fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 50) <= 0) continue;
+
+        uint8_t query[512];
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(stub->fd, query, sizeof(query), 0, (struct sockaddr*)&from, &from_len);
+        if (n < 17) continue;
+
+        // Flatten the question name; build_query never compresses it
+        char name[256];
+        size_t off = 12;
+        size_t name_len = 0;
+        while (off < (size_t)n && query[off] && name_len + query[off] + 1 < sizeof(name)) {
+            if (name_len) name[name_len++] = '.';
+            memcpy(name + name_len, query + off + 1, query[off]);
+            name_len += query[off];
+            off += 1 + query[off];
+        }
+        name[name_len] = '\0';
+        if (off + 5 > (size_t)n) continue;
+
+        uint16_t id = (uint16_t)((query[0] << 8) | query[1]);
+        int qtype = query[off + 2];
+        bool a = qtype == 1;
+
+        if (strcmp(name, "held.test") == 0) {
+            __atomic_fetch_add(&stub->held, 1, __ATOMIC_RELAXED);
+            while (stub->holding && !stub->stopping) usleep(1000);
+        }
+
+        uint8_t reply[512];
+        size_t len;
+        if (strcmp(name, "spoofed.test") == 0 && a) {
+            len = dns_stub_message(reply, id, "other.test", qtype, 0, bogus);
+            sendto(stub->fd, reply, len, 0, (struct sockaddr*)&from, from_len);
+            len = dns_stub_message(reply, id, name, qtype, 0, spoofed);
+        } else if (strcmp(name, "servfail.test") == 0) {
+            len = dns_stub_message(reply, id, name, qtype, 2, NULL);
+        } else if (strcmp(name, "missing.test") == 0) {
+            len = dns_stub_message(reply, id, name, qtype, 3, NULL);
+        } else {
+            len = dns_stub_message(reply, id, name, qtype, 0, a && strcmp(name, "good.test") == 0 ? good : NULL);
+        }
+        sendto(stub->fd, reply, len, 0, (struct sockaddr*)&from, from_len);
+    }
+    return NULL;
+}
+
+static void check_resolves_to(const char* host, const char* expected) {
+    struct sockaddr_storage addrs[4];
+    int count = se_dns_resolve(host, addrs, 4, 3000);
+    CHECK(count == 1);
+
+    char text[INET_ADDRSTRLEN] = "";
+    if (count == 1 && addrs[0].ss_family == AF_INET) {
+        inet_ntop(AF_INET, &((struct sockaddr_in*)&addrs[0])->sin_addr, text, sizeof(text));
+    }
+    CHECK(strcmp(text, expected) == 0);
+}
+
+// Start the stub and make it the resolver's only server
+static void dns_stub_start(dns_stub_t* stub, pthread_t* thread) {
+    stub->fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    CHECK(bind(stub->fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    getsockname(stub->fd, (struct sockaddr*)&addr, &addr_len);
+    stub->port = ntohs(addr.sin_port);
+
+    pthread_create(thread, NULL, dns_stub_thread, stub);
+
+    char server[32];
+    snprintf(server, sizeof(server), "127.0.0.1:%d", stub->port);
+    CHECK(se_dns_set_servers(server) == 1);
+}
+
+static void dns_stub_stop(dns_stub_t* stub, pthread_t thread) {
+    se_dns_set_servers(NULL);
+    stub->stopping = true;
+    pthread_join(thread, NULL);
+    close(stub->fd);
+}
+
+static void test_dns_resolver(void) {
+    dns_stub_t stub;
+    memset(&stub, 0, sizeof(stub));
+    pthread_t thread;
+    dns_stub_start(&stub, &thread);
+
+    check_resolves_to("good.test", "192.0.2.1");
+    check_resolves_to("spoofed.test", "192.0.2.2");     // The other question's answer is ignored
+
+    struct sockaddr_storage addrs[4];
+    CHECK(se_dns_resolve("missing.test", addrs, 4, 3000) == 0);
+    CHECK(se_dns_resolve("servfail.test", addrs, 4, 3000) == SE_DNS_RESOLVE_FAILED);
+    CHECK(se_dns_resolve("servfail.test", addrs, 4, 3000) == SE_DNS_RESOLVE_FAILED);  // Held, still an error
+
+    // Cached answers are served without asking again
+    se_dns_stats_t before, after;
+    se_dns_get_stats(&before);
+    check_resolves_to("good.test", "192.0.2.1");
+    se_dns_get_stats(&after);
+    CHECK(after.queries == before.queries);
+    CHECK(after.cache_hits == before.cache_hits + 1);
+
+    dns_stub_stop(&stub, thread);
+}
+
+typedef struct {
+    int count;
+    uint8_t type;
+    uint8_t payload[SE_UDP_MAX_PAYLOAD];
+    size_t len;
+} udp_capture_t;
+
+static void capture_udp(void* arg, uint8_t type, const uint8_t* payload, size_t len) {
+    udp_capture_t* capture = arg;
+    capture->count++;
+    capture->type = type;
+    capture->len = len;
+    memcpy(capture->payload, payload, len);
+}
+
+// Feed one raw datagram to channel and return how many messages it delivered
+static int udp_inject(int fd, se_udp_channel_t* channel, const uint8_t* datagram, size_t len,
+                      udp_capture_t* capture) {
+    int before = capture->count;
+    if (send(fd, datagram, len, 0) != (ssize_t)len) return -1;
+    se_udp_channel_recv(channel, capture_udp, capture);
+    return capture->count - before;
+}
+
+#define UDP_DATAGRAMS 70
+
+static void test_udp_channel(int aead) {
+    uint8_t client_random[SE_UDP_RANDOM_SIZE];
+    uint8_t server_random[SE_UDP_RANDOM_SIZE];
+    fill_packet(client_random, sizeof(client_random), 1);
+    fill_packet(server_random, sizeof(server_random), 2);
+
+    se_udp_keys_t client_keys;
+    se_udp_keys_t server_keys;
+    se_udp_derive_keys(client_random, server_random, true, &client_keys);
+    se_udp_derive_keys(client_random, server_random, false, &server_keys);
+    CHECK(client_keys.cookie == server_keys.cookie);
+    CHECK(memcmp(client_keys.send_key, server_keys.recv_key, SE_UDP_KEY_SIZE) == 0);
+    CHECK(memcmp(client_keys.recv_key, server_keys.send_key, SE_UDP_KEY_SIZE) == 0);
+    CHECK(memcmp(client_keys.send_key, client_keys.recv_key, SE_UDP_KEY_SIZE) != 0);
+
+    // The client's datagrams land on wire_fd to be read raw; inject_fd
+    // hands them to the server side
+    int client_pair[2];
+    int server_pair[2];
+    CHECK(socketpair(AF_UNIX, SOCK_DGRAM, 0, client_pair) == 0);
+    CHECK(socketpair(AF_UNIX, SOCK_DGRAM, 0, server_pair) == 0);
+    int wire_fd = client_pair[1];
+    int inject_fd = server_pair[1];
+
+    se_udp_channel_t* client = se_udp_channel_new(client_pair[0], aead, &client_keys);
+    se_udp_channel_t* server = se_udp_channel_new(server_pair[0], aead, &server_keys);
+    CHECK(client != NULL && server != NULL);
+    if (!client || !server) {
+        se_udp_channel_free(client);
+        se_udp_channel_free(server);
+        close(wire_fd);
+        close(inject_fd);
+        return;
+    }
+
+    // Seal datagrams 1..UDP_DATAGRAMS, each carrying its index
+    static uint8_t wire[UDP_DATAGRAMS][SE_UDP_MAX_DATAGRAM];
+    int wire_len[UDP_DATAGRAMS];
+    uint8_t payloads[UDP_DATAGRAMS][64];
+    for (int i = 0; i < UDP_DATAGRAMS; i++) {
+        fill_packet(payloads[i], sizeof(payloads[i]), (uint32_t)i);
+        struct iovec iov = { payloads[i], sizeof(payloads[i]) };
+        CHECK(se_udp_channel_send(client, SE_UDP_MSG_DATA, &iov, 1) == 1);
+        wire_len[i] = (int)recv(wire_fd, wire[i], SE_UDP_MAX_DATAGRAM, 0);
+        CHECK(wire_len[i] == (int)(SE_UDP_OVERHEAD + sizeof(payloads[i])));
+    }
+
+    udp_capture_t capture;
+    memset(&capture, 0, sizeof(capture));
+
+    // The server's own direction does not open on the server, only on the client
+    struct iovec probe = { payloads[5], 16 };
+    CHECK(se_udp_channel_send(server, SE_UDP_MSG_PROBE, &probe, 1) == 1);
+    uint8_t reflected[SE_UDP_MAX_DATAGRAM];
+    int reflected_len = (int)recv(inject_fd, reflected, sizeof(reflected), 0);
+    CHECK(reflected_len == (int)(SE_UDP_OVERHEAD + 16));
+    CHECK(udp_inject(inject_fd, server, reflected, (size_t)reflected_len, &capture) == 0);
+    CHECK(udp_inject(wire_fd, client, reflected, (size_t)reflected_len, &capture) == 1);
+    CHECK(capture.type == SE_UDP_MSG_PROBE && capture.len == 16);
+
+    // Opens to the same message
+    CHECK(udp_inject(inject_fd, server, wire[0], wire_len[0], &capture) == 1);
+    CHECK(capture.type == SE_UDP_MSG_DATA);
+    CHECK(capture.len == sizeof(payloads[0]));
+    CHECK(memcmp(capture.payload, payloads[0], sizeof(payloads[0])) == 0);
+
+    // Replays are dropped; reordering within the window is not
+    CHECK(udp_inject(inject_fd, server, wire[0], wire_len[0], &capture) == 0);
+    CHECK(udp_inject(inject_fd, server, wire[2], wire_len[2], &capture) == 1);
+    CHECK(udp_inject(inject_fd, server, wire[1], wire_len[1], &capture) == 1);
+    CHECK(udp_inject(inject_fd, server, wire[2], wire_len[2], &capture) == 0);
+
+    // A tampered datagram fails and leaves the window alone
+    uint8_t tampered[SE_UDP_MAX_DATAGRAM];
+    memcpy(tampered, wire[20], wire_len[20]);
+    tampered[SE_UDP_HEADER_SIZE + 5] ^= 0x01;
+    CHECK(udp_inject(inject_fd, server, tampered, wire_len[20], &capture) == 0);
+    CHECK(udp_inject(inject_fd, server, wire[20], wire_len[20], &capture) == 1);
+
+    // A different sequence number under the same ciphertext does not authenticate
+    memcpy(tampered, wire[30], wire_len[30]);
+    tampered[SE_UDP_HEADER_SIZE - 1] ^= 0x01;
+    CHECK(udp_inject(inject_fd, server, tampered, wire_len[30], &capture) == 0);
+
+    // Past the window's far edge: sequence 70 moves it, 4 (age 66) is too
+    // old even though never seen, 11 (age 59) still fits
+    CHECK(udp_inject(inject_fd, server, wire[69], wire_len[69], &capture) == 1);
+    CHECK(udp_inject(inject_fd, server, wire[3], wire_len[3], &capture) == 0);
+    CHECK(udp_inject(inject_fd, server, wire[10], wire_len[10], &capture) == 1);
+    CHECK(memcmp(capture.payload, payloads[10], sizeof(payloads[10])) == 0);
+
+    se_udp_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    se_udp_channel_get_counters(server, &stats);
+    CHECK(stats.datagrams_received == 6);
+    CHECK(stats.rejected == 6);
+    CHECK(se_udp_channel_last_rx_ms(server) > 0);
+
+    se_udp_channel_free(client);
+    se_udp_channel_free(server);
+    close(wire_fd);
+    close(inject_fd);
+}
+
+static size_t build_ipv4(uint8_t* packet, int protocol, uint16_t src_port, uint16_t dst_port,
+                         uint16_t fragment, uint8_t fill) {
+    memset(packet, fill, 60);
+    packet[0] = 0x45;
+    packet[6] = (uint8_t)(fragment >> 8);
+    packet[7] = (uint8_t)fragment;
+    packet[9] = (uint8_t)protocol;
+    uint8_t addresses[8] = { 10, 0, 0, 2, 93, 184, 216, 34 };
+    memcpy(packet + 12, addresses, sizeof(addresses));
+    packet[20] = (uint8_t)(src_port >> 8);
+    packet[21] = (uint8_t)src_port;
+    packet[22] = (uint8_t)(dst_port >> 8);
+    packet[23] = (uint8_t)dst_port;
+    return 60;
+}
+
+static size_t build_ipv6(uint8_t* packet, int protocol, uint16_t src_port, uint16_t dst_port, uint8_t fill) {
+    memset(packet, fill, 80);
+    packet[0] = 0x60;
+    packet[6] = (uint8_t)protocol;
+    for (int i = 0; i < 32; i++) packet[8 + i] = (uint8_t)(0x20 + i);
+    packet[40] = (uint8_t)(src_port >> 8);
+    packet[41] = (uint8_t)src_port;
+    packet[42] = (uint8_t)(dst_port >> 8);
+    packet[43] = (uint8_t)dst_port;
+    return 80;
+}
+
+static void test_flow_hash(void) {
+    uint8_t a[80];
+    uint8_t b[80];
+
+    // Everything but the 5-tuple (TTL, ID, checksum, payload) is ignored
+    size_t len = build_ipv4(a, IPPROTO_TCP, 40000, 443, 0, 0x11);
+    build_ipv4(b, IPPROTO_TCP, 40000, 443, 0, 0x77);
+    CHECK(se_packet_flow_hash(a, len) == se_packet_flow_hash(b, len));
+    CHECK(se_packet_flow_hash(a, len) == se_packet_flow_hash(a, len - 20));
+
+    build_ipv4(b, IPPROTO_TCP, 40001, 443, 0, 0x11);
+    CHECK(se_packet_flow_hash(a, len) != se_packet_flow_hash(b, len));
+    build_ipv4(b, IPPROTO_UDP, 40000, 443, 0, 0x11);
+    CHECK(se_packet_flow_hash(a, len) != se_packet_flow_hash(b, len));
+
+    // Every fragment of a datagram follows its first: MF set, then an
+    // offset with payload where the ports would be
+    build_ipv4(a, IPPROTO_UDP, 5353, 53, 0x2000, 0x11);
+    build_ipv4(b, IPPROTO_UDP, 1234, 4321, 0x00B9, 0x11);
+    CHECK(se_packet_flow_hash(a, len) == se_packet_flow_hash(b, len));
+
+    // Options move the ports
+    build_ipv4(a, IPPROTO_TCP, 0, 0, 0, 0x11);
+    build_ipv4(b, IPPROTO_TCP, 0, 0, 0, 0x11);
+    a[0] = b[0] = 0x46;
+    a[21] = 0x01;                           // Option bytes differ
+    a[24] = b[24] = 0x9C;                   // Same source port
+    CHECK(se_packet_flow_hash(a, len) == se_packet_flow_hash(b, len));
+    b[27] = 0x01;                           // Destination port differs
+    CHECK(se_packet_flow_hash(a, len) != se_packet_flow_hash(b, len));
+
+    len = build_ipv6(a, IPPROTO_UDP, 51000, 443, 0x11);
+    build_ipv6(b, IPPROTO_UDP, 51000, 443, 0x77);
+    CHECK(se_packet_flow_hash(a, len) == se_packet_flow_hash(b, len));
+    build_ipv6(b, IPPROTO_UDP, 51000, 444, 0x11);
+    CHECK(se_packet_flow_hash(a, len) != se_packet_flow_hash(b, len));
+
+    // Runts and other protocols hash without reading past the end
+    se_packet_flow_hash(a, 0);
+    se_packet_flow_hash(a, 1);
+    CHECK(se_packet_flow_hash(a, 39) == se_packet_flow_hash(b, 39));
+    uint8_t arp[28] = { 0x00, 0x01 };
+    se_packet_flow_hash(arp, sizeof(arp));
+
+    // Flows that differ only in the source port spread evenly over the
+    // transports, whatever their number
+    for (int transports = 2; transports <= 8; transports++) {
+        int counts[8] = { 0 };
+        for (int port = 0; port < 4096; port++) {
+            len = build_ipv4(a, IPPROTO_TCP, (uint16_t)(32768 + port), 443, 0, 0);
+            counts[se_packet_flow_hash(a, len) % (uint32_t)transports]++;
+        }
+        int fair = 4096 / transports;
+        for (int i = 0; i < transports; i++) {
+            CHECK(counts[i] > fair * 8 / 10 && counts[i] < fair * 12 / 10);
+        }
+    }
+}
+
+static void test_latency_histogram(void) {
+    se_latency_histogram_t* histogram = se_latency_new();
+    CHECK(histogram != NULL);
+    if (!histogram) return;
+
+    se_latency_snapshot_t snapshot;
+
+    // Each value lands in a bucket that contains it and is at most about
+    // 3% wide: the lowest value is the bucket's low bound, the 50th
+    // percentile of it and a far larger value its high bound
+    static const uint64_t values[] = {
+        0, 1, 63, 64, 65, 127, 128, 129, 1000, 4095, 4096, 123456,
+        1000000, 999999999, (1ULL << 35) + 12345, SE_LATENCY_MAX_NS
+    };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        uint64_t value = values[i];
+        se_latency_record(histogram, value, 1);
+        se_latency_record(histogram, SE_LATENCY_MAX_NS + 1000, 1);
+        se_latency_snapshot(histogram, &snapshot, true);
+
+        uint64_t low = snapshot.min_ns;
+        uint64_t high = se_latency_percentile(&snapshot, 50);
+        CHECK(snapshot.count == 2);
+        CHECK(low <= value && value <= high);
+        CHECK(value < 64 ? low == high : high - low < low / 32 + 1);
+    }
+
+    // Values past the top share the last bucket; max keeps the real value
+    se_latency_record(histogram, SE_LATENCY_MAX_NS * 4, 3);
+    se_latency_snapshot(histogram, &snapshot, true);
+    CHECK(snapshot.counts[SE_LATENCY_BUCKETS - 1] == 3);
+    CHECK(snapshot.max_ns == SE_LATENCY_MAX_NS * 4);
+
+    // 1..1000 us, one packet each
+    for (uint64_t us = 1; us <= 1000; us++) {
+        se_latency_record(histogram, us * 1000, 1);
+    }
+    se_latency_snapshot(histogram, &snapshot, false);
+    CHECK(snapshot.count == 1000);
+    CHECK(snapshot.sum_ns == 500500ULL * 1000);
+    CHECK(snapshot.max_ns == 1000000);
+    CHECK(snapshot.min_ns <= 1000 && snapshot.min_ns > 1000 - 1000 / 32);
+
+    uint64_t p50 = se_latency_percentile(&snapshot, 50);
+    uint64_t p99 = se_latency_percentile(&snapshot, 99);
+    CHECK(p50 >= 500000 && p50 <= 500000 + 500000 / 32);
+    CHECK(p99 >= 990000 && p99 <= 990000 + 990000 / 32);
+    CHECK(se_latency_percentile(&snapshot, 100) == 1000000);
+    CHECK(se_latency_percentile(&snapshot, 150) == 1000000);
+    CHECK(se_latency_percentile(&snapshot, 0) >= 1000 && se_latency_percentile(&snapshot, 0) < 1032);
+
+    // Batches time each read separately; the last slot takes the overflow
+    se_latency_batch_t batch;
+    memset(&batch, 0, sizeof(batch));
+    for (int i = 0; i < SE_LATENCY_BATCH + 10; i++) {
+        se_latency_batch_add(&batch, 1000000 + (uint64_t)i);
+    }
+    CHECK(batch.count == SE_LATENCY_BATCH);
+    CHECK(batch.packets[SE_LATENCY_BATCH - 1] == 11);
+    se_latency_reset(histogram);
+    se_latency_record_batch(histogram, &batch, 1000000 + 2 * SE_LATENCY_BATCH);
+    CHECK(batch.count == 0);
+    se_latency_snapshot(histogram, &snapshot, true);
+    CHECK(snapshot.count == SE_LATENCY_BATCH + 10);
+    CHECK(snapshot.max_ns == 2 * SE_LATENCY_BATCH);
+
+    // The resetting snapshot took everything
+    se_latency_snapshot(histogram, &snapshot, false);
+    CHECK(snapshot.count == 0 && snapshot.sum_ns == 0 && snapshot.max_ns == 0);
+    CHECK(se_latency_percentile(&snapshot, 50) == 0);
+
+    se_latency_free(histogram);
+}
+
+typedef struct {
+    int count;
+    int tids[2];
+    int32_t args[3 * SE_TRACE_RING_SIZE];
+    uint64_t last_ns;
+    bool ordered;
+} trace_capture_t;
+
+static void capture_trace(const se_trace_record_t* record, int tid, void* arg) {
+    trace_capture_t* capture = arg;
+    if (record->timestamp_ns < capture->last_ns) capture->ordered = false;
+    capture->last_ns = record->timestamp_ns;
+    if (capture->count < (int)(sizeof(capture->args) / sizeof(capture->args[0]))) {
+        capture->args[capture->count] = record->args[0];
+    }
+    if (capture->count == 0) capture->tids[0] = tid;
+    if (tid != capture->tids[0]) capture->tids[1] = tid;
+    capture->count++;
+}
+
+static void trace_capture_reset(trace_capture_t* capture) {
+    memset(capture, 0, sizeof(*capture));
+    capture->ordered = true;
+}
+
+typedef struct {
+    int first;
+    int count;
+} trace_writer_t;
+
+static void* trace_writer(void* arg) {
+    trace_writer_t* writer = arg;
+    for (int i = 0; i < writer->count; i++) {
+        se_trace_write(SE_TRACE_RECEIVE_ERROR, writer->first + i, 0, 0, 0, 0);
+    }
+    return NULL;
+}
+
+static void test_trace_rings(void) {
+    trace_capture_t* capture = malloc(sizeof(trace_capture_t));
+    CHECK(capture != NULL);
+    if (!capture) return;
+
+    // Start from empty rings
+    trace_capture_reset(capture);
+    se_trace_drain(capture_trace, capture, INT32_MAX);
+    se_trace_take_dropped();
+
+    // Partial drains, with the ring wrapping several times
+    int next = 0;
+    bool sequential = true;
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < 300; i++) {
+            se_trace_write(SE_TRACE_RECEIVE_ERROR, next + i, 1, 2, 3, 4);
+        }
+        trace_capture_reset(capture);
+        CHECK(se_trace_drain(capture_trace, capture, 100) == 100);
+        CHECK(se_trace_drain(capture_trace, capture, INT32_MAX) == 200);
+        for (int i = 0; i < 300; i++) {
+            if (capture->args[i] != next + i) sequential = false;
+        }
+        next += 300;
+    }
+    CHECK(sequential);
+    CHECK(se_trace_take_dropped() == 0);
+
+    // A full ring drops the newest records and counts them
+    for (int i = 0; i < SE_TRACE_RING_SIZE + 88; i++) {
+        se_trace_write(SE_TRACE_RECEIVE_ERROR, i, 0, 0, 0, 0);
+    }
+    trace_capture_reset(capture);
+    CHECK(se_trace_drain(capture_trace, capture, INT32_MAX) == SE_TRACE_RING_SIZE);
+    CHECK(capture->args[0] == 0 && capture->args[SE_TRACE_RING_SIZE - 1] == SE_TRACE_RING_SIZE - 1);
+    CHECK(se_trace_take_dropped() == 88);
+    CHECK(se_trace_take_dropped() == 0);
+
+    // Rings of several threads merge into one timestamp order
+    trace_writer_t writers[3] = {
+        { 0, 100 }, { 100, 100 }, { 200, 100 }
+    };
+    trace_writer(&writers[0]);
+    pthread_t thread;
+    pthread_create(&thread, NULL, trace_writer, &writers[1]);
+    pthread_join(thread, NULL);
+    trace_writer(&writers[2]);
+
+    trace_capture_reset(capture);
+    CHECK(se_trace_drain(capture_trace, capture, INT32_MAX) == 300);
+    CHECK(capture->ordered);
+    CHECK(capture->tids[1] != 0 && capture->tids[1] != capture->tids[0]);
+    sequential = true;
+    for (int i = 0; i < 300; i++) {
+        if (capture->args[i] != i) sequential = false;
+    }
+    CHECK(sequential);
+
+    // Formatting fills in the arguments and truncates safely
+    se_trace_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.event = SE_TRACE_RECEIVE_ERROR;
+    record.args[0] = 3;
+    record.args[1] = -5;
+    char text[64];
+    CHECK(se_trace_format(&record, text, sizeof(text)) == (int)strlen("Receive error on connection 3: -5"));
+    CHECK(strcmp(text, "Receive error on connection 3: -5") == 0);
+    CHECK(se_trace_format(&record, text, 8) == (int)strlen("Receive error on connection 3: -5"));
+    CHECK(strcmp(text, "Receive") == 0);
+    CHECK(strcmp(se_trace_event_name(SE_TRACE_RECEIVE_ERROR), "RECEIVE_ERROR") == 0);
+
+    free(capture);
+}
+
+#define STATS_PAGE_UPDATES 20000
+
+typedef struct {
+    const se_stats_page_t* page;
+    volatile bool stopping;
+    uint64_t consistent;
+    uint64_t torn;
+} stats_reader_t;
+
+// Read the page the way the Java poller does and check that every copy
+// taken between two equal, even sequence reads is whole
+static void* stats_page_reader(void* arg) {
+    stats_reader_t* reader = arg;
+    const se_stats_page_t* page = reader->page;
+    const uint64_t* fields = &page->state;
+    uint64_t copy[32];
+
+    while (!reader->stopping) {
+        uint32_t before = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) continue;
+        for (uint32_t i = 0; i < page->field_count; i++) {
+            copy[i] = __atomic_load_n(&fields[i], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->sequence, __ATOMIC_RELAXED) != before) continue;
+
+        // bytes_sent, bytes_received, packets_sent and packets_received
+        // are published equal
+        if (copy[3] == copy[4] && copy[3] == copy[5] && copy[3] == copy[6]) {
+            __atomic_store_n(&reader->consistent, reader->consistent + 1, __ATOMIC_RELAXED);
+        } else {
+            reader->torn++;
+        }
+    }
+    return NULL;
+}
+
+static void test_stats_page(void) {
+    se_connection_t* conn = se_connection_new();
+    CHECK(conn != NULL);
+    if (!conn) return;
+
+    const se_stats_page_t* page = se_connection_get_stats_page(conn);
+    CHECK(page->magic == SE_STATS_PAGE_MAGIC);
+    CHECK(page->version == SE_STATS_PAGE_VERSION);
+    CHECK(page->field_count == 20);
+    CHECK((page->sequence & 1) == 0);
+
+    stats_reader_t reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.page = page;
+    pthread_t thread;
+    pthread_create(&thread, NULL, stats_page_reader, &reader);
+
+    uint32_t sequence = page->sequence;
+    for (uint64_t i = 1; i <= STATS_PAGE_UPDATES; i++) {
+        pthread_mutex_lock(&conn->lock);
+        conn->stats.bytes_sent = i;
+        conn->stats.bytes_received = i;
+        conn->stats.packets_sent = i;
+        conn->stats.packets_received = i;
+        pthread_mutex_unlock(&conn->lock);
+        se_stats_page_publish(conn, true);
+    }
+
+    while (__atomic_load_n(&reader.consistent, __ATOMIC_RELAXED) == 0) {
+        usleep(1000);
+    }
+    reader.stopping = true;
+    pthread_join(thread, NULL);
+
+    CHECK(reader.torn == 0);
+    CHECK(reader.consistent > 0);
+    CHECK(page->sequence == sequence + 2 * STATS_PAGE_UPDATES);
+    CHECK(page->bytes_sent == STATS_PAGE_UPDATES);
+    CHECK(page->state == SE_STATE_DISCONNECTED);
+
+    // Freed pages stay mapped and go to the next connection, cleared
+    // under the same protocol
+    sequence = page->sequence;
+    se_connection_free(conn);
+    CHECK(page->magic == SE_STATS_PAGE_MAGIC);
+
+    conn = se_connection_new();
+    CHECK(conn != NULL);
+    if (!conn) return;
+    CHECK(se_connection_get_stats_page(conn) == page);
+    CHECK(page->sequence == sequence + 2);
+    CHECK(page->bytes_sent == 0 && page->packets_received == 0);
+    CHECK(page->field_count == 20);
+
+    se_connection_free(conn);
+}
+
+typedef struct {
+    bool hold;                  // Keep what was handed out instead of releasing it
+    uint32_t tail;
+    uint32_t head;
+    int notifications;
+    uint32_t next;              // Sequence number expected in the next record
+    int records;
+    int wraps;
+    bool valid;
+} tap_reader_t;
+
+static tap_reader_t g_tap_reader;
+
+// Walk [tail, head) the way the Java reader does
+static void tap_read(const se_packet_tap_t* tap, uint32_t tail, uint32_t head, tap_reader_t* reader) {
+    const uint8_t* data = (const uint8_t*)tap + SE_TAP_HEADER_SIZE;
+
+    while (tail != head) {
+        uint32_t offset = tail & (tap->capacity - 1);
+        const se_tap_record_t* record = (const se_tap_record_t*)(data + offset);
+        if (record->direction == SE_TAP_WRAP) {
+            reader->wraps++;
+            tail += tap->capacity - offset;
+            continue;
+        }
+
+        uint32_t expected = record->length < tap->snap_len ? record->length : tap->snap_len;
+        uint32_t sequence;
+        memcpy(&sequence, record + 1, sizeof(sequence));
+        if (record->direction != SE_TAP_RECEIVED || record->captured != expected || sequence != reader->next) {
+            reader->valid = false;
+            return;
+        }
+        reader->next++;
+        reader->records++;
+        tail += ((uint32_t)sizeof(se_tap_record_t) + record->captured + SE_TAP_RECORD_ALIGN - 1) &
+                ~(uint32_t)(SE_TAP_RECORD_ALIGN - 1);
+    }
+}
+
+static void on_packets_tapped(se_connection_t* conn, const se_packet_tap_t* tap, uint32_t tail, uint32_t head) {
+    g_tap_reader.notifications++;
+    g_tap_reader.tail = tail;
+    g_tap_reader.head = head;
+    if (g_tap_reader.hold) return;
+
+    tap_read(tap, tail, head, &g_tap_reader);
+    se_connection_release_packet_tap(conn, head);
+}
+
+// Tap a packet whose first bytes are its sequence number
+static void tap_one(se_connection_t* conn, uint32_t sequence, size_t len) {
+    uint8_t packet[400];
+    fill_packet(packet, len, sequence);
+    memcpy(packet, &sequence, sizeof(sequence));
+
+    // Split, like a frame payload that wrapped in the receive ring
+    struct iovec iov[2] = {
+        { packet, 3 },
+        { packet + 3, len - 3 }
+    };
+    se_tap_packet(conn, iov, 2, len);
+}
+
+static void test_packet_tap(void) {
+    se_connection_t* conn = se_connection_new();
+    CHECK(conn != NULL);
+    if (!conn) return;
+
+    memset(&g_tap_reader, 0, sizeof(g_tap_reader));
+    g_tap_reader.valid = true;
+    conn->on_packets_tapped = on_packets_tapped;
+
+    // 4096 bytes of ring; records of 64 and 112 bytes (96 bytes kept)
+    CHECK(se_connection_enable_packet_tap(conn, 1000, 96, 4, 60000000) == 0);
+    const se_packet_tap_t* tap = se_connection_get_packet_tap(conn);
+    CHECK(tap != NULL);
+    if (!tap) {
+        se_connection_free(conn);
+        return;
+    }
+    CHECK(tap->magic == SE_TAP_MAGIC && tap->capacity == 4096 && tap->snap_len == 96);
+
+    // A reader that keeps up sees every packet in order across wraps
+    uint32_t sequence = 0;
+    for (int i = 0; i < 400; i++, sequence++) {
+        tap_one(conn, sequence, i % 3 == 0 ? 40 : 300);
+    }
+    CHECK(g_tap_reader.notifications >= 99);
+
+    // The stragglers short of a notification
+    tap_read(tap, tap->tail, tap->head, &g_tap_reader);
+    se_connection_release_packet_tap(conn, tap->head);
+    CHECK(g_tap_reader.valid);
+    CHECK(g_tap_reader.records == 400);
+    CHECK(g_tap_reader.wraps > 0);
+    CHECK(tap->packets == 400 && tap->dropped == 0);
+
+    // A reader that holds its batch: the ring fills, then drops
+    g_tap_reader.hold = true;
+    int notifications = g_tap_reader.notifications;
+    uint32_t first = sequence;
+    for (int i = 0; i < 100; i++, sequence++) {
+        tap_one(conn, sequence, 300);
+    }
+    CHECK(g_tap_reader.notifications == notifications + 1);
+    CHECK(tap->dropped > 0);
+    CHECK(tap->packets + tap->dropped == 500);
+    CHECK(tap->head - tap->tail <= tap->capacity);
+
+    // Released, the records kept are the oldest of them, with nothing missing
+    g_tap_reader.hold = false;
+    tap_read(tap, g_tap_reader.tail, g_tap_reader.head, &g_tap_reader);
+    se_connection_release_packet_tap(conn, g_tap_reader.head);
+    uint32_t kept = (uint32_t)(tap->packets - 400);
+    tap_read(tap, tap->tail, tap->head, &g_tap_reader);
+    CHECK(g_tap_reader.valid);
+    CHECK(g_tap_reader.next == first + kept);
+
+    se_connection_disable_packet_tap(conn);
+    se_connection_free(conn);
+}
+
+// A session with only an ID and a cipher suite, which the cache can hand out
+static SSL_SESSION* make_session(SSL_CTX* ctx, int version, uint8_t id_byte, long age, long timeout) {
+    static const uint8_t tls12_suite[2] = { 0xC0, 0x2F };   // ECDHE-RSA-AES128-GCM-SHA256
+    static const uint8_t tls13_suite[2] = { 0x13, 0x01 };   // TLS_AES_128_GCM_SHA256
+
+    SSL* ssl = SSL_new(ctx);
+    const uint8_t* suite = version == TLS1_3_VERSION ? tls13_suite : tls12_suite;
+    const SSL_CIPHER* cipher = ssl ? SSL_CIPHER_find(ssl, suite) : NULL;
+    SSL_free(ssl);
+
+    SSL_SESSION* session = SSL_SESSION_new();
+    if (!session) return NULL;
+
+    uint8_t id[32];
+    uint8_t master_key[48];
+    memset(id, id_byte, sizeof(id));
+    memset(master_key, id_byte, sizeof(master_key));
+    SSL_SESSION_set1_id(session, id, sizeof(id));
+    SSL_SESSION_set1_master_key(session, master_key, sizeof(master_key));
+    SSL_SESSION_set_protocol_version(session, version);
+    SSL_SESSION_set_cipher(session, cipher);
+    SSL_SESSION_set_time(session, (long)time(NULL) - age);
+    SSL_SESSION_set_timeout(session, timeout);
+    return session;
+}
+
+static void put_be32(uint8_t* out, uint32_t value) {
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+// Write sessions in the cache file format se_session_cache_save uses
+static bool write_session_file(const char* path, const char** keys, SSL_SESSION** sessions, int count) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+
+    uint8_t header[12];
+    put_be32(header, 0x53455343);
+    put_be32(header + 4, 2);
+    put_be32(header + 8, (uint32_t)count);
+    bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+
+    for (int i = 0; i < count && ok; i++) {
+        uint8_t* der = NULL;
+        int der_len = i2d_SSL_SESSION(sessions[i], &der);
+        uint8_t lengths[8];
+        put_be32(lengths, (uint32_t)strlen(keys[i]));
+        put_be32(lengths + 4, der_len > 0 ? (uint32_t)der_len : 0);
+        ok = der_len > 0 &&
+             fwrite(lengths, 1, sizeof(lengths), file) == sizeof(lengths) &&
+             fwrite(keys[i], 1, strlen(keys[i]), file) == strlen(keys[i]) &&
+             fwrite(der, 1, (size_t)der_len, file) == (size_t)der_len;
+        OPENSSL_free(der);
+    }
+
+    return fclose(file) == 0 && ok;
+}
+
+// Attach a new SSL to the cache and return the first byte of the session
+// ID it was offered, 0 if none
+static int session_offered(SSL_CTX* ctx, const char* host, int port, bool verify_cert) {
+    SSL* ssl = SSL_new(ctx);
+    if (!ssl) return -1;
+
+    se_session_cache_attach(ssl, host, port, verify_cert);
+    SSL_SESSION* session = SSL_get_session(ssl);
+    unsigned int id_len = 0;
+    const uint8_t* id = session ? SSL_SESSION_get_id(session, &id_len) : NULL;
+    int offered = id_len > 0 ? id[0] : 0;
+
+    SSL_free(ssl);
+    return offered;
+}
+
+static void test_session_cache(void) {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    CHECK(ctx != NULL);
+    if (!ctx) return;
+    se_session_cache_setup_ctx(ctx);
+    se_session_cache_clear();
+
+    const char* keys[] = {
+        "vpn.test:443/verified",
+        "vpn.test:443/unverified",
+        "tls13.test:443/verified",
+        "old.test:443/verified",
+    };
+    SSL_SESSION* sessions[] = {
+        make_session(ctx, TLS1_2_VERSION, 0x11, 0, 3600),
+        make_session(ctx, TLS1_2_VERSION, 0x22, 0, 3600),
+        make_session(ctx, TLS1_3_VERSION, 0x33, 0, 3600),
+        make_session(ctx, TLS1_2_VERSION, 0x44, 7200, 3600),
+    };
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/softether-core-test-%d.sessions", (int)getpid());
+    CHECK(write_session_file(path, keys, sessions, 4));
+    for (int i = 0; i < 4; i++) SSL_SESSION_free(sessions[i]);
+
+    // The expired session is not loaded
+    CHECK(se_session_cache_load(path) == 3);
+
+    se_session_cache_stats_t before;
+    se_session_cache_get_stats(&before);
+
+    // The key is host, port and verify mode
+    CHECK(session_offered(ctx, "vpn.test", 443, true) == 0x11);
+    CHECK(session_offered(ctx, "vpn.test", 443, false) == 0x22);
+    CHECK(session_offered(ctx, "vpn.test", 8443, true) == 0);
+    CHECK(session_offered(ctx, "other.test", 443, true) == 0);
+    CHECK(session_offered(ctx, "old.test", 443, true) == 0);
+
+    // TLS 1.2 sessions are offered again, TLS 1.3 ones only once
+    CHECK(session_offered(ctx, "vpn.test", 443, true) == 0x11);
+    CHECK(session_offered(ctx, "tls13.test", 443, true) == 0x33);
+    CHECK(session_offered(ctx, "tls13.test", 443, true) == 0);
+
+    // A cached session that expires is dropped at the next lookup
+    SSL* ssl = SSL_new(ctx);
+    CHECK(ssl != NULL);
+    if (ssl) {
+        se_session_cache_attach(ssl, "vpn.test", 443, false);
+        SSL_SESSION* cached = SSL_get_session(ssl);
+        CHECK(cached != NULL);
+        if (cached) SSL_SESSION_set_time(cached, (long)time(NULL) - 7200);
+        SSL_free(ssl);
+    }
+    CHECK(session_offered(ctx, "vpn.test", 443, false) == 0);
+
+    se_session_cache_stats_t after;
+    se_session_cache_get_stats(&after);
+    CHECK(after.lookups - before.lookups == 10);
+    CHECK(after.hits - before.hits == 5);
+
+    // Only the session still usable is saved
+    CHECK(se_session_cache_save(path) == 1);
+    se_session_cache_clear();
+    CHECK(session_offered(ctx, "vpn.test", 443, true) == 0);
+    CHECK(se_session_cache_load(path) == 1);
+    CHECK(session_offered(ctx, "vpn.test", 443, true) == 0x11);
+
+    se_session_cache_clear();
+    remove(path);
+    SSL_CTX_free(ctx);
+}
+
+// Asynchronous connects against the mock server. A connect cancelled (or
+// disconnected) in any phase completes once, through the cancel, with
+// neither callback and no descriptor left open; one that runs to the end
+// completes once, through its callback.
+typedef struct {
+    int connected;
+    int errors;
+} connect_outcome_t;
+
+static void outcome_connected(se_connection_t* conn, const se_network_config_t* config) {
+    connect_outcome_t* outcome = conn->user_data;
+    __atomic_fetch_add(&outcome->connected, 1, __ATOMIC_RELAXED);
+}
+
+static void outcome_error(se_connection_t* conn, int error_code, const char* message) {
+    connect_outcome_t* outcome = conn->user_data;
+    __atomic_fetch_add(&outcome->errors, 1, __ATOMIC_RELAXED);
+}
+
+static int count_fds(void) {
+    DIR* dir = opendir("/proc/self/fd");
+    if (!dir) return -1;
+    int count = 0;
+    while (readdir(dir)) count++;
+    closedir(dir);
+    return count;
+}
+
+// Wait up to 5 s for *value to reach at least target
+static bool wait_for(volatile int* value, int target) {
+    for (int i = 0; i < 500 && __atomic_load_n(value, __ATOMIC_RELAXED) < target; i++) {
+        usleep(10000);
+    }
+    return __atomic_load_n(value, __ATOMIC_RELAXED) >= target;
+}
+
+static bool wait_for_phase(se_connection_t* conn, int phase) {
+    for (int i = 0; i < 500 && se_connection_get_connect_phase(conn) != phase; i++) {
+        usleep(10000);
+    }
+    return se_connection_get_connect_phase(conn) == phase;
+}
+
+static se_connection_t* async_connect_start(const char* host, int port, connect_outcome_t* outcome) {
+    se_connection_t* conn = se_connection_new();
+    CHECK(conn != NULL);
+    if (!conn) return NULL;
+
+    memset(outcome, 0, sizeof(*outcome));
+    conn->user_data = outcome;
+    conn->on_connected = outcome_connected;
+    conn->on_error = outcome_error;
+
+    se_connection_params_t params;
+    memset(&params, 0, sizeof(params));
+    snprintf(params.server_host, sizeof(params.server_host), "%s", host);
+    params.server_port = port;
+    snprintf(params.hub_name, sizeof(params.hub_name), "VPN");
+    snprintf(params.username, sizeof(params.username), "test");
+    params.max_connections = 2;
+    params.mtu = 1500;
+    CHECK(se_connection_connect_async(conn, &params) == SE_ERR_SUCCESS);
+    return conn;
+}
+
+// Start a connect, wait until it is stalled in phase (stalled, when
+// given, counts the stalls seen by the peer) and cancel or disconnect it
+static void check_cancel_in_phase(const char* host, int port, int phase, volatile int* stalled, bool disconnect) {
+    connect_outcome_t outcome;
+    se_connection_t* conn = async_connect_start(host, port, &outcome);
+    if (!conn) return;
+
+    CHECK(stalled == NULL || wait_for(stalled, 1));
+    CHECK(wait_for_phase(conn, phase));
+
+    if (disconnect) {
+        se_connection_disconnect(conn);
+        CHECK(se_connection_cancel_connect(conn) == -1);
+    } else {
+        CHECK(se_connection_cancel_connect(conn) == 0);
+        CHECK(se_connection_cancel_connect(conn) == -1);
+
+        // Cancelled in the session phase, it is left to the canceller
+        se_connection_disconnect(conn);
+    }
+    CHECK(se_connection_get_connect_phase(conn) == SE_CONNECT_PHASE_IDLE);
+    CHECK(se_connection_get_state(conn) == SE_STATE_DISCONNECTED);
+
+    // Nothing arrives late either
+    usleep(50000);
+    CHECK(outcome.connected == 0);
+    CHECK(outcome.errors == 0);
+
+    se_connection_free(conn);
+}
+
+static void mock_start(mock_server_t* server, pthread_t* thread, int hold_phase) {
+    memset(server, 0, sizeof(*server));
+    server->ssl_ctx = mock_server_ssl_ctx_new();
+    server->connections = 2;
+    server->hold_phase = hold_phase;
+    CHECK(server->ssl_ctx != NULL);
+    CHECK(mock_server_listen(server, false) == 0);
+    pthread_create(thread, NULL, mock_server_thread, server);
+}
+
+static void mock_stop(mock_server_t* server, pthread_t thread) {
+    server->stopping = true;
+    shutdown(server->listen_fd, SHUT_RDWR);
+    pthread_join(thread, NULL);
+    close(server->listen_fd);
+    SSL_CTX_free(server->ssl_ctx);
+}
+
+static void test_async_connect(void) {
+    connect_outcome_t outcome;
+    mock_server_t server;
+    pthread_t thread;
+
+    // Refused: on_error once. This also starts the connect thread, whose
+    // epoll fd and eventfd stay open for good, before fds are counted.
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    getsockname(fd, (struct sockaddr*)&addr, &addr_len);
+    close(fd);
+
+    se_connection_t* conn = async_connect_start("127.0.0.1", ntohs(addr.sin_port), &outcome);
+    if (!conn) return;
+    CHECK(wait_for(&outcome.errors, 1));
+    CHECK(se_connection_cancel_connect(conn) == -1);
+    usleep(50000);
+    CHECK(outcome.errors == 1);
+    CHECK(outcome.connected == 0);
+    CHECK(se_connection_get_last_error(conn) == SE_ERR_CONNECT_FAILED);
+    se_connection_free(conn);
+
+    // Connected: on_connected once, and a cancel finds nothing in flight
+    int fds = count_fds();
+    mock_start(&server, &thread, 0);
+    conn = async_connect_start("127.0.0.1", server.port, &outcome);
+    if (conn) {
+        CHECK(wait_for(&outcome.connected, 1));
+        CHECK(se_connection_get_state(conn) == SE_STATE_CONNECTED);
+        CHECK(se_connection_cancel_connect(conn) == -1);
+        se_connection_disconnect(conn);
+        CHECK(outcome.connected == 1);
+        CHECK(outcome.errors == 0);
+        se_connection_free(conn);
+    }
+    mock_stop(&server, thread);
+    CHECK(count_fds() == fds);
+
+    // Resolve: the lookup is still in flight when the connect lets go
+    dns_stub_t stub;
+    memset(&stub, 0, sizeof(stub));
+    stub.holding = true;
+    dns_stub_start(&stub, &thread);
+    check_cancel_in_phase("held.test", 443, SE_CONNECT_PHASE_RESOLVE, &stub.held, false);
+    stub.holding = false;
+    struct sockaddr_storage addrs[4];
+    se_dns_resolve("held.test", addrs, 4, 3000);  // Returns once the lookup has closed its socket
+    dns_stub_stop(&stub, thread);
+    CHECK(count_fds() == fds);
+
+    // TCP: a listener whose accept queue is full drops the SYN
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    addr.sin_port = 0;
+    addr_len = sizeof(addr);
+    bind(listener, (struct sockaddr*)&addr, sizeof(addr));
+    listen(listener, 0);
+    getsockname(listener, (struct sockaddr*)&addr, &addr_len);
+    int filler = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(connect(filler, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    check_cancel_in_phase("127.0.0.1", ntohs(addr.sin_port), SE_CONNECT_PHASE_TCP, NULL, false);
+    close(filler);
+    close(listener);
+    CHECK(count_fds() == fds);
+
+    // The server stalls the rest, the session phase while the additional
+    // connection joins
+    for (int phase = SE_CONNECT_PHASE_TLS; phase <= SE_CONNECT_PHASE_SESSION; phase++) {
+        mock_start(&server, &thread, phase);
+        check_cancel_in_phase("127.0.0.1", server.port, phase, &server.held, false);
+        mock_stop(&server, thread);
+        CHECK(count_fds() == fds);
+    }
+
+    // Disconnecting cancels too, waiting for the join to give up
+    mock_start(&server, &thread, SE_CONNECT_PHASE_SESSION);
+    check_cancel_in_phase("127.0.0.1", server.port, SE_CONNECT_PHASE_SESSION, &server.held, true);
+    mock_stop(&server, thread);
+    CHECK(count_fds() == fds);
+}
+
+typedef struct {
+    int count;
+    int priority;
+    char tag[32];
+    char message[64];
+} log_capture_t;
+
+static void capture_sink(int priority, const char* tag, const char* message, void* arg) {
+    log_capture_t* capture = arg;
+    capture->count++;
+    capture->priority = priority;
+    snprintf(capture->tag, sizeof(capture->tag), "%s", tag);
+    snprintf(capture->message, sizeof(capture->message), "%s", message);
+}
+
+static void test_log_sink(void) {
+    log_capture_t capture;
+    memset(&capture, 0, sizeof(capture));
+
+    se_log_set_sink(capture_sink, &capture);
+    se_log_print(SE_LOG_ERROR, "Test", "code %d", 42);
+    CHECK(capture.count == 1);
+    CHECK(capture.priority == SE_LOG_ERROR);
+    CHECK(strcmp(capture.tag, "Test") == 0);
+    CHECK(strcmp(capture.message, "code 42") == 0);
+
+    se_log_set_min_priority(SE_LOG_INFO);
+    se_log_print(SE_LOG_DEBUG, "Test", "dropped");
+    CHECK(capture.count == 1);
+
+    se_log_set_min_priority(SE_LOG_DEBUG);
+    se_log_set_sink(NULL, NULL);
+}
+
+int main(void) {
+    test_packet_roundtrip();
+    test_pool_alignment();
+    test_queue_cross_thread();
+    test_compress_roundtrip(SE_COMPRESS_ZLIB);
+    test_compress_roundtrip(SE_COMPRESS_LZ);
+    test_tun_batch();
+    test_dns_resolver();
+    test_udp_channel(SE_UDP_AEAD_AES_256_GCM);
+    test_udp_channel(SE_UDP_AEAD_CHACHA20_POLY1305);
+    test_flow_hash();
+    test_latency_histogram();
+    test_trace_rings();
+    test_stats_page();
+    test_packet_tap();
+    test_session_cache();
+    test_async_connect();
+    test_log_sink();
+
+    if (g_failures > 0) {
+        fprintf(stderr, "%d checks failed\n", g_failures);
+        return 1;
+    }
+    printf("All core tests passed\n");
+    return 0;
+}
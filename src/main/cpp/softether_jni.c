@@ -23,6 +23,9 @@
 #include <linux/if.h>
 #include <linux/if_tun.h>
 #include <sys/ioctl.h>
+#include <poll.h>
+
+#include "softether-native/softether_tun_batch.h"
 
 // SoftEther includes
 #include "SoftEtherVPN/src/Cedar/Cedar.h"
@@ -61,6 +64,7 @@
 // Buffer sizes - use SE_ prefix to avoid conflicts
 #define SE_MAX_PACKET_SIZE     8192
 #define SE_TUN_READ_BUFFER     32768
+#define SE_TUN_POLL_MS         100     // TUN read thread re-checks halt this often
 
 // Global state
 static struct {
@@ -82,6 +86,7 @@ static struct {
     int tunFd;
     bool halt;
     bool connected;
+    int tunIoCalls;     // Batch calls using tunFd without the lock
 
     // Statistics
     UINT64 bytesSent;
@@ -218,13 +223,18 @@ static void TunReadThreadProc(THREAD* thread, void* param)
     LOGD("TUN Read Thread started");
 
     while (!g_client.halt && g_client.tunFd >= 0) {
+        // The fd is non-blocking; wait for a packet here instead
+        struct pollfd pfd = { g_client.tunFd, POLLIN, 0 };
+        if (poll(&pfd, 1, SE_TUN_POLL_MS) == 0) {
+            continue;
+        }
+
         // Read packet from TUN
         ssize_t len = read(g_client.tunFd, buffer, sizeof(buffer));
 
         if (len < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // No data available, wait a bit
-                SleepThread(1);
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                // Another reader took it
                 continue;
             }
             if (errno == EBADF || errno == EINVAL) {
@@ -258,6 +268,38 @@ static void TunReadThreadProc(THREAD* thread, void* param)
     LOGD("TUN Read Thread ended");
 }
 
+/**
+ * Pin the TUN fd for a batch call that runs without the lock. Fails once
+ * disconnect has begun; disconnect waits for pinned calls before it
+ * closes the fd.
+ */
+static bool TunIoEnter(void)
+{
+    __atomic_fetch_add(&g_client.tunIoCalls, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&g_client.connected, __ATOMIC_SEQ_CST) || g_client.tunFd < 0) {
+        __atomic_fetch_sub(&g_client.tunIoCalls, 1, __ATOMIC_RELEASE);
+        return false;
+    }
+    return true;
+}
+
+static void TunIoLeave(void)
+{
+    __atomic_fetch_sub(&g_client.tunIoCalls, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Stop new batch calls and wait out the ones in flight. They never block,
+ * so this takes at most one read or write burst.
+ */
+static void TunIoShutdown(void)
+{
+    __atomic_store_n(&g_client.connected, false, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&g_client.tunIoCalls, __ATOMIC_ACQUIRE) > 0) {
+        SleepThread(1);
+    }
+}
+
 // ============================================================================
 // JNI Bridge Functions
 // ============================================================================
@@ -321,6 +363,7 @@ Java_vn_unlimit_softetherclient_SoftEtherClient_nativeCleanup(JNIEnv* env, jobje
         ReleaseThread(g_client.tunReadThread);
         g_client.tunReadThread = NULL;
     }
+    TunIoShutdown();
 
     // Now safe to cleanup with lock
     if (g_client.lock != NULL && g_client.lockInitialized) {
@@ -402,9 +445,14 @@ Java_vn_unlimit_softetherclient_SoftEtherClient_nativeConnect(
         return JNI_FALSE;
     }
 
-    // Store TUN fd
+    // Store TUN fd, non-blocking once for every reader: the TUN read
+    // thread waits in poll() and the batch calls never block
     g_client.tunFd = tunFd;
     g_client.halt = false;
+    int tunFlags = fcntl(tunFd, F_GETFL, 0);
+    if (tunFlags >= 0) {
+        fcntl(tunFd, F_SETFL, tunFlags | O_NONBLOCK);
+    }
 
     // Get connection parameters from Java object
     jclass paramsClass = (*env)->GetObjectClass(env, params);
@@ -584,6 +632,7 @@ Java_vn_unlimit_softetherclient_SoftEtherClient_nativeDisconnect(JNIEnv* env, jo
         ReleaseThread(g_client.tunReadThread);
         g_client.tunReadThread = NULL;
     }
+    TunIoShutdown();
 
     Lock(g_client.lock);
 
@@ -708,15 +757,9 @@ Java_vn_unlimit_softetherclient_SoftEtherClient_nativeReadPacket(JNIEnv* env, jo
     if (g_client.lock != NULL && g_client.lockInitialized) {
         Lock(g_client.lock);
         if (g_client.connected && g_client.tunFd >= 0) {
-            // Set non-blocking mode for this read
-            int flags = fcntl(g_client.tunFd, F_GETFL, 0);
-            fcntl(g_client.tunFd, F_SETFL, flags | O_NONBLOCK);
-
+            // Non-blocking since connect
             ssize_t len = read(g_client.tunFd, data, bufLen);
 
-            // Restore blocking mode
-            fcntl(g_client.tunFd, F_SETFL, flags);
-
             if (len > 0) {
                 g_client.bytesReceived += len;
                 result = (jint)len;
@@ -733,6 +776,78 @@ Java_vn_unlimit_softetherclient_SoftEtherClient_nativeReadPacket(JNIEnv* env, jo
     return result;
 }
 
+/**
+ * Resolve [offset, offset + length) of a direct ByteBuffer, or NULL if the
+ * buffer is not direct or the range is outside it
+ */
+static uint8_t* DirectBufferRange(JNIEnv* env, jobject buffer, jint offset, jint length)
+{
+    if (buffer == NULL || offset < 0 || length < 0) {
+        return NULL;
+    }
+
+    uint8_t* base = (uint8_t*)(*env)->GetDirectBufferAddress(env, buffer);
+    jlong capacity = (*env)->GetDirectBufferCapacity(env, buffer);
+    if (base == NULL || (jlong)offset + length > capacity) {
+        return NULL;
+    }
+    return base + offset;
+}
+
+/**
+ * Read every waiting TUN packet that fits into buffer[offset, offset + length),
+ * each preceded by its 16-bit big-endian length. length must be at least
+ * SE_TUN_BATCH_PREFIX + SE_MAX_PACKET_SIZE (8194) so the largest packet fits.
+ * Returns the bytes used, 0 if nothing was waiting, -1 on error, when not
+ * connected, or when length is too small.
+ */
+JNIEXPORT jint JNICALL
+Java_vn_unlimit_softetherclient_SoftEtherClient_nativeReadPackets(JNIEnv* env, jobject thiz,
+                                                                 jobject buffer, jint offset, jint length)
+{
+    if (length < SE_TUN_BATCH_PREFIX + SE_MAX_PACKET_SIZE) {
+        return -1;
+    }
+
+    uint8_t* data = DirectBufferRange(env, buffer, offset, length);
+    if (data == NULL || !TunIoEnter()) {
+        return -1;
+    }
+
+    int packets = 0;
+    int result = se_tun_read_batch(g_client.tunFd, data, (size_t)length, SE_MAX_PACKET_SIZE, &packets);
+    if (result > 0) {
+        __atomic_fetch_add(&g_client.bytesReceived, (UINT64)(result - packets * SE_TUN_BATCH_PREFIX), __ATOMIC_RELAXED);
+    }
+
+    TunIoLeave();
+    return result;
+}
+
+/**
+ * Write the length-prefixed packets in buffer[offset, offset + length) to
+ * the TUN. Returns the bytes consumed, short when the TUN is full, or -1
+ * on error or when not connected.
+ */
+JNIEXPORT jint JNICALL
+Java_vn_unlimit_softetherclient_SoftEtherClient_nativeWritePackets(JNIEnv* env, jobject thiz,
+                                                                  jobject buffer, jint offset, jint length)
+{
+    uint8_t* data = DirectBufferRange(env, buffer, offset, length);
+    if (data == NULL || !TunIoEnter()) {
+        return -1;
+    }
+
+    int packets = 0;
+    int result = se_tun_write_batch(g_client.tunFd, data, (size_t)length, &packets);
+    if (result > 0) {
+        __atomic_fetch_add(&g_client.bytesSent, (UINT64)(result - packets * SE_TUN_BATCH_PREFIX), __ATOMIC_RELAXED);
+    }
+
+    TunIoLeave();
+    return result;
+}
+
 // ============================================================================
 // Helper Functions
 // ============================================================================
@@ -3,6 +3,7 @@ package vn.unlimit.softetherclient
 import android.net.VpnService
 import android.os.ParcelFileDescriptor
 import android.util.Log
+import java.nio.ByteBuffer
 
 /**
  * Native SoftEther VPN client for Android.
@@ -28,6 +29,10 @@ class SoftEtherClient {
         const val ERR_DHCP_FAILED = 4
         const val ERR_TUN_CREATE_FAILED = 5
 
+        // Smallest room readPackets accepts: a 2-byte length prefix plus the
+        // largest packet the native side reads (SE_MAX_PACKET_SIZE, 8192)
+        const val READ_PACKETS_MIN_SPACE = 2 + 8192
+
         // Track if native library is available
         @JvmStatic
         var isNativeLibraryAvailable = false
@@ -130,6 +135,15 @@ class SoftEtherClient {
      */
     private external fun nativeReadPacket(buffer: ByteArray?): Int
 
+    /**
+     * Batched, lock-free variants of nativeReadPacket/nativeWritePacket over
+     * a direct buffer. Packets are stored back to back, each preceded by
+     * its length as a big-endian short.
+     * @return bytes used or consumed, 0 if none, -1 on error
+     */
+    private external fun nativeReadPackets(buffer: ByteBuffer, offset: Int, length: Int): Int
+    private external fun nativeWritePackets(buffer: ByteBuffer, offset: Int, length: Int): Int
+
     /**
      * Set the connection listener
      */
@@ -204,6 +218,50 @@ class SoftEtherClient {
         }
     }
 
+    /**
+     * Read every waiting TUN packet that fits between the buffer's position
+     * and limit in one JNI call, and advance the position past them. Each
+     * packet is preceded by its length (buffer.getShort() & 0xFFFF). At
+     * least READ_PACKETS_MIN_SPACE (8194) bytes must remain, so the largest
+     * packet always fits; with less nothing is read and -1 is returned.
+     * @return bytes added, 0 if nothing was waiting, -1 on error
+     */
+    fun readPackets(buffer: ByteBuffer): Int {
+        require(buffer.isDirect) { "readPackets needs a direct buffer" }
+        if (!isNativeLibraryAvailable) return -1
+        if (buffer.remaining() < READ_PACKETS_MIN_SPACE) {
+            Log.e(TAG, "readPackets needs $READ_PACKETS_MIN_SPACE bytes, got ${buffer.remaining()}")
+            return -1
+        }
+        return try {
+            val read = nativeReadPackets(buffer, buffer.position(), buffer.remaining())
+            if (read > 0) buffer.position(buffer.position() + read)
+            read
+        } catch (e: UnsatisfiedLinkError) {
+            Log.e(TAG, "nativeReadPackets failed: ${e.message}")
+            -1
+        }
+    }
+
+    /**
+     * Write the length-prefixed packets between the buffer's position and
+     * limit in one JNI call, and advance the position past those written.
+     * Anything left once the TUN is full stays for the next call.
+     * @return bytes consumed, -1 on error
+     */
+    fun writePackets(buffer: ByteBuffer): Int {
+        require(buffer.isDirect) { "writePackets needs a direct buffer" }
+        if (!isNativeLibraryAvailable) return -1
+        return try {
+            val written = nativeWritePackets(buffer, buffer.position(), buffer.remaining())
+            if (written > 0) buffer.position(buffer.position() + written)
+            written
+        } catch (e: UnsatisfiedLinkError) {
+            Log.e(TAG, "nativeWritePackets failed: ${e.message}")
+            -1
+        }
+    }
+
     /**
      * Connect to VPN with the given parameters
      */
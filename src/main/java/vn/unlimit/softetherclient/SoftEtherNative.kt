@@ -1,8 +1,12 @@
 package vn.unlimit.softetherclient
 
 import android.net.VpnService
+import android.os.Build
 import android.os.ParcelFileDescriptor
 import android.util.Log
+import java.lang.invoke.VarHandle
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
 
 /**
  * Native SoftEther VPN client using the reimplemented protocol.
@@ -28,6 +32,124 @@ class SoftEtherNative {
         const val ERR_DHCP_FAILED = 4
         const val ERR_TUN_CREATE_FAILED = 5
 
+        // TLS record layer modes
+        const val TLS_MODE_NONE = 0
+        const val TLS_MODE_USERSPACE = 1
+        const val TLS_MODE_KTLS_TX = 2
+        const val TLS_MODE_KTLS = 3
+
+        // Connect phases reported by getConnectPhase()
+        const val CONNECT_PHASE_IDLE = 0
+        const val CONNECT_PHASE_RESOLVE = 1
+        const val CONNECT_PHASE_TCP = 2
+        const val CONNECT_PHASE_TLS = 3
+        const val CONNECT_PHASE_HELLO = 4
+        const val CONNECT_PHASE_AUTH = 5
+        const val CONNECT_PHASE_DHCP = 6
+        const val CONNECT_PHASE_SESSION = 7
+
+        // Per-packet latency paths
+        const val LATENCY_TUN_TO_WIRE = 0
+        const val LATENCY_WIRE_TO_TUN = 1
+
+        // Fields of getLatencyStats(), nanoseconds apart from the count
+        const val LATENCY_STAT_COUNT = 0
+        const val LATENCY_STAT_MIN = 1
+        const val LATENCY_STAT_P50 = 2
+        const val LATENCY_STAT_P90 = 3
+        const val LATENCY_STAT_P99 = 4
+        const val LATENCY_STAT_P999 = 5
+        const val LATENCY_STAT_MAX = 6
+        const val LATENCY_STAT_MEAN = 7
+        const val LATENCY_STAT_FIELDS = 8
+
+        // Fields per connect in getConnectHistory()
+        const val CONNECT_TIMING_RESULT = 0        // ERR_*, or CONNECT_CANCELLED
+        const val CONNECT_TIMING_LAST_PHASE = 1    // Phase reached, the failing one on error
+        const val CONNECT_TIMING_ASYNC = 2         // 1 if started by connectAsync()
+        const val CONNECT_TIMING_TOTAL_MS = 3
+        const val CONNECT_TIMING_RESOLVE_MS = 4
+        const val CONNECT_TIMING_TCP_MS = 5
+        const val CONNECT_TIMING_TLS_MS = 6
+        const val CONNECT_TIMING_HELLO_MS = 7
+        const val CONNECT_TIMING_AUTH_MS = 8
+        const val CONNECT_TIMING_DHCP_MS = 9
+        const val CONNECT_TIMING_SESSION_MS = 10
+        const val CONNECT_TIMING_COUNT = 11
+        const val CONNECT_CANCELLED = -1
+
+        // Fields of readStats(), in the order of the native statistics page
+        const val STATS_STATE = 0                  // STATE_*
+        const val STATS_UPDATE_MS = 1              // Monotonic clock (SystemClock.uptimeMillis) of the update
+        const val STATS_UPTIME_MS = 2
+        const val STATS_BYTES_SENT = 3
+        const val STATS_BYTES_RECEIVED = 4
+        const val STATS_PACKETS_SENT = 5
+        const val STATS_PACKETS_RECEIVED = 6
+        const val STATS_ERRORS = 7
+        const val STATS_DROPS = 8
+        const val STATS_SEND_QUEUE = 9
+        const val STATS_RECV_QUEUE = 10
+        const val STATS_RTT_US = 11
+        const val STATS_RTT_VAR_US = 12
+        const val STATS_CONNECTS = 13
+        const val STATS_RECONNECTS = 14
+        const val STATS_CONNECT_FAILURES = 15
+        const val STATS_SEND_RATE = 16             // Bytes per second
+        const val STATS_RECV_RATE = 17
+        const val STATS_SEND_PACKET_RATE = 18      // Packets per second
+        const val STATS_RECV_PACKET_RATE = 19
+        const val STATS_FIELDS = 20
+
+        // Statistics page header: magic, version, sequence, field count
+        private const val STATS_PAGE_SEQUENCE_OFFSET = 8
+        private const val STATS_PAGE_FIELD_COUNT_OFFSET = 12
+        private const val STATS_PAGE_HEADER_SIZE = 16
+        private const val STATS_PAGE_READ_ATTEMPTS = 4
+
+        // Packet tap settings, see setPacketListener()
+        const val TAP_DEFAULT_CAPACITY = 1 shl 20
+        const val TAP_DEFAULT_SNAP_LENGTH = 128     // IP and transport headers
+        const val TAP_DEFAULT_NOTIFY_PACKETS = 64
+        const val TAP_DEFAULT_NOTIFY_MICROS = 10000
+
+        // Packet tap ring: 64-byte header, then 16-byte aligned records of a
+        // timestamp, length, captured length and direction, then the bytes
+        private const val TAP_CAPACITY_OFFSET = 8
+        private const val TAP_HEADER_SIZE = 64
+        private const val TAP_RECORD_LENGTH_OFFSET = 8
+        private const val TAP_RECORD_CAPTURED_OFFSET = 10
+        private const val TAP_RECORD_DIRECTION_OFFSET = 12
+        private const val TAP_RECORD_HEADER_SIZE = 16
+        private const val TAP_RECORD_ALIGN = 16
+        private const val TAP_WRAP = 0xFFFF
+
+        // Direction a parallel connection carries
+        const val TRANSPORT_ROLE_BOTH = 0
+        const val TRANSPORT_ROLE_UPLOAD = 1
+        const val TRANSPORT_ROLE_DOWNLOAD = 2
+
+        // Fields per connection in getTransportStats()
+        const val TRANSPORT_STAT_ROLE = 0
+        const val TRANSPORT_STAT_BYTES_SENT = 1
+        const val TRANSPORT_STAT_BYTES_RECEIVED = 2
+        const val TRANSPORT_STAT_PACKETS_SENT = 3
+        const val TRANSPORT_STAT_PACKETS_RECEIVED = 4
+        const val TRANSPORT_STAT_SEND_RATE = 5
+        const val TRANSPORT_STAT_RECV_RATE = 6
+        const val TRANSPORT_STAT_DROPS = 7
+        const val TRANSPORT_STAT_COUNT = 8
+
+        // UDP acceleration states
+        const val UDP_STATE_DISABLED = 0
+        const val UDP_STATE_PROBING = 1
+        const val UDP_STATE_ACTIVE = 2
+
+        // Data channel compression algorithms
+        const val COMPRESS_NONE = 0
+        const val COMPRESS_ZLIB = 1
+        const val COMPRESS_LZ = 2
+
         // Track if native library is available
         @JvmStatic
         var isNativeLibraryAvailable = false
@@ -46,16 +168,28 @@ class SoftEtherNative {
     }
 
     /**
-     * Interface for connection state callbacks
+     * Interface for connection state callbacks. Callbacks from native code
+     * arrive on one native callback thread, in order; onBytesTransferred
+     * carries the latest totals and may skip intermediate ones.
      */
     interface ConnectionListener {
         fun onStateChanged(state: Int)
         fun onError(errorCode: Int, errorMessage: String?)
         fun onConnectionEstablished(virtualIp: String?, subnetMask: String?, dnsServer: String?)
-        fun onPacketReceived(packet: ByteArray?)
+        @Deprecated("Never called; use setPacketListener()")
+        fun onPacketReceived(packet: ByteArray?) {}
         fun onBytesTransferred(sent: Long, received: Long)
     }
 
+    /**
+     * Receives tapped packets in batches on a native thread. packet holds
+     * the captured bytes between its position and limit and is only valid
+     * during the call; length is the full packet length.
+     */
+    fun interface PacketListener {
+        fun onPacket(packet: ByteBuffer, length: Int, timestampNs: Long)
+    }
+
     /**
      * Connection parameters for SoftEther VPN
      */
@@ -67,20 +201,39 @@ class SoftEtherNative {
         var password: String? = null,
         var useEncrypt: Boolean = true,
         var useCompress: Boolean = false,
+        var compressAlgorithm: Int = COMPRESS_ZLIB, // COMPRESS_LZ trades ratio for much less CPU
         var reconnectRetries: Int = 3,
         var checkServerCert: Boolean = false,
         var proxyHost: String? = null,
         var proxyPort: Int = 0,
         var proxyType: Int = 0, // 0: None, 1: HTTP, 2: SOCKS
-        var mtu: Int = 1400
+        var mtu: Int = 1400,
+        var maxConnections: Int = 1, // Parallel TCP connections, capped by the server
+        var halfDuplex: Boolean = false, // Dedicate additional connections to one direction
+        var useUdpAcceleration: Boolean = false // Carry data over UDP when the server offers it
     )
 
     private var nativeHandle: Long = 0
+
+    @Volatile
     private var state: Int = STATE_DISCONNECTED
     private var vpnService: VpnService? = null
     private var tunInterface: ParcelFileDescriptor? = null
     private var connectionListener: ConnectionListener? = null
 
+    @Volatile
+    private var statsPage: ByteBuffer? = null
+
+    // Only touched by loadFence()
+    @Volatile
+    private var fenceField: Int = 0
+
+    @Volatile
+    private var packetTap: ByteBuffer? = null
+
+    @Volatile
+    private var packetListener: PacketListener? = null
+
     // Native methods
     private external fun nativeInit(): Long
     private external fun nativeCleanup(handle: Long)
@@ -93,16 +246,39 @@ class SoftEtherNative {
         password: String,
         useEncrypt: Boolean,
         useCompress: Boolean,
+        compressAlgorithm: Int,
         checkServerCert: Boolean,
-        tunFd: Int
+        maxConnections: Int,
+        halfDuplex: Boolean,
+        useUdpAcceleration: Boolean,
+        tunFd: Int,
+        async: Boolean
     ): Boolean
 
     private external fun nativeDisconnect(handle: Long)
     private external fun nativeGetStatus(handle: Long): Int
     private external fun nativeGetStatistics(handle: Long): LongArray
+    private external fun nativeGetStatsPage(handle: Long): ByteBuffer?
+    private external fun nativeEnablePacketTap(
+        handle: Long,
+        capacity: Int,
+        snapLength: Int,
+        notifyPackets: Int,
+        notifyMicros: Int
+    ): ByteBuffer?
+    private external fun nativeDisablePacketTap(handle: Long)
+    private external fun nativeGetTransportStats(handle: Long): LongArray
+    private external fun nativeGetUdpStats(handle: Long): LongArray
+    private external fun nativeGetCompressionStats(handle: Long): LongArray
     private external fun nativeGetLastError(handle: Long): Int
     private external fun nativeGetErrorString(handle: Long): String
     private external fun nativeGetProtocolVersion(): Int
+    private external fun nativeGetTlsMode(handle: Long): Int
+    private external fun nativeGetConnectPhase(handle: Long): Int
+    private external fun nativeGetConnectHistory(handle: Long): LongArray
+    private external fun nativeGetLatencyStats(handle: Long, path: Int, reset: Boolean): LongArray
+    private external fun nativeSetSessionCacheFile(path: String): Boolean
+    private external fun nativeGetSessionCacheStats(): LongArray
     private external fun nativeIsLibraryLoaded(): Boolean
 
     // Test native methods
@@ -127,6 +303,9 @@ class SoftEtherNative {
 
         return try {
             nativeHandle = nativeInit()
+            if (nativeHandle != 0L) {
+                statsPage = nativeGetStatsPage(nativeHandle)?.order(ByteOrder.nativeOrder())
+            }
             nativeHandle != 0L
         } catch (e: UnsatisfiedLinkError) {
             Log.e(TAG, "nativeInit failed: ${e.message}")
@@ -139,6 +318,9 @@ class SoftEtherNative {
      */
     fun cleanup() {
         if (nativeHandle != 0L) {
+            statsPage = null
+            packetTap = null
+            packetListener = null
             try {
                 nativeCleanup(nativeHandle)
             } catch (e: UnsatisfiedLinkError) {
@@ -149,9 +331,22 @@ class SoftEtherNative {
     }
 
     /**
-     * Connect to SoftEther VPN server
+     * Connect to SoftEther VPN server, blocking until the session is up
      */
     fun connect(service: VpnService, params: ConnectionParams): Boolean {
+        return startConnect(service, params, false)
+    }
+
+    /**
+     * Start connecting to SoftEther VPN server and return at once.
+     * The outcome arrives through onConnectionEstablished() or onError(),
+     * called on the native callback thread; disconnect() cancels.
+     */
+    fun connectAsync(service: VpnService, params: ConnectionParams): Boolean {
+        return startConnect(service, params, true)
+    }
+
+    private fun startConnect(service: VpnService, params: ConnectionParams, async: Boolean): Boolean {
         if (!isNativeLibraryAvailable) {
             Log.e(TAG, "Cannot connect: native library not available")
             setState(STATE_ERROR)
@@ -209,8 +404,13 @@ class SoftEtherNative {
                 params.password!!,
                 params.useEncrypt,
                 params.useCompress,
+                params.compressAlgorithm,
                 params.checkServerCert,
-                tunFd
+                params.maxConnections,
+                params.halfDuplex,
+                params.useUdpAcceleration,
+                tunFd,
+                async
             )
 
             if (!result) {
@@ -269,9 +469,14 @@ class SoftEtherNative {
     }
 
     /**
-     * Get connection statistics
+     * Get connection statistics: bytes sent and received. Served from the
+     * statistics page, so up to half a second old while connected.
      */
     fun getStatistics(): Pair<Long, Long> {
+        val stats = LongArray(STATS_FIELDS)
+        if (readStats(stats)) {
+            return Pair(stats[STATS_BYTES_SENT], stats[STATS_BYTES_RECEIVED])
+        }
         if (nativeHandle != 0L) {
             try {
                 val stats = nativeGetStatistics(nativeHandle)
@@ -285,6 +490,130 @@ class SoftEtherNative {
         return Pair(0L, 0L)
     }
 
+    /**
+     * Copy the native statistics page into out, indexed by the STATS_*
+     * constants, without a JNI call or a lock: cheap enough to poll at any
+     * rate. The page is refreshed every half second and on state changes.
+     * Returns false if there is no page or every attempt overlapped an
+     * update. Safe to race cleanup(): the native page is never unmapped,
+     * so a late read just sees stale or zeroed numbers.
+     */
+    fun readStats(out: LongArray): Boolean {
+        val page = statsPage ?: return false
+        val count = minOf(out.size, page.getInt(STATS_PAGE_FIELD_COUNT_OFFSET))
+
+        // Fields are aligned longs, so none is torn on 64-bit devices; the
+        // sequence check rejects copies that overlapped an update
+        repeat(STATS_PAGE_READ_ATTEMPTS) {
+            val sequence = page.getInt(STATS_PAGE_SEQUENCE_OFFSET)
+            if (sequence and 1 == 0) {
+                for (i in 0 until count) {
+                    out[i] = page.getLong(STATS_PAGE_HEADER_SIZE + i * 8)
+                }
+                loadFence()
+                if (page.getInt(STATS_PAGE_SEQUENCE_OFFSET) == sequence) return true
+            }
+        }
+        return false
+    }
+
+    /**
+     * Keep the field reads above from moving past the second sequence
+     * read. Before API 33 a volatile store does it: ART puts barriers on
+     * both sides of one, ordering earlier loads before later ones.
+     */
+    private fun loadFence() {
+        if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.TIRAMISU) {
+            VarHandle.acquireFence()
+        } else {
+            fenceField = fenceField
+        }
+    }
+
+    /**
+     * Tap received packets: listener gets up to snapLength bytes of each,
+     * with no JNI call or allocation per packet. Batches come at most every
+     * notifyPackets packets or notifyMicros microseconds, and a quiet spell
+     * flushes stragglers late. Packets arriving while the ring is full are
+     * dropped. The first call fixes the ring capacity; null stops the tap.
+     * Returns false if the tap could not be set up.
+     */
+    fun setPacketListener(
+        listener: PacketListener?,
+        capacity: Int = TAP_DEFAULT_CAPACITY,
+        snapLength: Int = TAP_DEFAULT_SNAP_LENGTH,
+        notifyPackets: Int = TAP_DEFAULT_NOTIFY_PACKETS,
+        notifyMicros: Int = TAP_DEFAULT_NOTIFY_MICROS
+    ): Boolean {
+        if (nativeHandle == 0L) return false
+
+        return try {
+            if (listener == null) {
+                nativeDisablePacketTap(nativeHandle)
+                packetListener = null
+                return true
+            }
+            packetListener = listener
+            val tap = nativeEnablePacketTap(nativeHandle, capacity, snapLength, notifyPackets, notifyMicros)
+            packetTap = tap?.order(ByteOrder.nativeOrder())
+            tap != null
+        } catch (e: UnsatisfiedLinkError) {
+            Log.e(TAG, "nativeEnablePacketTap failed: ${e.message}")
+            false
+        }
+    }
+
+    /**
+     * Get per-connection statistics, one array per parallel connection
+     * indexed by the TRANSPORT_STAT_* constants. Rates are bytes per second.
+     */
+    fun getTransportStats(): Array<LongArray> {
+        if (nativeHandle != 0L) {
+            try {
+                val stats = nativeGetTransportStats(nativeHandle)
+                return Array(stats.size / TRANSPORT_STAT_COUNT) { i ->
+                    stats.copyOfRange(i * TRANSPORT_STAT_COUNT, (i + 1) * TRANSPORT_STAT_COUNT)
+                }
+            } catch (e: UnsatisfiedLinkError) {
+                Log.e(TAG, "nativeGetTransportStats failed: ${e.message}")
+            }
+        }
+        return emptyArray()
+    }
+
+    /**
+     * Get UDP acceleration counters: state (UDP_STATE_*), datagrams sent,
+     * datagrams received, bytes sent, bytes received, rejected datagrams
+     * and fallbacks to TLS.
+     */
+    fun getUdpStats(): LongArray {
+        if (nativeHandle != 0L) {
+            try {
+                return nativeGetUdpStats(nativeHandle)
+            } catch (e: UnsatisfiedLinkError) {
+                Log.e(TAG, "nativeGetUdpStats failed: ${e.message}")
+            }
+        }
+        return LongArray(7)
+    }
+
+    /**
+     * Get compression counters: algorithm (COMPRESS_*), packets offered,
+     * packets compressed, packets skipped as incompressible, bytes in,
+     * bytes out, compression CPU time (ns), compressed bytes received,
+     * bytes they decompressed to and decompression CPU time (ns).
+     */
+    fun getCompressionStats(): LongArray {
+        if (nativeHandle != 0L) {
+            try {
+                return nativeGetCompressionStats(nativeHandle)
+            } catch (e: UnsatisfiedLinkError) {
+                Log.e(TAG, "nativeGetCompressionStats failed: ${e.message}")
+            }
+        }
+        return LongArray(10)
+    }
+
     /**
      * Get the last error code
      */
@@ -325,6 +654,99 @@ class SoftEtherNative {
         }
     }
 
+    /**
+     * Get how TLS records are processed: user-space OpenSSL or kernel TLS
+     */
+    fun getTlsMode(): Int {
+        if (nativeHandle != 0L) {
+            try {
+                return nativeGetTlsMode(nativeHandle)
+            } catch (e: UnsatisfiedLinkError) {
+                Log.e(TAG, "nativeGetTlsMode failed: ${e.message}")
+            }
+        }
+        return TLS_MODE_NONE
+    }
+
+    /**
+     * Get how far a connect in progress has got (CONNECT_PHASE_*)
+     */
+    fun getConnectPhase(): Int {
+        if (nativeHandle != 0L) {
+            try {
+                return nativeGetConnectPhase(nativeHandle)
+            } catch (e: UnsatisfiedLinkError) {
+                Log.e(TAG, "nativeGetConnectPhase failed: ${e.message}")
+            }
+        }
+        return CONNECT_PHASE_IDLE
+    }
+
+    /**
+     * Get per-packet latency of one path (LATENCY_TUN_TO_WIRE or
+     * LATENCY_WIRE_TO_TUN) indexed by the LATENCY_STAT_* constants. With
+     * reset the histogram starts over, so polling gives interval figures.
+     */
+    fun getLatencyStats(path: Int, reset: Boolean = false): LongArray {
+        if (nativeHandle != 0L) {
+            try {
+                return nativeGetLatencyStats(nativeHandle, path, reset)
+            } catch (e: UnsatisfiedLinkError) {
+                Log.e(TAG, "nativeGetLatencyStats failed: ${e.message}")
+            }
+        }
+        return LongArray(LATENCY_STAT_FIELDS)
+    }
+
+    /**
+     * Get the phase timing of the last finished connects, newest first, one
+     * array per connect indexed by the CONNECT_TIMING_* constants
+     */
+    fun getConnectHistory(): Array<LongArray> {
+        if (nativeHandle != 0L) {
+            try {
+                val history = nativeGetConnectHistory(nativeHandle)
+                return Array(history.size / CONNECT_TIMING_COUNT) { i ->
+                    history.copyOfRange(i * CONNECT_TIMING_COUNT, (i + 1) * CONNECT_TIMING_COUNT)
+                }
+            } catch (e: UnsatisfiedLinkError) {
+                Log.e(TAG, "nativeGetConnectHistory failed: ${e.message}")
+            }
+        }
+        return emptyArray()
+    }
+
+    /**
+     * Persist TLS sessions in the given file so reconnects can resume.
+     * Existing sessions are loaded immediately and saved again on disconnect.
+     */
+    fun setSessionCacheFile(path: String): Boolean {
+        if (!isNativeLibraryAvailable) {
+            return false
+        }
+
+        return try {
+            nativeSetSessionCacheFile(path)
+        } catch (e: UnsatisfiedLinkError) {
+            Log.e(TAG, "nativeSetSessionCacheFile failed: ${e.message}")
+            false
+        }
+    }
+
+    /**
+     * Get TLS session cache counters: lookups, hits, resumed, stored
+     */
+    fun getSessionCacheStats(): LongArray {
+        if (isNativeLibraryAvailable) {
+            try {
+                return nativeGetSessionCacheStats()
+            } catch (e: UnsatisfiedLinkError) {
+                Log.e(TAG, "nativeGetSessionCacheStats failed: ${e.message}")
+            }
+        }
+        return LongArray(4)
+    }
+
     /**
      * Set the connection listener
      */
@@ -362,9 +784,26 @@ class SoftEtherNative {
      */
     @Suppress("unused")
     private fun onError(errorCode: Int, errorMessage: String?) {
+        // An asynchronous connect failed
+        if (state == STATE_CONNECTING) {
+            setState(STATE_ERROR)
+            closeTunInterface()
+        }
         connectionListener?.onError(errorCode, errorMessage)
     }
 
+    /**
+     * Called from native code when the session state changes. Connect
+     * outcomes have their own callbacks; this reports a session the data
+     * path lost.
+     */
+    @Suppress("unused")
+    private fun onNativeStateChanged(newState: Int) {
+        if (state == STATE_CONNECTED && newState != STATE_CONNECTED) {
+            setState(newState)
+        }
+    }
+
     /**
      * Called from native code to report statistics
      */
@@ -374,11 +813,33 @@ class SoftEtherNative {
     }
 
     /**
-     * Called from native code when packet is received
+     * Called from native code with a batch of tapped packets: the ring
+     * bytes from tail to head, reused once this returns
      */
     @Suppress("unused")
-    private fun onPacketReceived(packet: ByteArray) {
-        connectionListener?.onPacketReceived(packet)
+    private fun onPacketsTapped(tail: Int, head: Int) {
+        val listener = packetListener ?: return
+        val ring = packetTap ?: return
+        val mask = ring.getInt(TAP_CAPACITY_OFFSET) - 1
+        val packet = ring.duplicate()
+
+        var offset = tail
+        while (offset != head) {
+            val record = TAP_HEADER_SIZE + (offset and mask)
+            if (ring.getShort(record + TAP_RECORD_DIRECTION_OFFSET).toInt() and 0xFFFF == TAP_WRAP) {
+                offset += mask + 1 - (offset and mask)
+                continue
+            }
+
+            val length = ring.getShort(record + TAP_RECORD_LENGTH_OFFSET).toInt() and 0xFFFF
+            val captured = ring.getShort(record + TAP_RECORD_CAPTURED_OFFSET).toInt() and 0xFFFF
+            packet.clear()
+            packet.limit(record + TAP_RECORD_HEADER_SIZE + captured)
+            packet.position(record + TAP_RECORD_HEADER_SIZE)
+            listener.onPacket(packet, length, ring.getLong(record))
+
+            offset += (TAP_RECORD_HEADER_SIZE + captured + TAP_RECORD_ALIGN - 1) and (TAP_RECORD_ALIGN - 1).inv()
+        }
     }
 
     /**
@@ -124,8 +124,12 @@ class SoftEtherNativeUnitTest {
         assertNull(params.password)
         assertTrue(params.useEncrypt)
         assertFalse(params.useCompress)
+        assertEquals(SoftEtherNative.COMPRESS_ZLIB, params.compressAlgorithm)
         assertFalse(params.checkServerCert)
         assertEquals(1400, params.mtu)
+        assertEquals(1, params.maxConnections)
+        assertFalse(params.halfDuplex)
+        assertFalse(params.useUdpAcceleration)
     }
 
     @Test